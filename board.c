@@ -0,0 +1,491 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "board.h"
+
+
+// one geometry per board size, built on first use and never freed
+static BoardGeometry **geometries = NULL;
+static int numGeometries = 0;
+static pthread_mutex_t geometryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const int DX[NUM_DIRS] = { 1, -1,  1, -1 };
+static const int DY[NUM_DIRS] = { 1,  1, -1, -1 };
+
+
+static BoardGeometry* buildGeometry(BoardGeometry *g, int n) {
+    int d, x, y, sq, i;
+    int numMasks = 2*NUM_DIRS + 3;
+    uint64_t *masks;
+
+    g->n = n;
+    g->numSquares = n*n;
+    g->words = (n*n + 63) / 64;
+
+    masks = calloc((size_t)numMasks * g->words, sizeof(uint64_t));
+    for (i = 0; i < NUM_DIRS; i++) {
+        g->stepMask[i] = masks + i * g->words;
+        g->jumpMask[i] = masks + (NUM_DIRS + i) * g->words;
+    }
+    g->dark = masks + 2*NUM_DIRS * g->words;
+    g->kingRow[PLAYER_ONE] = masks + (2*NUM_DIRS + 1) * g->words;
+    g->kingRow[PLAYER_TWO] = masks + (2*NUM_DIRS + 2) * g->words;
+
+    for (d = 0; d < NUM_DIRS; d++)
+        g->offset[d] = DY[d]*n + DX[d];
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < n; x++) {
+            sq = y*n + x;
+
+            // same pattern drawBoard uses: (0, 0) is a light square
+            if ((x + y) % 2 == 1)
+                bitSet(g->dark, sq);
+
+            if (y == n-1)
+                bitSet(g->kingRow[PLAYER_ONE], sq);
+            if (y == 0)
+                bitSet(g->kingRow[PLAYER_TWO], sq);
+
+            for (d = 0; d < NUM_DIRS; d++) {
+                if (x + DX[d] >= 0 && x + DX[d] < n &&
+                    y + DY[d] >= 0 && y + DY[d] < n)
+                    bitSet(g->stepMask[d], sq);
+                if (x + 2*DX[d] >= 0 && x + 2*DX[d] < n &&
+                    y + 2*DY[d] >= 0 && y + 2*DY[d] < n)
+                    bitSet(g->jumpMask[d], sq);
+            }
+        }
+    }
+
+    return g;
+}
+
+/*
+    Returns the shared geometry for an n by n board.
+*/
+const BoardGeometry* boardGeometry(int n) {
+    BoardGeometry *g = NULL;
+    int i;
+
+    pthread_mutex_lock(&geometryLock);
+    for (i = 0; i < numGeometries; i++) {
+        if (geometries[i]->n == n) {
+            g = geometries[i];
+            break;
+        }
+    }
+    if (g == NULL) {
+        g = buildGeometry(malloc(sizeof(BoardGeometry)), n);
+        geometries = realloc(geometries,
+                             sizeof(BoardGeometry*) * (numGeometries + 1));
+        geometries[numGeometries++] = g;
+    }
+    pthread_mutex_unlock(&geometryLock);
+
+    return g;
+}
+
+
+/* Sets up an empty n by n board. */
+void boardInit(Board *b, int n) {
+    b->geo = boardGeometry(n);
+    b->n = n;
+    b->words = b->geo->words;
+
+    if (b->words == 1)
+        b->bits = b->small;
+    else
+        b->bits = malloc(sizeof(uint64_t) * NUM_PIECE_TYPES * b->words);
+    b->spill = NULL;
+    b->spillCap = 0;
+
+    boardClear(b);
+}
+
+void boardFree(Board *b) {
+    if (b->bits != b->small)
+        free(b->bits);
+    b->bits = NULL;
+    free(b->spill);
+    b->spill = NULL;
+    b->spillCap = 0;
+}
+
+// makes room for words more words on b's spill
+static void growSpill(Board *b, int words) {
+    if (b->spillLen + words <= b->spillCap)
+        return;
+    b->spillCap = b->spillLen + words > 2 * b->spillCap ? b->spillLen + words
+                                                         : 2 * b->spillCap;
+    b->spill = realloc(b->spill, sizeof(uint64_t) * b->spillCap);
+}
+
+/*
+    Copies src into dst. dst must have been set up with boardInit, though not
+    necessarily with the same size.
+*/
+void boardCopy(Board *dst, const Board *src) {
+    if (dst->n != src->n) {
+        boardFree(dst);
+        boardInit(dst, src->n);
+    }
+    memcpy(dst->bits, src->bits,
+           sizeof(uint64_t) * NUM_PIECE_TYPES * src->words);
+    memcpy(dst->count, src->count, sizeof(src->count));
+
+    // so that moves played on src before the copy can be taken back too
+    dst->spillLen = 0;
+    growSpill(dst, src->spillLen);
+    if (src->spillLen > 0)
+        memcpy(dst->spill, src->spill, sizeof(uint64_t) * src->spillLen);
+    dst->spillLen = src->spillLen;
+}
+
+void boardClear(Board *b) {
+    memset(b->bits, 0, sizeof(uint64_t) * NUM_PIECE_TYPES * b->words);
+    memset(b->count, 0, sizeof(b->count));
+    b->spillLen = 0;
+}
+
+/*
+    Lays out the starting position: men on the dark squares of each player's
+    first n/2-1 rows (n/2 rows on odd boards), leaving the middle empty.
+*/
+void boardSetup(Board *b) {
+    int n = b->n;
+    int lastRowOne = (n % 2 == 1) ? n/2 - 1 : n/2 - 2;
+    int firstRowTwo = n/2 + 1;
+    int w, t;
+    uint64_t *one = boardBits(b, MAN_ONE);
+    uint64_t *two = boardBits(b, MAN_TWO);
+
+    boardClear(b);
+
+    // whole rows are contiguous square ranges, so fill word by word
+    for (w = 0; w < b->words; w++) {
+        long lo = (long)w * 64;
+        long endOne = (long)(lastRowOne + 1) * n;
+        long startTwo = (long)firstRowTwo * n;
+        uint64_t rowsOne = 0, rowsTwo = 0;
+
+        if (endOne > lo)
+            rowsOne = endOne - lo >= 64 ? ~(uint64_t)0
+                                        : ((uint64_t)1 << (endOne - lo)) - 1;
+        if (startTwo < lo + 64) {
+            rowsTwo = startTwo <= lo ? ~(uint64_t)0
+                                     : ~(((uint64_t)1 << (startTwo - lo)) - 1);
+        }
+
+        one[w] = rowsOne & b->geo->dark[w];
+        two[w] = rowsTwo & b->geo->dark[w];
+    }
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        uint64_t *bits = boardBits(b, t);
+        b->count[t] = 0;
+        for (w = 0; w < b->words; w++)
+            b->count[t] += __builtin_popcountll(bits[w]);
+    }
+}
+
+
+char pieceChar(int type) {
+    switch (type) {
+        case MAN_ONE:   return 'X';
+        case MAN_TWO:   return 'Y';
+        case KING_ONE:  return 'K';
+        case KING_TWO:  return 'L';
+    }
+    return ' ';
+}
+
+int pieceFromChar(char c) {
+    switch (c) {
+        case 'X':   return MAN_ONE;
+        case 'Y':   return MAN_TWO;
+        case 'K':   return KING_ONE;
+        case 'L':   return KING_TWO;
+    }
+    return NO_PIECE;
+}
+
+enum player pieceOwner(int type) {
+    if (type == MAN_ONE || type == KING_ONE)
+        return PLAYER_ONE;
+    else if (type == MAN_TWO || type == KING_TWO)
+        return PLAYER_TWO;
+    return NO_PLAYER;
+}
+
+bool boardOnBoard(const Board *b, int x, int y) {
+    return x >= 0 && y >= 0 && x < b->n && y < b->n;
+}
+
+/* Returns the class of the piece on square sq, or NO_PIECE. */
+int boardPieceAt(const Board *b, int sq) {
+    int t;
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        if (bitTest(boardBits(b, t), sq))
+            return t;
+    }
+    return NO_PIECE;
+}
+
+bool boardOccupied(const Board *b, int sq) {
+    int w = sq >> 6;
+    uint64_t bit = (uint64_t)1 << (sq & 63);
+    const uint64_t *bits = b->bits;
+    int words = b->words;
+
+    return ((bits[w] | bits[words + w] | bits[2*words + w] |
+             bits[3*words + w]) & bit) != 0;
+}
+
+/* Returns the board character at (x, y); off-board squares read as ' '. */
+char boardGet(const Board *b, int x, int y) {
+    if (!boardOnBoard(b, x, y))
+        return ' ';
+    return pieceChar(boardPieceAt(b, y*b->n + x));
+}
+
+/* Puts piece (a board character, ' ' to empty) on (x, y). */
+void boardSet(Board *b, int x, int y, char piece) {
+    int sq, old, type;
+
+    if (!boardOnBoard(b, x, y))
+        return;
+
+    sq = y*b->n + x;
+    old = boardPieceAt(b, sq);
+    if (old != NO_PIECE) {
+        bitClear(boardBits(b, old), sq);
+        b->count[old]--;
+    }
+
+    type = pieceFromChar(piece);
+    if (type != NO_PIECE) {
+        bitSet(boardBits(b, type), sq);
+        b->count[type]++;
+    }
+}
+
+/* Number of pieces, kings included, that player p has left. */
+int boardCount(const Board *b, enum player p) {
+    if (p == PLAYER_ONE)
+        return b->count[MAN_ONE] + b->count[KING_ONE];
+    else if (p == PLAYER_TWO)
+        return b->count[MAN_TWO] + b->count[KING_TWO];
+    return 0;
+}
+
+
+/*
+    Plays m on the board: moves the piece along its path, removes every piece
+    it jumps and crowns it if it ends on the far row. The kings taken by a
+    chain longer than INLINE_HOPS hops are noted on b's spill.
+*/
+void boardApplyMove(Board *b, const Move *m, Undo *u) {
+    int type = boardPieceAt(b, m->from);
+    int sq = m->from;
+    int i, d, mid, captured, landed, bit;
+    enum player side = pieceOwner(type);
+
+    u->moved = type;
+    u->capturedKings = 0;
+    u->spill = b->spillLen;
+    if (m->isJump && m->numHops > INLINE_HOPS) {
+        growSpill(b, (m->numHops - INLINE_HOPS + 63) / 64);
+        b->spillLen += (m->numHops - INLINE_HOPS + 63) / 64;
+        memset(b->spill + u->spill, 0,
+               sizeof(uint64_t) * (b->spillLen - u->spill));
+    }
+
+    bitClear(boardBits(b, type), sq);
+
+    for (i = 0; i < m->numHops; i++) {
+        d = moveDir(m, i);
+        if (m->isJump) {
+            mid = sq + b->geo->offset[d];
+            captured = boardPieceAt(b, mid);
+            if ((captured == KING_ONE || captured == KING_TWO) &&
+                i < INLINE_HOPS) {
+                u->capturedKings |= (uint32_t)1 << i;
+            } else if (captured == KING_ONE || captured == KING_TWO) {
+                bit = i - INLINE_HOPS;
+                b->spill[u->spill + (bit >> 6)] |= (uint64_t)1 << (bit & 63);
+            }
+            bitClear(boardBits(b, captured), mid);
+            b->count[captured]--;
+            sq = mid + b->geo->offset[d];
+        } else {
+            sq += b->geo->offset[d];
+        }
+    }
+
+    landed = type;
+    if (type == MAN_ONE && bitTest(b->geo->kingRow[side], sq))
+        landed = KING_ONE;
+    else if (type == MAN_TWO && bitTest(b->geo->kingRow[side], sq))
+        landed = KING_TWO;
+
+    bitSet(boardBits(b, landed), sq);
+    if (landed != type) {
+        b->count[type]--;
+        b->count[landed]++;
+    }
+}
+
+/*
+    Takes back m, which must be the last move applied to b that is yet to
+    be taken back.
+*/
+void boardUndoMove(Board *b, const Move *m, const Undo *u) {
+    int type = u->moved;
+    int landed = boardPieceAt(b, m->to);
+    int sq = m->to;
+    int i, d, mid, captured;
+    bool sideOne = pieceOwner(type) == PLAYER_ONE;
+
+    bitClear(boardBits(b, landed), sq);
+    if (landed != type) {
+        b->count[landed]--;
+        b->count[type]++;
+    }
+
+    for (i = m->numHops - 1; i >= 0; i--) {
+        d = moveDir(m, i);
+        if (m->isJump) {
+            mid = sq - b->geo->offset[d];
+            if (undoTookKing(b, u, i))
+                captured = sideOne ? KING_TWO : KING_ONE;
+            else
+                captured = sideOne ? MAN_TWO : MAN_ONE;
+            bitSet(boardBits(b, captured), mid);
+            b->count[captured]++;
+            sq = mid - b->geo->offset[d];
+        } else {
+            sq -= b->geo->offset[d];
+        }
+    }
+
+    bitSet(boardBits(b, type), sq);
+    b->spillLen = u->spill;
+}
+
+
+/*
+    Builds a single-hop move (a step or one jump) from board coordinates.
+    Returns false if the coordinates are not one diagonal step or jump apart.
+*/
+bool moveFromCoords(const Board *b, Move *m, int x1, int y1, int x2, int y2) {
+    int dx = x2 - x1, dy = y2 - y1;
+    int d;
+
+    if (!boardOnBoard(b, x1, y1) || !boardOnBoard(b, x2, y2))
+        return false;
+    if (abs(dx) != abs(dy) || (abs(dx) != 1 && abs(dx) != 2))
+        return false;
+
+    if (dy > 0)
+        d = dx > 0 ? DIR_NE : DIR_NW;
+    else
+        d = dx > 0 ? DIR_SE : DIR_SW;
+
+    m->from = y1*b->n + x1;
+    m->to = y2*b->n + x2;
+    m->path = d;
+    m->longPath = NULL;
+    m->numHops = 1;
+    m->isJump = abs(dx) == 2;
+    m->promotes = false;
+    m->ownsPath = false;
+    return true;
+}
+
+/*
+    Copies src into dst, giving dst a path of its own if it has a long one.
+    Returns false, leaving dst with no hops at all, if there is no memory
+    for it.
+*/
+bool moveCopy(Move *dst, const Move *src) {
+    size_t bytes = sizeof(uint64_t) * pathWords(src->numHops);
+
+    *dst = *src;
+    dst->ownsPath = false;
+    if (src->longPath == NULL)
+        return true;
+
+    dst->longPath = malloc(bytes);
+    if (dst->longPath == NULL) {
+        dst->numHops = 0;
+        return false;
+    }
+    memcpy(dst->longPath, src->longPath, bytes);
+    dst->ownsPath = true;
+    return true;
+}
+
+/* Frees m's path if it has one of its own; any other Move is left be. */
+void moveFree(Move *m) {
+    if (m->ownsPath)
+        free(m->longPath);
+    m->longPath = NULL;
+    m->ownsPath = false;
+}
+
+/* True if the first hops hops of a and b go the same ways. */
+bool moveSameHops(const Move *a, const Move *b, int hops) {
+    const uint64_t *pa = a->longPath != NULL ? a->longPath : &a->path;
+    const uint64_t *pb = b->longPath != NULL ? b->longPath : &b->path;
+    int w, full = hops / 32, rest = hops % 32;
+
+    for (w = 0; w < full; w++) {
+        if (pa[w] != pb[w])
+            return false;
+    }
+    return rest == 0 ||
+           ((pa[full] ^ pb[full]) & (((uint64_t)1 << (2*rest)) - 1)) == 0;
+}
+
+/* Square m ends on, following its path from m->from. */
+int moveDestination(const BoardGeometry *g, const Move *m) {
+    int i, sq = m->from;
+    int step = m->isJump ? 2 : 1;
+
+    for (i = 0; i < m->numHops; i++)
+        sq += step * g->offset[moveDir(m, i)];
+    return sq;
+}
+
+/*
+    Writes m as "x,y-x,y" for a step or "x,y:x,y:x,y" for a capture chain,
+    listing every square the piece lands on. Returns buf.
+*/
+char* moveToString(const Board *b, const Move *m, char *buf, int len) {
+    int i, sq = m->from, used;
+    int step = m->isJump ? 2 : 1;
+
+    used = snprintf(buf, len, "%d,%d", squareX(b, sq), squareY(b, sq));
+    for (i = 0; i < m->numHops && used < len; i++) {
+        sq += step * b->geo->offset[moveDir(m, i)];
+        used += snprintf(buf + used, len - used, "%c%d,%d",
+                         m->isJump ? ':' : '-', squareX(b, sq), squareY(b, sq));
+    }
+    return buf;
+}
+
+void boardPrint(const Board *b, FILE *out) {
+    int x, y, i;
+
+    for (y = 0; y < b->n; y++) {
+        for (x = 0; x < b->n; x++)
+            fprintf(out, "%c ", boardGet(b, x, y));
+        fprintf(out, "\n");
+    }
+
+    for (i = 0; i < b->n*2; i++)
+        fprintf(out, "-");
+    fprintf(out, "\n");
+}
@@ -0,0 +1,242 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// different types of players
+enum player {
+    PLAYER_ONE,
+    PLAYER_TWO,
+    NO_PLAYER
+};
+
+// the four classes of piece, each kept in its own bitset
+//      MAN_ONE     'X'     player 1
+//      MAN_TWO     'Y'     player 2
+//      KING_ONE    'K'     player 1 kinged
+//      KING_TWO    'L'     player 2 kinged
+enum pieceType {
+    MAN_ONE,
+    MAN_TWO,
+    KING_ONE,
+    KING_TWO,
+    NUM_PIECE_TYPES,
+    NO_PIECE = -1
+};
+
+// diagonal directions; player one moves towards larger y
+enum direction {
+    DIR_NE,     // +x, +y
+    DIR_NW,     // -x, +y
+    DIR_SE,     // +x, -y
+    DIR_SW,     // -x, -y
+    NUM_DIRS
+};
+
+// hops a Move holds in its own path word, and an Undo in its own
+// capturedKings; only a longer chain needs room anywhere else
+#define INLINE_HOPS 32
+
+// room for moveToString's text of a move of up to INLINE_HOPS hops; that of
+// a longer chain is cut short
+#define MOVE_TEXT_LEN (64 + 8*INLINE_HOPS)
+
+
+/*
+    Masks and offsets that depend only on the size of the board. One of these
+    is built per distinct board size and shared by every Board of that size.
+    Squares are indexed sq = y*n + x, so a bitset needs ceil(n*n/64) words.
+*/
+typedef struct {
+    int n;
+    int words;
+    int numSquares;
+
+    // square index offset of one diagonal step in each direction
+    int offset[NUM_DIRS];
+
+    // squares from which a single step / a jump in each direction stays on
+    // the board
+    uint64_t *stepMask[NUM_DIRS];
+    uint64_t *jumpMask[NUM_DIRS];
+
+    // playable (dark) squares
+    uint64_t *dark;
+
+    // row on which each player's men are crowned
+    uint64_t *kingRow[2];
+} BoardGeometry;
+
+
+/*
+    Bitboard game state. For n <= 8 every piece class fits in one word, which
+    is stored inline; larger boards use multi-word bitsets on the heap.
+*/
+typedef struct {
+    int n;
+    int words;
+    const BoardGeometry *geo;
+
+    // NUM_PIECE_TYPES bitsets of `words` words each
+    uint64_t *bits;
+
+    // number of pieces of each class
+    int count[NUM_PIECE_TYPES];
+
+    uint64_t small[NUM_PIECE_TYPES];
+
+    // whether each hop of a long chain past its first INLINE_HOPS took a
+    // king, a bit a hop, stacked up for boardUndoMove to take back off
+    uint64_t *spill;
+    int spillLen;
+    int spillCap;
+} Board;
+
+
+/*
+    A move: the square the piece starts on plus the direction of every hop,
+    packed two bits per hop. A plain move has a single non-jumping hop.
+
+    Every hop of a chain takes a different piece, so a chain can be as
+    long as the other side has pieces: thousands on a big board. The first
+    INLINE_HOPS hops are always in path. A longer chain also has all its
+    hops in the words longPath points to, which belong to whatever the Move
+    was copied from (the MoveList it was generated into, say) unless
+    ownsPath is set; moveCopy gives a Move a copy of its own, to be freed
+    with moveFree.
+*/
+typedef struct {
+    int from;
+    int to;
+    uint64_t path;
+    uint64_t *longPath;
+    int numHops;
+    bool isJump;
+    bool promotes;
+    bool ownsPath;
+} Move;
+
+/*
+    What boardApplyMove needs to remember so the move can be taken back:
+    which captures were kings, the first INLINE_HOPS here and any more on
+    the board's spill from this index on.
+*/
+typedef struct {
+    signed char moved;
+    uint32_t capturedKings;
+    int spill;
+} Undo;
+
+
+const BoardGeometry* boardGeometry(int n);
+
+void boardInit(Board *b, int n);
+void boardFree(Board *b);
+void boardCopy(Board *dst, const Board *src);
+void boardClear(Board *b);
+void boardSetup(Board *b);
+
+char boardGet(const Board *b, int x, int y);
+void boardSet(Board *b, int x, int y, char piece);
+int boardPieceAt(const Board *b, int sq);
+bool boardOccupied(const Board *b, int sq);
+int boardCount(const Board *b, enum player p);
+bool boardOnBoard(const Board *b, int x, int y);
+
+void boardApplyMove(Board *b, const Move *m, Undo *u);
+void boardUndoMove(Board *b, const Move *m, const Undo *u);
+
+bool moveCopy(Move *dst, const Move *src);
+void moveFree(Move *m);
+bool moveSameHops(const Move *a, const Move *b, int hops);
+int moveDestination(const BoardGeometry *g, const Move *m);
+bool moveFromCoords(const Board *b, Move *m, int x1, int y1, int x2, int y2);
+char* moveToString(const Board *b, const Move *m, char *buf, int len);
+void boardPrint(const Board *b, FILE *out);
+
+char pieceChar(int type);
+int pieceFromChar(char c);
+enum player pieceOwner(int type);
+
+
+static inline uint64_t *boardBits(const Board *b, int type) {
+    return b->bits + type * b->words;
+}
+
+static inline bool bitTest(const uint64_t *bits, int sq) {
+    return (bits[sq >> 6] >> (sq & 63)) & 1;
+}
+
+static inline void bitSet(uint64_t *bits, int sq) {
+    bits[sq >> 6] |= (uint64_t)1 << (sq & 63);
+}
+
+static inline void bitClear(uint64_t *bits, int sq) {
+    bits[sq >> 6] &= ~((uint64_t)1 << (sq & 63));
+}
+
+// words a path of hops hops takes, two bits a hop
+static inline int pathWords(int hops) {
+    return (hops + 31) / 32;
+}
+
+static inline int moveDir(const Move *m, int hop) {
+    if (hop < INLINE_HOPS)
+        return (m->path >> (2*hop)) & 3;
+    return (m->longPath[hop >> 5] >> (2*(hop & 31))) & 3;
+}
+
+// whether hop of the move u was made for took a king; b is the board after
+static inline bool undoTookKing(const Board *b, const Undo *u, int hop) {
+    if (hop < INLINE_HOPS)
+        return (u->capturedKings >> hop) & 1;
+    hop += 64*u->spill - INLINE_HOPS;
+    return (b->spill[hop >> 6] >> (hop & 63)) & 1;
+}
+
+static inline int squareX(const Board *b, int sq) {
+    return sq % b->n;
+}
+
+static inline int squareY(const Board *b, int sq) {
+    return sq / b->n;
+}
+
+/*
+    Word w of the bitset whose bit i is bit (i + off) of `bits`, i.e. "is the
+    square `off` away from i in the set". Bits past either end read as zero.
+*/
+static inline uint64_t bitsetPull(const uint64_t *bits, int words, int w,
+                                  int off) {
+    int q, r;
+    long lo, hi;
+    uint64_t a, c;
+
+    if (off >= 0) {
+        q = off >> 6;
+        r = off & 63;
+        lo = (long)w + q;
+        hi = lo + 1;
+        a = lo < words ? bits[lo] : 0;
+        if (r == 0)
+            return a;
+        c = hi < words ? bits[hi] : 0;
+        return (a >> r) | (c << (64 - r));
+    } else {
+        off = -off;
+        q = off >> 6;
+        r = off & 63;
+        lo = (long)w - q;
+        hi = lo - 1;
+        a = lo >= 0 ? bits[lo] : 0;
+        if (r == 0)
+            return a;
+        c = hi >= 0 ? bits[hi] : 0;
+        return (a << r) | (c >> (64 - r));
+    }
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bot.h"
+#include "clock.h"
+#include "movegen.h"
+#include "netclient.h"
+
+
+/*
+    A search run on the opponent's time: our answer to the reply we expect,
+    started as soon as our own move is sent.
+*/
+typedef struct {
+    pthread_t thread;
+    Board board;            // the position after the expected reply
+    enum player side;
+    Move reply;
+    SearchLimits limits;
+    SearchControl control;
+    SearchResult result;
+    bool found;
+    bool running;
+    bool hit;               // the reply came; result will be our move
+} Ponder;
+
+
+static const char* playerName(enum player p) {
+    return p == PLAYER_ONE ? "Player One" : "Player Two";
+}
+
+static void* ponderThread(void *arg) {
+    Ponder *p = arg;
+
+    p->found = searchBestMove(&p->board, p->side, &p->limits, &p->result);
+    return NULL;
+}
+
+/*
+    Starts thinking, with no time limit, about our answer to the reply
+    `played` expects from the opponent, if it expects one. b is the board
+    after our move.
+*/
+static void startPonder(Ponder *p, const Board *b, enum player me,
+                        const SearchLimits *limits,
+                        const SearchResult *played) {
+    Undo undo;
+
+    if (!played->hasPonder)
+        return;
+
+    boardCopy(&p->board, b);
+    boardApplyMove(&p->board, &played->ponder, &undo);
+    p->side = me;
+    moveFree(&p->reply);
+    if (!moveCopy(&p->reply, &played->ponder))
+        return;
+    p->limits = *limits;
+    p->limits.timeMs = 0;
+    p->limits.control = &p->control;
+    searchControlInit(&p->control);
+    p->hit = false;
+    p->running = pthread_create(&p->thread, NULL, ponderThread, p) == 0;
+}
+
+/* Drops the search, and what it found; it notices within a millisecond. */
+static void cancelPonder(Ponder *p) {
+    if (!p->running)
+        return;
+    searchStop(&p->control);
+    pthread_join(p->thread, NULL);
+    searchResultFree(&p->result);
+    p->running = false;
+    p->hit = false;
+}
+
+/*
+    The opponent has played m. If that is the reply we were thinking about,
+    the search goes on for at most our usual time, less if it has already
+    gone deep enough, and becomes our move. Otherwise it is dropped.
+*/
+static void ponderReply(Ponder *p, const Move *m, int timeMs) {
+    if (!p->running)
+        return;
+    if (searchSameMove(m, &p->reply)) {
+        searchSetDeadline(&p->control, timeMs);
+        p->hit = true;
+    } else {
+        cancelPonder(p);
+    }
+}
+
+/*
+    Plays one game as a computer player with no window: connects like any
+    other client, asking for a game of size n (0 for the server's) against
+    a player of about its rating (over shared memory with shm, if it can),
+    then alternates between searching for our move and blocking on the
+    server for the opponent's. With ponder, it keeps searching while the
+    opponent thinks. Returns once the game is over or the connection is
+    lost.
+*/
+int runBot(const char *host, int port, int n, int rating, bool shm,
+           const SearchLimits *limits, bool ponder) {
+    ServerLink link;
+    ServerEvent e;
+    SearchResult result;
+    Ponder pondering;
+    Board board;
+    Move match;
+    Undo undo;
+    enum player me, opponent, turn = PLAYER_ONE;
+    double turnStart = now();
+    int hits = 0, guesses = 0;
+    bool found;
+    char buf[MOVE_TEXT_LEN];
+
+    if (!linkConnect(&link, host, port, n, rating, shm))
+        return 1;
+
+    me = link.welcome.role;
+    opponent = me == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    boardInit(&board, link.welcome.n);
+    boardSetup(&board);
+    boardInit(&pondering.board, board.n);
+    memset(&pondering.reply, 0, sizeof(Move));
+    memset(&result, 0, sizeof(result));
+    pondering.running = false;
+    pondering.hit = false;
+    printf("Playing as %s on a %dx%d board in game %llu\n",
+           playerName(me), board.n, board.n,
+           (unsigned long long)link.welcome.game);
+
+    for (;;) {
+        if (turn == me) {
+            // with no moves left we have lost; the server says so next
+            turn = NO_PLAYER;
+            searchResultFree(&result);
+            if (pondering.hit) {
+                pthread_join(pondering.thread, NULL);
+                pondering.running = false;
+                pondering.hit = false;
+                found = pondering.found;
+                // its moves are ours now
+                result = pondering.result;
+            } else {
+                found = searchBestMove(&board, me, limits, &result);
+            }
+
+            if (found) {
+                printf("%s  depth %d  score %d  %llu nodes in %.2fs\n",
+                       moveToString(&board, &result.best, buf, sizeof(buf)),
+                       result.depth, result.score,
+                       (unsigned long long)result.nodes, now() - turnStart);
+                boardApplyMove(&board, &result.best, &undo);
+
+                // a move lost with the connection is asked for again by
+                // the STATE_SYNC that comes with resuming the game
+                linkSendMove(&link, &result.best);
+                turn = opponent;
+                if (ponder)
+                    startPonder(&pondering, &board, me, limits, &result);
+            }
+            continue;
+        }
+
+        if (!linkReadEvent(&link, &e)) {
+            printf("ERROR lost connection to server\n");
+            break;
+        }
+
+        switch (e.type) {
+            case EVENT_MOVE:
+                if (pondering.running) {
+                    guesses++;
+                    ponderReply(&pondering, &e.move, limits->timeMs);
+                    if (pondering.hit)
+                        hits++;
+                }
+                turnStart = now();
+
+                if (turn == opponent && e.move.from >= 0 &&
+                    e.move.from < board.geo->numSquares &&
+                    findMove(&board, opponent, &e.move, &match)) {
+                    boardApplyMove(&board, &match, &undo);
+                    turn = me;
+                } else {
+                    cancelPonder(&pondering);
+                    printf("ERROR opponent sent an illegal move\n");
+                }
+                moveFree(&e.move);
+                break;
+            case EVENT_ERROR:
+                printf("ERROR server refused our move (code %d)\n", e.code);
+                break;
+            case EVENT_STATE_SYNC:
+                cancelPonder(&pondering);
+                boardCopy(&board, e.board);
+                boardFree(e.board);
+                free(e.board);
+                turn = e.player;
+                turnStart = now();
+                break;
+            case EVENT_GAME_OVER:
+                cancelPonder(&pondering);
+                printf("%s wins\n", playerName(e.player));
+                if (guesses > 0)
+                    printf("Guessed %d of %d replies\n", hits, guesses);
+                searchResultFree(&result);
+                moveFree(&pondering.reply);
+                boardFree(&pondering.board);
+                boardFree(&board);
+                close(link.fd);
+                return 0;
+            case EVENT_CLOSED:
+                break;
+        }
+    }
+
+    cancelPonder(&pondering);
+    searchResultFree(&result);
+    moveFree(&pondering.reply);
+    boardFree(&pondering.board);
+    boardFree(&board);
+    return 1;
+}
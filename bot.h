@@ -0,0 +1,11 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdbool.h>
+
+#include "search.h"
+
+int runBot(const char *host, int port, int n, int rating, bool shm,
+           const SearchLimits *limits, bool ponder);
+
+#endif
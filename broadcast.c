@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "broadcast.h"
+
+
+/* A buffer holding a copy of the len bytes, with one reference to it. */
+Broadcast* broadcastNew(const void *bytes, size_t len) {
+    Broadcast *b = malloc(sizeof(Broadcast) + len);
+
+    b->refs = 1;
+    b->seq = 0;
+    b->next = NULL;
+    b->len = len;
+    if (len > 0)
+        memcpy(b->data, bytes, len);
+    return b;
+}
+
+void broadcastRetain(Broadcast *b) {
+    if (b != NULL)
+        b->refs++;
+}
+
+/*
+    Lets go of b, freeing it if that was the last reference, and then the
+    frames after it that only it was holding on to. Iterative, so a long
+    chain can't run the stack out.
+*/
+void broadcastRelease(Broadcast *b) {
+    Broadcast *next;
+
+    while (b != NULL && --b->refs == 0) {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+
+/* Starts a feed with an empty frame for readers to begin after. */
+void feedStart(Feed *feed) {
+    feed->tail = broadcastNew(NULL, 0);
+}
+
+/* Links a new frame holding a copy of the len bytes onto the feed. */
+void feedAppend(Feed *feed, const void *bytes, size_t len) {
+    Broadcast *b = broadcastNew(bytes, len), *old = feed->tail;
+
+    // the new frame's first reference is old's link to it
+    b->seq = old->seq + 1;
+    old->next = b;
+    broadcastRetain(b);
+    feed->tail = b;
+    broadcastRelease(old);
+}
+
+/* Lets go of the feed; readers still on it can finish what is there. */
+void feedStop(Feed *feed) {
+    broadcastRelease(feed->tail);
+    feed->tail = NULL;
+}
+
+
+/*
+    Puts c at the end of the feed, with everything in it already sent, by
+    way of detour if there is one.
+*/
+void cursorStart(FeedCursor *c, Broadcast *detour, const Feed *feed) {
+    broadcastRetain(feed->tail);
+    if (detour == NULL) {
+        c->at = feed->tail;
+        c->offset = feed->tail->len;
+        c->then = NULL;
+        return;
+    }
+    broadcastRetain(detour);
+    c->at = detour;
+    c->offset = 0;
+    c->then = feed->tail;
+}
+
+void cursorStop(FeedCursor *c) {
+    broadcastRelease(c->at);
+    broadcastRelease(c->then);
+    c->at = NULL;
+    c->then = NULL;
+}
+
+// what comes after c->at: the frame after the detour, or after at itself
+static Broadcast* following(const FeedCursor *c) {
+    return c->then != NULL ? c->then->next : c->at->next;
+}
+
+/*
+    Points up to max of iov at what c has still to send, in order. Returns
+    how many it used, 0 if c is caught up.
+*/
+int cursorGather(const FeedCursor *c, struct iovec *iov, int max) {
+    const Broadcast *b = c->at, *then = c->then;
+    size_t offset = c->offset;
+    int count = 0;
+
+    while (b != NULL && count < max) {
+        if (offset < b->len) {
+            iov[count].iov_base = (void*)(b->data + offset);
+            iov[count].iov_len = b->len - offset;
+            count++;
+        }
+        if (then != NULL) {
+            b = then->next;
+            then = NULL;
+        } else {
+            b = b->next;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+/*
+    Moves c on past n bytes just sent, letting go of each frame as it
+    leaves it. A cursor that reaches the end of a detour with nothing after
+    it settles on the frame the detour rejoins, as if it had sent that.
+*/
+void cursorAdvance(FeedCursor *c, size_t n) {
+    Broadcast *next;
+    size_t step;
+
+    while (c->at != NULL) {
+        step = c->at->len - c->offset;
+        if (step > n)
+            step = n;
+        c->offset += step;
+        n -= step;
+        if (c->offset < c->at->len)
+            break;
+
+        next = following(c);
+        if (next == NULL) {
+            if (c->then != NULL) {
+                broadcastRelease(c->at);
+                c->at = c->then;
+                c->offset = c->then->len;
+                c->then = NULL;
+            }
+            break;
+        }
+
+        broadcastRetain(next);
+        broadcastRelease(c->at);
+        broadcastRelease(c->then);
+        c->at = next;
+        c->offset = 0;
+        c->then = NULL;
+    }
+}
+
+bool cursorPending(const FeedCursor *c) {
+    return c->at != NULL &&
+           (c->offset < c->at->len || following(c) != NULL);
+}
+
+// whether c has sent part of a buffer, so can't skip the rest of it
+bool cursorMidFrame(const FeedCursor *c) {
+    return c->at != NULL && c->offset > 0 && c->offset < c->at->len;
+}
+
+/* How many frames of the feed c has yet to start on. */
+uint64_t cursorLag(const FeedCursor *c, const Feed *feed) {
+    const Broadcast *at = c->then != NULL ? c->then : c->at;
+
+    if (at == NULL || feed->tail == NULL)
+        return 0;
+    return feed->tail->seq - at->seq;
+}
@@ -0,0 +1,60 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+
+/*
+    Frames going out to many sockets at once, each encoded once into a
+    reference-counted buffer that every socket sends from.
+
+    A feed is a chain of them in the order they were broadcast. Each
+    reader walks the chain at its own pace with a cursor, holding a
+    reference to the frame it is on, and the feed holds one to its tail
+    so that the next frame can be linked on. A frame is also referenced by
+    the one before it, so it goes as soon as the slowest reader is past it.
+    A cursor can detour through a buffer off the chain, such as a snapshot
+    of the whole game, and then pick up the chain after a given frame.
+
+    For use by one thread: the counts are not atomic.
+*/
+typedef struct Broadcast {
+    int refs;
+    uint64_t seq;           // its place in the feed
+    struct Broadcast *next;
+    size_t len;
+    unsigned char data[];
+} Broadcast;
+
+typedef struct {
+    Broadcast *tail;        // NULL until the feed is started
+} Feed;
+
+typedef struct {
+    Broadcast *at;          // being sent, or NULL for nothing at all
+    size_t offset;          // bytes of it already sent
+    Broadcast *then;        // where to go on from after a detour
+} FeedCursor;
+
+
+Broadcast* broadcastNew(const void *bytes, size_t len);
+void broadcastRetain(Broadcast *b);
+void broadcastRelease(Broadcast *b);
+
+void feedStart(Feed *feed);
+void feedAppend(Feed *feed, const void *bytes, size_t len);
+void feedStop(Feed *feed);
+
+void cursorStart(FeedCursor *c, Broadcast *detour, const Feed *feed);
+void cursorStop(FeedCursor *c);
+int cursorGather(const FeedCursor *c, struct iovec *iov, int max);
+void cursorAdvance(FeedCursor *c, size_t n);
+bool cursorPending(const FeedCursor *c);
+bool cursorMidFrame(const FeedCursor *c);
+uint64_t cursorLag(const FeedCursor *c, const Feed *feed);
+
+#endif
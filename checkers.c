@@ -3,11 +3,31 @@
 #include <stdbool.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h> 
+#include <unistd.h>
+
+#include "board.h"
+#include "bot.h"
+#include "movegen.h"
+#include "loadgen.h"
+#include "mcts.h"
+#include "perft.h"
+#include "netclient.h"
+#include "protocol.h"
+#include "render.h"
+#include "replay.h"
+#include "search.h"
+#include "selftest.h"
+#include "tablebase.h"
+#include "tournament.h"
+#include "watch.h"
+#include "server.h"
 
 #ifdef __APPLE__
     #include <GLUT/glut.h>
@@ -18,50 +38,151 @@
 
 const int WIDTH = 500;
 const int HEIGHT = 500;
-const int PI = 3.1415926f;
 const char* HELP_STR =
 "ARGUMENTS\n\n"
 "    [--nVal   (-n)]           Number of squares on each side of the board.\n"
-"                            Default is 8.\n"
+"                            Default is 8. A client asks the server for a\n"
+"                            game of this size.\n"
+"    [--rating R]            A client's rating; it is matched with players\n"
+"                            rated about the same. Default is 0.\n"
+"    [--shm]                 A client on the same host as the server plays\n"
+"                            over shared memory instead of TCP, if the\n"
+"                            server can. So do --loadgen's clients.\n"
 "    [--server (-s)]         Start in server mode.\n"
 "    [--client (-c)]         Start in client mode\n"
 "    [--port   (-p)]         Run server on specified port number.\n"
+"    [--metrics PORT]        With --server, serve counters and latencies\n"
+"                            over HTTP on localhost:PORT.\n"
+"    [--log DIR]             With --server, record every game in DIR,\n"
+"                            and resume the games in it after a crash.\n"
+"    [--watch GAME]          Connect as a spectator of game GAME, printing\n"
+"                            its moves as they are played.\n"
+"    [--replay FILE]         List the games in a --log file, then exit.\n"
+"    [--game G]              With --replay, show game G instead.\n"
+"    [--ply P]               With --game, show the board after P moves\n"
+"                            instead of at the end.\n"
+"    [--perft DEPTH]         Count move-generation leaf nodes from the\n"
+"                            starting position to DEPTH, then exit.\n"
+"    [--divide]              With --perft, list the count under each\n"
+"                            first move.\n"
+"    [--bench DEPTH]         Search the starting position to DEPTH on 1, 2,\n"
+"                            4, ... threads and report the speedup.\n"
+"    [--mctsbench MS]        Run Monte Carlo search on the starting position\n"
+"                            for MS ms on 1, 2, 4, ... threads and report\n"
+"                            playouts a second.\n"
+"    [--tbgen PIECES]        Build 8x8 endgame tables for up to PIECES\n"
+"                            pieces, then exit.\n"
+"    [--tbdir DIR]           Where --tbgen writes the tables and --ai finds\n"
+"                            them. Default is ./tables.\n"
+"    [--threads (-t)]        Worker threads for the server, --perft, --ai,\n"
+"                            --bench and --tbgen. Default is the number of\n"
+"                            online CPUs.\n"
+"    [--ai]                  Connect as a client whose moves are played by\n"
+"                            the computer.\n"
+"    [--headless]            With --ai, play without opening a window.\n"
+"    [--movetime MS]         How long --ai may think about each move.\n"
+"                            Default is 1000.\n"
+"    [--engine NAME]         How --ai searches: alphabeta (the default) or\n"
+"                            mcts, Monte Carlo tree search, for big boards.\n"
+"    [--depth PLIES]         Stop --ai's alphabeta search at PLIES.\n"
+"    [--tournament GAMES]    Play GAMES games of --engine against --versus\n"
+"                            on --threads threads, then exit.\n"
+"    [--versus NAME]         The engine --tournament plays against. Default\n"
+"                            is --engine itself.\n"
+"    [--openplies PLIES]     Random plies at the start of each pair of\n"
+"                            --tournament games. Default is 4.\n"
+"    [--loadgen CLIENTS]     Connect CLIENTS clients that play random games\n"
+"                            against each other, and report the server's\n"
+"                            move latency.\n"
+"    [--rate MOVES]          Moves a second in each --loadgen game.\n"
+"                            Default is 10.\n"
+"    [--duration SECONDS]    How long --loadgen runs. Default is 10.\n"
+"    [--seed N]              Seed for --loadgen's moves. Default is 1.\n"
+"    [--watchers N]          Have N more --loadgen clients watch the first\n"
+"                            game.\n"
+"    [--noponder]            Keep --ai from thinking on the opponent's time.\n"
+"    [--selftest]            Run the unit tests, then exit.\n"
 "\n"
 "KEYBOARD COMMANDS\n\n"
 "    L                       draws labels over the checkers pieces\n"
 "    P                       prints the board to STDOUT\n"
+"    + / -                   zooms in / out (so does the mouse wheel)\n"
+"    0                       shows the whole board again\n"
+"    arrow keys              pan (so does dragging with the right button)\n"
 ;
 
+// room for the window title
+#define TITLE_LEN 32
 
+// how often the window checks for news from the server
+#define POLL_MS 15
 
-// different types of players
-enum player {
-    PLAYER_ONE,
-    PLAYER_TWO,
-    NO_PLAYER
+// how far one press of a zoom or pan key goes
+#define ZOOM_STEP 1.25f
+#define PAN_STEP 40
+
+
+
+// result of playing one hop of a move
+enum hopResult {
+    HOP_ILLEGAL,
+    HOP_CONTINUE,   // a capture chain that must keep going
+    HOP_DONE
 };
 
 // possible modes of operation
 enum modeType {
     SERVER,
-    CLIENT
+    CLIENT,
+    PERFT,
+    BENCH,      // time the engine's search on 1, 2, 4, ... threads
+    MCTSBENCH,  // the same for Monte Carlo playouts
+    TBGEN,      // build the endgame tables
+    TOURNAMENT, // engine against engine, many games at once
+    LOADGEN,    // many clients playing random games, to load a server
+    REPLAY,     // read a game log
+    WATCH,      // follow a game on the server
+    BOT,        // a computer player with no window
+    SELFTEST    // run the unit tests
 };
 
 
-typedef struct {
-    // move from other player
-    int x1, y1, x2, y2;
-
-    // if isMyTurn is False, game is over
-    bool isMyTurn;
-} Message;
-
-
 // command line options
 enum modeType mode = SERVER;
 int numSquaresOnSide = -1;
+int requestedN = 0;
+int rating = 0;
+bool useShm = false;
 int port = 9020;
+int metricsPort = 0;
+char* logDir = NULL;
+char* replayPath = NULL;
+int replayGame = -1;
+int replayPly = -1;
+uint64_t watchedGame = 0;
 char* serverAddr = "localhost";
+int perftDepth = 0;
+bool perftDivide = false;
+int numThreads = 0;
+bool aiPlayer = false;
+bool headless = false;
+int benchDepth = 0;
+int benchMs = 0;
+int tournamentGames = 0;
+int openPlies = DEFAULT_OPENING_PLIES;
+int loadClients = 0;
+int loadRate = DEFAULT_LOAD_RATE;
+int loadSeconds = DEFAULT_LOAD_SECONDS;
+int loadWatchers = 0;
+uint64_t loadSeed = 1;
+int tbPieces = 0;
+char* tbDir = TB_DEFAULT_DIR;
+SearchLimits aiLimits = { .timeMs = 1000, .threads = 1,
+                          .engine = ENGINE_ALPHABETA };
+SearchLimits versusLimits;
+enum searchEngine versusEngine;
+bool versus = false;
+bool aiPonder = true;
 
 // display options
 bool drawLabels = false;
@@ -72,85 +193,89 @@ char dragType = ' ';
 int dragXFrom, dragYFrom;
 int mouseX, mouseY;
 
+// used for panning the view with the right button
+bool panning = false;
+int panX, panY;
+
 //Game statistics
-int numChecksOne;
-int numChecksTwo;
 int isGameOver = -1;
+enum player turn;
+
+// legal moves for the side to move, and how far into one of them we are:
+// chainHops hops of turnList.moves[chainMove], and any that start the same
+MoveList turnList;
+int chainFrom, chainSq, chainHops, chainMove;
 
 // other globals
-char **board;
-char titleStr[255];
+Board board;
+char titleStr[TITLE_LEN];
 enum player me;
 enum player opponent;
 
 // communication
-int serverSocket, playerOneSock, playerTwoSock;
+ServerLink server;
+
+// the computer player thinks on its own thread, on a copy of the board
+pthread_t aiThread;
+Board aiBoard;
+uint64_t aiKey;
+SearchResult aiResult;
+bool aiThinking = false;
+atomic_bool aiDone;
+
+// on the opponent's time it thinks about the reply it expects from them
+SearchLimits aiSearch;
+SearchControl aiControl;
+Move aiReply;
+bool aiPondering = false;
 
 bool procArgs(int argc, char* argv[]);
 void init();
-char** initMatrix(int n, int m);
 void drawScreen();
+void reshape(int width, int height);
+void visibility(int state);
 void drawBoard();
-void drawPiece(char pieceType, int x, int y);
-void drawKing(float x, float y, int scale);
+void drawPiece(char pieceType, float x, float y);
 void drawWin(int player);
-void drawReesesCup(int x, int y, int radius);
-bool isValidMove(enum player p, bool isKing, int x1, int y1, int x2, int y2);
+void beginTurn(enum player p);
+enum hopResult playHop(int x1, int y1, int x2, int y2);
+void pollServer(int value);
+void drawHints();
 enum player determinePlayer(char piece);
 void decideBoardCoords(int mouseX, int mouseY, int *x, int *y);
 void motionFunc(int x, int y);
+static void markDragged();
+static void markHints();
 void mouseFunc(int button, int state, int x, int y);
 void printBoard();
 void keyPressed(unsigned char key, int x, int y);
+void specialKeyPressed(int key, int x, int y);
 void drawString(char* str, int x, int y);
-int serverAddPlayer(char* playerTitle, int serverSocket, struct sockaddr_in clientAddr);
 void initSockets();
 
 
-void displayMessage(Message* mesg) {
-    printf("mesg->x1 = %d\n", mesg->x1);
-    printf("mesg->y1 = %d\n", mesg->y1);
-    printf("mesg->x2 = %d\n", mesg->x2);
-    printf("mesg->y2 = %d\n\n", mesg->y2);
-}
-
-
-
-void sendMoveToServer( Message* mess) {
-    int n = write(serverSocket,mess,sizeof(Message));
-    if (n < 0)
-        printf("ERROR sending move to server \n");
-}
-
-void sendMoveToClient( Message* mess, int clientSocket) {
-    int n = write(clientSocket,mess,sizeof(Message));
-    if (n < 0)
-        printf("ERROR sending move to server \n");
-}
-
-void getMessageFromServer(Message* message) {
-    int n;
-    n = read(serverSocket,message,sizeof(Message));
-    if (n < 0)
-            printf("ERROR receiving message from server\n");
-    // get message
-}
-
-void getMessageFromClient(Message* message, int clientSocket) {
-    int n;
-    n = read(clientSocket,message,sizeof(Message));
-    if (n < 0)
-            printf("ERROR receiving message from client\n");
-    // get message
-}
-
 int main(int argc, char* argv[]) {
 
     bool goodArgs = procArgs(argc, argv);
     if (!goodArgs)
         return 1;
 
-    if (mode == CLIENT) {
+    if (mode == PERFT) {
+        runPerft(numSquaresOnSide, perftDepth, numThreads, perftDivide);
+    } else if (mode == BENCH) {
+        runSearchBench(numSquaresOnSide, benchDepth, numThreads);
+    } else if (mode == MCTSBENCH) {
+        runMctsBench(numSquaresOnSide, benchMs, numThreads);
+    } else if (mode == TBGEN) {
+        return tbGenerate(tbDir, tbPieces, numThreads) ? 0 : 1;
+    } else if (mode == LOADGEN) {
+        return runLoadGen(serverAddr, port, loadClients, loadRate,
+                          loadSeconds, loadSeed, numThreads, loadWatchers,
+                          useShm);
+    } else if (mode == TOURNAMENT) {
+        runTournament(numSquaresOnSide, tournamentGames, openPlies,
+                      numThreads, &aiLimits, &versusLimits);
+    } else if (mode == CLIENT) {
         initSockets();
 
         // GLUT setup stuff
@@ -164,18 +289,18 @@ int main(int argc, char* argv[]) {
 
         // register display callback
         glutDisplayFunc(drawScreen);
-        
-        //player 2 listens for player 1 move 
-        if(me == PLAYER_TWO)
-        {
-        	Message* message = malloc(sizeof(Message));
-            getMessageFromServer(message);
-            isValidMove(opponent, true, message->x1, message->y1, message->x2, message->y2);
-            char dragType = board[message->x1][message->y1];
-            board[message->x2][message->y2] = dragType;
-            board[message->x1][message->y1] = ' ';        
+
+        // the opponent's moves arrive on another thread; pick them up
+        // between frames so the window never stops repainting
+        if (!linkStart(&server)) {
+            printf("ERROR starting network thread\n");
+            return 1;
         }
-        
+        glutTimerFunc(POLL_MS, pollServer, 0);
+
+        // Player One always moves first
+        beginTurn(PLAYER_ONE);
+
         glutMainLoop();
 
         // Listen for message
@@ -186,44 +311,19 @@ int main(int argc, char* argv[]) {
         //     Display game over message
 
 
+    } else if (mode == BOT) {
+        return runBot(serverAddr, port, requestedN, rating, useShm,
+                      &aiLimits, aiPonder);
+    } else if (mode == SELFTEST) {
+        return runSelfTests() == 0 ? 0 : 1;
+    } else if (mode == REPLAY) {
+        return runReplay(replayPath, replayGame, replayPly);
+    } else if (mode == WATCH) {
+        return runWatch(serverAddr, port, watchedGame);
     } else if (mode == SERVER) {
-    
-        initSockets();
-        
-        bool gameOver = false;
-        int winner;
-        enum player whoseTurn = PLAYER_ONE;
-        int currTurnSocket = playerOneSock;
-        int waitTurnSocket = playerTwoSock;
-        Message* message = malloc(sizeof(Message));
-        while (isGameOver == -1) {
-            
-                
-            // make a message for player whose turn it is
-            // send message
-            // listen for reply
-            // send that answer to the other player
-
-
-	        getMessageFromClient(message, currTurnSocket);
-            sendMoveToClient(message, waitTurnSocket);
-
-
-            displayMessage(message);
-
-/*
-            isValidMove(opponent, true, message->x1, message->y1, message->x2, message->y2);
-            board[message->x2][message->y2] = board[message->x1][message->y1];
-            board[message->x1][message->y1] = ' ';
-*/
-
-            int holder = currTurnSocket;
-            currTurnSocket = waitTurnSocket;
-            waitTurnSocket = holder;
-
-
-
-        }
+        ServerOptions options = { port, numSquaresOnSide, numThreads,
+                                  metricsPort, logDir };
+        return runServer(&options);
     }
 
 
@@ -233,6 +333,20 @@ int main(int argc, char* argv[]) {
 }
 
 
+/* Reads an engine name given for option opt. */
+static bool parseEngine(const char *opt, const char *name,
+                        enum searchEngine *engine) {
+    if (name != NULL && !strcmp(name, "alphabeta")) {
+        *engine = ENGINE_ALPHABETA;
+    } else if (name != NULL && !strcmp(name, "mcts")) {
+        *engine = ENGINE_MCTS;
+    } else {
+        printf("%s needs alphabeta or mcts\n", opt);
+        return false;
+    }
+    return true;
+}
+
 /*
     Process command-line arguments. Return false if the program should
     quit right away. Return true if we should continue.
@@ -260,23 +374,171 @@ bool procArgs(int argc, char* argv[]) {
             mode = CLIENT;
         } else if (!strcmp(argLabel, "--port") || !strcmp(argLabel, "-p")) {
             port = atoi(argVal);
+        } else if (!strcmp(argLabel, "--metrics")) {
+            metricsPort = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--log")) {
+            logDir = argVal;
+        } else if (!strcmp(argLabel, "--replay")) {
+            mode = REPLAY;
+            replayPath = argVal;
+        } else if (!strcmp(argLabel, "--watch")) {
+            mode = WATCH;
+            watchedGame = argVal ? strtoull(argVal, NULL, 10) : 0;
+        } else if (!strcmp(argLabel, "--game")) {
+            replayGame = argVal ? atoi(argVal) : -1;
+        } else if (!strcmp(argLabel, "--ply")) {
+            replayPly = argVal ? atoi(argVal) : -1;
+        } else if (!strcmp(argLabel, "--rating")) {
+            rating = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--shm")) {
+            useShm = true;
         } else if (!strcmp(argLabel, "--address") || !strcmp(argLabel, "-a")) {
             serverAddr = argVal;
+        } else if (!strcmp(argLabel, "--perft")) {
+            mode = PERFT;
+            perftDepth = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--bench")) {
+            mode = BENCH;
+            benchDepth = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--mctsbench")) {
+            mode = MCTSBENCH;
+            benchMs = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--tbgen")) {
+            mode = TBGEN;
+            tbPieces = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--tbdir")) {
+            tbDir = argVal ? argVal : TB_DEFAULT_DIR;
+        } else if (!strcmp(argLabel, "--divide")) {
+            perftDivide = true;
+        } else if (!strcmp(argLabel, "--threads") || !strcmp(argLabel, "-t")) {
+            numThreads = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--ai")) {
+            mode = CLIENT;
+            aiPlayer = true;
+        } else if (!strcmp(argLabel, "--headless")) {
+            headless = true;
+        } else if (!strcmp(argLabel, "--movetime")) {
+            aiLimits.timeMs = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--noponder")) {
+            aiPonder = false;
+        } else if (!strcmp(argLabel, "--engine")) {
+            if (!parseEngine(argLabel, argVal, &aiLimits.engine))
+                return false;
+        } else if (!strcmp(argLabel, "--versus")) {
+            if (!parseEngine(argLabel, argVal, &versusEngine))
+                return false;
+            versus = true;
+        } else if (!strcmp(argLabel, "--depth")) {
+            aiLimits.maxDepth = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--tournament")) {
+            mode = TOURNAMENT;
+            tournamentGames = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--openplies")) {
+            openPlies = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--loadgen")) {
+            mode = LOADGEN;
+            loadClients = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--rate")) {
+            loadRate = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--duration")) {
+            loadSeconds = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--watchers")) {
+            loadWatchers = argVal ? atoi(argVal) : 0;
+        } else if (!strcmp(argLabel, "--selftest")) {
+            mode = SELFTEST;
+        } else if (!strcmp(argLabel, "--seed")) {
+            loadSeed = argVal ? strtoull(argVal, NULL, 10) : 0;
         }
 
         argNum++;
     }
 
+    // a client asks for the size it was given, or takes the server's
+    requestedN = numSquaresOnSide > 1 ? numSquaresOnSide : 0;
+
     // check to see that required arguments were specified
     if (numSquaresOnSide == -1 || numSquaresOnSide <= 1) {
         printf("Defaulting to n=8\n");
         numSquaresOnSide = 8;
     }
-    if (mode == SERVER) {
+    if (numThreads <= 0)
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads <= 0)
+        numThreads = 1;
+    aiLimits.threads = numThreads;
+
+    // --tournament's other engine plays on the same terms
+    versusLimits = aiLimits;
+    if (versus)
+        versusLimits.engine = versusEngine;
+
+    if (headless) {
+        if (!aiPlayer) {
+            printf("--headless needs --ai\n");
+            return false;
+        }
+        mode = BOT;
+    }
+    if (rating < 0) {
+        printf("--rating can't be negative\n");
+        return false;
+    }
+    if (aiPlayer && aiLimits.timeMs <= 0) {
+        printf("--movetime needs a time of at least 1 ms\n");
+        return false;
+    }
+    if (aiPlayer || mode == TOURNAMENT)
+        tbOpen(tbDir);
+
+    if (mode == PERFT) {
+        if (perftDepth <= 0) {
+            printf("--perft needs a depth of at least 1\n");
+            return false;
+        }
+    } else if (mode == BENCH) {
+        if (benchDepth <= 0 || benchDepth >= MAX_PLY) {
+            printf("--bench needs a depth from 1 to %d\n", MAX_PLY - 1);
+            return false;
+        }
+    } else if (mode == MCTSBENCH) {
+        if (benchMs <= 0) {
+            printf("--mctsbench needs a time of at least 1 ms\n");
+            return false;
+        }
+    } else if (mode == LOADGEN) {
+        if (loadClients < 2 || loadRate <= 0 || loadSeconds <= 0) {
+            printf("--loadgen needs at least 2 clients, a --rate and a "
+                   "--duration\n");
+            return false;
+        }
+    } else if (mode == TOURNAMENT) {
+        if (tournamentGames <= 0 || openPlies < 0) {
+            printf("--tournament needs at least 1 game\n");
+            return false;
+        }
+        if (aiLimits.timeMs <= 0 && (aiLimits.maxDepth <= 0 ||
+                                     aiLimits.engine == ENGINE_MCTS ||
+                                     versusLimits.engine == ENGINE_MCTS)) {
+            printf("--tournament needs a --movetime, or a --depth for "
+                   "alphabeta\n");
+            return false;
+        }
+    } else if (mode == REPLAY) {
+        if (replayPath == NULL) {
+            printf("--replay needs a log file\n");
+            return false;
+        }
+    } else if (mode == TBGEN) {
+        if (tbPieces < 2 || tbPieces > TB_MAX_PIECES) {
+            printf("--tbgen needs from 2 to %d pieces\n", TB_MAX_PIECES);
+            return false;
+        }
+    } else if (mode == SERVER) {
         printf("Starting in SERVER mode.\n");
         printf("Running on port %d\n", port);
-    } else if (mode == CLIENT) {
-        printf("Starting in CLIENT mode.\n");
+    } else if (mode == CLIENT || mode == BOT || mode == WATCH) {
+        printf("Starting in %s mode.\n", mode == BOT ? "BOT" :
+               mode == WATCH ? "WATCH" : "CLIENT");
         printf("Connecting to port %d\n", port);
     }
 
@@ -314,197 +576,108 @@ void init() {
     glEnable(GL_POLYGON_SMOOTH_HINT);
     glEnable(GL_LINE_SMOOTH_HINT);
 
+    // textures and tables for drawing the board
+    renderInit(WIDTH, HEIGHT);
+
+    // redraw everything when the window itself changes
+    glutReshapeFunc(reshape);
+    glutVisibilityFunc(visibility);
+
     // set mouse motion func
     glutMouseFunc(mouseFunc);
     glutMotionFunc(motionFunc);
 
     // set keyboard func
     glutKeyboardFunc(keyPressed);
+    glutSpecialFunc(specialKeyPressed);
 
-    // allocate memory for n pointers to char arrays
-    board = initMatrix(numSquaresOnSide, numSquaresOnSide);
-
-	
-
-    // fill in the board character array
+    // lay out the pieces
     //      X       represents player 1
     //      Y       represents player 2
     //      K       represents player 1 kinged
     //      L       represents player 2 kinged
-    //      _       means this square is off
-
-    int x, y;
-    bool evenCol, sqrOn;
-
-
-    for (x = 0; x < numSquaresOnSide; x++) {        
-        evenCol = !evenCol;
-        sqrOn = evenCol;
-
-        for (y = 0; y<numSquaresOnSide; y++) {
-            sqrOn = !sqrOn;
-
-            board[x][y] = ' ';
-
-            if (sqrOn) {
-                if (numSquaresOnSide % 2 == 1) {
-                    if (y < numSquaresOnSide/2) {
-                        board[x][y] = 'X';
-                    } else if (y > numSquaresOnSide/2){
-                        board[x][y] = 'Y';
-                    }
-                } else {
-                    if (y < numSquaresOnSide/2 - 1) {
-                        board[x][y] = 'X';
-                    } else if (y > numSquaresOnSide/2){
-                        board[x][y] = 'Y';
-                    }
-                }
-            }
-        }
-    }
-
-
-}
-
-/* Creates a 2D array of char and returns a pointer. */
-char** initMatrix(int n, int m) {
-    int i;
-
-    // reserve space for n pointers to char arrays
-    char** a = (char**) malloc(sizeof(char*)*n);
-
-    // guarantee contiguous allocation
-    a[0] = malloc(n*m * sizeof(char));
-
-    // Make double subscripts work with some hardcoded
-    // pointer arithmetic. Note that we don't have to
-    // redo these pointers when receiving a new matrix
-    // because the matrices are allocated contiguously!
-    for (i=0; i<n; i++)
-        a[i] = (char*)(a[0] + i*m);
- 
-    return a;
+    boardInit(&board, numSquaresOnSide);
+    boardSetup(&board);
+    boardInit(&aiBoard, numSquaresOnSide);
 }
 
 
 /*
-    Display the state of the game visually
+    Paints the whole scene; renderRepaint clips it to whatever changed.
 */
-void drawScreen() {
+static void drawFrame() {
+    float x, y;
+
     // clear the screen
     glClear(GL_COLOR_BUFFER_BIT);
 
     // draw the current state of the game
     drawBoard();
 
+    // optionally draw the piece that is being dragged, over the board
+    if (dragging) {
+        drawHints();
+        renderScreenToBoard(mouseX, mouseY, &x, &y);
+        drawPiece(dragType, x, y);
+    }
 
+    // messages are placed in window pixels, not on the board
+    renderScreenProjection();
 	
 	// draw the current state of the game
-	if(numChecksOne == 0){
+	if(boardCount(&board, PLAYER_ONE) == 0 || isGameOver == PLAYER_TWO){
 		drawWin(2);
         if (me == PLAYER_TWO) {
     		system("./CppTest");
             exit(0);
         }
 		
-	} else if (numChecksTwo == 0) {
+	} else if (boardCount(&board, PLAYER_TWO) == 0 || isGameOver == PLAYER_ONE) {
 		drawWin(1);
         if (me == PLAYER_ONE) {
     		system("./CppTest");
             exit(0);
         }
 	}
-   
-    // flushes all unfinished drawing commands
-    glFlush();
 }
 
-
 /*
-    Draw the checkerboard pattern
+    Display the state of the game visually, repainting only what changed
+    since the last time
 */
-void drawBoard() {
-    int x, y;
-    int x1, y1, x2, y2;
-    int cx, cy, r;
-    float xPos, yPos;
-    float sqrWidth = 1.*WIDTH / numSquaresOnSide;
-    float sqrHeight = 1.*HEIGHT / numSquaresOnSide;
-    bool evenCol, sqrOn;
-
-
-    // represents which color this column should start with
-    evenCol = false;
-
-
-    // avoid the oncoming infinite loop if square width or height is zero
-    if (sqrWidth == 0)
-        sqrWidth = 1;
-    if (sqrHeight == 0)
-        sqrHeight = 1;
-
-
-    // draw the checkerboard
-    for (x = 0; x < numSquaresOnSide; x++) {
-        
-        xPos = x * sqrWidth;
-
-        evenCol = !evenCol;
-        sqrOn = evenCol;
-
-        for (y = 0; y<numSquaresOnSide; y++) {
-
-            yPos = y * sqrHeight;
-
-            sqrOn = !sqrOn;
-
-            if (sqrOn) {
-                x1 = (int)(xPos + 0.5);
-                x2 = (int)(xPos + sqrWidth + 0.5);
-                y1 = (int)(yPos + 0.5);
-                y2 = (int)(yPos + sqrHeight + 0.5);
-
-
-                glColor3f(.0f, .0f, .0f);
-
-                glBegin(GL_QUADS);
-                    glVertex2f(x1, y1);
-                    glVertex2f(x2, y1);
-                    glVertex2f(x2, y2);
-                    glVertex2f(x1, y2);
-                glEnd();
-
-                cx = (x1 + x2) / 2;
-                cy = (y1 + y2) / 2;
-                drawPiece(board[x][y], cx, cy);
+void drawScreen() {
+    renderRepaint(drawFrame);
 
+    // flushes all unfinished drawing commands
+    glFlush();
+}
 
-                if (drawLabels) {
-                    // draw the board character at this position
-                    glColor3f(1.0f, 1.0f, 1.0f);
-                    glRasterPos2i(cx-9/2, cy - 15/2);
-                    glutBitmapCharacter(GLUT_BITMAP_9_BY_15, board[x][y]);
-                    glColor3f(0.0f, 0.0f, 0.0f);
-                }
+/* Called when the window changes size; everything must be redrawn. */
+void reshape(int width, int height) {
+    renderResize(width, height);
+}
 
-            }
+/* Called when the window is uncovered, which may have lost its contents. */
+void visibility(int state) {
+    if (state == GLUT_VISIBLE)
+        renderMarkAllDirty();
+}
 
-        }
-    }
 
-    // optionally draw the piece that is being dragged
-    if (dragging) {
-        drawPiece(dragType, mouseX, mouseY);
-    }
+/*
+    Draw the checkerboard pattern and the pieces on it, as much of it as the
+    view shows. Leaves the projection in board units, one per square.
+*/
+void drawBoard() {
+    renderBoard(&board, drawLabels);
 }
 
 /*
-    Draw the positions of the players' pieces
+    Draw a piece centred on (x, y), in board units
 */
-void drawPiece(char pieceType, int screenX, int screenY) {
+void drawPiece(char pieceType, float x, float y) {
 
-    int diam = WIDTH/numSquaresOnSide;
+    float radius = 1 / 2.1;
 
     switch (pieceType) {
         // player 1
@@ -520,7 +693,7 @@ void drawPiece(char pieceType, int screenX, int screenY) {
             break;
     }
     
-    drawReesesCup(screenX, screenY, diam/2.1);
+    renderDisc(x, y, radius);
 
     switch (pieceType) {
         case 'K':
@@ -532,42 +705,11 @@ void drawPiece(char pieceType, int screenX, int screenY) {
     }
 
     if (pieceType == 'K' || pieceType == 'L')
-        drawKing(screenX, screenY, diam/2.1);
+        renderCrown(x, y, radius);
 
     glColor3f(0.0f, 0.0f, 0.0f);
 }
 
-/*
-    Draws a piece at (x, y) with the specified radius.
-*/
-void drawReesesCup(int x, int y, int radius) {
-    bool in = false;
-    float numPts = 2*PI*10;
-    float theta;
-    float r1, r2;
-    r1 = radius;
-    r2 = 0.8 * radius;
-
-    //glBegin(GL_POINTS);
-    glBegin(GL_POLYGON);
-    //glBegin(GL_LINE_LOOP);
-    //glBegin(GL_TRIANGLES);
-    for (theta=0; theta<=2.*PI; theta+=2.*PI/numPts) {
-
-        // decide which radius to use
-        /*in = !in;
-        if (in) radius = r2;
-        else    radius = r1;
-        */
-        glVertex2f(x + sin(theta)*radius, y + cos(theta)*radius);
-    }
-
-    glVertex2f(x, y+r1);
-
-    glEnd();
-
-}
-
 
 //Draw Win
 
@@ -582,34 +724,16 @@ void drawWin(int p) {
 }
 
 
-
-/*
- Draws a king at (x, y) with the specified radius.
- */
-void drawKing(float x, float y, int scale) {
-
-    x = x - 1.0/3.0*scale;
-    y = y - 1.0/3.0*scale;
-
-    glBegin(GL_POLYGON);
-    glVertex2f(x,y);
-    glVertex2f(x - 1.0/3.0*scale, y + 2.0/3.0*scale);
-    glVertex2f(x, y + 0.5*scale);
-    glVertex2f(x + 1.0/3.0*scale, y+1.0*scale);
-    glVertex2f(x + 2.0/3.0*scale, y+0.5*scale);
-    glVertex2f(x + 1.0*scale, y + 2.0/3.0*scale);
-    glVertex2f(x + 2.0/3.0*scale, y);
-    glEnd();
-	
-}
-
 /*
     Figure out the coordinates of the square on the board that the mouse is
     inside.
 */
 void decideBoardCoords(int mouseX, int mouseY, int *x, int *y) {
-    *x = 1. * numSquaresOnSide * mouseX / WIDTH;
-    *y = numSquaresOnSide - 1. * numSquaresOnSide * mouseY / HEIGHT;
+    float bx, by;
+
+    renderScreenToBoard(mouseX, HEIGHT - mouseY, &bx, &by);
+    *x = (int)floorf(bx);
+    *y = (int)floorf(by);
 }
 
 
@@ -617,72 +741,377 @@ void decideBoardCoords(int mouseX, int mouseY, int *x, int *y) {
     Called when the mouse is moved while a button is down.
 */
 void motionFunc(int x, int y) {
+    if (panning) {
+        renderPan(x - panX, panY - y);
+        panX = x;
+        panY = y;
+        glutPostRedisplay();
+    }
+
+    if (dragging) {
+        // the piece leaves one spot and turns up in another
+        markDragged();
+        mouseX = x;
+        mouseY = HEIGHT - y;
+        markDragged();
+        glutPostRedisplay();
+    }
+
     mouseX = x;
     mouseY = HEIGHT - y;
-    glutPostRedisplay();
+}
+
+/* Marks where the dragged piece is drawn as needing a repaint. */
+static void markDragged() {
+    float x, y;
+
+    renderScreenToBoard(mouseX, mouseY, &x, &y);
+    renderMarkDirty(x, y, 0.5);
 }
 
 
 enum player determinePlayer(char piece) {
-    if (piece == 'X' || piece == 'K')
-        return PLAYER_ONE;
-    else if (piece == 'Y' || piece == 'L')
-        return PLAYER_TWO;
-    else
-        return NO_PLAYER;
+    return pieceOwner(pieceFromChar(piece));
+}
+
+static void* think(void *arg) {
+    searchBestMove(&aiBoard, me, &aiSearch, &aiResult);
+    atomic_store(&aiDone, true);
+    return NULL;
 }
 
 /*
-    Determines if the move is valid.  If a piece has been jumped, overwrite
-    that part of the board with a space.
-     
-    FIXME -- really really bad code
+    Starts the computer thinking about our move on a copy of the board, so
+    the window keeps repainting meanwhile. pollServer picks up the answer.
 */
-bool isValidMove(enum player p, bool isKing, int x1, int y1, int x2, int y2) {
-    int goal = 0;
-    if (p == PLAYER_ONE)
-        goal = 1;
-    else if (p == PLAYER_TWO)
-        goal = -1;
-
-    bool goodSingleJump = (board[x2][y2] == ' ' && abs(x2-x1) == 1 && 
-                          ((isKing && abs(y2-y1) == 1) || (!isKing && y2-y1 == goal)));
-
-    // between jump coordinates -- the space that is passed during the jump
-    int bx, by;
-    char jumped;
-
-    if (goodSingleJump)
-        return true;
-    else {
-        goal *= 2;
-        if (abs(x2-x1) == 2 && isKing && abs(y2-y1) == 2 || !isKing && y2-y1 == goal) {
-            bx = (x2+x1)/2;
-            by = (y2+y1)/2;
-            jumped = board[bx][by];
-            if ((p == PLAYER_ONE && (jumped == 'Y' || jumped == 'L')) ||
-                (p == PLAYER_TWO && (jumped == 'X' || jumped == 'K'))) {
-
-                printf("Piece at (%d, %d) was taken.\n", bx, by);
-				if (p == PLAYER_ONE) {
-					numChecksOne--;
-					printf("Player one has %d checkers. Player two has %d checkers.\n", numChecksOne, numChecksTwo);
-				} else{
-					numChecksTwo--;
-					printf("Player one has %d checkers. Player two has %d checkers.\n", numChecksOne, numChecksTwo);
-				}
-				
-				board[bx][by] = ' ';
-                board[bx][by] = ' ';
-                glutPostRedisplay();
-                return true;
+static void startThinking() {
+    // if it is already thinking, finishThinking starts it over when done
+    if (aiThinking)
+        return;
+
+    searchResultFree(&aiResult);
+    boardCopy(&aiBoard, &board);
+    aiKey = zobristHash(&board, me);
+    aiSearch = aiLimits;
+    aiSearch.control = NULL;
+    atomic_store(&aiDone, false);
+    aiThinking = pthread_create(&aiThread, NULL, think, NULL) == 0;
+    if (!aiThinking)
+        printf("ERROR starting computer player\n");
+}
 
-				
-            }
+/*
+    Starts the computer thinking, with no time limit, about its answer to
+    the reply it expects from the opponent, so the table is warm and, if the
+    guess is right, the answer is most of the way there when the reply comes.
+*/
+static void startPondering() {
+    Undo undo;
+
+    if (!aiPonder || aiThinking || !aiResult.hasPonder)
+        return;
+
+    moveFree(&aiReply);
+    if (!moveCopy(&aiReply, &aiResult.ponder))
+        return;
+    searchResultFree(&aiResult);
+    boardCopy(&aiBoard, &board);
+    boardApplyMove(&aiBoard, &aiReply, &undo);
+    aiKey = zobristHash(&aiBoard, me);
+    aiSearch = aiLimits;
+    aiSearch.timeMs = 0;
+    aiSearch.control = &aiControl;
+    searchControlInit(&aiControl);
+    atomic_store(&aiDone, false);
+    aiThinking = aiPondering =
+        pthread_create(&aiThread, NULL, think, NULL) == 0;
+}
+
+/* Drops the search on the opponent's time; it stops within a millisecond. */
+static void stopPondering() {
+    if (!aiPondering)
+        return;
+    searchStop(&aiControl);
+    pthread_join(aiThread, NULL);
+    aiThinking = aiPondering = false;
+}
+
+/*
+    The opponent has played m. If the computer guessed it, its search goes
+    on for at most its usual time and finishThinking plays the answer as
+    usual; otherwise the search is dropped and beginTurn starts a fresh one.
+*/
+static void ponderReply(const Move *m) {
+    if (!aiPondering)
+        return;
+    if (searchSameMove(m, &aiReply)) {
+        searchSetDeadline(&aiControl, aiLimits.timeMs);
+        aiPondering = false;
+    } else {
+        stopPondering();
+    }
+}
+
+/*
+    Lists the legal moves for player p and starts a fresh move. The list
+    grows as needed, so huge boards never lose moves to a full buffer.
+*/
+void beginTurn(enum player p) {
+    static bool listed = false;
+
+    if (!listed) {
+        moveListAlloc(&turnList);
+        listed = true;
+    }
+    generateMoves(&board, p, &turnList);
+
+    turn = p;
+    chainHops = 0;
+    chainFrom = chainSq = chainMove = -1;
+
+    if (turnList.count == 0) {
+        isGameOver = p == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+        renderMarkAllDirty();
+    } else if (aiPlayer && p == me && isGameOver == -1) {
+        startThinking();
+    }
+}
+
+/*
+    True if m, a legal move, could be the one being played this turn: it
+    starts with the hops played so far (from square `from` if none are) and
+    has more to come.
+*/
+static bool continuesChain(const Move *m, int from) {
+    return m->from == (chainHops > 0 ? chainFrom : from) &&
+           m->numHops > chainHops &&
+           (chainHops == 0 ||
+            moveSameHops(m, &turnList.moves[chainMove], chainHops));
+}
+
+/*
+    Returns the legal move that the hop (x1, y1) -> (x2, y2) would continue,
+    given the hops already played this turn, or NULL if there is none.
+*/
+static const Move* matchHop(int x1, int y1, int x2, int y2, Move *hop) {
+    int i, d;
+
+    if (!moveFromCoords(&board, hop, x1, y1, x2, y2))
+        return NULL;
+    if (chainHops > 0 && hop->from != chainSq)
+        return NULL;
+
+    d = moveDir(hop, 0);
+    for (i = 0; i < turnList.count; i++) {
+        const Move *m = &turnList.moves[i];
+        if (continuesChain(m, hop->from) && m->isJump == hop->isJump &&
+            moveDir(m, chainHops) == d)
+            return m;
+    }
+    return NULL;
+}
+
+/* Tells the renderer which squares m, just played, has changed. */
+static void noteMove(const Move *m) {
+    int i, sq = m->from;
+
+    renderSquareChanged(&board, sq);
+    for (i = 0; i < m->numHops; i++) {
+        if (m->isJump) {
+            sq += board.geo->offset[moveDir(m, i)];
+            renderSquareChanged(&board, sq);
         }
+        sq += board.geo->offset[moveDir(m, i)];
+        renderSquareChanged(&board, sq);
+    }
+}
+
+/*
+    Plays one hop of the side to move's turn if it is legal: a step, or one
+    jump of a capture chain. Jumped pieces come off the board right away.
+*/
+enum hopResult playHop(int x1, int y1, int x2, int y2) {
+    Move hop;
+    Undo undo;
+    const Move *m = matchHop(x1, y1, x2, y2, &hop);
+
+    if (m == NULL)
+        return HOP_ILLEGAL;
+
+    if (chainHops == 0)
+        chainFrom = hop.from;
+    chainMove = m - turnList.moves;
+    chainHops++;
+    chainSq = hop.to;
+
+    boardApplyMove(&board, &hop, &undo);
+    noteMove(&hop);
+    if (hop.isJump)
+        printf("Player one has %d checkers. Player two has %d checkers.\n",
+               boardCount(&board, PLAYER_ONE), boardCount(&board, PLAYER_TWO));
+
+    return m->numHops == chainHops ? HOP_DONE : HOP_CONTINUE;
+}
+
+/*
+    Plays a whole move the opponent sent, capture chain and all, if it is
+    one of their legal moves. Nothing is changed if it is not.
+*/
+static bool playRemoteMove(const Move *m) {
+    Move match;
+    Undo undo;
+
+    if (m->from < 0 || m->from >= board.geo->numSquares ||
+        !findMove(&board, opponent, m, &match))
+        return false;
+
+    boardApplyMove(&board, &match, &undo);
+    noteMove(&match);
+    if (match.isJump)
+        printf("Player one has %d checkers. Player two has %d checkers.\n",
+               boardCount(&board, PLAYER_ONE), boardCount(&board, PLAYER_TWO));
+    return true;
+}
+
+/*
+    Plays the computer's move once it has one. If the board changed while it
+    was thinking (the server sent a STATE_SYNC) the answer is thrown away and
+    it thinks again. Returns true if a move was played.
+*/
+static bool finishThinking() {
+    Undo undo;
+    char buf[MOVE_TEXT_LEN];
+
+    // a search on the opponent's time waits for their reply even if done
+    if (!aiThinking || aiPondering || !atomic_load(&aiDone))
+        return false;
+    pthread_join(aiThread, NULL);
+    aiThinking = false;
+
+    if (turn != me || isGameOver != -1)
+        return false;
+    if (zobristHash(&board, me) != aiKey) {
+        startThinking();
+        return false;
+    }
+
+    printf("%s  depth %d  score %d  %llu nodes in %.2fs\n",
+           moveToString(&board, &aiResult.best, buf, sizeof(buf)),
+           aiResult.depth, aiResult.score,
+           (unsigned long long)aiResult.nodes, aiResult.seconds);
+    boardApplyMove(&board, &aiResult.best, &undo);
+    noteMove(&aiResult.best);
+    linkSendMove(&server, &aiResult.best);
+    beginTurn(opponent);
+    if (turn == opponent && isGameOver == -1)
+        startPondering();
+    return true;
+}
+
+/*
+    Handles whatever the server has sent since the last call, without ever
+    waiting for it: the opponent's move, the end of the game, or the whole
+    board. Then plays the computer's move, if it has finished thinking. Runs
+    on a GLUT timer.
+*/
+void pollServer(int value) {
+    ServerEvent e;
+    bool changed = false;
+
+    while (linkPollEvent(&server, &e)) {
+        switch (e.type) {
+            case EVENT_MOVE:
+                ponderReply(&e.move);
+                if (turn == opponent && playRemoteMove(&e.move)) {
+                    beginTurn(me);
+                    changed = true;
+                } else {
+                    printf("ERROR opponent sent an illegal move\n");
+                }
+                moveFree(&e.move);
+                break;
+            case EVENT_ERROR:
+                // the server puts us right with a STATE_SYNC or GAME_OVER next
+                printf("ERROR server refused our move (code %d)\n", e.code);
+                break;
+            case EVENT_GAME_OVER:
+                stopPondering();
+                isGameOver = e.player;
+                renderMarkAllDirty();
+                changed = true;
+                break;
+            case EVENT_STATE_SYNC:
+                // whatever we were doing was based on the wrong board
+                stopPondering();
+                dragging = false;
+                dragType = ' ';
+                boardCopy(&board, e.board);
+                renderBoardChanged();
+                boardFree(e.board);
+                free(e.board);
+                numSquaresOnSide = board.n;
+                beginTurn(e.player);
+                changed = true;
+                break;
+            case EVENT_CLOSED:
+                printf("ERROR lost connection to server\n");
+                glutPostRedisplay();
+                return;
+        }
+    }
+
+    if (finishThinking())
+        changed = true;
+
+    if (changed)
+        glutPostRedisplay();
+    glutTimerFunc(POLL_MS, pollServer, 0);
+}
+
+/*
+    Lists the squares the dragged piece may be dropped on next, one per
+    direction at most. Returns how many there are.
+*/
+static int listHints(int squares[NUM_DIRS]) {
+    int i, j, sq, count = 0;
+    int from = dragYFrom*board.n + dragXFrom;
+
+    for (i = 0; i < turnList.count; i++) {
+        const Move *m = &turnList.moves[i];
+        if (!continuesChain(m, from))
+            continue;
+
+        sq = from + board.geo->offset[moveDir(m, chainHops)] * (m->isJump ? 2 : 1);
+        for (j = 0; j < count && squares[j] != sq; j++)
+            ;
+        if (j == count)
+            squares[count++] = sq;
     }
-    return false;
+    return count;
+}
+
+/*
+    Marks the squares the dragged piece may be dropped on.
+*/
+void drawHints() {
+    int squares[NUM_DIRS];
+    int i, count = listHints(squares);
+
+    glColor3f(0.3f, 0.6f, 0.3f);
+    for (i = 0; i < count; i++)
+        renderDisc(squareX(&board, squares[i]) + 0.5,
+                   squareY(&board, squares[i]) + 0.5, 1 / 6.);
+    glColor3f(0.0f, 0.0f, 0.0f);
+}
+
+/* Marks the hint markers as needing a repaint, as they come or go. */
+static void markHints() {
+    int squares[NUM_DIRS];
+    int i, count = listHints(squares);
 
+    for (i = 0; i < count; i++)
+        renderMarkDirty(squareX(&board, squares[i]) + 0.5,
+                        squareY(&board, squares[i]) + 0.5, 0.5);
 }
 
 /*
@@ -691,8 +1120,7 @@ bool isValidMove(enum player p, bool isKing, int x1, int y1, int x2, int y2) {
 void mouseFunc(int button, int state, int x, int y) {
 
     int dragXTo, dragYTo;
-    enum player playerNum;
-    bool isKing;
+    enum hopResult result;
 
     mouseX = x;
     mouseY = HEIGHT - y;
@@ -705,17 +1133,21 @@ void mouseFunc(int button, int state, int x, int y) {
 
                 dragging = true;
                 decideBoardCoords(x, y, &dragXFrom, &dragYFrom);
-                dragType = board[dragXFrom][dragYFrom];
+                dragType = boardGet(&board, dragXFrom, dragYFrom);
 		
-                // if this square is off
-                if (dragType == ' ' || (((me == PLAYER_ONE) && (dragType == 'X' || dragType == 'K' )) 
-                  || ((me == PLAYER_TWO) && (dragType == 'Y' || dragType == 'L' )))){
+                // if this square is off or holds the opponent's piece
+                if (dragType == ' ' || determinePlayer(dragType) != me ||
+                    turn != me || isGameOver != -1 || aiPlayer) {
                     dragType = ' ';	
                     dragging = false;
                     return;
                 }
 
-                board[dragXFrom][dragYFrom] = ' ';
+                boardSet(&board, dragXFrom, dragYFrom, ' ');
+                renderSquareChanged(&board, dragYFrom*board.n + dragXFrom);
+                markHints();
+                markDragged();
+                glutPostRedisplay();
 
                 printf("dragging piece @ (%d, %d)\n", dragXFrom, dragYFrom);
             }
@@ -723,97 +1155,90 @@ void mouseFunc(int button, int state, int x, int y) {
 
             if (dragging) { // drop the piece that is being dragged
                 
+                markHints();
+                markDragged();
+                glutPostRedisplay();
+
                 dragging = false;
                 decideBoardCoords(x, y, &dragXTo, &dragYTo);
 
-                playerNum = determinePlayer(dragType);
-                isKing = dragType == 'K' || dragType == 'L';
-                // determine if this is a valid location to drop the piece
-                if (isValidMove(playerNum, isKing, dragXFrom, dragYFrom, dragXTo, dragYTo)) {
+                // put the piece back so the hop can be played from its square
+                boardSet(&board, dragXFrom, dragYFrom, dragType);
+                renderSquareChanged(&board, dragYFrom*board.n + dragXFrom);
 
-                    // promote to king?
-                    if (dragType == 'X' && dragYTo == numSquaresOnSide-1)
-                        dragType = 'K';
-                    else if (dragType == 'Y' && dragYTo == 0) {
-                        dragType = 'L';
-                    }
-
-                    board[dragXTo][dragYTo] = dragType;
-
-		    glutPostRedisplay();
-
-                    // TODO Send move to server
-                    // TODO Listen for other player's move
-                    Message* message = malloc(sizeof(Message));
-                             
-                    message->x1 = dragXFrom;
-                    message->y1 = dragYFrom;
-                    message->x2 = dragXTo;
-                    message->y2 = dragYTo;
-                    sendMoveToServer(message);
-                    /*bool myTurn = false;
-                    do
-                    {
-                        */
-
-                    if (numChecksOne != 0 && numChecksTwo != 0) {
-                        getMessageFromServer(message); 
-                        fflush(stdout);
-                        isValidMove(me, true, message->x1, message->y1, message->x2, message->y2);      		
-                        char dragType = board[message->x1][message->y1];
-
-                        // promote to king?
-                        if (dragType == 'X' && message->y2 == numSquaresOnSide-1)
-                            dragType = 'K';
-                        else if (dragType == 'Y' && message->y2 == 0) {
-                            dragType = 'L';
-                        }
-
-
-                        board[message->x2][message->y2] = dragType;
-                        board[message->x1][message->y1] = ' ';
-                            //myTurn = true;//message->isMyTurn;
+                // determine if this is a valid location to drop the piece
+                result = playHop(dragXFrom, dragYFrom, dragXTo, dragYTo);
+                if (result != HOP_ILLEGAL) {
+
+                    // a capture chain keeps the turn until it is finished,
+                    // then goes to the server whole in one frame
+                    if (result == HOP_DONE) {
+                        linkSendMove(&server, &turnList.moves[chainMove]);
+                        beginTurn(opponent);
                     }
-
-                    //}while(!myTurn);
                 } else {
                     printf("INVALID!\n");
-                    board[dragXFrom][dragYFrom] = dragType;
                 }
             }
         }
 
-    } else {
-        
-    }
+    } else if (button == GLUT_RIGHT_BUTTON) {
+        // drag the board around
+        panning = state == GLUT_DOWN;
+        panX = x;
+        panY = y;
 
-    glutPostRedisplay();
+    } else if ((button == 3 || button == 4) && state == GLUT_DOWN) {
+        // the wheel zooms in and out about the pointer
+        renderZoom(button == 3 ? ZOOM_STEP : 1 / ZOOM_STEP, x, HEIGHT - y);
+        glutPostRedisplay();
+    }
 
 }
 
 void printBoard() {
-    int x, y;
-    for (y=0; y<numSquaresOnSide; y++) {
-        for (x=0; x<numSquaresOnSide; x++) {
-            printf("%c ", board[x][y]);
-        }
-        printf("\n");
-    }
-
-    int i;
-    for (i=0; i<numSquaresOnSide*2; i++) 
-        printf("-");
-    printf("\n");
+    boardPrint(&board, stdout);
 }
 void keyPressed(unsigned char key, int x, int y) {
     switch (key) {
         case 'l':
         case 'L':
             drawLabels = !drawLabels;
+            renderMarkAllDirty();
             break;
         case 'p':
         case 'P':
             printBoard();
+            return;
+        case '+':
+        case '=':
+            renderZoom(ZOOM_STEP, WIDTH/2, HEIGHT/2);
+            break;
+        case '-':
+            renderZoom(1 / ZOOM_STEP, WIDTH/2, HEIGHT/2);
+            break;
+        case '0':
+            renderResetView();
+            break;
+    }
+    glutPostRedisplay();
+}
+
+/* Arrow keys pan the view. */
+void specialKeyPressed(int key, int x, int y) {
+    switch (key) {
+        case GLUT_KEY_LEFT:
+            renderPan(PAN_STEP, 0);
+            break;
+        case GLUT_KEY_RIGHT:
+            renderPan(-PAN_STEP, 0);
+            break;
+        case GLUT_KEY_UP:
+            renderPan(0, -PAN_STEP);
+            break;
+        case GLUT_KEY_DOWN:
+            renderPan(0, PAN_STEP);
+            break;
     }
     glutPostRedisplay();
 }
@@ -839,137 +1264,18 @@ void drawString(char* str, int x, int y) {
 
 
 
-/*
-    Adds a player by listening for a connection from the client.
-    
-    Returns sockfd for the client
-*/
-int serverAddPlayer(char* playerTitle, int serverSocket, struct sockaddr_in clientAddr) {
-    int clientSockFd;
-    int clilen;
-    int n;
-    
-
-    // listen for incoming connection from client 
-    int backlog = 1;
-    listen(serverSocket,backlog);
-    clilen = sizeof(clientAddr);
-    clientSockFd = accept(serverSocket, 
-             (struct sockaddr *) &clientAddr, 
-             &clilen);
-    if (clientSockFd < 0) 
-      printf("ERROR on accept\n");
-
-
-    // send the window title to the client
-    n = write(clientSockFd,playerTitle,255);
-    if (n < 0) 
-        printf("ERROR sending player title string\n");
-    else
-        printf("Sent title string '%s'\n", playerTitle);
-
-
-    n = write(clientSockFd,&numSquaresOnSide, sizeof(int));
-    if (n < 0)
-        printf("ERROR sending board size to client");
-    else
-        printf("Sent board size to %s\n", playerTitle);
-
-    return clientSockFd;
-
-}
-
 void initSockets() {
-    struct hostent *server;
-    struct sockaddr_in serv_addr, cli_addr;
-    socklen_t clilen;
-
-    int sockfd, n;
-    char buffer[256];
-
-    // set up sockets
-    if (mode == CLIENT) {
-
-        serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-        if (serverSocket < 0) 
-            printf("ERROR opening socket\n");
-
-        server = gethostbyname(serverAddr);
-        
-        if (server == NULL) {
-            fprintf(stderr,"ERROR, no such host\n");
-            exit(0);
-        }
-
-        bzero((char *) &serv_addr, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        bcopy((char *)server->h_addr, 
-             (char *)&serv_addr.sin_addr.s_addr,
-             server->h_length);
-        serv_addr.sin_port = htons(port);
-        if (connect(serverSocket, (struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) {
-            printf("ERROR connecting\n");
-            exit(0);
-        }
-
-
-        // read in title string
-        n = read(serverSocket,&titleStr[0],255);
-        if (n < 0) 
-            printf("ERROR receiving title string\n");
-        else
-            printf("Received title string\n");
-
-        // get board size
-        n = read(serverSocket,&numSquaresOnSide, sizeof(int));
-        if (n < 0)
-            printf("ERROR receiving board size\n");
-        else
-            printf("Received size of board: %d\n", numSquaresOnSide);
-		
-		if(numSquaresOnSide%2 ==0){
-			numChecksOne = ((numSquaresOnSide/2) -1) * (numSquaresOnSide/2);
-			numChecksTwo = ((numSquaresOnSide/2) -1) * (numSquaresOnSide/2);
-		} else{
-			numChecksOne = ((numSquaresOnSide/2) * (numSquaresOnSide/2)) + ((numSquaresOnSide/2)/2) ;
-			numChecksTwo = ((numSquaresOnSide/2) * (numSquaresOnSide/2)) + ((numSquaresOnSide/2)/2) ;
-		}
-		
-
-	if(!strcmp(titleStr,"Player One"))
-	{
-		me = PLAYER_ONE;
-		opponent = PLAYER_TWO;
-	}else 
-	{
-		me = PLAYER_TWO;
-	        opponent = PLAYER_ONE;
-	}
-        printf("RECEIVED: '%s'\n", titleStr);
-
-
-    } else if (mode == SERVER) {
-           
-        // create server socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0) 
-        printf("ERROR opening socket\n");
-
-        bzero((char *) &serv_addr, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = INADDR_ANY;
-        serv_addr.sin_port = htons(port);
-        if (bind(sockfd, (struct sockaddr *) &serv_addr,
-              sizeof(serv_addr)) < 0) 
-              printf("ERROR on binding\n");
-
-
-         // --------- listen for connection from client 1
-        playerOneSock = serverAddPlayer("Player One", sockfd, cli_addr);
-        playerTwoSock = serverAddPlayer("Player Two", sockfd, cli_addr);
-        me = NO_PLAYER;
-
-    }
+    if (!linkConnect(&server, serverAddr, port, requestedN, rating,
+                     useShm))
+        exit(0);
+
+    numSquaresOnSide = server.welcome.n;
+    printf("Received size of board: %d\n", numSquaresOnSide);
+
+    me = server.welcome.role;
+    opponent = me == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    strcpy(titleStr, me == PLAYER_ONE ? "Player One" : "Player Two");
+    printf("RECEIVED: '%s'\n", titleStr);
+    printf("Spectators can watch with --watch %llu\n",
+           (unsigned long long)server.welcome.game);
 }
-
-
@@ -0,0 +1,15 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+
+/*
+    The monotonic clock, for timing things; it never jumps when the wall
+    clock is set.
+*/
+
+double now();
+uint64_t nowMicros();
+
+#endif
@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "gamelog.h"
+#include "clock.h"
+#include "histogram.h"
+#include "varint.h"
+
+// a record's length is written as a varint padded out to this many bytes,
+// so that it can be filled in once the rest of the record is
+#define LEN_BYTES 5
+
+// a batch may grow past LOG_BATCH_BYTES while the writer is behind, but
+// never past this; it always has room for the largest keyframe
+#define BATCH_LIMIT (MAX_FRAME_LEN + LOG_BATCH_BYTES)
+
+// the most a checkpoint may hold
+#define CHECKPOINT_LIMIT ((size_t)1 << 32)
+
+// full batches a worker may have waiting for the writer
+#define MAX_BATCHES 64
+
+// checkpoints likewise; a worker skips one rather than wait
+#define MAX_CHECKPOINTS 2
+
+// batches the writer gathers into one write
+#define WRITE_BATCHES 16
+
+
+static bool appendVarint(NetBuffer *buf, uint64_t v) {
+    unsigned char bytes[VARINT_MAX_BYTES];
+
+    return bufferAppend(buf, bytes, varintEncode(bytes, v));
+}
+
+/*
+    Starts a record of type for game at the end of buf, returning where it
+    starts for endRecord.
+*/
+static size_t beginRecord(NetBuffer *buf, int type, uint64_t game) {
+    static const unsigned char blank[LEN_BYTES];
+    size_t start = buf->len;
+    unsigned char t = type;
+
+    if (bufferAppend(buf, blank, LEN_BYTES) && bufferAppend(buf, &t, 1))
+        appendVarint(buf, game);
+    return start;
+}
+
+/*
+    Fills in the length of the record begun at start, or if ok is false
+    (something didn't fit) takes the record back out. Returns whether the
+    record is there.
+*/
+static bool endRecord(NetBuffer *buf, size_t start, bool ok) {
+    unsigned char *len = (unsigned char*)bufferHead(buf) + start;
+    uint64_t n = buf->len - start - LEN_BYTES;
+    int i;
+
+    if (!ok || buf->len <= start + LEN_BYTES + 1) {
+        buf->len = start;
+        return false;
+    }
+    for (i = 0; i < LEN_BYTES; i++, n >>= 7)
+        len[i] = (n & 0x7f) | (i < LEN_BYTES - 1 ? 0x80 : 0);
+    return true;
+}
+
+// beginRecord for s's batch
+static size_t beginLogged(LogShard *s, int type, uint64_t game) {
+    if (s->batch.len == 0)
+        s->batchStarted = nowMicros();
+    return beginRecord(&s->batch, type, game);
+}
+
+// endRecord for s's batch, keeping track of where in the file it will be
+static void endLogged(LogShard *s, size_t start, bool ok) {
+    if (endRecord(&s->batch, start, ok))
+        s->offset += s->batch.len - start;
+    else
+        counterAdd(&s->dropped, 1);
+}
+
+static bool appendTokens(NetBuffer *buf, const uint64_t *tokens) {
+    return appendVarint(buf, tokens[0]) && appendVarint(buf, tokens[1]);
+}
+
+
+void gameLogSession(LogShard *s, uint64_t firstGame) {
+    endLogged(s, beginLogged(s, LOG_SESSION, firstGame), true);
+}
+
+void gameLogStart(LogShard *s, uint64_t game, int n,
+                  const uint64_t *tokens) {
+    size_t start = beginLogged(s, LOG_START, game);
+
+    endLogged(s, start, appendVarint(&s->batch, n) &&
+                        appendTokens(&s->batch, tokens));
+}
+
+void gameLogMove(LogShard *s, uint64_t game, int ply, const Move *m) {
+    size_t start = beginLogged(s, LOG_MOVE, game);
+
+    endLogged(s, start, appendVarint(&s->batch, ply) &&
+                        writeMove(&s->batch, m));
+}
+
+void gameLogKeyframe(LogShard *s, uint64_t game, int ply, const Board *b,
+                     enum player toMove) {
+    size_t start = beginLogged(s, LOG_KEYFRAME, game);
+
+    endLogged(s, start, appendVarint(&s->batch, ply) &&
+                        writeStateSync(&s->batch, b, toMove));
+}
+
+void gameLogEnd(LogShard *s, uint64_t game, int ply, enum player winner) {
+    size_t start = beginLogged(s, LOG_END, game);
+    unsigned char w = winner;
+
+    endLogged(s, start, appendVarint(&s->batch, ply) &&
+                        bufferAppend(&s->batch, &w, 1));
+}
+
+// hands s's batch to the writer and takes an empty one; false if it can't
+static bool handOver(LogShard *s) {
+    if (!spscPush(&s->full, &s->batch))
+        return false;
+    if (!spscPop(&s->empty, &s->batch))
+        bufferInit(&s->batch, LOG_BATCH_BYTES, BATCH_LIMIT);
+    return true;
+}
+
+/*
+    Hands s's batch to the writer once it is big enough or old enough,
+    taking an empty one back in its place. Called by the worker after each
+    pass through its loop. If the writer has every batch it may hold, the
+    records stay where they are for now.
+*/
+void gameLogFlush(LogShard *s) {
+    if (s->batch.len == 0)
+        return;
+    if (s->batch.len < LOG_BATCH_BYTES &&
+        nowMicros() - s->batchStarted < LOG_FLUSH_MS * 1000)
+        return;
+    handOver(s);
+}
+
+/*
+    How long, in milliseconds, the worker may sleep before its batch is due
+    to be flushed; -1 if there is nothing waiting.
+*/
+int gameLogTimeout(const LogShard *s) {
+    int64_t left;
+
+    if (s->batch.len == 0)
+        return -1;
+    left = LOG_FLUSH_MS - (int64_t)(nowMicros() - s->batchStarted) / 1000;
+    return left > 0 ? left : 1;
+}
+
+
+/*
+    Starts a checkpoint in cp, as of the end of what s has logged so far.
+    The worker then adds its games with checkpointGame, as many at a time
+    as suits it, and hands cp over with gameLogCheckpoint.
+*/
+void checkpointBegin(NetBuffer *cp, const LogShard *s, uint64_t nextGame) {
+    size_t start;
+
+    bufferInit(cp, LOG_BATCH_BYTES, CHECKPOINT_LIMIT);
+    start = beginRecord(cp, LOG_CHECKPOINT, nextGame);
+    endRecord(cp, start, appendVarint(cp, s->offset));
+}
+
+/* Adds a game in play to cp. Returns false if it doesn't fit. */
+bool checkpointGame(NetBuffer *cp, uint64_t game, int ply,
+                    const uint64_t *tokens, const Board *b,
+                    enum player toMove) {
+    size_t start = beginRecord(cp, LOG_GAME, game);
+
+    return endRecord(cp, start, appendVarint(cp, ply) &&
+                                appendTokens(cp, tokens) &&
+                                writeStateSync(cp, b, toMove));
+}
+
+/*
+    Gives the writer a finished checkpoint, and the log records before it
+    along with it so that they reach the disk no later. Returns false, and
+    frees cp, if the writer still has the checkpoints or batches before it
+    to write: a checkpoint must never be on disk ahead of its records.
+*/
+bool gameLogCheckpoint(LogShard *s, NetBuffer *cp) {
+    if ((s->batch.len > 0 && !handOver(s)) ||
+        !spscPush(&s->checkpoints, cp)) {
+        bufferFree(cp);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+    Writes batches to fd in as few calls as it takes, adding up what went
+    out in *written. Returns false on an error.
+*/
+static bool writeBatches(int fd, NetBuffer *batches, int count,
+                         uint64_t *written) {
+    struct iovec iov[WRITE_BATCHES];
+    int i, first = 0;
+    ssize_t n;
+
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = bufferHead(&batches[i]);
+        iov[i].iov_len = batches[i].len;
+    }
+
+    while (first < count) {
+        n = writev(fd, iov + first, count - first);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        *written += n;
+
+        // step past whatever went out, partway into a batch if need be
+        while (first < count && (size_t)n >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count) {
+            iov[first].iov_base = (char*)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/*
+    Replaces the checkpoint at path with cp: written beside it, synced, then
+    renamed over it, so a crash leaves either the old one or the new.
+*/
+static bool writeCheckpoint(const char *path, NetBuffer *cp) {
+    char temp[4096];
+    uint64_t written = 0;
+    bool ok;
+    int fd;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    ok = writeBatches(fd, cp, 1, &written) && fsync(fd) == 0;
+    close(fd);
+    return ok && rename(temp, path) == 0;
+}
+
+/*
+    Every LOG_FLUSH_MS, writes out whatever batches each worker has handed
+    over and syncs each file written to, then hands the batches back, and
+    writes any checkpoint that came after them. A log that can't be written
+    to is reported once and its records discarded.
+*/
+static void* writerLoop(void *arg) {
+    GameLog *log = arg;
+    struct timespec pause = {0, LOG_FLUSH_MS * 1000000L};
+    NetBuffer batches[WRITE_BATCHES], cp;
+    LogShard *s;
+    uint64_t written;
+    bool *failed = calloc(log->numShards, sizeof(bool));
+    int i, j, count;
+
+    for (;;) {
+        nanosleep(&pause, NULL);
+
+        for (i = 0; i < log->numShards; i++) {
+            s = &log->shards[i];
+            written = 0;
+
+            do {
+                for (count = 0; count < WRITE_BATCHES; count++)
+                    if (!spscPop(&s->full, &batches[count]))
+                        break;
+                if (count > 0 && !failed[i] &&
+                    !writeBatches(s->fd, batches, count, &written)) {
+                    printf("ERROR writing game log %d: %s\n", i,
+                           strerror(errno));
+                    failed[i] = true;
+                }
+                for (j = 0; j < count; j++) {
+                    bufferConsume(&batches[j], batches[j].len);
+                    if (!spscPush(&s->empty, &batches[j]))
+                        bufferFree(&batches[j]);
+                }
+            } while (count == WRITE_BATCHES);
+
+            if (written > 0) {
+                fsync(s->fd);
+                counterAdd(&s->written, written);
+                counterAdd(&s->syncs, 1);
+            }
+
+            while (spscPop(&s->checkpoints, &cp)) {
+                if (!writeCheckpoint(s->checkpointPath, &cp))
+                    printf("ERROR writing %s: %s\n", s->checkpointPath,
+                           strerror(errno));
+                bufferFree(&cp);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* dir/name-shard.suffix, for the caller to free. */
+char* gameLogPath(const char *dir, const char *name, int shard,
+                  const char *suffix) {
+    size_t len = strlen(dir) + strlen(name) + strlen(suffix) + 16;
+    char *path = malloc(len);
+
+    snprintf(path, len, "%s/%s-%d%s", dir, name, shard, suffix);
+    return path;
+}
+
+/*
+    Opens (creating dir if need be) shard-0.log to shard-<numShards-1>.log in
+    dir for appending, and starts the writer thread. Each worker should
+    begin its log with gameLogSession. Returns NULL if any of that fails.
+*/
+GameLog* gameLogOpen(const char *dir, int numShards) {
+    GameLog *log;
+    LogShard *s;
+    struct stat st;
+    char *path;
+    int i;
+
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        printf("ERROR creating %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+
+    log = calloc(1, sizeof(GameLog));
+    log->numShards = numShards;
+    log->shards = calloc(numShards, sizeof(LogShard));
+
+    for (i = 0; i < numShards; i++) {
+        s = &log->shards[i];
+        path = gameLogPath(dir, "shard", i, ".log");
+        s->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (s->fd < 0 || fstat(s->fd, &st) < 0) {
+            printf("ERROR opening %s: %s\n", path, strerror(errno));
+            return NULL;
+        }
+        free(path);
+        s->offset = st.st_size;
+        s->checkpointPath = gameLogPath(dir, "checkpoint", i, "");
+
+        if (!spscInit(&s->full, sizeof(NetBuffer), MAX_BATCHES) ||
+            !spscInit(&s->empty, sizeof(NetBuffer), 2 * MAX_BATCHES) ||
+            !spscInit(&s->checkpoints, sizeof(NetBuffer), MAX_CHECKPOINTS))
+            return NULL;
+        bufferInit(&s->batch, LOG_BATCH_BYTES, BATCH_LIMIT);
+    }
+
+    if (pthread_create(&log->writer, NULL, writerLoop, log) != 0)
+        return NULL;
+    return log;
+}
+
+
+// input cursor over a record; ok goes false on any overrun
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    bool ok;
+} Cursor;
+
+static uint64_t getVarint(Cursor *c) {
+    return varintDecode(c->data, c->len, &c->pos, &c->ok);
+}
+
+// a ply, which must be one a game can have reached
+static int getPly(Cursor *c) {
+    uint64_t ply = getVarint(c);
+
+    if (ply > LOG_MAX_PLY) {
+        c->ok = false;
+        return 0;
+    }
+    return ply;
+}
+
+/*
+    The protocol frame that makes up the rest of the record c is reading,
+    which must be of type.
+*/
+static bool getFrame(Cursor *c, int type, Frame *f) {
+    NetBuffer view;
+
+    view.data = (char*)c->data + c->pos;
+    view.start = 0;
+    view.len = view.cap = view.limit = c->len - c->pos;
+    if (!c->ok || peekFrame(&view, f) != 1 || f->type != type)
+        return false;
+    c->pos += f->size;
+    return true;
+}
+
+/*
+    Reads the record at the front of the len bytes at p. Returns 1 and
+    fills r if it is whole, 0 if it was cut short (the end of a log whose
+    writer stopped partway), or -1 if it is corrupt. Record types this
+    doesn't know are returned as they are, with nothing but their size.
+*/
+int logNextRecord(const unsigned char *p, size_t len, LogRecord *r) {
+    Cursor c = { p, len, 0, true };
+    uint64_t size, winner;
+
+    size = getVarint(&c);
+    if (!c.ok)
+        return len >= 10 ? -1 : 0;
+    if (size == 0)
+        return -1;
+    if (size > len - c.pos)
+        return 0;
+    r->size = c.pos + size;
+
+    // from here on, only the record itself
+    c.len = r->size;
+    r->type = c.data[c.pos++];
+    r->game = getVarint(&c);
+
+    switch (r->type) {
+    case LOG_SESSION:
+        break;
+    case LOG_START:
+        r->n = getVarint(&c);
+        r->tokens[0] = getVarint(&c);
+        r->tokens[1] = getVarint(&c);
+        c.ok = c.ok && r->n >= 2 && r->n <= 65535;
+        break;
+    case LOG_MOVE:
+        r->ply = getPly(&c);
+        c.ok = getFrame(&c, FRAME_MOVE, &r->frame);
+        break;
+    case LOG_KEYFRAME:
+        r->ply = getPly(&c);
+        c.ok = getFrame(&c, FRAME_STATE_SYNC, &r->frame);
+        break;
+    case LOG_END:
+        r->ply = getPly(&c);
+        winner = c.pos < c.len ? c.data[c.pos++] : NO_PLAYER + 1;
+        c.ok = c.ok && winner <= NO_PLAYER;
+        r->winner = winner;
+        break;
+    case LOG_CHECKPOINT:
+        r->offset = getVarint(&c);
+        break;
+    case LOG_GAME:
+        r->ply = getPly(&c);
+        r->tokens[0] = getVarint(&c);
+        r->tokens[1] = getVarint(&c);
+        c.ok = getFrame(&c, FRAME_STATE_SYNC, &r->frame);
+        break;
+    default:
+        return 1;
+    }
+    return c.ok && c.pos == c.len ? 1 : -1;
+}
+
+/*
+    Maps the file at path read-only, setting *size. Returns NULL if it
+    can't be, with errno set, or with errno 0 if the file is empty.
+*/
+const unsigned char* logMap(const char *path, size_t *size) {
+    struct stat st;
+    void *data;
+    int fd;
+
+    *size = 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        errno = 0;
+        return NULL;
+    }
+    *size = st.st_size;
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return data != MAP_FAILED ? data : NULL;
+}
+
+void logUnmap(const unsigned char *data, size_t size) {
+    munmap((void*)data, size);
+}
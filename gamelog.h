@@ -0,0 +1,141 @@
+#ifndef GAMELOG_H
+#define GAMELOG_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "netbuf.h"
+#include "protocol.h"
+#include "spsc.h"
+
+// a keyframe, the whole board, is logged every this many plies of a game
+#define LOG_KEYFRAME_PLIES 32
+
+// plies are counted in an int, so a record claiming one past this is corrupt
+#define LOG_MAX_PLY (INT_MAX - 1)
+
+// a worker hands its records to the writer once it has this many bytes of
+// them, or once they are this many milliseconds old
+#define LOG_BATCH_BYTES (64 << 10)
+#define LOG_FLUSH_MS 20
+
+
+/*
+    Game record log.
+
+    Each server worker appends to a log file of its own, its shard. A record
+    is framed like a protocol frame (a varint byte count, then a one-byte
+    record type, then the payload). Every payload starts with a game id,
+    and most embed the protocol's own encoding of a move or a position:
+
+        SESSION     the first id the server will give a new game; it has
+                    (re)started, and any game with a later id is a new one
+        START       game id, board size, both players' session tokens
+        MOVE        game id, ply, then a whole MOVE frame
+        KEYFRAME    game id, ply, then a whole STATE_SYNC frame
+        END         game id, ply, winner (NO_PLAYER if it was abandoned)
+
+    Ids are unique among the games of one session in one shard, and across
+    sessions too when the server resumed from a checkpoint. A game is in
+    its start position at ply 0 and has a keyframe at every multiple of
+    LOG_KEYFRAME_PLIES after that, so any ply can be reached from the
+    nearest keyframe at or before it plus fewer than LOG_KEYFRAME_PLIES
+    moves.
+
+    Each shard also has a checkpoint file, rewritten whole every so often,
+    holding the games that were in play when it was taken:
+
+        CHECKPOINT  the next game id, then how long the log was when the
+                    checkpoint was begun
+        GAME        game id, ply, both tokens, then a whole STATE_SYNC frame
+
+    The games in a checkpoint are as of some moment after it was begun, so
+    what the log says after that point brings them up to date, and moves
+    the checkpoint already has are recognized by their ply.
+*/
+enum logRecordType {
+    LOG_SESSION = 1,
+    LOG_START,
+    LOG_MOVE,
+    LOG_KEYFRAME,
+    LOG_END,
+    LOG_CHECKPOINT,
+    LOG_GAME
+};
+
+// one record, pointing into the bytes it was read from
+typedef struct {
+    int type;
+    uint64_t game;
+    int n;              // START
+    uint64_t tokens[2]; // START and GAME
+    int ply;            // MOVE, KEYFRAME, END and GAME
+    enum player winner; // END
+    uint64_t offset;    // CHECKPOINT
+    Frame frame;        // MOVE, KEYFRAME and GAME
+
+    // bytes the whole record took up
+    size_t size;
+} LogRecord;
+
+/*
+    One worker's log. The worker fills batch and trades full batches for
+    empty ones with the writer thread through the two queues, so it never
+    waits on the disk; if the writer falls so far behind that no empty
+    batch is left, records that don't fit are dropped and counted.
+    Finished checkpoints go to the writer the same way.
+*/
+typedef struct {
+    int fd;
+    NetBuffer batch;
+    uint64_t batchStarted;  // when the first record went into batch, in us
+
+    // where in the file the next record will be
+    uint64_t offset;
+
+    SpscQueue full;         // worker to writer
+    SpscQueue empty;        // and back
+    SpscQueue checkpoints;  // worker to writer
+    char *checkpointPath;
+
+    _Atomic uint64_t dropped;   // written by the worker
+    _Atomic uint64_t written;   // bytes, written by the writer
+    _Atomic uint64_t syncs;     // likewise
+} LogShard;
+
+typedef struct {
+    LogShard *shards;
+    int numShards;
+    pthread_t writer;
+} GameLog;
+
+
+GameLog* gameLogOpen(const char *dir, int numShards);
+char* gameLogPath(const char *dir, const char *name, int shard,
+                  const char *suffix);
+
+void gameLogSession(LogShard *s, uint64_t firstGame);
+void gameLogStart(LogShard *s, uint64_t game, int n, const uint64_t *tokens);
+void gameLogMove(LogShard *s, uint64_t game, int ply, const Move *m);
+void gameLogKeyframe(LogShard *s, uint64_t game, int ply, const Board *b,
+                     enum player toMove);
+void gameLogEnd(LogShard *s, uint64_t game, int ply, enum player winner);
+void gameLogFlush(LogShard *s);
+int gameLogTimeout(const LogShard *s);
+
+void checkpointBegin(NetBuffer *cp, const LogShard *s, uint64_t nextGame);
+bool checkpointGame(NetBuffer *cp, uint64_t game, int ply,
+                    const uint64_t *tokens, const Board *b,
+                    enum player toMove);
+bool gameLogCheckpoint(LogShard *s, NetBuffer *cp);
+
+int logNextRecord(const unsigned char *p, size_t len, LogRecord *r);
+const unsigned char* logMap(const char *path, size_t *size);
+void logUnmap(const unsigned char *data, size_t size);
+
+#endif
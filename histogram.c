@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "histogram.h"
+
+#define SUB_COUNT (1 << HIST_SUB_BITS)
+
+
+static inline int bucketOf(uint64_t value) {
+    int top;
+
+    if (value < SUB_COUNT)
+        return value;
+    top = 63 - __builtin_clzll(value);
+    return ((top - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           ((value >> (top - HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+// the largest value that falls in bucket b
+static uint64_t bucketTop(int b) {
+    int range = b >> HIST_SUB_BITS;
+    uint64_t sub = b & (SUB_COUNT - 1);
+
+    if (range == 0)
+        return sub;
+    return ((SUB_COUNT + sub + 1) << (range - 1)) - 1;
+}
+
+
+void histInit(Histogram *h) {
+    memset(h, 0, sizeof(Histogram));
+}
+
+void histRecord(Histogram *h, uint64_t value) {
+    counterAdd(&h->counts[bucketOf(value)], 1);
+    counterAdd(&h->total, 1);
+    counterAdd(&h->sum, value);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+/*
+    Adds src's counts into dst. dst must be the caller's own, with nothing
+    else recording into it.
+*/
+void histMerge(Histogram *dst, const Histogram *src) {
+    uint64_t count;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        count = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        if (count != 0)
+            counterAdd(&dst->counts[i], count);
+    }
+    counterAdd(&dst->total,
+               atomic_load_explicit(&src->total, memory_order_relaxed));
+    counterAdd(&dst->sum,
+               atomic_load_explicit(&src->sum, memory_order_relaxed));
+    if (histMax(src) > histMax(dst))
+        atomic_store_explicit(&dst->max, histMax(src), memory_order_relaxed);
+}
+
+/*
+    The value percent of the recorded values are at or below, to the width
+    of its bucket; 0 if nothing has been recorded.
+*/
+uint64_t histPercentile(const Histogram *h, double percent) {
+    uint64_t total = histCount(h), seen = 0, top;
+    double rank = total * percent / 100;
+    int i;
+
+    if (total == 0)
+        return 0;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen > 0 && seen >= rank) {
+            top = bucketTop(i);
+            return top < histMax(h) ? top : histMax(h);
+        }
+    }
+    return histMax(h);
+}
+
+uint64_t histCount(const Histogram *h) {
+    return atomic_load_explicit(&h->total, memory_order_relaxed);
+}
+
+uint64_t histMax(const Histogram *h) {
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+uint64_t histSum(const Histogram *h) {
+    return atomic_load_explicit(&h->sum, memory_order_relaxed);
+}
+
+double histMean(const Histogram *h) {
+    uint64_t total = histCount(h);
+
+    return total > 0 ? (double)histSum(h) / total : 0;
+}
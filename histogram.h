@@ -0,0 +1,49 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// values below 2^HIST_SUB_BITS are counted exactly; above that, every power
+// of two is split into 2^HIST_SUB_BITS buckets, so any value is known to
+// within about 3%
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+
+/*
+    Counts of values, such as latencies in microseconds, in buckets of
+    roughly constant relative width (log-linear, as in HdrHistogram), so
+    that percentiles come out to a few percent whatever the range. One
+    thread records into a histogram; any thread may read it meanwhile.
+    Recording is a couple of relaxed atomic stores and takes no lock.
+*/
+typedef struct {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} Histogram;
+
+
+/*
+    Adds to a counter that only the calling thread ever changes: cheaper
+    than an atomic add, and as safe for anyone reading it.
+*/
+static inline void counterAdd(_Atomic uint64_t *counter, uint64_t by) {
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed)
+                          + by, memory_order_relaxed);
+}
+
+
+void histInit(Histogram *h);
+void histRecord(Histogram *h, uint64_t value);
+void histMerge(Histogram *dst, const Histogram *src);
+uint64_t histPercentile(const Histogram *h, double percent);
+uint64_t histCount(const Histogram *h);
+uint64_t histMax(const Histogram *h);
+uint64_t histSum(const Histogram *h);
+double histMean(const Histogram *h);
+
+#endif
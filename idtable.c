@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "idtable.h"
+
+#define INITIAL_SLOTS 64
+
+
+// spreads keys that count up, such as game ids, over the whole table
+static inline size_t slotOf(const IdTable *t, uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & t->mask;
+}
+
+static void insert(IdTable *t, uint64_t key, void *value) {
+    size_t i = slotOf(t, key);
+
+    while (t->slots[i].key != 0 && t->slots[i].key != key)
+        i = (i + 1) & t->mask;
+    if (t->slots[i].key == 0)
+        t->count++;
+    t->slots[i].key = key;
+    t->slots[i].value = value;
+}
+
+static void resize(IdTable *t, size_t size) {
+    IdSlot *old = t->slots;
+    size_t i, oldSize = t->slots != NULL ? t->mask + 1 : 0;
+
+    t->slots = calloc(size, sizeof(IdSlot));
+    t->mask = size - 1;
+    t->count = 0;
+    for (i = 0; i < oldSize; i++)
+        if (old[i].key != 0)
+            insert(t, old[i].key, old[i].value);
+    free(old);
+}
+
+
+void idTableInit(IdTable *t) {
+    t->slots = NULL;
+    t->count = 0;
+    resize(t, INITIAL_SLOTS);
+}
+
+void idTableFree(IdTable *t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->count = 0;
+}
+
+/* The value stored under key, or NULL if there is none. */
+void* idTableGet(const IdTable *t, uint64_t key) {
+    size_t i = slotOf(t, key);
+
+    while (t->slots[i].key != 0) {
+        if (t->slots[i].key == key)
+            return t->slots[i].value;
+        i = (i + 1) & t->mask;
+    }
+    return NULL;
+}
+
+/* Stores value under key, replacing whatever was there. */
+void idTablePut(IdTable *t, uint64_t key, void *value) {
+    if (2 * (t->count + 1) > t->mask + 1)
+        resize(t, 2 * (t->mask + 1));
+    insert(t, key, value);
+}
+
+/*
+    Removes key, then moves each entry in the run after it back into the
+    gap if its probe sequence passes through the gap.
+*/
+void idTableRemove(IdTable *t, uint64_t key) {
+    size_t gap = slotOf(t, key), i, home;
+
+    while (t->slots[gap].key != key) {
+        if (t->slots[gap].key == 0)
+            return;
+        gap = (gap + 1) & t->mask;
+    }
+    t->count--;
+
+    for (i = (gap + 1) & t->mask; t->slots[i].key != 0;
+         i = (i + 1) & t->mask) {
+        home = slotOf(t, t->slots[i].key);
+
+        // i can fill the gap if its home is not in (gap, i], cyclically
+        if (((i - home) & t->mask) >= ((i - gap) & t->mask)) {
+            t->slots[gap] = t->slots[i];
+            gap = i;
+        }
+    }
+    t->slots[gap].key = 0;
+    t->slots[gap].value = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef IDTABLE_H
+#define IDTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+    Hash table from nonzero 64-bit keys to pointers, for use by one thread.
+    Open addressing with linear probing, kept at most half full; removal
+    shifts later entries back rather than leaving tombstones, so lookups
+    stay short however much churn there is.
+*/
+typedef struct {
+    uint64_t key;   // 0 for an empty slot
+    void *value;
+} IdSlot;
+
+typedef struct {
+    IdSlot *slots;
+    size_t mask;
+    size_t count;
+} IdTable;
+
+
+void idTableInit(IdTable *t);
+void idTableFree(IdTable *t);
+void* idTableGet(const IdTable *t, uint64_t key);
+void idTablePut(IdTable *t, uint64_t key, void *value);
+void idTableRemove(IdTable *t, uint64_t key);
+
+#endif
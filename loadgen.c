@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "loadgen.h"
+#include "clock.h"
+#include "histogram.h"
+#include "movegen.h"
+#include "netclient.h"
+#include "poller.h"
+#include "protocol.h"
+#include "spsc.h"
+
+// events handled per pass through a worker's loop
+#define MAX_EVENTS 256
+
+// new pairs that can be waiting for each worker to pick them up
+#define HANDOFF_QUEUE_SIZE 4096
+
+// a game still going after this many plies is abandoned and replaced
+#define MAX_GAME_PLIES 400
+
+// how long to wait before trying again when a pair failed to connect
+#define CONNECT_RETRY_US 10000
+
+// how often the audience checks whether the test is over
+#define AUDIENCE_POLL_MS 100
+
+
+typedef struct Pair Pair;
+
+// one of our connections to the server
+typedef struct {
+    int fd;
+    enum player role;
+    Pair *pair;
+    NetBuffer in, out;
+    ShmLink *shm;           // where frames go instead of fd, or NULL
+} Client;
+
+/*
+    Two of our clients seated in the same game, and the game as they see it.
+    Only one of them is ever due to move, so a pair waits in its worker's
+    due list at most once.
+*/
+struct Pair {
+    Client clients[2];      // by role
+    Board board;
+    enum player toMove;     // NO_PLAYER once the game has ended
+    int plies;
+    uint64_t random;
+    uint64_t game;          // its number on the server, to watch it by
+
+    double sentAt;          // when the move now in flight was sent
+    double due;             // when toMove moves next, while on the list
+
+    bool queued;
+    bool closed;
+    Pair *prevDue, *nextDue;
+    Pair *nextClosed;
+};
+
+typedef struct LoadGen LoadGen;
+
+// one event loop thread, which owns the pairs handed to it outright
+typedef struct {
+    LoadGen *load;
+    pthread_t thread;
+    Poller poller;
+    Waker waker;
+    SpscQueue handoff;
+
+    // pairs waiting to move, soonest first; every move waits as long, so
+    // appending keeps the list in order
+    Pair *dueHead, *dueTail;
+
+    // closed during this pass, freed at the end of it
+    Pair *closed;
+
+    MoveList list;
+
+    // written by this thread alone, read by the reporting thread
+    Histogram relay;
+    _Atomic uint64_t played, games, abandoned, dropped, protocol;
+} LoadWorker;
+
+// a client watching a game, whose frames are counted and thrown away
+typedef struct {
+    int fd;
+    NetBuffer in;
+    bool sawEnd;            // GAME_OVER came, so its hanging up is expected
+} Spectator;
+
+/*
+    Spectators of one game, connected and read by a thread of their own so
+    that they load the server without slowing our players down.
+*/
+typedef struct {
+    LoadGen *load;
+    pthread_t thread;
+    Poller poller;
+    uint64_t game;
+    Spectator *spectators;
+    int count, open;
+
+    // read once the thread has been joined
+    uint64_t connected, frames, bytes, snapshots, toEnd, dropped;
+} Audience;
+
+struct LoadGen {
+    const char *host;
+    int port;
+    bool shm;               // ask for shared memory
+    double delay;           // seconds between a move arriving and the reply
+    LoadWorker *workers;
+    int numWorkers;
+
+    atomic_int live;        // pairs handed out and not yet closed
+    atomic_bool stop;
+};
+
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t sumCounters(const LoadGen *load, size_t offset) {
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < load->numWorkers; i++)
+        total += atomic_load((_Atomic uint64_t *)
+                             ((char *)&load->workers[i] + offset));
+    return total;
+}
+
+
+static void unqueue(LoadWorker *w, Pair *p) {
+    if (!p->queued)
+        return;
+    if (p->prevDue != NULL)
+        p->prevDue->nextDue = p->nextDue;
+    else
+        w->dueHead = p->nextDue;
+    if (p->nextDue != NULL)
+        p->nextDue->prevDue = p->prevDue;
+    else
+        w->dueTail = p->prevDue;
+    p->queued = false;
+}
+
+// puts p at the back of the due list, to move once the delay has passed
+static void schedule(LoadWorker *w, Pair *p) {
+    p->due = now() + w->load->delay;
+    p->prevDue = w->dueTail;
+    p->nextDue = NULL;
+    if (w->dueTail != NULL)
+        w->dueTail->nextDue = p;
+    else
+        w->dueHead = p;
+    w->dueTail = p;
+    p->queued = true;
+}
+
+/*
+    Hangs up both of p's clients, counting the reason on error unless it is
+    NULL, which means the game ended as it should.
+*/
+static void closePair(LoadWorker *w, Pair *p, _Atomic uint64_t *error) {
+    int i;
+
+    if (p->closed)
+        return;
+    p->closed = true;
+    if (error != NULL)
+        counterAdd(error, 1);
+
+    unqueue(w, p);
+    for (i = 0; i < 2; i++) {
+        pollerRemove(&w->poller, p->clients[i].fd);
+        if (p->clients[i].shm != NULL)
+            pollerRemove(&w->poller, p->clients[i].shm->bell.readFd);
+        close(p->clients[i].fd);
+    }
+    p->nextClosed = w->closed;
+    w->closed = p;
+    atomic_fetch_sub(&w->load->live, 1);
+}
+
+static void freePair(Pair *p) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        bufferFree(&p->clients[i].in);
+        bufferFree(&p->clients[i].out);
+        if (p->clients[i].shm != NULL) {
+            shmClose(p->clients[i].shm);
+            free(p->clients[i].shm);
+        }
+    }
+    boardFree(&p->board);
+    free(p);
+}
+
+static void reapClosed(LoadWorker *w) {
+    Pair *p, *next;
+
+    for (p = w->closed; p != NULL; p = next) {
+        next = p->nextClosed;
+        freePair(p);
+    }
+    w->closed = NULL;
+}
+
+/*
+    Plays a random legal move for the side to move and sends it. The move
+    is tiny and the socket or ring fresh, so it goes in one write or not at
+    all.
+*/
+static void playMove(LoadWorker *w, Pair *p) {
+    Client *c = &p->clients[p->toMove];
+    enum player other = p->toMove == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    Move m;
+    Undo undo;
+
+    if (p->plies >= MAX_GAME_PLIES) {
+        closePair(w, p, &w->abandoned);
+        return;
+    }
+
+    generateMoves(&p->board, p->toMove, &w->list);
+    m = w->list.moves[splitmix64(&p->random) % w->list.count];
+
+    writeMove(&c->out, &m);
+    p->sentAt = now();
+    if (c->shm != NULL)
+        shmWriteFrom(c->shm, &c->out);
+    else
+        bufferWriteTo(&c->out, c->fd);
+    if (c->out.len > 0) {
+        closePair(w, p, &w->dropped);
+        return;
+    }
+
+    boardApplyMove(&p->board, &m, &undo);
+    p->plies++;
+    p->toMove = countMoves(&p->board, other) > 0 ? other : NO_PLAYER;
+}
+
+/*
+    Handles what the server has sent c: the opponent's move, timed from
+    when it was sent and answered after the delay, or the end of the game.
+    Anything else means the game has gone wrong.
+*/
+static void readClient(LoadWorker *w, Client *c) {
+    Pair *p = c->pair;
+    Frame f;
+    ssize_t n;
+    int found;
+
+    for (;;) {
+        n = bufferReadFrom(&c->in, c->fd);
+        if (n > 0)
+            continue;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        closePair(w, p, &w->dropped);
+        return;
+    }
+
+    // over shared memory the socket only ever says the server has gone
+    if (c->shm != NULL) {
+        wakerDrain(&c->shm->bell);
+        do {
+            while ((n = shmReadInto(c->shm, &c->in)) > 0)
+                ;
+            if (errno != EAGAIN) {
+                closePair(w, p, &w->protocol);
+                return;
+            }
+        } while (!shmWaitRead(c->shm));
+    }
+
+    while (!p->closed && (found = peekFrame(&c->in, &f)) != 0) {
+        if (found < 0) {
+            closePair(w, p, &w->protocol);
+            return;
+        }
+
+        switch (f.type) {
+            case FRAME_MOVE:
+                histRecord(&w->relay, (now() - p->sentAt) * 1e6);
+                counterAdd(&w->played, 1);
+                if (p->toMove == c->role)
+                    schedule(w, p);
+                break;
+            case FRAME_GAME_OVER:
+                counterAdd(&w->games, 1);
+                closePair(w, p, NULL);
+                break;
+            default:
+                closePair(w, p, &w->protocol);
+                break;
+        }
+        bufferConsume(&c->in, f.size);
+    }
+}
+
+/* Starts the games the connector has handed this worker. */
+static void adoptPairs(LoadWorker *w) {
+    Pair *p;
+    int i;
+
+    wakerDrain(&w->waker);
+
+    while (spscPop(&w->handoff, &p)) {
+        for (i = 0; i < 2; i++) {
+            setNonBlocking(p->clients[i].fd);
+            if (!pollerAdd(&w->poller, p->clients[i].fd, POLL_READ,
+                           &p->clients[i]) ||
+                (p->clients[i].shm != NULL &&
+                 !pollerAdd(&w->poller, p->clients[i].shm->bell.readFd,
+                            POLL_READ, &p->clients[i]))) {
+                printf("ERROR watching client socket\n");
+                closePair(w, p, &w->dropped);
+                break;
+            }
+
+            // arms the ring's bell, which rings only for a waiting reader
+            if (p->clients[i].shm != NULL)
+                readClient(w, &p->clients[i]);
+        }
+        if (!p->closed)
+            schedule(w, p);
+    }
+}
+
+static void* workerLoop(void *arg) {
+    LoadWorker *w = arg;
+    PollEvent events[MAX_EVENTS];
+    Client *c;
+    Pair *p;
+    int i, numEvents, timeoutMs;
+    double t;
+
+    while (!atomic_load_explicit(&w->load->stop, memory_order_relaxed)) {
+        timeoutMs = -1;
+        if (w->dueHead != NULL) {
+            t = w->dueHead->due - now();
+            timeoutMs = t > 0 ? (int)(t * 1000) + 1 : 0;
+        }
+
+        numEvents = pollerWait(&w->poller, events, MAX_EVENTS, timeoutMs);
+        if (numEvents < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("ERROR waiting for events\n");
+            break;
+        }
+
+        for (i = 0; i < numEvents; i++) {
+            if (events[i].data == &w->waker) {
+                adoptPairs(w);
+                continue;
+            }
+            c = events[i].data;
+            if (!c->pair->closed)
+                readClient(w, c);
+        }
+
+        t = now();
+        while ((p = w->dueHead) != NULL && p->due <= t) {
+            unqueue(w, p);
+            playMove(w, p);
+        }
+
+        reapClosed(w);
+    }
+
+    return NULL;
+}
+
+static bool startWorker(LoadWorker *w, LoadGen *load) {
+    memset(w, 0, sizeof(LoadWorker));
+    w->load = load;
+    histInit(&w->relay);
+    moveListAlloc(&w->list);
+
+    if (!pollerCreate(&w->poller) || !wakerCreate(&w->waker) ||
+        !spscInit(&w->handoff, sizeof(Pair*), HANDOFF_QUEUE_SIZE) ||
+        !pollerAdd(&w->poller, w->waker.readFd, POLL_READ, &w->waker))
+        return false;
+
+    return pthread_create(&w->thread, NULL, workerLoop, w) == 0;
+}
+
+
+static void closeSpectator(Audience *a, Spectator *s) {
+    if (s->sawEnd)
+        a->toEnd++;
+    else
+        a->dropped++;
+    pollerRemove(&a->poller, s->fd);
+    close(s->fd);
+    s->fd = -1;
+    bufferFree(&s->in);
+    a->open--;
+}
+
+// counts the frames s has been sent, noting the snapshots and the end
+static void readSpectator(Audience *a, Spectator *s) {
+    Frame f;
+    ssize_t n;
+    int found;
+
+    for (;;) {
+        while ((found = peekFrame(&s->in, &f)) > 0) {
+            a->frames++;
+            if (f.type == FRAME_STATE_SYNC)
+                a->snapshots++;
+            if (f.type == FRAME_GAME_OVER)
+                s->sawEnd = true;
+            bufferConsume(&s->in, f.size);
+        }
+        if (found < 0)
+            break;
+
+        n = bufferReadFrom(&s->in, s->fd);
+        if (n > 0) {
+            a->bytes += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        break;
+    }
+    closeSpectator(a, s);
+}
+
+/*
+    Connects the audience to its game, then reads until the test is over
+    or the server has hung up on every one of them.
+*/
+static void* audienceLoop(void *arg) {
+    Audience *a = arg;
+    PollEvent events[MAX_EVENTS];
+    ServerLink link;
+    Spectator *s;
+    int i, numEvents;
+
+    for (i = 0; i < a->count; i++) {
+        s = &a->spectators[i];
+        s->fd = -1;
+        if (atomic_load(&a->load->stop) ||
+            !linkWatch(&link, a->load->host, a->load->port, a->game))
+            continue;
+
+        // the snapshot may have come in with the WELCOME
+        s->fd = link.fd;
+        s->in = link.in;
+        a->bytes += s->in.len;
+        bufferFree(&link.out);
+        setNonBlocking(s->fd);
+        if (!pollerAdd(&a->poller, s->fd, POLL_READ, s)) {
+            close(s->fd);
+            s->fd = -1;
+            bufferFree(&s->in);
+            continue;
+        }
+        a->connected++;
+        a->open++;
+        readSpectator(a, s);
+    }
+
+    while (a->open > 0 && !atomic_load(&a->load->stop)) {
+        numEvents = pollerWait(&a->poller, events, MAX_EVENTS,
+                               AUDIENCE_POLL_MS);
+        if (numEvents < 0 && errno != EINTR)
+            break;
+        for (i = 0; i < numEvents; i++) {
+            s = events[i].data;
+            if (s->fd >= 0)
+                readSpectator(a, s);
+        }
+    }
+
+    for (i = 0; i < a->count; i++) {
+        if (a->spectators[i].fd >= 0) {
+            close(a->spectators[i].fd);
+            bufferFree(&a->spectators[i].in);
+        }
+    }
+    return NULL;
+}
+
+static bool startAudience(Audience *a, LoadGen *load, uint64_t game) {
+    a->load = load;
+    a->game = game;
+    a->spectators = calloc(a->count, sizeof(Spectator));
+    if (!pollerCreate(&a->poller))
+        return false;
+    return pthread_create(&a->thread, NULL, audienceLoop, a) == 0;
+}
+
+
+/*
+    Connects two clients one after the other, so the server seats them
+    together, and sets up their game. Returns NULL, having counted why, if
+    either could not connect or they were not seated as a pair.
+*/
+static Pair* connectPair(LoadGen *load, uint64_t seed, Histogram *handshake,
+                         uint64_t *connectErrors, uint64_t *pairErrors) {
+    ServerLink links[2];
+    Pair *p;
+    double start;
+    int i, made;
+
+    for (made = 0; made < 2; made++) {
+        start = now();
+        if (!linkConnect(&links[made], load->host, load->port, 0, 0,
+                         load->shm)) {
+            (*connectErrors)++;
+            break;
+        }
+        histRecord(handshake, (now() - start) * 1e6);
+        if (links[made].welcome.role != (enum player)made) {
+            (*pairErrors)++;
+            made++;
+            break;
+        }
+    }
+    if (made < 2 || links[0].welcome.n != links[1].welcome.n) {
+        for (i = 0; i < made; i++) {
+            close(links[i].fd);
+            bufferFree(&links[i].in);
+            bufferFree(&links[i].out);
+            if (links[i].overShm)
+                shmClose(&links[i].shm);
+        }
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(Pair));
+    for (i = 0; i < 2; i++) {
+        p->clients[i].fd = links[i].fd;
+        p->clients[i].role = i;
+        p->clients[i].pair = p;
+        p->clients[i].in = links[i].in;
+        p->clients[i].out = links[i].out;
+        if (links[i].overShm) {
+            p->clients[i].shm = malloc(sizeof(ShmLink));
+            *p->clients[i].shm = links[i].shm;
+        }
+    }
+    boardInit(&p->board, links[0].welcome.n);
+    boardSetup(&p->board);
+    p->toMove = PLAYER_ONE;
+    p->random = seed;
+    p->game = links[0].welcome.game;
+    return p;
+}
+
+/*
+    Runs the load test: this thread connects pairs and keeps their number
+    up as games end, while the workers play them, and the audience, if
+    there is one, watches the first.
+*/
+int runLoadGen(const char *host, int port, int connections, int rate,
+               int seconds, uint64_t seed, int numThreads, int watchers,
+               bool shm) {
+    LoadGen load;
+    Audience audience;
+    LoadWorker *w;
+    Histogram handshake, relay;
+    Pair *p;
+    uint64_t pairIndex = 0, connectErrors = 0, pairErrors = 0;
+    uint64_t played, lastPlayed = 0;
+    double start, end, nextReport, t;
+    int i, next = 0, tries, pairs = connections / 2;
+
+    // a server hanging up mid-write must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&load, 0, sizeof(LoadGen));
+    load.host = host;
+    load.port = port;
+    load.shm = shm;
+    load.delay = 1.0 / rate;
+    load.numWorkers = numThreads > 0 ? numThreads : 1;
+    atomic_init(&load.live, 0);
+    atomic_init(&load.stop, false);
+    histInit(&handshake);
+    memset(&audience, 0, sizeof(Audience));
+
+    load.workers = malloc(sizeof(LoadWorker) * load.numWorkers);
+    for (i = 0; i < load.numWorkers; i++) {
+        if (!startWorker(&load.workers[i], &load)) {
+            printf("ERROR starting worker thread\n");
+            return 1;
+        }
+    }
+
+    printf("load test: %d clients in %d games, %d moves/s per game, "
+           "%d s, %d threads\n", pairs * 2, pairs, rate, seconds,
+           load.numWorkers);
+    fflush(stdout);
+
+    start = now();
+    end = start + seconds;
+    nextReport = start + 1;
+    while ((t = now()) < end) {
+        if (atomic_load(&load.live) < pairs) {
+            p = connectPair(&load, splitmix64(&seed) ^ pairIndex++,
+                            &handshake, &connectErrors, &pairErrors);
+            if (p == NULL) {
+                usleep(CONNECT_RETRY_US);
+                continue;
+            }
+
+            if (watchers > 0 && audience.count == 0) {
+                audience.count = watchers;
+                if (!startAudience(&audience, &load, p->game)) {
+                    printf("ERROR starting audience thread\n");
+                    return 1;
+                }
+            }
+
+            // round robin, skipping any worker whose queue is full
+            for (tries = 0; tries < load.numWorkers; tries++) {
+                w = &load.workers[next];
+                next = (next + 1) % load.numWorkers;
+                if (spscPush(&w->handoff, &p)) {
+                    atomic_fetch_add(&load.live, 1);
+                    wakerSignal(&w->waker);
+                    break;
+                }
+            }
+            if (tries == load.numWorkers) {
+                close(p->clients[0].fd);
+                close(p->clients[1].fd);
+                freePair(p);
+            }
+        } else {
+            usleep(1000);
+        }
+
+        if (t >= nextReport) {
+            played = sumCounters(&load, offsetof(LoadWorker, played));
+            printf("%5.0f s  %6d games  %8.0f moves/s  %llu errors\n",
+                   t - start, atomic_load(&load.live),
+                   (played - lastPlayed) / (t - nextReport + 1),
+                   (unsigned long long)(connectErrors + pairErrors +
+                   sumCounters(&load, offsetof(LoadWorker, dropped)) +
+                   sumCounters(&load, offsetof(LoadWorker, protocol))));
+            fflush(stdout);
+            lastPlayed = played;
+            nextReport += 1;
+        }
+    }
+
+    atomic_store(&load.stop, true);
+    for (i = 0; i < load.numWorkers; i++) {
+        wakerSignal(&load.workers[i].waker);
+        pthread_join(load.workers[i].thread, NULL);
+    }
+    if (audience.count > 0)
+        pthread_join(audience.thread, NULL);
+    t = now() - start;
+
+    histInit(&relay);
+    for (i = 0; i < load.numWorkers; i++)
+        histMerge(&relay, &load.workers[i].relay);
+    played = sumCounters(&load, offsetof(LoadWorker, played));
+
+    printf("moves %llu (%.0f/s), games finished %llu, abandoned %llu\n",
+           (unsigned long long)played, played / t,
+           (unsigned long long)sumCounters(&load,
+                                           offsetof(LoadWorker, games)),
+           (unsigned long long)sumCounters(&load,
+                                           offsetof(LoadWorker, abandoned)));
+    printf("relay latency us: p50 %llu  p99 %llu  p99.9 %llu  max %llu  "
+           "mean %.1f\n",
+           (unsigned long long)histPercentile(&relay, 50),
+           (unsigned long long)histPercentile(&relay, 99),
+           (unsigned long long)histPercentile(&relay, 99.9),
+           (unsigned long long)histMax(&relay), histMean(&relay));
+    printf("handshake us: p50 %llu  p99 %llu  max %llu\n",
+           (unsigned long long)histPercentile(&handshake, 50),
+           (unsigned long long)histPercentile(&handshake, 99),
+           (unsigned long long)histMax(&handshake));
+    printf("errors: connect %llu  unpaired %llu  dropped %llu  "
+           "protocol %llu\n", (unsigned long long)connectErrors,
+           (unsigned long long)pairErrors,
+           (unsigned long long)sumCounters(&load,
+                                           offsetof(LoadWorker, dropped)),
+           (unsigned long long)sumCounters(&load,
+                                           offsetof(LoadWorker, protocol)));
+    if (audience.count > 0) {
+        printf("spectators: %llu of %d connected  %llu frames  %llu bytes  "
+               "%llu snapshots\n", (unsigned long long)audience.connected,
+               audience.count, (unsigned long long)audience.frames,
+               (unsigned long long)audience.bytes,
+               (unsigned long long)audience.snapshots);
+        printf("spectators hung up on: after the end %llu  before it %llu\n",
+               (unsigned long long)audience.toEnd,
+               (unsigned long long)audience.dropped);
+    }
+
+    return connectErrors + pairErrors > 0 ? 1 : 0;
+}
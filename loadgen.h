@@ -0,0 +1,42 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// moves a second each game makes unless told otherwise
+#define DEFAULT_LOAD_RATE 10
+
+// how long a load test runs unless told otherwise, in seconds
+#define DEFAULT_LOAD_SECONDS 10
+
+
+/*
+    Stress-tests a server: keeps `connections` clients connected, in pairs
+    that play each other, making random legal moves at `rate` moves a
+    second per game, for `seconds` seconds. Games that end are replaced
+    with new ones. Prints progress every second and then the relay latency
+    (from one client sending a move to its opponent receiving it) at p50,
+    p99 and p99.9, moves and games played, and connection errors.
+
+    Clients speak the ordinary protocol, handshake and all. Pairs are
+    connected one after the other by a single thread, so on a server no one
+    else is using both halves of a pair are seated in the same game and the
+    latency of every move can be timed. The games themselves run on
+    numThreads threads, each with its own event loop. The same seed plays
+    the same moves.
+
+    With watchers above 0, that many more clients watch the first game as
+    spectators, on a thread of their own, and the frames and bytes they
+    were sent are reported, with how many the server hung up on before
+    the game was over for falling behind.
+
+    With shm, players ask for shared memory as a client on the same host
+    would, and their moves go through it wherever the server takes it up.
+*/
+
+int runLoadGen(const char *host, int port, int connections, int rate,
+               int seconds, uint64_t seed, int numThreads, int watchers,
+               bool shm);
+
+#endif
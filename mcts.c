@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "mcts.h"
+#include "clock.h"
+#include "movegen.h"
+
+// playouts run from each leaf a walk reaches
+#define BATCH 8
+
+// weight of the UCT exploration term
+#define EXPLORE 1.0
+
+// a playout still going after this many plies per row of the board is
+// scored on material: a man is worth 2, a king 3
+#define PLAYOUT_PLIES_PER_ROW 8
+
+// Node.first while the node has no children: not yet expanded (a leaf is
+// expanded on its second batch), being expanded by another thread, out of
+// room in the pool, or the end of the game. Children are never at index 0,
+// which is the root.
+#define UNEXPANDED 0
+#define TERMINAL (UINT32_MAX - 2)
+#define POOL_FULL (UINT32_MAX - 1)
+#define EXPANDING UINT32_MAX
+
+
+/*
+    One position in the tree. A node's children are numChildren nodes in a
+    row from first, published by storing first last. score is in
+    half-points (a win 2, a draw 1) for the side that played move, over
+    visits playouts, some of which may still be running.
+*/
+typedef struct {
+    Move move;
+    _Atomic uint32_t first;
+    uint32_t numChildren;
+    _Atomic uint32_t visits;
+    _Atomic uint32_t score;
+} Node;
+
+/*
+    Nodes for one search, which draws from them until they run out. Pools
+    are kept for the next search when done with, so there are only ever as
+    many as searches running at once.
+*/
+typedef struct NodePool {
+    Node *nodes;
+    uint32_t size;
+    _Atomic uint64_t next;
+    struct NodePool *nextFree;
+} NodePool;
+
+// one position being searched by any number of threads
+typedef struct {
+    NodePool *pool;
+    enum player side;
+    double start;
+    const SearchLimits *limits;
+    const Board *root;
+
+    // set once the main thread sees time is up; the helpers then stop too
+    atomic_bool stop;
+} MctsJob;
+
+/*
+    Per-thread scratch: the board walked down the tree, the board a playout
+    runs on, and a move list that grows to fit the widest position seen.
+    The paths of the long chains among the children it adds to the tree
+    are kept here too, for as long as the tree is.
+*/
+typedef struct {
+    MctsJob *job;
+    int id;             // 0 for the main thread
+
+    Board board;
+    Board playout;
+    MoveList list;
+
+    uint64_t **paths;
+    int numPaths;
+    int pathsCap;
+
+    uint32_t path[MAX_PLY + 1];
+    uint64_t random;
+    uint64_t playouts;
+} Walker;
+
+
+static NodePool *freePools = NULL;
+static size_t poolBytes = (size_t)DEFAULT_MCTS_MB << 20;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// xorshift64*: plenty for picking playout moves
+static inline uint64_t nextRandom(Walker *w) {
+    w->random ^= w->random >> 12;
+    w->random ^= w->random << 25;
+    w->random ^= w->random >> 27;
+    return w->random * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+    Sets how many bytes of nodes each search may use from now on, dropping
+    pools of the old size that are not in use.
+*/
+bool mctsInit(size_t bytes) {
+    NodePool *p;
+
+    if (bytes / sizeof(Node) < 2)
+        return false;
+
+    pthread_mutex_lock(&poolLock);
+    poolBytes = bytes;
+    while ((p = freePools) != NULL) {
+        freePools = p->nextFree;
+        free(p->nodes);
+        free(p);
+    }
+    pthread_mutex_unlock(&poolLock);
+    return true;
+}
+
+/* A pool for a search to use, one left over from before if possible. */
+static NodePool* takePool() {
+    NodePool *p;
+    size_t count;
+
+    pthread_mutex_lock(&poolLock);
+    p = freePools;
+    if (p != NULL)
+        freePools = p->nextFree;
+    count = poolBytes / sizeof(Node);
+    pthread_mutex_unlock(&poolLock);
+    if (p != NULL)
+        return p;
+
+    if (count > POOL_FULL / 2)
+        count = POOL_FULL / 2;
+    p = malloc(sizeof(NodePool));
+    if (p == NULL)
+        return NULL;
+    p->nodes = malloc(count * sizeof(Node));
+    if (p->nodes == NULL) {
+        free(p);
+        return NULL;
+    }
+    p->size = count;
+    return p;
+}
+
+static void givePool(NodePool *p) {
+    pthread_mutex_lock(&poolLock);
+    if (p->size == (uint32_t)(poolBytes / sizeof(Node))) {
+        p->nextFree = freePools;
+        freePools = p;
+        p = NULL;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    // sized before mctsInit last changed the size
+    if (p != NULL) {
+        free(p->nodes);
+        free(p);
+    }
+}
+
+/* Lists side's moves in b into the walker's list, which grows to fit. */
+static int listMoves(Walker *w, const Board *b, enum player side) {
+    generateMoves(b, side, &w->list);
+    return w->list.count;
+}
+
+/*
+    Gives m, bound for the tree, a path of the walker's own in place of the
+    one in its list. False if there is no memory for it.
+*/
+static bool keepPath(Walker *w, Move *m) {
+    uint64_t **grown, *path;
+
+    if (m->longPath == NULL)
+        return true;
+    if (w->numPaths == w->pathsCap) {
+        grown = realloc(w->paths, sizeof(uint64_t*) *
+                                  (w->pathsCap > 0 ? 2 * w->pathsCap : 16));
+        if (grown == NULL)
+            return false;
+        w->paths = grown;
+        w->pathsCap = w->pathsCap > 0 ? 2 * w->pathsCap : 16;
+    }
+    path = malloc(sizeof(uint64_t) * pathWords(m->numHops));
+    if (path == NULL)
+        return false;
+    memcpy(path, m->longPath, sizeof(uint64_t) * pathWords(m->numHops));
+    w->paths[w->numPaths++] = path;
+    m->longPath = path;
+    return true;
+}
+
+static void initNode(Node *node, const Move *m) {
+    node->move = *m;
+    node->numChildren = 0;
+    atomic_init(&node->first, UNEXPANDED);
+    atomic_init(&node->visits, 0);
+    atomic_init(&node->score, 0);
+}
+
+/*
+    Gives node, the position on the walker's board with side to move, its
+    children, unless another thread already has or is doing so. Returns
+    what node->first is now.
+*/
+static uint32_t expand(Walker *w, Node *node, enum player side) {
+    NodePool *pool = w->job->pool;
+    uint32_t first = UNEXPANDED;
+    uint64_t at;
+    int count, i;
+
+    if (!atomic_compare_exchange_strong(&node->first, &first, EXPANDING))
+        return first;
+
+    count = listMoves(w, &w->board, side);
+    if (count == 0) {
+        first = TERMINAL;
+    } else {
+        at = atomic_fetch_add(&pool->next, count);
+        if (at + count > pool->size) {
+            first = POOL_FULL;
+        } else {
+            first = at;
+            for (i = 0; i < count && first != POOL_FULL; i++) {
+                initNode(&pool->nodes[at + i], &w->list.moves[i]);
+                if (!keepPath(w, &pool->nodes[at + i].move))
+                    first = POOL_FULL;
+            }
+            if (first != POOL_FULL)
+                node->numChildren = count;
+        }
+    }
+
+    atomic_store_explicit(&node->first, first, memory_order_release);
+    return first;
+}
+
+/*
+    The child of node with the best UCT value: its win rate plus a bonus
+    that grows for children visited little compared with their siblings.
+    Playouts still running count as losses, so a child being explored by
+    other threads looks worse until their results are in.
+*/
+static uint32_t selectChild(const Node *nodes, const Node *node,
+                            uint32_t first) {
+    double logVisits = log(atomic_load_explicit(&node->visits,
+                                                memory_order_relaxed) + 1);
+    double value, bestValue = -1;
+    uint32_t i, best = first, visits;
+    const Node *c;
+
+    for (i = 0; i < node->numChildren; i++) {
+        c = &nodes[first + i];
+        visits = atomic_load_explicit(&c->visits, memory_order_relaxed);
+        if (visits == 0)
+            return first + i;
+
+        value = atomic_load_explicit(&c->score, memory_order_relaxed) /
+                (2.0 * visits) + EXPLORE * sqrt(logVisits / visits);
+        if (value > bestValue) {
+            bestValue = value;
+            best = first + i;
+        }
+    }
+    return best;
+}
+
+// a man is worth 2 and a king 3, with side's pieces positive
+static int material(const Board *b, enum player side) {
+    int diff = 2 * (b->count[MAN_ONE] - b->count[MAN_TWO]) +
+               3 * (b->count[KING_ONE] - b->count[KING_TWO]);
+    return side == PLAYER_ONE ? diff : -diff;
+}
+
+/*
+    Plays random moves from the walker's board, side to move, until the
+    game ends or has gone on long enough to call on material. Returns the
+    half-points side scores.
+*/
+static int playout(Walker *w, enum player side) {
+    Board *b = &w->playout;
+    enum player turn = side;
+    int ply, count, diff, limit = PLAYOUT_PLIES_PER_ROW * b->n;
+    Undo undo;
+
+    boardCopy(b, &w->board);
+    for (ply = 0; ply < limit; ply++) {
+        count = listMoves(w, b, turn);
+        if (count == 0)
+            return turn == side ? 0 : 2;
+        boardApplyMove(b, &w->list.moves[((nextRandom(w) >> 32) * count)
+                                          >> 32], &undo);
+        turn = turn == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    }
+
+    diff = material(b, side);
+    return diff > 0 ? 2 : diff < 0 ? 0 : 1;
+}
+
+/*
+    One walk: down the tree from the root by UCT to a leaf, expanding it if
+    it has been reached before, then a batch of playouts from it and the
+    results back up the path.
+*/
+static void walk(Walker *w) {
+    MctsJob *job = w->job;
+    Node *nodes = job->pool->nodes;
+    enum player turn = job->side;
+    Node *node = &nodes[0];
+    uint32_t first, index;
+    int depth = 0, i, won = 0;
+    Undo undo;
+
+    boardCopy(&w->board, job->root);
+    w->path[0] = 0;
+    atomic_fetch_add_explicit(&node->visits, BATCH, memory_order_relaxed);
+
+    for (;;) {
+        first = atomic_load_explicit(&node->first, memory_order_acquire);
+        if (first == UNEXPANDED &&
+            atomic_load_explicit(&node->visits, memory_order_relaxed) > BATCH)
+            first = expand(w, node, turn);
+        if (first == UNEXPANDED || first >= TERMINAL || depth == MAX_PLY)
+            break;
+
+        index = selectChild(nodes, node, first);
+        node = &nodes[index];
+        atomic_fetch_add_explicit(&node->visits, BATCH, memory_order_relaxed);
+        boardApplyMove(&w->board, &node->move, &undo);
+        turn = turn == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+        w->path[++depth] = index;
+    }
+
+    // the side to move at the end of the game has lost, every time
+    if (first != TERMINAL) {
+        for (i = 0; i < BATCH; i++)
+            won += playout(w, turn);
+        w->playouts += BATCH;
+    }
+
+    // the leaf's score is for the side that moved into it, not turn
+    for (i = depth; i >= 0; i--) {
+        atomic_fetch_add_explicit(&nodes[w->path[i]].score,
+                                  (depth - i) % 2 == 0 ? 2*BATCH - won : won,
+                                  memory_order_relaxed);
+    }
+}
+
+/*
+    When the job must finish, on the now() clock, or 0 if it has no deadline
+    (yet). A deadline set through the control overrides the time limit.
+*/
+static double jobDeadline(const MctsJob *job) {
+    SearchControl *c = job->limits->control;
+    long long us;
+
+    if (c != NULL &&
+        (us = atomic_load_explicit(&c->deadline, memory_order_relaxed)) != 0)
+        return us / 1e6;
+    if (job->limits->timeMs > 0)
+        return job->start + job->limits->timeMs / 1000.0;
+    return 0;
+}
+
+/*
+    Walks until told to stop. The main thread checks the clock and the
+    control after every walk; helpers only watch the job.
+*/
+static void run(Walker *w) {
+    MctsJob *job = w->job;
+    SearchControl *c = job->limits->control;
+    double deadline;
+
+    while (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+        walk(w);
+        if (w->id > 0)
+            continue;
+
+        deadline = jobDeadline(job);
+        if ((c != NULL && atomic_load_explicit(&c->stop,
+                                               memory_order_relaxed)) ||
+            (deadline > 0 && now() > deadline))
+            atomic_store(&job->stop, true);
+    }
+}
+
+static void* mctsThread(void *arg) {
+    run(arg);
+    return NULL;
+}
+
+static Walker* walkerNew(MctsJob *job, int id) {
+    Walker *w = calloc(1, sizeof(Walker));
+
+    w->job = job;
+    w->id = id;
+    boardInit(&w->board, job->root->n);
+    boardInit(&w->playout, job->root->n);
+    moveListAlloc(&w->list);
+
+    // never zero, which xorshift would never leave
+    w->random = ((uint64_t)(job->start * 1e9) ^ (uint64_t)id << 48) | 1;
+    return w;
+}
+
+static void walkerFree(Walker *w) {
+    int i;
+
+    boardFree(&w->board);
+    boardFree(&w->playout);
+    moveListFree(&w->list);
+    for (i = 0; i < w->numPaths; i++)
+        free(w->paths[i]);
+    free(w->paths);
+    free(w);
+}
+
+// the child of node with the most visits, or NULL if it has none
+static const Node* mostVisited(const Node *nodes, const Node *node) {
+    uint32_t first = atomic_load(&node->first);
+    const Node *best = NULL;
+    uint32_t i;
+
+    if (first == UNEXPANDED || first >= TERMINAL)
+        return NULL;
+    for (i = 0; i < node->numChildren; i++) {
+        if (best == NULL ||
+            atomic_load(&nodes[first + i].visits) > atomic_load(&best->visits))
+            best = &nodes[first + i];
+    }
+    return best;
+}
+
+/*
+    Grows the tree from b on limits->threads threads until the time is up
+    or the control says stop, and picks the root move played out most. That
+    move's most visited reply is the one to ponder on. treeNodes, if not
+    NULL, is set to how many nodes the tree grew to.
+*/
+static bool search(const Board *b, enum player side,
+                   const SearchLimits *limits, SearchResult *result,
+                   uint64_t *treeNodes) {
+    MctsJob job;
+    Walker **walkers;
+    pthread_t *helpers;
+    const Node *nodes, *best, *node;
+    Move none;
+    uint64_t used;
+    int i, numThreads, numHelpers = 0;
+    bool copied;
+
+    memset(result, 0, sizeof(SearchResult));
+    if ((job.pool = takePool()) == NULL)
+        return false;
+    nodes = job.pool->nodes;
+
+    job.side = side;
+    job.root = b;
+    job.limits = limits;
+    job.start = now();
+    atomic_init(&job.stop, false);
+    numThreads = limits->threads > 1 ? limits->threads : 1;
+
+    walkers = malloc(sizeof(Walker*) * numThreads);
+    for (i = 0; i < numThreads; i++)
+        walkers[i] = walkerNew(&job, i);
+
+    // the root is expanded up front, so there is a move even if the search
+    // is stopped before its first walk
+    memset(&none, 0, sizeof(Move));
+    initNode(&job.pool->nodes[0], &none);
+    atomic_store(&job.pool->next, 1);
+    boardCopy(&walkers[0]->board, b);
+    if (expand(walkers[0], &job.pool->nodes[0], side) >= TERMINAL) {
+        for (i = 0; i < numThreads; i++)
+            walkerFree(walkers[i]);
+        free(walkers);
+        givePool(job.pool);
+        return false;
+    }
+
+    helpers = malloc(sizeof(pthread_t) * numThreads);
+    for (i = 1; i < numThreads; i++) {
+        if (pthread_create(&helpers[numHelpers], NULL, mctsThread,
+                           walkers[i]) != 0)
+            break;
+        numHelpers++;
+    }
+    run(walkers[0]);
+    for (i = 0; i < numHelpers; i++)
+        pthread_join(helpers[i], NULL);
+
+    best = mostVisited(nodes, &nodes[0]);
+    copied = moveCopy(&result->best, &best->move);
+    if (atomic_load(&best->visits) > 0)
+        result->score = (int)(1000.0 * atomic_load(&best->score) /
+                              atomic_load(&best->visits)) - 1000;
+    for (node = best; node != NULL; node = mostVisited(nodes, node))
+        result->depth++;
+    node = mostVisited(nodes, best);
+    if (node != NULL && atomic_load(&node->visits) > 0)
+        result->hasPonder = moveCopy(&result->ponder, &node->move);
+
+    for (i = 0; i < numThreads; i++) {
+        result->nodes += walkers[i]->playouts;
+        walkerFree(walkers[i]);
+    }
+    result->seconds = now() - job.start;
+
+    used = atomic_load(&job.pool->next);
+    if (treeNodes != NULL)
+        *treeNodes = used < job.pool->size ? used : job.pool->size;
+
+    free(walkers);
+    free(helpers);
+    givePool(job.pool);
+    return copied;
+}
+
+/*
+    Picks side's move in b by Monte Carlo tree search. False if side has no
+    moves, or there is no memory for the tree.
+*/
+bool mctsBestMove(const Board *b, enum player side,
+                  const SearchLimits *limits, SearchResult *result) {
+    return search(b, side, limits, result, NULL);
+}
+
+/*
+    Searches the starting position for ms milliseconds with 1, 2, 4, ... up
+    to maxThreads threads, and reports playouts a second and how many more
+    each thread count manages than one thread.
+*/
+void runMctsBench(int n, int ms, int maxThreads) {
+    Board b;
+    SearchLimits limits;
+    SearchResult r;
+    double baseRate = 0, rate;
+    int threads;
+    uint64_t used;
+    char buf[MOVE_TEXT_LEN];
+
+    boardInit(&b, n);
+    boardSetup(&b);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.timeMs = ms;
+    limits.engine = ENGINE_MCTS;
+
+    printf("mcts n=%d %d ms\n", n, ms);
+    printf("threads  %12s  %12s  %7s  %10s  %5s  %s\n", "playouts",
+           "playouts/sec", "speedup", "tree nodes", "depth", "move");
+
+    for (threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2
+                                                          : maxThreads) {
+        limits.threads = threads;
+        if (!search(&b, PLAYER_ONE, &limits, &r, &used)) {
+            printf("ERROR allocating node pool\n");
+            break;
+        }
+
+        rate = r.seconds > 0 ? r.nodes / r.seconds : 0;
+        if (threads == 1)
+            baseRate = rate;
+        printf("%7d  %12llu  %12.0f  %6.2fx  %10llu  %5d  %s\n",
+               threads, (unsigned long long)r.nodes, rate,
+               baseRate > 0 ? rate / baseRate : 0,
+               (unsigned long long)used,
+               r.depth, moveToString(&b, &r.best, buf, sizeof(buf)));
+        fflush(stdout);
+        searchResultFree(&r);
+
+        if (threads >= maxThreads)
+            break;
+    }
+
+    boardFree(&b);
+}
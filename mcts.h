@@ -0,0 +1,37 @@
+#ifndef MCTS_H
+#define MCTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "search.h"
+
+// node pool size used unless the caller sets one up first
+#define DEFAULT_MCTS_MB 64
+
+
+/*
+    Monte Carlo tree search, for boards so wide that alpha-beta cannot see
+    far: rather than scoring positions it plays random games out from them,
+    and grows a tree towards the moves whose games go best (UCT).
+
+    Every thread walks the one shared tree. A walk counts its playouts
+    against every node it passes on the way down, before they are played
+    (virtual loss), so the threads behind it are steered to other branches
+    instead of all piling into the same one; the results are added on the
+    way back. Each leaf reached gets a batch of playouts at once, which
+    spreads the cost of the walk. Playouts run on per-thread boards and
+    move buffers and allocate nothing.
+
+    Nodes come from a pool with a hard cap, allocated once and kept for the
+    next search. When it is full the tree stops growing and the search
+    carries on with the leaves it has. Searches running at once, in
+    different games, each have their own pool.
+*/
+
+bool mctsInit(size_t bytes);
+bool mctsBestMove(const Board *b, enum player side,
+                  const SearchLimits *limits, SearchResult *result);
+void runMctsBench(int n, int ms, int maxThreads);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+// a scraper gets this long to send its request before it is hung up on
+#define REQUEST_TIMEOUT_SECONDS 1
+
+// the most of a request we read; the rest of it doesn't matter
+#define MAX_REQUEST 4096
+
+
+typedef struct {
+    int fd;
+    MetricsWriter write;
+    void *arg;
+} MetricsServer;
+
+
+/*
+    Reads until the blank line that ends the request's headers, so the
+    scraper isn't answered before it has finished asking. What it asked
+    for is ignored: there is only one thing to serve.
+*/
+static bool readRequest(int fd) {
+    char request[MAX_REQUEST + 1];
+    size_t len = 0;
+    ssize_t n;
+
+    while (len < MAX_REQUEST) {
+        n = read(fd, request + len, MAX_REQUEST - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL ||
+            strstr(request, "\n\n") != NULL)
+            return true;
+    }
+    return true;
+}
+
+static void* metricsLoop(void *arg) {
+    MetricsServer *m = arg;
+    struct timeval timeout = {REQUEST_TIMEOUT_SECONDS, 0};
+    FILE *out;
+    int fd;
+
+    for (;;) {
+        fd = accept(m->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            printf("ERROR accepting metrics connection\n");
+            break;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (!readRequest(fd) || (out = fdopen(fd, "w")) == NULL) {
+            close(fd);
+            continue;
+        }
+
+        fprintf(out, "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Connection: close\r\n\r\n");
+        m->write(out, m->arg);
+        fclose(out);
+    }
+
+    close(m->fd);
+    free(m);
+    return NULL;
+}
+
+bool metricsStart(int port, MetricsWriter write, void *arg) {
+    struct sockaddr_in addr;
+    MetricsServer *m;
+    pthread_t thread;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // only for this machine: the numbers are for whoever runs the server
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, 16) < 0) {
+        close(fd);
+        return false;
+    }
+
+    m = malloc(sizeof(MetricsServer));
+    m->fd = fd;
+    m->write = write;
+    m->arg = arg;
+    if (pthread_create(&thread, NULL, metricsLoop, m) != 0) {
+        close(fd);
+        free(m);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+
+void metricsCounter(FILE *out, const char *name, const char *help,
+                    uint64_t value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help,
+            name, name, (unsigned long long)value);
+}
+
+void metricsGauge(FILE *out, const char *name, const char *help,
+                  double value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.6g\n", name, help,
+            name, name, value);
+}
+
+/*
+    A histogram as a summary: p50, p99 and p99.9, each good to the few
+    percent the histogram's buckets are wide, then the sum, count and
+    largest value.
+*/
+void metricsSummary(FILE *out, const char *name, const char *help,
+                    const Histogram *h) {
+    static const double quantiles[] = {0.5, 0.99, 0.999};
+    size_t i;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+        fprintf(out, "%s{quantile=\"%g\"} %llu\n", name, quantiles[i],
+                (unsigned long long)histPercentile(h, 100 * quantiles[i]));
+    fprintf(out, "%s_sum %llu\n%s_count %llu\n%s_max %llu\n", name,
+            (unsigned long long)histSum(h), name,
+            (unsigned long long)histCount(h), name,
+            (unsigned long long)histMax(h));
+}
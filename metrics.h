@@ -0,0 +1,31 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "histogram.h"
+
+
+// writes every metric to out, in the Prometheus text format
+typedef void (*MetricsWriter)(FILE *out, void *arg);
+
+/*
+    Serves metrics over plain HTTP on 127.0.0.1:port from a thread of its
+    own: any request, whatever its path, is answered with what write(out,
+    arg) prints. The thread sleeps in accept() until someone scrapes, so
+    the endpoint costs nothing the rest of the time; whatever it reports
+    must be safe to read from another thread. Returns false if the port
+    can't be opened.
+*/
+bool metricsStart(int port, MetricsWriter write, void *arg);
+
+void metricsCounter(FILE *out, const char *name, const char *help,
+                    uint64_t value);
+void metricsGauge(FILE *out, const char *name, const char *help,
+                  double value);
+void metricsSummary(FILE *out, const char *name, const char *help,
+                    const Histogram *h);
+
+#endif
@@ -0,0 +1,612 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "movegen.h"
+
+
+/*
+    Everything the capture search needs while it follows one chain. Pieces
+    jumped so far stay on the board until the move is over, so they are
+    remembered here instead: they can't be jumped twice and still block.
+
+    A chain is at most as long as the other side has pieces, which on a big
+    board is more than fits here; captured and the hops of the path past
+    the Move's own word then move to the heap, grown as the chain gets
+    longer. With target set, only that move's chain is followed.
+*/
+typedef struct {
+    const Board *b;
+    const uint64_t *opp[2];
+    int from;
+    bool isKing;
+    enum player side;
+    int *captured;
+    uint64_t *path;
+    int room;
+    bool failed;
+    MoveList *list;
+    int found;
+
+    const Move *target;
+    int to;
+    bool promotes;
+
+    int small[INLINE_HOPS];
+} ChainSearch;
+
+
+void moveListInit(MoveList *list, Move *storage, int capacity) {
+    list->moves = storage;
+    list->capacity = capacity;
+    list->count = 0;
+    list->overflow = false;
+    list->hops = NULL;
+    list->hopsUsed = 0;
+    list->hopCapacity = 0;
+    list->growable = false;
+}
+
+/* Sets up an empty list that generateMoves grows as it needs to. */
+void moveListAlloc(MoveList *list) {
+    moveListInit(list, NULL, 0);
+    list->growable = true;
+}
+
+void moveListFree(MoveList *list) {
+    if (list->growable) {
+        free(list->moves);
+        free(list->hops);
+    }
+    moveListInit(list, NULL, 0);
+}
+
+/*
+    Makes room in a growable list for moves moves and words words of long
+    paths. Returns false if it had that already or the memory ran out.
+*/
+static bool moveListReserve(MoveList *list, int moves, size_t words) {
+    Move *grownMoves;
+    uint64_t *grownHops;
+    bool grew = false;
+
+    if (moves > list->capacity) {
+        if (moves < 2 * list->capacity)
+            moves = 2 * list->capacity;
+        grownMoves = realloc(list->moves, sizeof(Move) * moves);
+        if (grownMoves == NULL)
+            return false;
+        list->moves = grownMoves;
+        list->capacity = moves;
+        grew = true;
+    }
+    if (words > list->hopCapacity) {
+        if (words < 2 * list->hopCapacity)
+            words = 2 * list->hopCapacity;
+        grownHops = realloc(list->hops, sizeof(uint64_t) * words);
+        if (grownHops == NULL)
+            return false;
+        list->hops = grownHops;
+        list->hopCapacity = words;
+        grew = true;
+    }
+    return grew;
+}
+
+static inline void addMove(MoveList *list, const Move *m) {
+    if (list == NULL)
+        return;
+    if (list->count < list->capacity)
+        list->moves[list->count++] = *m;
+    else
+        list->overflow = true;
+}
+
+/* Adds a chain longer than INLINE_HOPS, whose later hops are in s->path. */
+static void addLongMove(ChainSearch *s, const Move *m) {
+    MoveList *list = s->list;
+    size_t words = pathWords(m->numHops);
+    uint64_t *hops;
+
+    if (list->count < list->capacity &&
+        list->hopsUsed + words <= list->hopCapacity) {
+        hops = list->hops + list->hopsUsed;
+        hops[0] = m->path;
+        memcpy(hops + 1, s->path + 1, sizeof(uint64_t) * (words - 1));
+        list->moves[list->count] = *m;
+        list->moves[list->count++].longPath = hops;
+    } else {
+        list->overflow = true;
+    }
+    list->hopsUsed += words;
+}
+
+// directions a man of each side may move in
+static const int FORWARD[2][2] = {
+    { DIR_NE, DIR_NW },
+    { DIR_SE, DIR_SW }
+};
+
+static inline int sideMan(enum player side) {
+    return side == PLAYER_ONE ? MAN_ONE : MAN_TWO;
+}
+
+static inline int sideKing(enum player side) {
+    return side == PLAYER_ONE ? KING_ONE : KING_TWO;
+}
+
+static inline bool dirAllowed(enum player side, bool isKing, int d) {
+    return isKing || d == FORWARD[side][0] || d == FORWARD[side][1];
+}
+
+
+static void chainInit(ChainSearch *s, const Board *b, enum player side,
+                      MoveList *list) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+
+    s->b = b;
+    s->opp[0] = boardBits(b, sideMan(other));
+    s->opp[1] = boardBits(b, sideKing(other));
+    s->side = side;
+    s->captured = s->small;
+    s->path = NULL;
+    s->room = INLINE_HOPS;
+    s->failed = false;
+    s->list = list;
+    s->found = 0;
+    s->target = NULL;
+}
+
+static void chainFree(ChainSearch *s) {
+    // path is only ever allocated along with captured
+    if (s->captured != s->small) {
+        free(s->captured);
+        free(s->path);
+    }
+    if (s->failed && s->list != NULL)
+        s->list->overflow = true;
+}
+
+/* Doubles the longest chain s can follow. Returns false if out of memory. */
+static bool growChain(ChainSearch *s) {
+    int room = 2 * s->room;
+    int *captured = malloc(sizeof(int) * room);
+    uint64_t *path = calloc(pathWords(room), sizeof(uint64_t));
+
+    if (captured == NULL || path == NULL) {
+        free(captured);
+        free(path);
+        s->failed = true;
+        return false;
+    }
+
+    memcpy(captured, s->captured, sizeof(int) * s->room);
+    if (s->path != NULL)
+        memcpy(path, s->path, sizeof(uint64_t) * pathWords(s->room));
+    if (s->captured != s->small)
+        free(s->captured);
+    free(s->path);
+
+    s->captured = captured;
+    s->path = path;
+    s->room = room;
+    return true;
+}
+
+// sets or clears (d == 0) hop's two bits of the path under construction
+static inline void setHop(ChainSearch *s, Move *m, int hop, int d) {
+    uint64_t *word = hop < INLINE_HOPS ? &m->path : &s->path[hop >> 5];
+    int shift = 2 * (hop & 31);
+
+    *word = (*word & ~((uint64_t)3 << shift)) | (uint64_t)d << shift;
+}
+
+/*
+    Extends the chain in s by every jump available from sq, recording each
+    finished chain. Landing on the far row crowns a man and ends the move.
+    Following a target, only its next hop is tried, and once its last hop
+    is made only whether the chain could go on is checked: if so, the
+    target stops short and is no move. Were memory to run out, a chain too
+    long to follow would be dropped rather than recorded cut short.
+*/
+static void followChain(ChainSearch *s, Move *m, int sq) {
+    const BoardGeometry *g = s->b->geo;
+    int d, i, mid, to;
+    unsigned int dirs = (1 << NUM_DIRS) - 1;
+    bool extended = false, taken, promotes;
+
+    if (s->target != NULL && m->numHops < s->target->numHops)
+        dirs = 1 << moveDir(s->target, m->numHops);
+
+    if (!(!s->isKing && m->numHops > 0 && bitTest(g->kingRow[s->side], sq))) {
+
+        for (d = 0; d < NUM_DIRS; d++) {
+            if (!(dirs & (1 << d)) || !dirAllowed(s->side, s->isKing, d) ||
+                !bitTest(g->jumpMask[d], sq))
+                continue;
+
+            mid = sq + g->offset[d];
+            to = mid + g->offset[d];
+            if (!bitTest(s->opp[0], mid) && !bitTest(s->opp[1], mid))
+                continue;
+            if (to != s->from && boardOccupied(s->b, to))
+                continue;
+
+            taken = false;
+            for (i = 0; i < m->numHops; i++) {
+                if (s->captured[i] == mid) {
+                    taken = true;
+                    break;
+                }
+            }
+            if (taken)
+                continue;
+
+            // jumps are forced, so stopping here would be illegal
+            extended = true;
+            if (s->target != NULL && m->numHops == s->target->numHops)
+                break;
+            if (m->numHops == s->room && !growChain(s))
+                continue;
+
+            s->captured[m->numHops] = mid;
+            setHop(s, m, m->numHops, d);
+            m->numHops++;
+            followChain(s, m, to);
+            m->numHops--;
+            setHop(s, m, m->numHops, 0);
+        }
+    }
+
+    if (extended || m->numHops == 0)
+        return;
+
+    promotes = !s->isKing && bitTest(g->kingRow[s->side], sq);
+    if (s->target != NULL) {
+        if (m->numHops == s->target->numHops) {
+            s->to = sq;
+            s->promotes = promotes;
+            s->found++;
+        }
+        return;
+    }
+
+    m->to = sq;
+    m->promotes = promotes;
+    if (s->list != NULL && m->numHops > INLINE_HOPS)
+        addLongMove(s, m);
+    else
+        addMove(s->list, m);
+    s->found++;
+}
+
+/*
+    Word w of the set of empty playable squares, pulled `off` squares: bit i
+    is set if square i + off is empty. Shifting distributes over the bitwise
+    operations, and the dark mask reads as zero off the ends of the board.
+*/
+static inline uint64_t pullEmpty(const Board *b, int w, int off) {
+    const uint64_t *bits = b->bits;
+    int words = b->words;
+    uint64_t occ;
+
+    occ = bitsetPull(bits, words, w, off) |
+          bitsetPull(bits + words, words, w, off) |
+          bitsetPull(bits + 2*words, words, w, off) |
+          bitsetPull(bits + 3*words, words, w, off);
+
+    return bitsetPull(b->geo->dark, words, w, off) & ~occ;
+}
+
+/* Word w of the pieces in own that can jump in direction d. */
+static inline uint64_t jumpersWord(const Board *b, const uint64_t *own,
+                                   const uint64_t *opp0, const uint64_t *opp1,
+                                   int w, int d) {
+    const BoardGeometry *g = b->geo;
+    int off = g->offset[d];
+    uint64_t mask = own[w] & g->jumpMask[d][w];
+
+    if (mask == 0)
+        return 0;
+    mask &= bitsetPull(opp0, b->words, w, off) |
+            bitsetPull(opp1, b->words, w, off);
+    if (mask == 0)
+        return 0;
+    return mask & pullEmpty(b, w, 2*off);
+}
+
+/* Word w of the pieces in own that can step in direction d. */
+static inline uint64_t stepersWord(const Board *b, const uint64_t *own,
+                                   int w, int d) {
+    uint64_t mask = own[w] & b->geo->stepMask[d][w];
+
+    if (mask == 0)
+        return 0;
+    return mask & pullEmpty(b, w, b->geo->offset[d]);
+}
+
+/*
+    Scans the board for capturing pieces. If list is non-NULL every complete
+    capture chain is added to it; if stopAtFirst is set the scan returns as
+    soon as one capturing piece is seen. Returns the number of moves found.
+*/
+static int generateCaptures(const Board *b, enum player side, MoveList *list,
+                            bool stopAtFirst) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    const uint64_t *men = boardBits(b, sideMan(side));
+    const uint64_t *kings = boardBits(b, sideKing(side));
+    const uint64_t *opp0 = boardBits(b, sideMan(other));
+    const uint64_t *opp1 = boardBits(b, sideKing(other));
+    ChainSearch s;
+    Move m;
+    int w, d, k, sq;
+    uint64_t jumpers[2], bits;
+    bool searching = false;
+
+    for (w = 0; w < b->words; w++) {
+        if ((men[w] | kings[w]) == 0)
+            continue;
+
+        jumpers[0] = 0;
+        jumpers[1] = 0;
+        for (d = 0; d < NUM_DIRS; d++) {
+            if (dirAllowed(side, false, d))
+                jumpers[0] |= jumpersWord(b, men, opp0, opp1, w, d);
+            jumpers[1] |= jumpersWord(b, kings, opp0, opp1, w, d);
+        }
+
+        if ((jumpers[0] | jumpers[1]) == 0)
+            continue;
+        if (stopAtFirst)
+            return 1;
+
+        // most positions have no capture, so this is only set up for one
+        if (!searching) {
+            chainInit(&s, b, side, list);
+            m.longPath = NULL;
+            m.isJump = true;
+            m.ownsPath = false;
+            searching = true;
+        }
+
+        for (k = 0; k < 2; k++) {
+            bits = jumpers[k];
+            while (bits) {
+                sq = w*64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                s.from = sq;
+                s.isKing = k == 1;
+                m.from = sq;
+                m.path = 0;
+                m.numHops = 0;
+                followChain(&s, &m, sq);
+            }
+        }
+    }
+
+    if (!searching)
+        return 0;
+    chainFree(&s);
+    return s.found;
+}
+
+/* Adds every non-capturing move for side. */
+static int generateSteps(const Board *b, enum player side, MoveList *list) {
+    const uint64_t *men = boardBits(b, sideMan(side));
+    const uint64_t *kings = boardBits(b, sideKing(side));
+    const BoardGeometry *g = b->geo;
+    int found = 0;
+    int w, d, sq;
+    uint64_t bits;
+    Move m;
+
+    m.longPath = NULL;
+    m.numHops = 1;
+    m.isJump = false;
+    m.ownsPath = false;
+
+    for (w = 0; w < b->words; w++) {
+        if ((men[w] | kings[w]) == 0)
+            continue;
+
+        for (d = 0; d < NUM_DIRS; d++) {
+            bits = stepersWord(b, kings, w, d);
+            if (dirAllowed(side, false, d))
+                bits |= stepersWord(b, men, w, d);
+
+            if (list == NULL) {
+                found += __builtin_popcountll(bits);
+                continue;
+            }
+
+            while (bits) {
+                sq = w*64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                m.from = sq;
+                m.to = sq + g->offset[d];
+                m.path = d;
+                m.promotes = bitTest(men, sq) &&
+                             bitTest(g->kingRow[side], m.to);
+                addMove(list, &m);
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+
+/*
+    One pass of the generator over list: the moves of the piece on sq, or
+    of every piece if sq is negative. Returns the number of legal moves.
+*/
+static int generateOnce(const Board *b, enum player side, int sq,
+                        MoveList *list) {
+    const BoardGeometry *g = b->geo;
+    ChainSearch s;
+    Move m;
+    int type, d, found = 0;
+
+    list->count = 0;
+    list->overflow = false;
+    list->hopsUsed = 0;
+
+    if (sq < 0) {
+        found = generateCaptures(b, side, list, false);
+        if (found == 0)
+            found = generateSteps(b, side, list);
+        return found;
+    }
+
+    type = boardPieceAt(b, sq);
+    if (type == NO_PIECE || pieceOwner(type) != side)
+        return 0;
+
+    m.from = sq;
+    m.longPath = NULL;
+    m.ownsPath = false;
+
+    if (sideHasCapture(b, side)) {
+        chainInit(&s, b, side, list);
+        s.from = sq;
+        s.isKing = type == sideKing(side);
+        m.path = 0;
+        m.numHops = 0;
+        m.isJump = true;
+        followChain(&s, &m, sq);
+        chainFree(&s);
+        return s.found;
+    }
+
+    m.numHops = 1;
+    m.isJump = false;
+    for (d = 0; d < NUM_DIRS; d++) {
+        if (!dirAllowed(side, type == sideKing(side), d) ||
+            !bitTest(g->stepMask[d], sq) ||
+            boardOccupied(b, sq + g->offset[d]))
+            continue;
+
+        m.to = sq + g->offset[d];
+        m.path = d;
+        m.promotes = type == sideMan(side) && bitTest(g->kingRow[side], m.to);
+        addMove(list, &m);
+        found++;
+    }
+
+    return found;
+}
+
+// generateOnce, over again in a larger list for as long as it overflows
+static int generateGrowing(const Board *b, enum player side, int sq,
+                           MoveList *list) {
+    int found;
+
+    if (list->growable && list->capacity == 0)
+        moveListReserve(list, MAX_MOVES, 0);
+
+    found = generateOnce(b, side, sq, list);
+    while (list->overflow && list->growable &&
+           moveListReserve(list, found, list->hopsUsed))
+        found = generateOnce(b, side, sq, list);
+
+    return found;
+}
+
+/*
+    Generates every legal move for side into list. Captures are mandatory, so
+    if any piece can jump only capture chains are listed, each followed to
+    its end. Returns the number of legal moves, which is larger than
+    list->count only if the list overflowed.
+*/
+int generateMoves(const Board *b, enum player side, MoveList *list) {
+    return generateGrowing(b, side, -1, list);
+}
+
+/*
+    Counts side's legal moves without listing them. Plain moves are counted
+    straight from the bitsets; capture chains still have to be walked.
+*/
+int countMoves(const Board *b, enum player side) {
+    int found = generateCaptures(b, side, NULL, false);
+    if (found == 0)
+        found = generateSteps(b, side, NULL);
+    return found;
+}
+
+/* Returns true if side has at least one capture available. */
+bool sideHasCapture(const Board *b, enum player side) {
+    return generateCaptures(b, side, NULL, true) > 0;
+}
+
+/*
+    Generates the legal moves of the piece on square sq only, still honouring
+    mandatory captures elsewhere on the board. Returns the number of moves.
+*/
+int generatePieceMoves(const Board *b, enum player side, int sq,
+                       MoveList *list) {
+    return generateGrowing(b, side, sq, list);
+}
+
+/*
+    Checks that m is one of side's legal moves by playing its hops out from
+    its start square: a step must be to an empty square with no capture
+    on, and a chain must jump an enemy piece with every hop and end where
+    the rules end it. Nothing is listed, so no move is too long to check.
+    On success m (with `to` and `promotes` filled in) is copied to match,
+    which may be m itself or NULL; a copy borrows m's path.
+*/
+bool findMove(const Board *b, enum player side, const Move *m, Move *match) {
+    const BoardGeometry *g = b->geo;
+    ChainSearch s;
+    Move walk;
+    int type, d, to;
+    bool isKing, promotes;
+
+    if (m->numHops < 1 || m->from < 0 || m->from >= b->n * b->n)
+        return false;
+    type = boardPieceAt(b, m->from);
+    if (type == NO_PIECE || pieceOwner(type) != side)
+        return false;
+    isKing = type == sideKing(side);
+
+    if (m->isJump) {
+        chainInit(&s, b, side, NULL);
+        s.from = m->from;
+        s.isKing = isKing;
+        s.target = m;
+        walk.from = m->from;
+        walk.path = 0;
+        walk.longPath = NULL;
+        walk.numHops = 0;
+        walk.isJump = true;
+        walk.ownsPath = false;
+        followChain(&s, &walk, m->from);
+        chainFree(&s);
+        if (s.found == 0)
+            return false;
+        to = s.to;
+        promotes = s.promotes;
+    } else {
+        d = moveDir(m, 0);
+        to = m->from + g->offset[d];
+        if (m->numHops != 1 || !dirAllowed(side, isKing, d) ||
+            !bitTest(g->stepMask[d], m->from) || boardOccupied(b, to) ||
+            sideHasCapture(b, side))
+            return false;
+        promotes = !isKing && bitTest(g->kingRow[side], to);
+    }
+
+    if (match == NULL)
+        return true;
+    if (match != m) {
+        *match = *m;
+        match->ownsPath = false;
+    }
+    if (m->numHops < INLINE_HOPS)
+        match->path &= ((uint64_t)1 << (2*m->numHops)) - 1;
+    match->to = to;
+    match->promotes = promotes;
+    return true;
+}
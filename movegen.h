@@ -0,0 +1,46 @@
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+#include "board.h"
+
+// room a growable list starts out with: enough for any position on boards
+// up to about 16x16
+#define MAX_MOVES 256
+
+
+/*
+    Storage for generated moves. A list set up with moveListInit uses the
+    caller's array and never allocates: if the position has more moves than
+    fit, or a chain longer than INLINE_HOPS hops (which needs room for its
+    path that such a list lacks), overflow is set and the extra moves are
+    dropped. One set up with moveListAlloc grows to hold every move, paths
+    and all, and keeps its room from one position to the next until
+    moveListFree.
+*/
+typedef struct {
+    Move *moves;
+    int count;
+    int capacity;
+    bool overflow;
+
+    // the paths of chains too long for their own path word; hopsUsed also
+    // counts the words of moves that didn't fit
+    uint64_t *hops;
+    size_t hopsUsed;
+    size_t hopCapacity;
+    bool growable;
+} MoveList;
+
+
+void moveListInit(MoveList *list, Move *storage, int capacity);
+void moveListAlloc(MoveList *list);
+void moveListFree(MoveList *list);
+
+int generateMoves(const Board *b, enum player side, MoveList *list);
+int generatePieceMoves(const Board *b, enum player side, int sq,
+                       MoveList *list);
+int countMoves(const Board *b, enum player side);
+bool sideHasCapture(const Board *b, enum player side);
+bool findMove(const Board *b, enum player side, const Move *m, Move *match);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "netbuf.h"
+
+// read at most this much from a socket in one call
+#define READ_CHUNK 4096
+
+
+void bufferInit(NetBuffer *buf, size_t initial, size_t limit) {
+    buf->data = malloc(initial);
+    buf->start = 0;
+    buf->len = 0;
+    buf->cap = initial;
+    buf->limit = limit;
+}
+
+void bufferFree(NetBuffer *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->cap = buf->len = buf->start = 0;
+}
+
+/*
+    Makes room for n more bytes after the queued ones, first by sliding the
+    queued bytes to the front and then by growing. Returns false if that
+    would take the buffer past its limit.
+*/
+bool bufferReserve(NetBuffer *buf, size_t n) {
+    size_t need = buf->len + n;
+    size_t cap;
+
+    if (buf->start + need <= buf->cap)
+        return true;
+
+    if (buf->start > 0) {
+        memmove(buf->data, buf->data + buf->start, buf->len);
+        buf->start = 0;
+        if (need <= buf->cap)
+            return true;
+    }
+
+    if (need > buf->limit)
+        return false;
+
+    cap = buf->cap ? buf->cap : 64;
+    while (cap < need)
+        cap *= 2;
+    if (cap > buf->limit)
+        cap = buf->limit;
+
+    buf->data = realloc(buf->data, cap);
+    buf->cap = cap;
+    return true;
+}
+
+bool bufferAppend(NetBuffer *buf, const void *bytes, size_t n) {
+    if (!bufferReserve(buf, n))
+        return false;
+    memcpy(bufferTail(buf), bytes, n);
+    buf->len += n;
+    return true;
+}
+
+void bufferConsume(NetBuffer *buf, size_t n) {
+    if (n >= buf->len) {
+        buf->start = 0;
+        buf->len = 0;
+    } else {
+        buf->start += n;
+        buf->len -= n;
+    }
+}
+
+/*
+    Reads whatever the socket has, up to the buffer limit. Returns the number
+    of bytes read, 0 on end of file, or -1 with errno set (EAGAIN when there
+    is simply nothing to read, ENOBUFS when the buffer is full).
+*/
+ssize_t bufferReadFrom(NetBuffer *buf, int fd) {
+    size_t room = READ_CHUNK;
+    ssize_t n;
+
+    if (buf->len + room > buf->limit)
+        room = buf->limit - buf->len;
+    if (room == 0 || !bufferReserve(buf, room)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    n = read(fd, bufferTail(buf), room);
+    if (n > 0)
+        buf->len += n;
+    return n;
+}
+
+/*
+    Writes as much of the queue as the socket will take. Returns the number
+    of bytes written or -1 with errno set.
+*/
+ssize_t bufferWriteTo(NetBuffer *buf, int fd) {
+    ssize_t n;
+
+    if (buf->len == 0)
+        return 0;
+
+    n = write(fd, bufferHead(buf), buf->len);
+    if (n > 0)
+        bufferConsume(buf, n);
+    return n;
+}
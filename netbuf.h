@@ -0,0 +1,39 @@
+#ifndef NETBUF_H
+#define NETBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/*
+    Byte queue for a non-blocking socket. Bytes are appended at the end and
+    consumed from the front; the buffer grows on demand up to limit, so a
+    peer that stops reading can't make us hold unbounded data.
+*/
+typedef struct {
+    char *data;
+    size_t start;
+    size_t len;
+    size_t cap;
+    size_t limit;
+} NetBuffer;
+
+
+void bufferInit(NetBuffer *buf, size_t initial, size_t limit);
+void bufferFree(NetBuffer *buf);
+bool bufferReserve(NetBuffer *buf, size_t n);
+bool bufferAppend(NetBuffer *buf, const void *bytes, size_t n);
+void bufferConsume(NetBuffer *buf, size_t n);
+ssize_t bufferReadFrom(NetBuffer *buf, int fd);
+ssize_t bufferWriteTo(NetBuffer *buf, int fd);
+
+static inline char* bufferHead(const NetBuffer *buf) {
+    return buf->data + buf->start;
+}
+
+static inline char* bufferTail(const NetBuffer *buf) {
+    return buf->data + buf->start + buf->len;
+}
+
+#endif
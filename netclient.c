@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "netclient.h"
+
+// server events that can wait for the game thread to pick them up
+#define EVENT_QUEUE_SIZE 1024
+
+// how long the reader sleeps when the game thread has fallen that far behind
+#define QUEUE_FULL_WAIT_US 1000
+
+// after losing the server mid-game, try to resume this often for this long
+#define RESUME_RETRY_MS 250
+#define RESUME_SECONDS 30
+
+// how many times the reader looks in an empty ring before it sleeps, when
+// there is a core to spare for the server to fill it from
+#define SHM_SPINS 20000
+
+// how long a move waits for room in a full ring before trying again
+#define RING_FULL_WAIT_US 100
+
+
+/* Hands every byte queued in l->out to the socket. */
+static bool flushLink(ServerLink *l) {
+    ssize_t n;
+
+    while (l->out.len > 0) {
+        n = bufferWriteTo(&l->out, l->fd);
+        if (n < 0 && errno != EINTR) {
+            bufferConsume(&l->out, l->out.len);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Hands every byte queued in l->out to the ring. Gives up, dropping the
+    bytes, if the ring is corrupt or the reader has gone back to TCP.
+*/
+static bool flushRing(ServerLink *l) {
+    while (l->out.len > 0 && atomic_load(&l->overShm)) {
+        if (shmWriteFrom(&l->shm, &l->out) < 0) {
+            if (errno != EAGAIN)
+                break;
+            usleep(RING_FULL_WAIT_US);
+        }
+    }
+    if (l->out.len > 0) {
+        bufferConsume(&l->out, l->out.len);
+        return false;
+    }
+    return true;
+}
+
+/* Whether host is this one, by a loopback address. */
+static bool isLocalHost(const char *host) {
+    struct hostent *server = gethostbyname(host);
+
+    return server != NULL && server->h_addrtype == AF_INET &&
+           (unsigned char)server->h_addr[0] == 127;
+}
+
+/* Opens a connection to the local socket of the server on port, or -1. */
+static int openLocalSocket(int port) {
+    struct sockaddr_un addr;
+    socklen_t len = shmLocalAddress(&addr, port);
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Opens a connection to host:port, or returns -1 saying why not if loud. */
+static int openSocket(const char *host, int port, bool loud) {
+    struct hostent *server;
+    struct sockaddr_in serv_addr;
+    int fd, one = 1;
+
+    server = gethostbyname(host);
+    if (server == NULL) {
+        if (loud)
+            fprintf(stderr, "ERROR, no such host\n");
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        if (loud)
+            printf("ERROR opening socket\n");
+        return -1;
+    }
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serv_addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        if (loud)
+            printf("ERROR connecting\n");
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/*
+    Frames HELLO into out, with token to resume a game, or 0 and the board
+    size and rating for a new one, and whether shared memory comes with it.
+*/
+static void sayHello(NetBuffer *out, uint64_t token, int n, int rating,
+                     bool shm) {
+    Hello hello;
+
+    hello.version = PROTOCOL_VERSION;
+    hello.token = token;
+    hello.n = n;
+    hello.rating = rating;
+    hello.shm = shm;
+    bufferInit(out, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+    writeHello(out, &hello);
+}
+
+/*
+    Sends the opening frame, HELLO or WATCH, on fd, with the descriptors
+    of shared memory if fds isn't NULL, and reads the answer into
+    *welcome, leaving anything after it in in. Returns false if the
+    connection failed, or with *code set if the server refused us.
+*/
+static bool greet(int fd, NetBuffer *in, const NetBuffer *opening,
+                  const int *fds, Welcome *welcome, int *code) {
+    Frame f;
+    bool sent;
+
+    // say which protocol we speak; the server seats us or turns us away
+    if (fds != NULL)
+        sent = shmSendOpening(fd, opening, fds);
+    else
+        sent = write(fd, bufferHead(opening), opening->len) ==
+               (ssize_t)opening->len;
+
+    *code = 0;
+    if (!sent || !recvFrame(fd, in, &f))
+        return false;
+    if (parseError(&f, code) || !parseWelcome(&f, welcome)) {
+        if (*code == 0)
+            *code = ERROR_BAD_FRAME;
+        return false;
+    }
+    bufferConsume(in, f.size);
+    return true;
+}
+
+/*
+    Connects l to the server with the given opening, printing what went
+    wrong. With shm, and the server on this host, shared memory is passed
+    along over the local socket; TCP is used otherwise.
+*/
+static bool linkOpen(ServerLink *l, const char *host, int port,
+                     const NetBuffer *opening, bool shm) {
+    int fds[SHM_FDS], code;
+    bool mapped = false, ok;
+
+    memset(l, 0, sizeof(ServerLink));
+    l->host = host;
+    l->port = port;
+    l->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPINS : 0;
+
+    // a server vanishing mid-write must not kill us; we reconnect instead
+    signal(SIGPIPE, SIG_IGN);
+
+    l->fd = -1;
+    if (shm && isLocalHost(host)) {
+        l->fd = openLocalSocket(port);
+        if (l->fd >= 0)
+            mapped = shmCreate(&l->shm, fds);
+    }
+    if (l->fd < 0)
+        l->fd = openSocket(host, port, true);
+    if (l->fd < 0)
+        return false;
+
+    bufferInit(&l->in, 256, MAX_FRAME_LEN + 16);
+    bufferInit(&l->out, MAX_SMALL_FRAME, MAX_FRAME_LEN + 16);
+
+    ok = greet(l->fd, &l->in, opening, mapped ? fds : NULL, &l->welcome,
+               &code);
+    if (mapped) {
+        shmPassed(&l->shm, fds);
+        if (ok && l->welcome.shm)
+            atomic_store(&l->overShm, true);
+        else
+            shmClose(&l->shm);
+    }
+    if (!ok) {
+        if (code != 0)
+            printf("ERROR server refused us (code %d)\n", code);
+        else
+            printf("ERROR receiving welcome\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+    Connects to the server and asks for a game on an n by n board (0 for
+    the server's size) against a player rated about the same. On success
+    l->welcome holds our seat, the board size, our session token and the
+    number the game can be watched by. Prints what went wrong otherwise.
+    With shm, asks for shared memory if the server is on this host.
+*/
+bool linkConnect(ServerLink *l, const char *host, int port, int n,
+                 int rating, bool shm) {
+    NetBuffer hello;
+    bool ok;
+
+    sayHello(&hello, 0, n, rating, shm);
+    ok = linkOpen(l, host, port, &hello, shm);
+    bufferFree(&hello);
+    return ok;
+}
+
+/*
+    Connects to the server as a spectator of the given game. Events are
+    read as for a player, starting with an EVENT_STATE_SYNC of the board
+    as it stands; moves can't be sent, and a dropped connection is not
+    resumed.
+*/
+bool linkWatch(ServerLink *l, const char *host, int port, uint64_t game) {
+    NetBuffer opening;
+    Watch watch;
+    bool ok;
+
+    watch.version = PROTOCOL_VERSION;
+    watch.game = game;
+    bufferInit(&opening, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+    writeWatch(&opening, &watch);
+    ok = linkOpen(l, host, port, &opening, false);
+    bufferFree(&opening);
+    return ok;
+}
+
+/*
+    Gets our seat back after the connection dropped, retrying while the
+    server might be restarting. The new socket takes over l->fd's number,
+    so a move being sent from the game thread meanwhile at worst fails.
+    Returns false if the server has forgotten the game or never came back.
+*/
+static bool linkResume(ServerLink *l) {
+    NetBuffer in, hello;
+    Welcome welcome;
+    int fd, code = 0, tries;
+    bool ok = false;
+
+    // moves from the game thread go to the socket again, once it's back
+    atomic_store(&l->overShm, false);
+
+    printf("Lost the server; trying to resume the game\n");
+    sayHello(&hello, l->welcome.token, 0, 0, false);
+    for (tries = 0; !ok && tries < RESUME_SECONDS * 1000 / RESUME_RETRY_MS;
+         tries++) {
+        if (tries > 0)
+            usleep(RESUME_RETRY_MS * 1000);
+        fd = openSocket(l->host, l->port, false);
+        if (fd < 0)
+            continue;
+
+        bufferInit(&in, 256, MAX_FRAME_LEN + 16);
+        if (greet(fd, &in, &hello, NULL, &welcome, &code) &&
+            welcome.role == l->welcome.role && dup2(fd, l->fd) >= 0) {
+            close(fd);
+            bufferFree(&l->in);
+            l->in = in;
+            ok = true;
+            break;
+        }
+        close(fd);
+        bufferFree(&in);
+        if (code != 0)
+            break;
+    }
+    bufferFree(&hello);
+
+    printf(ok ? "Resumed the game\n" : "ERROR could not resume the game\n");
+    return ok;
+}
+
+/*
+    Frames the move and blocks until it has all been handed to the socket,
+    or the ring.
+*/
+bool linkSendMove(ServerLink *l, const Move *m) {
+    bool sent;
+
+    writeMove(&l->out, m);
+    sent = atomic_load(&l->overShm) ? flushRing(l) : flushLink(l);
+    if (!sent) {
+        printf("ERROR sending move to server \n");
+        return false;
+    }
+    return true;
+}
+
+/*
+    Blocks until a whole frame has come through the ring, like recvFrame.
+    Spins a little first if it can, then sleeps on its bell and the socket
+    together; once the socket says the server has gone, what is left in the
+    ring is still read.
+*/
+static bool recvRingFrame(ServerLink *l, Frame *f) {
+    struct pollfd fds[2];
+    bool gone = false;
+    int found, spins = 0;
+
+    for (;;) {
+        found = peekFrame(&l->in, f);
+        if (found != 0)
+            return found > 0;
+
+        if (shmReadInto(&l->shm, &l->in) > 0) {
+            spins = 0;
+            continue;
+        }
+        if (errno != EAGAIN || gone)
+            return false;
+        if (spins++ < l->spins || !shmWaitRead(&l->shm))
+            continue;
+
+        fds[0].fd = l->shm.bell.readFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = l->fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            return false;
+        wakerDrain(&l->shm.bell);
+
+        // nothing more comes on the socket; readable means hung up
+        if (fds[1].revents != 0)
+            gone = true;
+    }
+}
+
+/*
+    Blocks until the server's next frame has arrived and decodes it into e.
+    Returns false, with e->type EVENT_CLOSED, once the connection is gone.
+*/
+bool linkReadEvent(ServerLink *l, ServerEvent *e) {
+    Frame f;
+    GameOver over;
+    bool ok;
+
+    memset(e, 0, sizeof(ServerEvent));
+    while (atomic_load(&l->overShm) ? !recvRingFrame(l, &f) :
+                                      !recvFrame(l->fd, &l->in, &f)) {
+        if (l->welcome.token == 0 || !linkResume(l)) {
+            e->type = EVENT_CLOSED;
+            return false;
+        }
+    }
+
+    switch (f.type) {
+        case FRAME_MOVE:
+            e->type = EVENT_MOVE;
+            ok = parseMove(&f, &e->move);
+            break;
+        case FRAME_GAME_OVER:
+            e->type = EVENT_GAME_OVER;
+            ok = parseGameOver(&f, &over);
+            e->player = over.winner;
+            break;
+        case FRAME_STATE_SYNC:
+            e->type = EVENT_STATE_SYNC;
+            e->board = malloc(sizeof(Board));
+            boardInit(e->board, l->welcome.n);
+            ok = parseStateSync(&f, e->board, &e->player);
+            if (!ok) {
+                boardFree(e->board);
+                free(e->board);
+                e->board = NULL;
+            }
+            break;
+        case FRAME_ERROR:
+            e->type = EVENT_ERROR;
+            ok = parseError(&f, &e->code);
+            break;
+        default:
+            ok = false;
+    }
+    bufferConsume(&l->in, f.size);
+
+    if (!ok) {
+        e->type = EVENT_CLOSED;
+        return false;
+    }
+    return true;
+}
+
+static void* readerThread(void *arg) {
+    ServerLink *l = arg;
+    ServerEvent e;
+    bool open;
+
+    do {
+        open = linkReadEvent(l, &e);
+        while (!spscPush(&l->events, &e))
+            usleep(QUEUE_FULL_WAIT_US);
+    } while (open);
+
+    return NULL;
+}
+
+/* Starts the reader thread; from now on read events with linkPollEvent. */
+bool linkStart(ServerLink *l) {
+    if (!spscInit(&l->events, sizeof(ServerEvent), EVENT_QUEUE_SIZE))
+        return false;
+    return pthread_create(&l->reader, NULL, readerThread, l) == 0;
+}
+
+/* Takes the next event off the queue without waiting. False if none. */
+bool linkPollEvent(ServerLink *l, ServerEvent *e) {
+    return spscPop(&l->events, e);
+}
@@ -0,0 +1,93 @@
+#ifndef NETCLIENT_H
+#define NETCLIENT_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "netbuf.h"
+#include "protocol.h"
+#include "shmring.h"
+#include "spsc.h"
+
+
+/*
+    A client's connection to the server. After linkStart, a reader thread
+    sits blocked on the socket and turns each frame into a ServerEvent,
+    handed to the thread running the game through a lock-free
+    single-producer/single-consumer queue, so that thread never waits on the
+    network. Moves are sent straight from the game thread; they are a few
+    bytes and never block for long.
+
+    If the connection drops mid-game, reading reconnects and resumes the
+    session with the server's token, for as long as the server might be
+    restarting; the server then sends the whole board as an
+    EVENT_STATE_SYNC, which also brings back a move lost on the way out.
+
+    A player on the same host as the server can ask for shared memory
+    (see shmring.h) instead: the link then passes it over the server's
+    local socket, and if the server takes it up, frames go both ways
+    through the rings while the socket only tells the reader when the
+    server has gone. Anywhere else, or if the server doesn't, it is TCP as
+    usual. A resumed session is always TCP.
+
+    A spectator's link, from linkWatch, reads the same events and only
+    those.
+*/
+
+enum serverEventType {
+    EVENT_MOVE,
+    EVENT_GAME_OVER,
+    EVENT_STATE_SYNC,
+    EVENT_ERROR,
+    EVENT_CLOSED        // the server hung up or sent garbage; nothing follows
+};
+
+typedef struct {
+    enum serverEventType type;
+
+    // EVENT_MOVE: the opponent's move, to and promotes not yet filled in,
+    // which the receiver must moveFree
+    Move move;
+
+    // EVENT_GAME_OVER: the winner; EVENT_STATE_SYNC: the side to move
+    enum player player;
+
+    // EVENT_ERROR: a protocolError
+    int code;
+
+    // EVENT_STATE_SYNC: the whole board, which the receiver must boardFree
+    // and free
+    Board *board;
+} ServerEvent;
+
+typedef struct {
+    int fd;
+    Welcome welcome;
+    NetBuffer in, out;
+
+    // where to reconnect to
+    const char *host;
+    int port;
+
+    pthread_t reader;
+    SpscQueue events;
+
+    // set while frames go through shm rather than fd; the mapping is kept
+    // once made, so a move sent just as the reader drops it is only lost
+    ShmLink shm;
+    atomic_bool overShm;
+    int spins;              // ring checks before the reader sleeps
+} ServerLink;
+
+
+bool linkConnect(ServerLink *l, const char *host, int port, int n,
+                 int rating, bool shm);
+bool linkWatch(ServerLink *l, const char *host, int port, uint64_t game);
+bool linkStart(ServerLink *l);
+bool linkSendMove(ServerLink *l, const Move *m);
+bool linkReadEvent(ServerLink *l, ServerEvent *e);
+bool linkPollEvent(ServerLink *l, ServerEvent *e);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "perft.h"
+#include "clock.h"
+#include "movegen.h"
+
+
+/*
+    Per-thread scratch: a copy of the position and one growable move list
+    per ply, so the counting itself never allocates once warmed up.
+*/
+typedef struct {
+    Board board;
+    MoveList lists[MAX_PERFT_DEPTH];
+} PerftWorker;
+
+// work shared by the threads splitting the root
+typedef struct {
+    const Board *root;
+    enum player side;
+    int depth;
+    Move *rootMoves;
+    int numRootMoves;
+    uint64_t *rootCounts;
+    atomic_int next;
+} PerftJob;
+
+
+static void workerInit(PerftWorker *w, const Board *b) {
+    int i;
+
+    boardInit(&w->board, b->n);
+    boardCopy(&w->board, b);
+    for (i = 0; i < MAX_PERFT_DEPTH; i++)
+        moveListAlloc(&w->lists[i]);
+}
+
+static void workerFree(PerftWorker *w) {
+    int i;
+
+    for (i = 0; i < MAX_PERFT_DEPTH; i++)
+        moveListFree(&w->lists[i]);
+    boardFree(&w->board);
+}
+
+/*
+    Counts the leaves depth plies below the worker's position. The last ply
+    is bulk-counted: its moves are counted but never played.
+*/
+static uint64_t perftCount(PerftWorker *w, enum player side, int depth,
+                           int ply) {
+    MoveList *list = &w->lists[ply];
+    Undo undo;
+    uint64_t nodes = 0;
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    int i;
+
+    if (depth == 0)
+        return 1;
+    if (depth == 1)
+        return countMoves(&w->board, side);
+
+    generateMoves(&w->board, side, list);
+    for (i = 0; i < list->count; i++) {
+        boardApplyMove(&w->board, &list->moves[i], &undo);
+        nodes += perftCount(w, other, depth - 1, ply + 1);
+        boardUndoMove(&w->board, &list->moves[i], &undo);
+    }
+
+    return nodes;
+}
+
+/* Single-threaded perft of b with side to move. */
+uint64_t perft(const Board *b, enum player side, int depth) {
+    PerftWorker w;
+    uint64_t nodes;
+
+    workerInit(&w, b);
+    nodes = perftCount(&w, side, depth, 0);
+    workerFree(&w);
+
+    return nodes;
+}
+
+/* Thread body: takes root moves off the shared counter until none are left. */
+static void* perftThread(void *arg) {
+    PerftJob *job = arg;
+    PerftWorker w;
+    Undo undo;
+    enum player other = job->side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    int i;
+
+    workerInit(&w, job->root);
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->numRootMoves) {
+        boardApplyMove(&w.board, &job->rootMoves[i], &undo);
+        job->rootCounts[i] = perftCount(&w, other, job->depth - 1, 1);
+        boardUndoMove(&w.board, &job->rootMoves[i], &undo);
+    }
+    workerFree(&w);
+
+    return NULL;
+}
+
+/*
+    Counts the leaves at depth plies, splitting the root moves among
+    numThreads threads. Fills counts with the subtotal of each root move.
+*/
+static uint64_t perftSplit(const Board *b, enum player side, int depth,
+                           int numThreads, MoveList *rootList,
+                           uint64_t *counts) {
+    PerftJob job;
+    pthread_t *threads;
+    uint64_t nodes = 0;
+    int i;
+
+    job.root = b;
+    job.side = side;
+    job.depth = depth;
+    job.rootMoves = rootList->moves;
+    job.numRootMoves = rootList->count;
+    job.rootCounts = counts;
+    atomic_init(&job.next, 0);
+
+    threads = malloc(sizeof(pthread_t) * numThreads);
+    for (i = 0; i < numThreads; i++)
+        pthread_create(&threads[i], NULL, perftThread, &job);
+    for (i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    for (i = 0; i < rootList->count; i++)
+        nodes += counts[i];
+    return nodes;
+}
+
+/*
+    Runs perft from the starting position of an n by n board for every depth
+    up to depth, reporting node counts and speed. With divide set, also
+    prints the subtotal under each root move of the deepest search.
+*/
+void runPerft(int n, int depth, int numThreads, bool divide) {
+    Board b;
+    MoveList rootList;
+    uint64_t *counts;
+    uint64_t nodes;
+    int d, i;
+    double start, elapsed;
+    char buf[MOVE_TEXT_LEN];
+
+    if (depth > MAX_PERFT_DEPTH)
+        depth = MAX_PERFT_DEPTH;
+
+    boardInit(&b, n);
+    boardSetup(&b);
+
+    moveListAlloc(&rootList);
+    generateMoves(&b, PLAYER_ONE, &rootList);
+    counts = malloc(sizeof(uint64_t) * (rootList.count + 1));
+
+    printf("perft n=%d threads=%d\n", n, numThreads);
+
+    for (d = 1; d <= depth; d++) {
+        start = now();
+        if (d == 1)
+            nodes = countMoves(&b, PLAYER_ONE);
+        else
+            nodes = perftSplit(&b, PLAYER_ONE, d, numThreads, &rootList,
+                               counts);
+        elapsed = now() - start;
+
+        printf("depth %2d  %15llu nodes  %9.3f s  %10.0f nps\n", d,
+               (unsigned long long)nodes, elapsed,
+               elapsed > 0 ? nodes / elapsed : 0.);
+        fflush(stdout);
+    }
+
+    if (divide && depth > 1) {
+        printf("\ndivide at depth %d\n", depth);
+        for (i = 0; i < rootList.count; i++) {
+            printf("%-24s %llu\n",
+                   moveToString(&b, &rootList.moves[i], buf, sizeof(buf)),
+                   (unsigned long long)counts[i]);
+        }
+    } else if (divide) {
+        printf("\ndivide at depth 1\n");
+        for (i = 0; i < rootList.count; i++)
+            printf("%-24s 1\n",
+                   moveToString(&b, &rootList.moves[i], buf, sizeof(buf)));
+    }
+
+    free(counts);
+    moveListFree(&rootList);
+    boardFree(&b);
+}
@@ -0,0 +1,15 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// deepest perft the counter keeps per-ply move buffers for
+#define MAX_PERFT_DEPTH 64
+
+uint64_t perft(const Board *b, enum player side, int depth);
+void runPerft(int n, int depth, int numThreads, bool divide);
+
+#endif
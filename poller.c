@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "poller.h"
+
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+#else
+    #include <sys/types.h>
+    #include <sys/event.h>
+    #include <sys/time.h>
+#endif
+
+// most events pulled from the kernel in one pollerWait
+#define MAX_KERNEL_EVENTS 256
+
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool wakerCreate(Waker *w) {
+#ifdef __linux__
+    w->readFd = w->writeFd = eventfd(0, EFD_NONBLOCK);
+    return w->readFd >= 0;
+#else
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return false;
+    setNonBlocking(fds[0]);
+    setNonBlocking(fds[1]);
+    w->readFd = fds[0];
+    w->writeFd = fds[1];
+    return true;
+#endif
+}
+
+void wakerSignal(Waker *w) {
+#ifdef __linux__
+    uint64_t one = 1;
+    write(w->writeFd, &one, sizeof(one));
+#else
+    char c = 0;
+    write(w->writeFd, &c, 1);
+#endif
+}
+
+/* Clears pending wakeups so readFd stops reporting readable. */
+void wakerDrain(Waker *w) {
+    char buf[64];
+
+    while (read(w->readFd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+void pollerClose(Poller *p) {
+    if (p->fd >= 0)
+        close(p->fd);
+    p->fd = -1;
+}
+
+
+#ifdef __linux__
+
+bool pollerCreate(Poller *p) {
+    p->fd = epoll_create1(0);
+    return p->fd >= 0;
+}
+
+static bool epollControl(Poller *p, int op, int fd, int events, void *data) {
+    struct epoll_event ev;
+
+    ev.events = 0;
+    if (events & POLL_READ)
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & POLL_WRITE)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = data;
+
+    return epoll_ctl(p->fd, op, fd, &ev) == 0;
+}
+
+bool pollerAdd(Poller *p, int fd, int events, void *data) {
+    return epollControl(p, EPOLL_CTL_ADD, fd, events, data);
+}
+
+bool pollerModify(Poller *p, int fd, int events, void *data) {
+    return epollControl(p, EPOLL_CTL_MOD, fd, events, data);
+}
+
+void pollerRemove(Poller *p, int fd) {
+    struct epoll_event ev;
+    epoll_ctl(p->fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/*
+    Waits up to timeoutMs (-1 for ever) for events. Errors and hang-ups are
+    reported as readable so the next read sees them.
+*/
+int pollerWait(Poller *p, PollEvent *events, int maxEvents, int timeoutMs) {
+    struct epoll_event kernel[MAX_KERNEL_EVENTS];
+    int i, n;
+
+    if (maxEvents > MAX_KERNEL_EVENTS)
+        maxEvents = MAX_KERNEL_EVENTS;
+
+    n = epoll_wait(p->fd, kernel, maxEvents, timeoutMs);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < n; i++) {
+        events[i].data = kernel[i].data.ptr;
+        events[i].events = 0;
+        if (kernel[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            events[i].events |= POLL_READ;
+        if (kernel[i].events & EPOLLOUT)
+            events[i].events |= POLL_WRITE;
+    }
+    return n;
+}
+
+#else
+
+bool pollerCreate(Poller *p) {
+    p->fd = kqueue();
+    return p->fd >= 0;
+}
+
+/* kqueue has one filter per direction; turn each on or off. */
+static bool kqueueSet(Poller *p, int fd, int events, void *data) {
+    struct kevent changes[2];
+
+    EV_SET(&changes[0], fd, EVFILT_READ,
+           EV_ADD | ((events & POLL_READ) ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+    EV_SET(&changes[1], fd, EVFILT_WRITE,
+           EV_ADD | ((events & POLL_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+
+    return kevent(p->fd, changes, 2, NULL, 0, NULL) == 0;
+}
+
+bool pollerAdd(Poller *p, int fd, int events, void *data) {
+    return kqueueSet(p, fd, events, data);
+}
+
+bool pollerModify(Poller *p, int fd, int events, void *data) {
+    return kqueueSet(p, fd, events, data);
+}
+
+void pollerRemove(Poller *p, int fd) {
+    struct kevent changes[2];
+
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(p->fd, changes, 2, NULL, 0, NULL);
+}
+
+int pollerWait(Poller *p, PollEvent *events, int maxEvents, int timeoutMs) {
+    struct kevent kernel[MAX_KERNEL_EVENTS];
+    struct timespec ts, *tsp = NULL;
+    int i, n;
+
+    if (maxEvents > MAX_KERNEL_EVENTS)
+        maxEvents = MAX_KERNEL_EVENTS;
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        tsp = &ts;
+    }
+
+    n = kevent(p->fd, NULL, 0, kernel, maxEvents, tsp);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < n; i++) {
+        events[i].data = kernel[i].udata;
+        events[i].events = kernel[i].filter == EVFILT_WRITE ? POLL_WRITE
+                                                            : POLL_READ;
+        if (kernel[i].flags & (EV_EOF | EV_ERROR))
+            events[i].events |= POLL_READ;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdbool.h>
+
+// readiness flags for pollerAdd/pollerModify and PollEvent.events
+#define POLL_READ   1
+#define POLL_WRITE  2
+
+
+/*
+    Thin wrapper over the kernel's readiness notification: epoll on Linux,
+    kqueue on OS X. Each registered fd carries a user pointer that comes back
+    with its events.
+*/
+typedef struct {
+    int fd;
+} Poller;
+
+typedef struct {
+    void *data;
+    int events;
+} PollEvent;
+
+
+bool pollerCreate(Poller *p);
+void pollerClose(Poller *p);
+bool pollerAdd(Poller *p, int fd, int events, void *data);
+bool pollerModify(Poller *p, int fd, int events, void *data);
+void pollerRemove(Poller *p, int fd);
+int pollerWait(Poller *p, PollEvent *events, int maxEvents, int timeoutMs);
+
+/*
+    Lets another thread wake a loop blocked in pollerWait: readFd is watched
+    by the loop, wakerSignal makes it readable. An eventfd on Linux, a pipe
+    elsewhere.
+*/
+typedef struct {
+    int readFd;
+    int writeFd;
+} Waker;
+
+bool wakerCreate(Waker *w);
+void wakerSignal(Waker *w);
+void wakerDrain(Waker *w);
+
+bool setNonBlocking(int fd);
+
+#endif
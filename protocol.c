@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "protocol.h"
+#include "varint.h"
+
+
+/*
+    Output cursor for encoding a payload. With data NULL it only counts, so
+    a large payload can be sized before it is written.
+*/
+typedef struct {
+    unsigned char *data;
+    size_t len;
+} Encoder;
+
+// input cursor over a payload; ok goes false on any overrun
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    bool ok;
+} Decoder;
+
+
+static void putByte(Encoder *e, unsigned int byte) {
+    if (e->data != NULL)
+        e->data[e->len] = (unsigned char)byte;
+    e->len++;
+}
+
+static void putVarint(Encoder *e, uint64_t v) {
+    unsigned char bytes[VARINT_MAX_BYTES];
+    size_t i, len = varintEncode(bytes, v);
+
+    for (i = 0; i < len; i++)
+        putByte(e, bytes[i]);
+}
+
+static unsigned int getByte(Decoder *d) {
+    if (d->pos >= d->len) {
+        d->ok = false;
+        return 0;
+    }
+    return d->data[d->pos++];
+}
+
+static uint64_t getVarint(Decoder *d) {
+    return varintDecode(d->data, d->len, &d->pos, &d->ok);
+}
+
+static void decoderInit(Decoder *d, const Frame *f) {
+    d->data = f->payload;
+    d->len = f->len;
+    d->pos = 0;
+    d->ok = true;
+}
+
+// a payload must be used up exactly
+static bool decoderDone(const Decoder *d) {
+    return d->ok && d->pos == d->len;
+}
+
+
+/* Appends a frame of type with the len payload bytes to buf. */
+static bool appendFrame(NetBuffer *buf, int type, const unsigned char *payload,
+                        size_t len) {
+    unsigned char header[16];
+    Encoder e = { header, 0 };
+
+    putVarint(&e, len + 1);
+    putByte(&e, type);
+
+    if (!bufferReserve(buf, e.len + len))
+        return false;
+    bufferAppend(buf, header, e.len);
+    bufferAppend(buf, payload, len);
+    return true;
+}
+
+bool writeHello(NetBuffer *buf, const Hello *hello) {
+    unsigned char payload[MAX_SMALL_FRAME];
+    Encoder e = { payload, 0 };
+
+    putVarint(&e, hello->version);
+    putVarint(&e, hello->token);
+    putVarint(&e, hello->n);
+    putVarint(&e, hello->rating);
+    putByte(&e, hello->shm);
+    return appendFrame(buf, FRAME_HELLO, payload, e.len);
+}
+
+bool writeWelcome(NetBuffer *buf, const Welcome *welcome) {
+    unsigned char payload[MAX_SMALL_FRAME];
+    Encoder e = { payload, 0 };
+
+    putVarint(&e, welcome->version);
+    putByte(&e, welcome->role);
+    putVarint(&e, welcome->n);
+    putVarint(&e, welcome->token);
+    putVarint(&e, welcome->game);
+    putByte(&e, welcome->shm);
+    return appendFrame(buf, FRAME_WELCOME, payload, e.len);
+}
+
+bool writeWatch(NetBuffer *buf, const Watch *watch) {
+    unsigned char payload[MAX_SMALL_FRAME];
+    Encoder e = { payload, 0 };
+
+    putVarint(&e, watch->version);
+    putVarint(&e, watch->game);
+    return appendFrame(buf, FRAME_WATCH, payload, e.len);
+}
+
+/* Start square, then (hop count << 1 | jump flag), then the packed hops. */
+static void encodeMove(Encoder *e, const Move *m) {
+    const uint64_t *words = m->longPath != NULL ? m->longPath : &m->path;
+    int i;
+
+    putVarint(e, m->from);
+    putVarint(e, (uint64_t)m->numHops << 1 | m->isJump);
+    for (i = 0; i < m->numHops; i += 4)
+        putByte(e, (words[i >> 5] >> (2*(i & 31))) & 0xff);
+}
+
+/*
+    A move of up to INLINE_HOPS hops is a small frame; a longer chain is
+    sized first and encoded straight into buf, as a STATE_SYNC is.
+*/
+bool writeMove(NetBuffer *buf, const Move *m) {
+    unsigned char payload[MAX_SMALL_FRAME];
+    Encoder sizer = { NULL, 0 };
+    Encoder e = { payload, 0 };
+
+    if (m->numHops <= INLINE_HOPS) {
+        encodeMove(&e, m);
+        return appendFrame(buf, FRAME_MOVE, payload, e.len);
+    }
+
+    encodeMove(&sizer, m);
+    if (sizer.len + 1 > MAX_FRAME_LEN)
+        return false;
+
+    putVarint(&e, sizer.len + 1);
+    putByte(&e, FRAME_MOVE);
+    if (!bufferReserve(buf, e.len + sizer.len))
+        return false;
+    bufferAppend(buf, payload, e.len);
+
+    e.data = (unsigned char*)bufferTail(buf);
+    e.len = 0;
+    encodeMove(&e, m);
+    buf->len += e.len;
+    return true;
+}
+
+bool writeGameOver(NetBuffer *buf, const GameOver *over) {
+    unsigned char payload[1];
+
+    payload[0] = over->winner;
+    return appendFrame(buf, FRAME_GAME_OVER, payload, 1);
+}
+
+bool writeError(NetBuffer *buf, int code) {
+    unsigned char payload[MAX_SMALL_FRAME];
+    Encoder e = { payload, 0 };
+
+    putVarint(&e, code);
+    return appendFrame(buf, FRAME_ERROR, payload, e.len);
+}
+
+/*
+    Side to move and board size, then for each piece class its count and
+    the gaps between its occupied squares in increasing order.
+*/
+static void encodeState(Encoder *e, const Board *b, enum player toMove) {
+    int t, w, sq, prev;
+    uint64_t bits;
+    const uint64_t *set;
+
+    putByte(e, toMove);
+    putVarint(e, b->n);
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        set = boardBits(b, t);
+        putVarint(e, b->count[t]);
+
+        prev = -1;
+        for (w = 0; w < b->words; w++) {
+            bits = set[w];
+            while (bits) {
+                sq = w*64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                putVarint(e, sq - prev - 1);
+                prev = sq;
+            }
+        }
+    }
+}
+
+bool writeStateSync(NetBuffer *buf, const Board *b, enum player toMove) {
+    unsigned char header[16];
+    Encoder sizer = { NULL, 0 };
+    Encoder e = { header, 0 };
+
+    encodeState(&sizer, b, toMove);
+    if (sizer.len + 1 > MAX_FRAME_LEN)
+        return false;
+
+    putVarint(&e, sizer.len + 1);
+    putByte(&e, FRAME_STATE_SYNC);
+    if (!bufferReserve(buf, e.len + sizer.len))
+        return false;
+    bufferAppend(buf, header, e.len);
+
+    e.data = (unsigned char*)bufferTail(buf);
+    e.len = 0;
+    encodeState(&e, b, toMove);
+    buf->len += e.len;
+    return true;
+}
+
+
+/*
+    Looks for a complete frame at the front of buf. Returns 1 and fills f if
+    there is one, 0 if more bytes are needed, or -1 if the stream is
+    corrupt. f points into buf; consume f->size bytes once done with it.
+*/
+int peekFrame(const NetBuffer *buf, Frame *f) {
+    Frame whole;
+    Decoder d;
+    uint64_t len;
+
+    whole.payload = (const unsigned char*)bufferHead(buf);
+    whole.len = buf->len;
+    decoderInit(&d, &whole);
+
+    len = getVarint(&d);
+    if (!d.ok)
+        return buf->len >= 10 ? -1 : 0;
+    if (len == 0 || len > MAX_FRAME_LEN)
+        return -1;
+    if (d.pos + len > buf->len)
+        return 0;
+
+    f->type = d.data[d.pos];
+    f->payload = d.data + d.pos + 1;
+    f->len = len - 1;
+    f->size = d.pos + len;
+    return 1;
+}
+
+/*
+    Blocks until a whole frame has arrived on fd. Returns false on a closed
+    or broken connection or a corrupt stream.
+*/
+bool recvFrame(int fd, NetBuffer *buf, Frame *f) {
+    int found;
+    ssize_t n;
+
+    for (;;) {
+        found = peekFrame(buf, f);
+        if (found != 0)
+            return found > 0;
+
+        n = bufferReadFrom(buf, fd);
+        if (n == 0)
+            return false;
+        if (n < 0 && errno != EINTR)
+            return false;
+    }
+}
+
+bool parseHello(const Frame *f, Hello *hello) {
+    Decoder d;
+
+    if (f->type != FRAME_HELLO)
+        return false;
+    decoderInit(&d, f);
+    hello->version = getVarint(&d);
+
+    // older clients send less, and are told they are out of date
+    hello->token = d.pos < d.len ? getVarint(&d) : 0;
+    hello->n = d.pos < d.len ? getVarint(&d) : 0;
+    hello->rating = d.pos < d.len ? getVarint(&d) : 0;
+    hello->shm = d.pos < d.len ? getByte(&d) != 0 : false;
+    return decoderDone(&d);
+}
+
+bool parseWelcome(const Frame *f, Welcome *welcome) {
+    Decoder d;
+    unsigned int role;
+
+    if (f->type != FRAME_WELCOME)
+        return false;
+    decoderInit(&d, f);
+    welcome->version = getVarint(&d);
+    role = getByte(&d);
+    welcome->role = role <= NO_PLAYER ? (enum player)role : NO_PLAYER;
+    welcome->n = getVarint(&d);
+    welcome->token = getVarint(&d);
+    welcome->game = getVarint(&d);
+    welcome->shm = getByte(&d) != 0;
+    return decoderDone(&d) && role <= NO_PLAYER && welcome->n > 1;
+}
+
+bool parseWatch(const Frame *f, Watch *watch) {
+    Decoder d;
+
+    if (f->type != FRAME_WATCH)
+        return false;
+    decoderInit(&d, f);
+    watch->version = getVarint(&d);
+    watch->game = getVarint(&d);
+    return decoderDone(&d);
+}
+
+/*
+    Decodes a MOVE frame. Fills in everything but to and promotes, which
+    need the board: see moveDestination and findMove. A chain longer than
+    INLINE_HOPS gets a path of its own, so free m with moveFree.
+*/
+bool parseMove(const Frame *f, Move *m) {
+    Decoder d;
+    uint64_t hops;
+    uint64_t *words;
+    int i;
+
+    if (f->type != FRAME_MOVE)
+        return false;
+    decoderInit(&d, f);
+
+    m->from = getVarint(&d);
+    hops = getVarint(&d);
+    m->path = 0;
+    m->longPath = NULL;
+    m->to = -1;
+    m->isJump = (hops & 1) != 0;
+    m->promotes = false;
+    m->ownsPath = false;
+    // every four hops take a byte the frame must have
+    if (!d.ok || hops >> 1 < 1 || (hops >> 1) > 4 * (d.len - d.pos) ||
+        (!m->isJump && hops >> 1 != 1))
+        return false;
+    m->numHops = hops >> 1;
+
+    if (m->numHops > INLINE_HOPS) {
+        m->longPath = calloc(pathWords(m->numHops), sizeof(uint64_t));
+        if (m->longPath == NULL)
+            return false;
+        m->ownsPath = true;
+    }
+    words = m->longPath != NULL ? m->longPath : &m->path;
+
+    for (i = 0; i < m->numHops; i += 4)
+        words[i >> 5] |= (uint64_t)getByte(&d) << (2*(i & 31));
+    m->path = words[0];
+    if (decoderDone(&d))
+        return true;
+    moveFree(m);
+    return false;
+}
+
+bool parseGameOver(const Frame *f, GameOver *over) {
+    Decoder d;
+    unsigned int winner;
+
+    if (f->type != FRAME_GAME_OVER)
+        return false;
+    decoderInit(&d, f);
+    winner = getByte(&d);
+    over->winner = winner <= NO_PLAYER ? (enum player)winner : NO_PLAYER;
+    return decoderDone(&d);
+}
+
+/*
+    Decodes a STATE_SYNC into b, which is resized to the sent board size if
+    need be. b is left cleared if the frame is bad.
+*/
+bool parseStateSync(const Frame *f, Board *b, enum player *toMove) {
+    Decoder d;
+    uint64_t n, squares, count, gap, next, sq;
+    int t;
+
+    if (f->type != FRAME_STATE_SYNC)
+        return false;
+    decoderInit(&d, f);
+
+    *toMove = getByte(&d) == PLAYER_ONE ? PLAYER_ONE : PLAYER_TWO;
+    n = getVarint(&d);
+    if (!d.ok || n < 2 || n > 65535)
+        return false;
+
+    if (b->n != (int)n) {
+        boardFree(b);
+        boardInit(b, n);
+    }
+    boardClear(b);
+    squares = n * n;
+
+    for (t = 0; t < NUM_PIECE_TYPES && d.ok; t++) {
+        count = getVarint(&d);
+        if (count > squares) {
+            d.ok = false;
+            break;
+        }
+
+        // each square is sent as the gap after the one before
+        next = 0;
+        while (count-- > 0 && d.ok) {
+            gap = getVarint(&d);
+            if (!d.ok || gap >= squares - next) {
+                d.ok = false;
+                break;
+            }
+            sq = next + gap;
+            next = sq + 1;
+            if (!bitTest(b->geo->dark, sq) || boardOccupied(b, sq)) {
+                d.ok = false;
+                break;
+            }
+            bitSet(boardBits(b, t), sq);
+            b->count[t]++;
+        }
+    }
+
+    if (!decoderDone(&d)) {
+        boardClear(b);
+        return false;
+    }
+    return true;
+}
+
+bool parseError(const Frame *f, int *code) {
+    Decoder d;
+
+    if (f->type != FRAME_ERROR)
+        return false;
+    decoderInit(&d, f);
+    *code = getVarint(&d);
+    return decoderDone(&d);
+}
@@ -0,0 +1,146 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "netbuf.h"
+
+
+/*
+    Wire format between the server and its clients.
+
+    Everything is a frame: a varint byte count, then a one-byte frame type,
+    then the payload. Integers in payloads are unsigned LEB128 varints, so
+    nothing depends on host byte order or struct padding. A move is its
+    start square plus a varint of hop count and jump flag plus the hops
+    packed two bits each: a few bytes instead of a 40-byte struct, and no
+    limit on how long a capture chain can be.
+
+    A client opens with HELLO naming the protocol version it speaks, and
+    the board size and rating of the game it wants; it is seated with the
+    next client to ask for the same. The server answers with WELCOME (its
+    seat, the board size, a session token and the game's number) or ERROR
+    and a hang-up. After that the players exchange MOVE frames through
+    the server, which may also send GAME_OVER or a full
+    STATE_SYNC. A MOVE is a whole turn: a capture chain goes in one frame,
+    never hop by hop.
+
+    A client that lost its connection mid-game can get its seat back by
+    opening with a HELLO that carries its token. The server answers with
+    WELCOME and then a STATE_SYNC of the game as it now stands (or
+    GAME_OVER, if it ended meanwhile), or with ERROR_NO_SESSION if the game
+    is gone.
+
+    A client on the same host as the server may connect to the server's
+    local socket instead and pass a shared-memory channel along with its
+    HELLO (see shmring.h). If the WELCOME says the server took it up, every
+    frame after it goes through the channel, and the socket carries
+    nothing more; if not, the local socket carries them as TCP would.
+
+    A spectator opens with WATCH and a game's number instead. It is sent
+    WELCOME with no seat, a STATE_SYNC, and then every move played and the
+    GAME_OVER, or ERROR_NO_GAME. It sends nothing more itself.
+*/
+
+#define PROTOCOL_VERSION 6
+
+// largest frame either side will accept; a STATE_SYNC of a huge board is
+// the only thing that gets close
+#define MAX_FRAME_LEN (32 << 20)
+
+// longest a small fixed frame can be once encoded
+#define MAX_SMALL_FRAME 64
+
+enum frameType {
+    FRAME_HELLO = 1,
+    FRAME_WELCOME,
+    FRAME_MOVE,
+    FRAME_GAME_OVER,
+    FRAME_STATE_SYNC,
+    FRAME_ERROR,
+    FRAME_WATCH
+};
+
+// codes carried by FRAME_ERROR
+enum protocolError {
+    ERROR_BAD_VERSION = 1,
+    ERROR_BAD_FRAME,
+    ERROR_ILLEGAL_MOVE,
+    ERROR_OUT_OF_TURN,
+    ERROR_GAME_OVER,
+    ERROR_NO_SESSION,
+    ERROR_NO_GAME,
+    ERROR_BAD_SIZE
+};
+
+// one frame, pointing into the buffer it was read from
+typedef struct {
+    int type;
+    const unsigned char *payload;
+    size_t len;
+
+    // bytes the whole frame took up, header included
+    size_t size;
+} Frame;
+
+typedef struct {
+    int version;
+
+    // the session to resume, or 0 to be seated in a new game
+    uint64_t token;
+
+    // for a new game: the board size wanted (0 for the server's) and the
+    // player's rating, to be matched with someone of about the same
+    int n;
+    int rating;
+
+    // its shared-memory channel came with it
+    bool shm;
+} Hello;
+
+typedef struct {
+    int version;
+    enum player role;   // NO_PLAYER for a spectator
+    int n;
+    uint64_t token;
+
+    // the number spectators watch the game by
+    uint64_t game;
+
+    // the rest of the frames go through the client's shared memory
+    bool shm;
+} Welcome;
+
+typedef struct {
+    int version;
+    uint64_t game;
+} Watch;
+
+typedef struct {
+    enum player winner;
+} GameOver;
+
+
+bool writeHello(NetBuffer *buf, const Hello *hello);
+bool writeWelcome(NetBuffer *buf, const Welcome *welcome);
+bool writeWatch(NetBuffer *buf, const Watch *watch);
+bool writeMove(NetBuffer *buf, const Move *m);
+bool writeGameOver(NetBuffer *buf, const GameOver *over);
+bool writeStateSync(NetBuffer *buf, const Board *b, enum player toMove);
+bool writeError(NetBuffer *buf, int code);
+
+int peekFrame(const NetBuffer *buf, Frame *f);
+bool recvFrame(int fd, NetBuffer *buf, Frame *f);
+
+bool parseHello(const Frame *f, Hello *hello);
+bool parseWelcome(const Frame *f, Welcome *welcome);
+bool parseWatch(const Frame *f, Watch *watch);
+bool parseMove(const Frame *f, Move *m);
+bool parseGameOver(const Frame *f, GameOver *over);
+bool parseStateSync(const Frame *f, Board *b, enum player *toMove);
+bool parseError(const Frame *f, int *code);
+
+#endif
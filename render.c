@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "render.h"
+
+#ifdef __APPLE__
+    #include <GLUT/glut.h>
+#else
+    #include <GL/glut.h>
+#endif
+
+// straight edges around a piece drawn as polygons
+#define CIRCLE_SEGMENTS 48
+
+// below this many pixels a square, the board comes from its LOD texture
+#define LOD_SCALE 3.0f
+
+// below this many pixels a square, labels would just be noise
+#define LABEL_SCALE 16.0f
+
+// closest a view may zoom in, in pixels a square
+#define MAX_SCALE 400.0f
+
+// separate regions kept for the next repaint before they are merged
+#define MAX_DIRTY 8
+
+// size of a piece and of a king's crown, in squares
+#define PIECE_RADIUS (1 / 2.1f)
+#define CROWN_RADIUS (0.45f / 2.1f)
+
+
+/*
+    Vertices for everything drawn in one colour, so a whole colour goes to
+    GL in one call. The storage is kept from frame to frame.
+*/
+typedef struct {
+    GLfloat *xy;
+    int count;
+    int capacity;
+} VertexBatch;
+
+// bodies of each player's pieces, then the crowns of their kings
+enum batchType {
+    BATCH_BODY_ONE,
+    BATCH_BODY_TWO,
+    BATCH_CROWN_ONE,
+    BATCH_CROWN_TWO,
+    NUM_BATCHES
+};
+
+static const GLubyte batchColor[NUM_BATCHES][3] = {
+    {222, 163, 82},
+    {204, 77,  51},
+    {196, 138, 56},
+    {179, 51,  26}
+};
+static const GLubyte darkColor[3] = {0, 0, 0};
+static const GLubyte lightColor[3] = {153, 25, 51};
+
+// a region of the window, in pixels: [x0, x1) x [y0, y1)
+typedef struct {
+    int x0, y0, x1, y1;
+} Rect;
+
+// unit circle, worked out once; entry CIRCLE_SEGMENTS repeats entry 0
+static float circleX[CIRCLE_SEGMENTS + 1], circleY[CIRCLE_SEGMENTS + 1];
+
+// window size, and the largest smooth point GL will draw
+static int winWidth, winHeight;
+static float maxPointSize;
+
+// the view: pixels a square, and the board point at the bottom left
+static int boardN = 0;
+static float viewScale;
+static float viewX, viewY;
+
+// 2x2 texture repeated over the board to draw every square at once
+static GLuint checkerTexture;
+
+/*
+    Centres of the pieces in view, one vertex a piece, and the square range
+    [instX0, instX1) x [instY0, instY1) they were gathered from.
+*/
+static VertexBatch instances[NUM_BATCHES];
+static int instX0, instY0, instX1, instY1;
+static bool instStale = true;
+
+// pieces in view as triangles, for when they are too big to be points
+static VertexBatch triangles[NUM_BATCHES];
+
+/*
+    The board at one texel a square (every lodStep-th square on boards
+    larger than GL's biggest texture), for drawing it zoomed far out.
+    lodPixels mirrors the texture so single squares can be patched.
+*/
+static GLuint lodTexture;
+static GLubyte *lodPixels;
+static int lodStep, lodDim, lodTexSize;
+static bool lodStale = true;
+
+/*
+    What the next repaint has to cover. The window is single buffered, so
+    everything outside these regions still shows the last frame.
+*/
+static Rect dirty[MAX_DIRTY];
+static int numDirty = 0;
+static bool dirtyAll = true;
+
+
+/* Makes room for n more vertices at the end of b and returns them. */
+static GLfloat* batchReserve(VertexBatch *b, int n) {
+    if (b->count + n > b->capacity) {
+        while (b->count + n > b->capacity)
+            b->capacity = b->capacity ? 2 * b->capacity : 4096;
+        b->xy = realloc(b->xy, sizeof(GLfloat) * 2 * b->capacity);
+    }
+    b->count += n;
+    return b->xy + 2 * (b->count - n);
+}
+
+static void drawBatch(const VertexBatch *b, GLenum mode, const GLubyte *color) {
+    if (b->count == 0)
+        return;
+    glColor3ubv(color);
+    glVertexPointer(2, GL_FLOAT, 0, b->xy);
+    glDrawArrays(mode, 0, b->count);
+}
+
+/* Adds a filled circle as a fan of triangles. */
+static void batchDisc(VertexBatch *b, float x, float y, float radius) {
+    GLfloat *v = batchReserve(b, 3 * CIRCLE_SEGMENTS);
+    int i;
+
+    for (i = 0; i < CIRCLE_SEGMENTS; i++) {
+        *v++ = x;
+        *v++ = y;
+        *v++ = x + circleX[i] * radius;
+        *v++ = y + circleY[i] * radius;
+        *v++ = x + circleX[i+1] * radius;
+        *v++ = y + circleY[i+1] * radius;
+    }
+}
+
+/* The crown's outline, around its centre (x, y). */
+static void crownPoints(float x, float y, float scale, float *cx, float *cy) {
+    x -= scale / 3;
+    y -= scale / 3;
+    cx[0] = x;                  cy[0] = y;
+    cx[1] = x - scale / 3;      cy[1] = y + 2 * scale / 3;
+    cx[2] = x;                  cy[2] = y + scale / 2;
+    cx[3] = x + scale / 3;      cy[3] = y + scale;
+    cx[4] = x + 2 * scale / 3;  cy[4] = y + scale / 2;
+    cx[5] = x + scale;          cy[5] = y + 2 * scale / 3;
+    cx[6] = x + 2 * scale / 3;  cy[6] = y;
+}
+
+/* Adds a king's crown, split into the triangles of its fan. */
+static void batchCrown(VertexBatch *b, float x, float y, float scale) {
+    GLfloat *v = batchReserve(b, 15);
+    float cx[7], cy[7];
+    int i;
+
+    crownPoints(x, y, scale, cx, cy);
+    for (i = 1; i < 6; i++) {
+        *v++ = cx[0];   *v++ = cy[0];
+        *v++ = cx[i];   *v++ = cy[i];
+        *v++ = cx[i+1]; *v++ = cy[i+1];
+    }
+}
+
+/* Draws one piece's body straight away, for pieces that aren't on the board. */
+void renderDisc(float x, float y, float radius) {
+    int i;
+
+    glBegin(GL_POLYGON);
+    for (i = 0; i < CIRCLE_SEGMENTS; i++)
+        glVertex2f(x + circleX[i]*radius, y + circleY[i]*radius);
+    glEnd();
+}
+
+void renderCrown(float x, float y, float scale) {
+    float cx[7], cy[7];
+    int i;
+
+    crownPoints(x, y, scale, cx, cy);
+    glBegin(GL_POLYGON);
+    for (i = 0; i < 7; i++)
+        glVertex2f(cx[i], cy[i]);
+    glEnd();
+}
+
+
+/*
+    Returns the first square in [start, end) whose bit is set, or end if
+    there is none.
+*/
+static int nextSquare(const uint64_t *bits, int start, int end) {
+    int w = start >> 6;
+    uint64_t word;
+
+    if (start >= end)
+        return end;
+
+    word = bits[w] & (~(uint64_t)0 << (start & 63));
+    while (word == 0) {
+        w++;
+        if ((long)w * 64 >= end)
+            return end;
+        word = bits[w];
+    }
+
+    start = w*64 + __builtin_ctzll(word);
+    return start < end ? start : end;
+}
+
+static bool overlaps(const Rect *a, const Rect *b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static void merge(Rect *into, const Rect *r) {
+    if (r->x0 < into->x0) into->x0 = r->x0;
+    if (r->y0 < into->y0) into->y0 = r->y0;
+    if (r->x1 > into->x1) into->x1 = r->x1;
+    if (r->y1 > into->y1) into->y1 = r->y1;
+}
+
+/*
+    Adds a region of the window to the next repaint. Touching regions are
+    merged, and so is everything once there are too many to keep apart.
+*/
+static void addDirty(int x0, int y0, int x1, int y1) {
+    Rect r;
+    int i;
+
+    r.x0 = x0 < 0 ? 0 : x0;
+    r.y0 = y0 < 0 ? 0 : y0;
+    r.x1 = x1 > winWidth ? winWidth : x1;
+    r.y1 = y1 > winHeight ? winHeight : y1;
+    if (dirtyAll || r.x0 >= r.x1 || r.y0 >= r.y1)
+        return;
+
+    for (i = 0; i < numDirty; i++) {
+        if (overlaps(&dirty[i], &r)) {
+            merge(&dirty[i], &r);
+            return;
+        }
+    }
+
+    if (numDirty == MAX_DIRTY) {
+        for (i = 1; i < numDirty; i++)
+            merge(&dirty[0], &dirty[i]);
+        merge(&dirty[0], &r);
+        numDirty = 1;
+        return;
+    }
+    dirty[numDirty++] = r;
+}
+
+/*
+    Adds the square of side 2*radius centred on board point (x, y) to the
+    next repaint, with a pixel to spare for smoothing.
+*/
+void renderMarkDirty(float x, float y, float radius) {
+    float sx = (x - viewX) * viewScale;
+    float sy = (y - viewY) * viewScale;
+    float r = radius * viewScale;
+
+    addDirty((int)floorf(sx - r) - 1, (int)floorf(sy - r) - 1,
+             (int)ceilf(sx + r) + 1, (int)ceilf(sy + r) + 1);
+}
+
+/* Makes the next repaint cover the whole window. */
+void renderMarkAllDirty() {
+    dirtyAll = true;
+    numDirty = 0;
+}
+
+/*
+    Calls draw to paint whatever has been marked dirty since the last
+    repaint, once for each region with drawing clipped to it. Called with
+    nothing marked, as GLUT does when the window is uncovered, it repaints
+    the whole window.
+*/
+void renderRepaint(void (*draw)(void)) {
+    int i;
+
+    if (dirtyAll || numDirty == 0) {
+        draw();
+    } else {
+        glEnable(GL_SCISSOR_TEST);
+        for (i = 0; i < numDirty; i++) {
+            glScissor(dirty[i].x0, dirty[i].y0,
+                      dirty[i].x1 - dirty[i].x0, dirty[i].y1 - dirty[i].y0);
+            draw();
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    numDirty = 0;
+    dirtyAll = false;
+}
+
+static void clampView() {
+    float fit = (float)(winWidth < winHeight ? winWidth : winHeight) / boardN;
+    float seenX, seenY;
+
+    if (viewScale < fit)
+        viewScale = fit;
+    if (viewScale > MAX_SCALE)
+        viewScale = MAX_SCALE;
+
+    // anything that moves the view moves every pixel
+    renderMarkAllDirty();
+
+    seenX = winWidth / viewScale;
+    seenY = winHeight / viewScale;
+    viewX = seenX >= boardN ? (boardN - seenX) / 2
+                            : fminf(fmaxf(viewX, 0), boardN - seenX);
+    viewY = seenY >= boardN ? (boardN - seenY) / 2
+                            : fminf(fmaxf(viewY, 0), boardN - seenY);
+}
+
+/* Shows the whole board. */
+void renderResetView() {
+    viewScale = 0;
+    viewX = viewY = 0;
+    clampView();
+}
+
+/* Zooms by factor, keeping the board point under (screenX, screenY) put. */
+void renderZoom(float factor, int screenX, int screenY) {
+    float x, y;
+
+    renderScreenToBoard(screenX, screenY, &x, &y);
+    viewScale *= factor;
+    clampView();
+    viewX = x - screenX / viewScale;
+    viewY = y - screenY / viewScale;
+    clampView();
+}
+
+/* Slides the board by (dx, dy) pixels. */
+void renderPan(int dx, int dy) {
+    viewX -= dx / viewScale;
+    viewY -= dy / viewScale;
+    clampView();
+}
+
+void renderScreenToBoard(int screenX, int screenY, float *x, float *y) {
+    *x = viewX + screenX / viewScale;
+    *y = viewY + screenY / viewScale;
+}
+
+void renderBoardProjection() {
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(viewX, viewX + winWidth / viewScale,
+               viewY, viewY + winHeight / viewScale);
+    glMatrixMode(GL_MODELVIEW);
+}
+
+void renderScreenProjection() {
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0.0, winWidth, 0.0, winHeight);
+    glMatrixMode(GL_MODELVIEW);
+}
+
+
+/* Colour of square sq in the LOD texture: its piece, or the square itself. */
+static const GLubyte* lodColor(const Board *b, int sq) {
+    int type = boardPieceAt(b, sq);
+
+    if (type == NO_PIECE)
+        return bitTest(b->geo->dark, sq) ? darkColor : lightColor;
+    if (type == KING_ONE || type == KING_TWO)
+        return batchColor[BATCH_CROWN_ONE + pieceOwner(type)];
+    return batchColor[BATCH_BODY_ONE + pieceOwner(type)];
+}
+
+/* Repaints the whole LOD texture from b. */
+static void buildLod(const Board *b) {
+    int tx, ty, t, sq;
+    const GLubyte *color;
+    GLubyte *p;
+
+    for (ty = 0; ty < lodDim; ty++) {
+        for (tx = 0; tx < lodDim; tx++) {
+            color = ((tx*lodStep + ty*lodStep) % 2 == 1) ? darkColor : lightColor;
+            memcpy(lodPixels + 3 * (ty*lodDim + tx), color, 3);
+        }
+    }
+
+    // only the pieces need looking up, and the bitboards list them
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        const uint64_t *bits = boardBits(b, t);
+        int end = b->geo->numSquares;
+
+        for (sq = nextSquare(bits, 0, end); sq < end;
+             sq = nextSquare(bits, sq + 1, end)) {
+            int x = squareX(b, sq), y = squareY(b, sq);
+            if (x % lodStep != 0 || y % lodStep != 0)
+                continue;
+            p = lodPixels + 3 * ((y / lodStep) * lodDim + x / lodStep);
+            memcpy(p, lodColor(b, sq), 3);
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, lodTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lodDim, lodDim, GL_RGB,
+                    GL_UNSIGNED_BYTE, lodPixels);
+    lodStale = false;
+}
+
+/* Sets the view and the LOD texture up for a new board size. */
+static void setBoardSize(int n) {
+    GLint maxTexture;
+
+    boardN = n;
+    renderResetView();
+    instStale = true;
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+    lodStep = (n + maxTexture - 1) / maxTexture;
+    lodDim = (n + lodStep - 1) / lodStep;
+    for (lodTexSize = 1; lodTexSize < lodDim; lodTexSize *= 2)
+        ;
+
+    free(lodPixels);
+    lodPixels = malloc(3 * (size_t)lodDim * lodDim);
+
+    glBindTexture(GL_TEXTURE_2D, lodTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, lodTexSize, lodTexSize, 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, NULL);
+    lodStale = true;
+}
+
+/* Notes that square sq of b has changed since the last frame. */
+void renderSquareChanged(const Board *b, int sq) {
+    int x = squareX(b, sq), y = squareY(b, sq);
+    GLubyte *p;
+
+    if (b->n != boardN)
+        return;
+
+    renderMarkDirty(x + 0.5f, y + 0.5f, 0.5f);
+
+    if (x >= instX0 && x < instX1 && y >= instY0 && y < instY1)
+        instStale = true;
+
+    if (lodStale || x % lodStep != 0 || y % lodStep != 0)
+        return;
+    p = lodPixels + 3 * ((y / lodStep) * lodDim + x / lodStep);
+    memcpy(p, lodColor(b, sq), 3);
+    glBindTexture(GL_TEXTURE_2D, lodTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x / lodStep, y / lodStep, 1, 1, GL_RGB,
+                    GL_UNSIGNED_BYTE, p);
+}
+
+/* Notes that any square of the board may have changed. */
+void renderBoardChanged() {
+    instStale = true;
+    lodStale = true;
+    renderMarkAllDirty();
+}
+
+
+/* Draws a quad over [x0, x1) x [y0, y1) textured with [0, s) x [0, t). */
+static void texturedQuad(float x0, float y0, float x1, float y1,
+                         float s0, float t0, float s1, float t1) {
+    glBegin(GL_QUADS);
+        glTexCoord2f(s0, t0); glVertex2f(x0, y0);
+        glTexCoord2f(s1, t0); glVertex2f(x1, y0);
+        glTexCoord2f(s1, t1); glVertex2f(x1, y1);
+        glTexCoord2f(s0, t1); glVertex2f(x0, y1);
+    glEnd();
+}
+
+/* Gathers the centre of every piece in the square range in view. */
+static void gatherInstances(const Board *b, int x0, int y0, int x1, int y1) {
+    int i, t, y, sq, start, end;
+
+    for (i = 0; i < NUM_BATCHES; i++)
+        instances[i].count = 0;
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        const uint64_t *bits = boardBits(b, t);
+        enum player owner = pieceOwner(t);
+        bool king = t == KING_ONE || t == KING_TWO;
+
+        for (y = y0; y < y1; y++) {
+            start = y * b->n + x0;
+            end = y * b->n + x1;
+            for (sq = nextSquare(bits, start, end); sq < end;
+                 sq = nextSquare(bits, sq + 1, end)) {
+                GLfloat *v = batchReserve(&instances[BATCH_BODY_ONE + owner], 1);
+                v[0] = sq - y * b->n + 0.5f;
+                v[1] = y + 0.5f;
+                if (king) {
+                    v = batchReserve(&instances[BATCH_CROWN_ONE + owner], 1);
+                    v[0] = sq - y * b->n + 0.5f;
+                    v[1] = y + 0.5f;
+                }
+            }
+        }
+    }
+
+    instX0 = x0;
+    instY0 = y0;
+    instX1 = x1;
+    instY1 = y1;
+    instStale = false;
+}
+
+/*
+    Draws the pieces in view. Each is a single smooth point when GL can draw
+    points that big, so a whole colour is one vertex a piece in one call;
+    up close, where only a few pieces fit on screen, they are built from
+    triangles instead.
+*/
+static void drawPieces() {
+    float diameter = 2 * PIECE_RADIUS * viewScale;
+    int i, j;
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    if (diameter <= maxPointSize) {
+        glEnable(GL_POINT_SMOOTH);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        glPointSize(diameter);
+        drawBatch(&instances[BATCH_BODY_ONE], GL_POINTS, batchColor[BATCH_BODY_ONE]);
+        drawBatch(&instances[BATCH_BODY_TWO], GL_POINTS, batchColor[BATCH_BODY_TWO]);
+        glPointSize(diameter * CROWN_RADIUS / PIECE_RADIUS);
+        drawBatch(&instances[BATCH_CROWN_ONE], GL_POINTS, batchColor[BATCH_CROWN_ONE]);
+        drawBatch(&instances[BATCH_CROWN_TWO], GL_POINTS, batchColor[BATCH_CROWN_TWO]);
+
+        glDisable(GL_BLEND);
+        glDisable(GL_POINT_SMOOTH);
+    } else {
+        for (i = 0; i < NUM_BATCHES; i++) {
+            triangles[i].count = 0;
+            for (j = 0; j < instances[i].count; j++) {
+                GLfloat *c = instances[i].xy + 2*j;
+                if (i < BATCH_CROWN_ONE)
+                    batchDisc(&triangles[i], c[0], c[1], PIECE_RADIUS);
+                else
+                    batchCrown(&triangles[i], c[0], c[1], PIECE_RADIUS);
+            }
+            drawBatch(&triangles[i], GL_TRIANGLES, batchColor[i]);
+        }
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+static void drawLabels(const Board *b) {
+    int t, y, sq, start, end;
+
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        const uint64_t *bits = boardBits(b, t);
+
+        for (y = instY0; y < instY1; y++) {
+            start = y * b->n + instX0;
+            end = y * b->n + instX1;
+            for (sq = nextSquare(bits, start, end); sq < end;
+                 sq = nextSquare(bits, sq + 1, end)) {
+                glRasterPos2f(squareX(b, sq) + 0.5f - 4.5f / viewScale,
+                              y + 0.5f - 7.5f / viewScale);
+                glutBitmapCharacter(GLUT_BITMAP_9_BY_15, pieceChar(t));
+            }
+        }
+    }
+}
+
+/*
+    Draws b as seen through the view, leaving the board projection set so
+    the caller can draw over it in board units.
+*/
+void renderBoard(const Board *b, bool labels) {
+    float seenX1, seenY1;
+    int x0, y0, x1, y1;
+
+    if (b->n != boardN)
+        setBoardSize(b->n);
+    renderBoardProjection();
+
+    glEnable(GL_TEXTURE_2D);
+    glColor3f(1.0f, 1.0f, 1.0f);
+
+    if (viewScale < LOD_SCALE) {
+        if (lodStale)
+            buildLod(b);
+        glBindTexture(GL_TEXTURE_2D, lodTexture);
+        texturedQuad(0, 0, lodDim * lodStep, lodDim * lodStep,
+                     0, 0, (float)lodDim / lodTexSize, (float)lodDim / lodTexSize);
+        glDisable(GL_TEXTURE_2D);
+        return;
+    }
+
+    seenX1 = viewX + winWidth / viewScale;
+    seenY1 = viewY + winHeight / viewScale;
+
+    // every square in view in one quad, the texture repeating every two
+    glBindTexture(GL_TEXTURE_2D, checkerTexture);
+    texturedQuad(viewX, viewY, seenX1, seenY1,
+                 viewX / 2, viewY / 2, seenX1 / 2, seenY1 / 2);
+    glDisable(GL_TEXTURE_2D);
+
+    x0 = (int)floorf(fmaxf(viewX, 0));
+    y0 = (int)floorf(fmaxf(viewY, 0));
+    x1 = (int)fminf(ceilf(seenX1), b->n);
+    y1 = (int)fminf(ceilf(seenY1), b->n);
+    if (instStale || x0 != instX0 || y0 != instY0 || x1 != instX1 || y1 != instY1)
+        gatherInstances(b, x0, y0, x1, y1);
+
+    drawPieces();
+
+    if (labels && viewScale >= LABEL_SCALE)
+        drawLabels(b);
+    glColor3f(0.0f, 0.0f, 0.0f);
+}
+
+/* Takes a new window size; the next repaint covers all of it. */
+void renderResize(int width, int height) {
+    winWidth = width;
+    winHeight = height;
+    glViewport(0, 0, width, height);
+    if (boardN > 0)
+        clampView();
+    renderMarkAllDirty();
+}
+
+void renderInit(int width, int height) {
+    GLubyte checker[2][2][3];
+    GLfloat range[2];
+    int i;
+
+    winWidth = width;
+    winHeight = height;
+
+    // every piece is drawn from the same circle
+    for (i = 0; i <= CIRCLE_SEGMENTS; i++) {
+        circleX[i] = sin(2 * M_PI * i / CIRCLE_SEGMENTS);
+        circleY[i] = cos(2 * M_PI * i / CIRCLE_SEGMENTS);
+    }
+
+    glGetFloatv(GL_POINT_SIZE_RANGE, range);
+    maxPointSize = range[1];
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // square (x, y) is dark when x + y is odd
+    memcpy(checker[0][0], lightColor, 3);
+    memcpy(checker[0][1], darkColor, 3);
+    memcpy(checker[1][0], darkColor, 3);
+    memcpy(checker[1][1], lightColor, 3);
+
+    glGenTextures(1, &checkerTexture);
+    glBindTexture(GL_TEXTURE_2D, checkerTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                 checker);
+
+    glGenTextures(1, &lodTexture);
+    glBindTexture(GL_TEXTURE_2D, lodTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
@@ -0,0 +1,47 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+
+#include "board.h"
+
+
+/*
+    Draws the board through a view that can be zoomed and panned, touching
+    only what is on screen. Squares are one textured quad; pieces are one
+    vertex each, gathered for the squares in view and kept until the view
+    moves or one of those squares changes; zoomed far enough out, the whole
+    board is a single texture holding one texel per square.
+
+    Only what has changed is repainted: changed squares and any regions the
+    caller marks dirty, each redrawn with drawing clipped to it. Anything
+    that moves the view, and a window resize, repaints the whole window.
+
+    Board drawing works in board units, one unit per square, with square
+    (x, y) covering [x, x+1) x [y, y+1). Screen positions are in pixels with
+    the origin at the bottom left of the window.
+*/
+
+void renderInit(int width, int height);
+void renderResize(int width, int height);
+void renderBoard(const Board *b, bool labels);
+
+void renderRepaint(void (*draw)(void));
+void renderMarkDirty(float x, float y, float radius);
+void renderMarkAllDirty(void);
+
+void renderSquareChanged(const Board *b, int sq);
+void renderBoardChanged(void);
+
+void renderResetView(void);
+void renderZoom(float factor, int screenX, int screenY);
+void renderPan(int dx, int dy);
+void renderScreenToBoard(int screenX, int screenY, float *x, float *y);
+
+void renderBoardProjection(void);
+void renderScreenProjection(void);
+
+void renderDisc(float x, float y, float radius);
+void renderCrown(float x, float y, float scale);
+
+#endif
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "replay.h"
+#include "clock.h"
+#include "gamelog.h"
+#include "idtable.h"
+#include "movegen.h"
+#include "protocol.h"
+
+
+/*
+    Where one game's records are in the log. Offsets are from the start of
+    the file; 0, where the first SESSION record always is, means missing.
+*/
+typedef struct {
+    int n;
+    int plies;
+    bool ended;
+    enum player winner;
+
+    // the MOVE record of each ply, and the KEYFRAME record of every
+    // LOG_KEYFRAME_PLIES'th ply
+    size_t *moves;
+    size_t *keyframes;
+    int movesCap, keyframesCap;
+} ReplayGame;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+
+    ReplayGame **games;
+    int numGames, gamesCap;
+
+    // the game each id stands for in the current session, under id + 1
+    IdTable ids;
+
+    size_t records;
+} ReplayLog;
+
+
+/*
+    Sets (*array)[i], growing the array with missing entries to fit it.
+    Returns false if it can't be grown.
+*/
+static bool setOffset(size_t **array, int *cap, int i, size_t offset) {
+    int grown = *cap > 0 ? *cap : 64;
+    size_t *bigger;
+
+    if (i >= *cap) {
+        while (grown <= i)
+            grown *= 2;
+        bigger = realloc(*array, sizeof(size_t) * grown);
+        if (bigger == NULL)
+            return false;
+        memset(bigger + *cap, 0, sizeof(size_t) * (grown - *cap));
+        *array = bigger;
+        *cap = grown;
+    }
+    (*array)[i] = offset;
+    return true;
+}
+
+// the game the current session's id stands for, or NULL
+static ReplayGame* gameFor(ReplayLog *log, uint64_t id) {
+    return id + 1 != 0 ? idTableGet(&log->ids, id + 1) : NULL;
+}
+
+/*
+    Starts a game under id, which any id may be: they are looked up in a
+    table rather than an array. Returns false if there is no memory for it.
+*/
+static bool addGame(ReplayLog *log, uint64_t id, int n) {
+    ReplayGame **grown, *g;
+    int cap;
+
+    if (id + 1 == 0)
+        return true;
+    if (log->numGames == log->gamesCap) {
+        cap = log->gamesCap > 0 ? 2 * log->gamesCap : 64;
+        grown = realloc(log->games, sizeof(ReplayGame*) * cap);
+        if (grown == NULL)
+            return false;
+        log->games = grown;
+        log->gamesCap = cap;
+    }
+    g = calloc(1, sizeof(ReplayGame));
+    if (g == NULL)
+        return false;
+    g->n = n;
+    g->winner = NO_PLAYER;
+
+    log->games[log->numGames++] = g;
+    idTablePut(&log->ids, id + 1, g);
+    return true;
+}
+
+/*
+    Runs through the log once, noting where each game's moves and keyframes
+    are; only the record headers are decoded. A log cut short by a crash
+    ends at its last whole record.
+*/
+static bool indexLog(ReplayLog *log) {
+    LogRecord r;
+    ReplayGame *g;
+    size_t pos = 0, i;
+    int found;
+    bool ok = true;
+
+    while (pos < log->size) {
+        found = logNextRecord(log->data + pos, log->size - pos, &r);
+        if (found < 0) {
+            printf("ERROR: corrupt record at byte %zu\n", pos);
+            return false;
+        }
+        if (found == 0) {
+            printf("Log ends partway through a record at byte %zu\n", pos);
+            break;
+        }
+        log->records++;
+
+        switch (r.type) {
+        case LOG_SESSION:
+            // ids from here on are new games; the earlier ones may go on
+            for (i = 0; i <= log->ids.mask; ) {
+                if (log->ids.slots[i].key > r.game)
+                    idTableRemove(&log->ids, log->ids.slots[i].key);
+                else
+                    i++;
+            }
+            break;
+        case LOG_START:
+            ok = addGame(log, r.game, r.n);
+            break;
+        case LOG_MOVE:
+            if ((g = gameFor(log, r.game)) == NULL)
+                break;
+            // every ply before this one has a record before it
+            if ((size_t)r.ply >= log->records) {
+                printf("ERROR: ply %d out of place at byte %zu\n", r.ply,
+                       pos);
+                return false;
+            }
+            ok = setOffset(&g->moves, &g->movesCap, r.ply, pos);
+            if (r.ply + 1 > g->plies)
+                g->plies = r.ply + 1;
+            break;
+        case LOG_KEYFRAME:
+            if ((g = gameFor(log, r.game)) == NULL ||
+                r.ply % LOG_KEYFRAME_PLIES != 0)
+                break;
+            if ((size_t)r.ply >= log->records) {
+                printf("ERROR: ply %d out of place at byte %zu\n", r.ply,
+                       pos);
+                return false;
+            }
+            ok = setOffset(&g->keyframes, &g->keyframesCap,
+                           r.ply / LOG_KEYFRAME_PLIES, pos);
+            break;
+        case LOG_END:
+            if ((g = gameFor(log, r.game)) != NULL) {
+                g->ended = true;
+                g->winner = r.winner;
+            }
+            break;
+        }
+        if (!ok) {
+            printf("ERROR: out of memory at byte %zu\n", pos);
+            return false;
+        }
+        pos += r.size;
+    }
+    return true;
+}
+
+static const char* gameResult(const ReplayGame *g) {
+    if (!g->ended)
+        return "unfinished";
+    if (g->winner == PLAYER_ONE)
+        return "player one won";
+    if (g->winner == PLAYER_TWO)
+        return "player two won";
+    return "abandoned";
+}
+
+/*
+    Sets b to game g's board after ply moves: from the nearest keyframe at
+    or before ply, or the start, then the few moves since. Returns false if
+    a record it needs is missing or doesn't make sense.
+*/
+static bool seekGame(const ReplayLog *log, const ReplayGame *g, int ply,
+                     Board *b, enum player *toMove) {
+    LogRecord r;
+    Move m;
+    Undo undo;
+    char text[256];
+    int k = ply / LOG_KEYFRAME_PLIES, from = 0, i;
+
+    while (k > 0 && (k >= g->keyframesCap || g->keyframes[k] == 0))
+        k--;
+
+    boardSetup(b);
+    *toMove = PLAYER_ONE;
+    if (k > 0) {
+        logNextRecord(log->data + g->keyframes[k],
+                      log->size - g->keyframes[k], &r);
+        if (!parseStateSync(&r.frame, b, toMove) || b->n != g->n) {
+            printf("ERROR: bad keyframe at ply %d\n", r.ply);
+            return false;
+        }
+        from = k * LOG_KEYFRAME_PLIES;
+    }
+    printf("From %s at ply %d, then %d moves:", k > 0 ? "the keyframe" :
+           "the start", from, ply - from);
+
+    for (i = from; i < ply; i++) {
+        if (i >= g->movesCap || g->moves[i] == 0) {
+            printf("\nERROR: ply %d is missing from the log\n", i);
+            return false;
+        }
+        logNextRecord(log->data + g->moves[i], log->size - g->moves[i], &r);
+        if (!parseMove(&r.frame, &m)) {
+            printf("\nERROR: ply %d is not a legal move\n", i);
+            return false;
+        }
+        if (m.from >= b->geo->numSquares || !findMove(b, *toMove, &m, &m)) {
+            printf("\nERROR: ply %d is not a legal move\n", i);
+            moveFree(&m);
+            return false;
+        }
+        printf(" %s", moveToString(b, &m, text, sizeof(text)));
+        boardApplyMove(b, &m, &undo);
+        moveFree(&m);
+        *toMove = *toMove == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    }
+    printf("\n");
+    return true;
+}
+
+static void freeLog(ReplayLog *log) {
+    int i;
+
+    for (i = 0; i < log->numGames; i++) {
+        free(log->games[i]->moves);
+        free(log->games[i]->keyframes);
+        free(log->games[i]);
+    }
+    free(log->games);
+    idTableFree(&log->ids);
+}
+
+int runReplay(const char *path, int game, int ply) {
+    ReplayLog log;
+    ReplayGame *g;
+    Board b;
+    enum player toMove;
+    double start;
+    bool ok;
+    int i;
+
+    memset(&log, 0, sizeof(ReplayLog));
+    log.data = logMap(path, &log.size);
+    if (log.data == NULL && errno == 0) {
+        printf("%s is empty\n", path);
+        return 0;
+    }
+    if (log.data == NULL) {
+        printf("ERROR reading %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    idTableInit(&log.ids);
+    start = now();
+    ok = indexLog(&log);
+    printf("%s: %zu records, %d games, indexed in %.3f s\n", path,
+           log.records, log.numGames, now() - start);
+
+    if (ok && game < 0) {
+        for (i = 0; i < log.numGames; i++) {
+            g = log.games[i];
+            printf("game %6d  %dx%d  %5d plies  %s\n", i, g->n, g->n,
+                   g->plies, gameResult(g));
+        }
+    } else if (ok && game >= log.numGames) {
+        printf("There are only %d games in the log\n", log.numGames);
+        ok = false;
+    } else if (ok) {
+        g = log.games[game];
+        if (ply < 0 || ply > g->plies)
+            ply = g->plies;
+
+        boardInit(&b, g->n);
+        start = now();
+        ok = seekGame(&log, g, ply, &b, &toMove);
+        if (ok) {
+            printf("Game %d, %dx%d, %s; ply %d of %d, found in %.0f us\n",
+                   game, g->n, g->n, gameResult(g), ply, g->plies,
+                   (now() - start) * 1e6);
+            boardPrint(&b, stdout);
+            printf("Player %s to move\n",
+                   toMove == PLAYER_ONE ? "one" : "two");
+        }
+        boardFree(&b);
+    }
+
+    freeLog(&log);
+    logUnmap(log.data, log.size);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/*
+    Reads a game log shard written by the server. With game -1, lists the
+    games in it; otherwise prints the board of that game (numbered from 0
+    in the order they appear) after ply moves, or at its end if ply is -1.
+*/
+int runReplay(const char *path, int game, int ply);
+
+#endif
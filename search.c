@@ -0,0 +1,933 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "search.h"
+#include "clock.h"
+#include "movegen.h"
+#include "tablebase.h"
+#include "mcts.h"
+
+// nodes searched between looks at the clock; a power of two
+#define CLOCK_CHECK_NODES 1024
+
+// what pieces are worth, and a man's bonus for each row it has advanced
+#define MAN_VALUE 100
+#define KING_VALUE 150
+#define ADVANCE_VALUE 2
+
+// move ordering: table move, then captures (longest first), promotions,
+// killers, and the rest by history
+#define ORDER_TT (1 << 30)
+#define ORDER_CAPTURE (1 << 29)
+#define ORDER_PROMOTE (1 << 28)
+#define ORDER_KILLER (1 << 27)
+#define HISTORY_MAX (1 << 26)
+
+// table entry with no best move
+#define NO_MOVE 0xffff
+
+
+// what a stored score says about the position's true score
+enum bound {
+    BOUND_NONE,
+    BOUND_UPPER,    // at most this; every move failed low
+    BOUND_LOWER,    // at least this; a move failed high
+    BOUND_EXACT
+};
+
+/*
+    One transposition table slot. data packs the entry; check is the key
+    XORed with data, so a slot half-written by another thread never matches.
+*/
+typedef struct {
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+} TTSlot;
+
+typedef struct {
+    int score;
+    int depth;
+    int bound;
+    int move;       // index of the best move in generation order, or NO_MOVE
+    int generation;
+} TTEntry;
+
+// Zobrist keys for one board size: NUM_PIECE_TYPES * numSquares of them
+typedef struct {
+    int n;
+    uint64_t *keys;
+} ZobristKeys;
+
+
+typedef struct Searcher Searcher;
+
+// one position being searched by any number of threads
+typedef struct {
+    enum player side;
+    int maxDepth;
+    double start;
+    const SearchLimits *limits;
+    const Board *root;
+
+    Searcher **threads;
+    int numThreads;
+
+    // set once the main thread is done; the helpers then stop too
+    atomic_bool stop;
+} SearchJob;
+
+/*
+    Per-thread scratch: a copy of the position, one growable move list per
+    ply with room to sort it, and the ordering heuristics. Nothing is
+    allocated once the buffers have grown to fit. Threads share nothing but
+    the transposition table and the job.
+*/
+struct Searcher {
+    SearchJob *job;
+    int id;             // 0 for the main thread
+
+    Board board;
+    const uint64_t *zobrist;
+
+    MoveList lists[MAX_PLY + 1];
+    int *scores[MAX_PLY + 1];
+    int *order[MAX_PLY + 1];
+    int capacity[MAX_PLY + 1];
+
+    // key of the position at each ply, and how many reversible moves (king
+    // steps) led up to it, for spotting repetitions
+    uint64_t keys[MAX_PLY + 1];
+    int reversible[MAX_PLY + 1];
+
+    Move killers[MAX_PLY][2];
+
+    // per side, by from square and first direction
+    uint32_t *history;
+
+    int rootBest;
+    uint64_t nodes;
+    bool canStop;
+    bool stopped;
+
+    // nodes as of the last clock check, for the main thread to total up
+    _Atomic uint64_t reported;
+
+    // the last depth this thread finished and what it found there; best
+    // is one of the root's moves in lists[0]
+    int depth;
+    int score;
+    Move best;
+};
+
+
+static TTSlot *table = NULL;
+static uint64_t tableMask;
+// bumped by every search; searches in different games may run at once
+static atomic_int generation;
+
+static pthread_mutex_t zobristLock = PTHREAD_MUTEX_INITIALIZER;
+static ZobristKeys *zobrist = NULL;
+static int numZobrist = 0;
+
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// toggled whenever the side to move changes
+static uint64_t sideKey() {
+    uint64_t state = 0;
+    return splitmix64(&state);
+}
+
+/*
+    Returns the Zobrist keys for boards of size n, generating them the first
+    time. They are the same on every run, so saved keys stay meaningful.
+*/
+static const uint64_t* zobristKeys(int n) {
+    const BoardGeometry *g = boardGeometry(n);
+    uint64_t *keys = NULL;
+    uint64_t state;
+    int i;
+
+    pthread_mutex_lock(&zobristLock);
+    for (i = 0; i < numZobrist; i++) {
+        if (zobrist[i].n == n) {
+            keys = zobrist[i].keys;
+            break;
+        }
+    }
+    if (keys == NULL) {
+        keys = malloc(sizeof(uint64_t) * NUM_PIECE_TYPES * g->numSquares);
+        state = (uint64_t)n << 32;
+        for (i = 0; i < NUM_PIECE_TYPES * g->numSquares; i++)
+            keys[i] = splitmix64(&state);
+        zobrist = realloc(zobrist, sizeof(ZobristKeys) * (numZobrist + 1));
+        zobrist[numZobrist].n = n;
+        zobrist[numZobrist].keys = keys;
+        numZobrist++;
+    }
+    pthread_mutex_unlock(&zobristLock);
+
+    return keys;
+}
+
+static inline uint64_t pieceKey(const uint64_t *keys, int numSquares,
+                                int type, int sq) {
+    return keys[type * numSquares + sq];
+}
+
+/* The Zobrist key of b with side to move, computed from scratch. */
+uint64_t zobristHash(const Board *b, enum player side) {
+    const uint64_t *keys = zobristKeys(b->n);
+    const uint64_t *bits;
+    uint64_t key = side == PLAYER_TWO ? sideKey() : 0;
+    uint64_t word;
+    int t, w;
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        bits = boardBits(b, t);
+        for (w = 0; w < b->words; w++) {
+            for (word = bits[w]; word; word &= word - 1)
+                key ^= pieceKey(keys, b->geo->numSquares, t,
+                                w*64 + __builtin_ctzll(word));
+        }
+    }
+    return key;
+}
+
+/*
+    What playing m, which boardApplyMove described with u, does to the key:
+    XOR it into the key from before the move to get the key after, or the
+    other way round when taking it back. b is the board m was played on,
+    still holding any captures past u's own.
+*/
+static uint64_t keyDelta(const uint64_t *keys, const Board *b,
+                         const Move *m, const Undo *u) {
+    const BoardGeometry *g = b->geo;
+    int type = u->moved;
+    enum player side = pieceOwner(type);
+    int sq = m->from;
+    int i, d, landed, captured;
+    uint64_t delta = sideKey() ^ pieceKey(keys, g->numSquares, type, sq);
+
+    for (i = 0; i < m->numHops; i++) {
+        d = moveDir(m, i);
+        sq += g->offset[d];
+        if (m->isJump) {
+            if (undoTookKing(b, u, i))
+                captured = side == PLAYER_ONE ? KING_TWO : KING_ONE;
+            else
+                captured = side == PLAYER_ONE ? MAN_TWO : MAN_ONE;
+            delta ^= pieceKey(keys, g->numSquares, captured, sq);
+            sq += g->offset[d];
+        }
+    }
+
+    landed = type;
+    if (type == MAN_ONE && bitTest(g->kingRow[side], sq))
+        landed = KING_ONE;
+    else if (type == MAN_TWO && bitTest(g->kingRow[side], sq))
+        landed = KING_TWO;
+
+    return delta ^ pieceKey(keys, g->numSquares, landed, sq);
+}
+
+/* The key change made by m, as keyDelta; b is the board m was played on. */
+uint64_t zobristMove(const Board *b, const Move *m, const Undo *u) {
+    return keyDelta(zobristKeys(b->n), b, m, u);
+}
+
+
+/*
+    Allocates the transposition table, rounded down to a power of two slots.
+    Any earlier table is thrown away.
+*/
+bool ttInit(size_t bytes) {
+    size_t slots = 1;
+
+    while (slots * 2 * sizeof(TTSlot) <= bytes)
+        slots *= 2;
+
+    free(table);
+    table = calloc(slots, sizeof(TTSlot));
+    if (table == NULL)
+        return false;
+    tableMask = slots - 1;
+    return true;
+}
+
+void ttClear(void) {
+    if (table != NULL)
+        memset(table, 0, sizeof(TTSlot) * (tableMask + 1));
+}
+
+static inline uint64_t packEntry(int score, int depth, int bound, int move) {
+    return (uint64_t)(uint16_t)score |
+           (uint64_t)(depth & 0xff) << 16 |
+           (uint64_t)bound << 24 |
+           (uint64_t)(move & 0xffff) << 26 |
+           (uint64_t)(atomic_load_explicit(&generation, memory_order_relaxed)
+                      & 0xff) << 42;
+}
+
+static inline void unpackEntry(uint64_t data, TTEntry *e) {
+    e->score = (int16_t)(data & 0xffff);
+    e->depth = (data >> 16) & 0xff;
+    e->bound = (data >> 24) & 3;
+    e->move = (data >> 26) & 0xffff;
+    e->generation = (data >> 42) & 0xff;
+}
+
+static bool ttProbe(uint64_t key, TTEntry *e) {
+    TTSlot *slot = &table[key & tableMask];
+    uint64_t check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+    uint64_t data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+
+    if ((check ^ data) != key || data == 0)
+        return false;
+    unpackEntry(data, e);
+    return true;
+}
+
+/*
+    Stores an entry unless the slot holds a deeper one for the same position
+    from this search. A new entry without a best move keeps the old one's.
+*/
+static void ttStore(uint64_t key, int score, int depth, int bound, int move) {
+    TTSlot *slot = &table[key & tableMask];
+    uint64_t check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+    uint64_t data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    int current = atomic_load_explicit(&generation, memory_order_relaxed)
+                  & 0xff;
+    TTEntry old;
+
+    if (depth < 0)
+        depth = 0;
+
+    if ((check ^ data) == key && data != 0) {
+        unpackEntry(data, &old);
+        if (old.generation == current && old.depth > depth &&
+            bound != BOUND_EXACT)
+            return;
+        if (move == NO_MOVE)
+            move = old.move;
+    }
+
+    data = packEntry(score, depth, bound, move);
+    atomic_store_explicit(&slot->data, data, memory_order_relaxed);
+    atomic_store_explicit(&slot->check, key ^ data, memory_order_relaxed);
+}
+
+// win scores are stored relative to the node, not the root
+static inline int scoreToTT(int score, int ply) {
+    if (score >= WIN_BOUND)
+        return score + ply;
+    if (score <= -WIN_BOUND)
+        return score - ply;
+    return score;
+}
+
+static inline int scoreFromTT(int score, int ply) {
+    if (score >= WIN_BOUND)
+        return score - ply;
+    if (score <= -WIN_BOUND)
+        return score + ply;
+    return score;
+}
+
+
+/* How many rows all of type's men have come from their own back row. */
+static long advancement(const Board *b, int type) {
+    const uint64_t *bits = boardBits(b, type);
+    uint64_t word;
+    long total = 0;
+    int w, y;
+
+    for (w = 0; w < b->words; w++) {
+        for (word = bits[w]; word; word &= word - 1) {
+            y = (w*64 + __builtin_ctzll(word)) / b->n;
+            total += type == MAN_ONE ? y : b->n - 1 - y;
+        }
+    }
+    return total;
+}
+
+/* Static score of b from side's point of view. */
+static int evaluate(const Board *b, enum player side) {
+    long score;
+
+    score = MAN_VALUE * (long)(b->count[MAN_ONE] - b->count[MAN_TWO]) +
+            KING_VALUE * (long)(b->count[KING_ONE] - b->count[KING_TWO]) +
+            ADVANCE_VALUE * ((long)advancement(b, MAN_ONE) -
+                             advancement(b, MAN_TWO));
+
+    // on huge boards material alone could pass for a forced win
+    if (score >= WIN_BOUND)
+        score = WIN_BOUND - 1;
+    else if (score <= -WIN_BOUND)
+        score = -WIN_BOUND + 1;
+
+    return side == PLAYER_ONE ? score : -score;
+}
+
+
+/* True if a and b are the same move, whether or not `to` is filled in. */
+bool searchSameMove(const Move *a, const Move *b) {
+    return a->from == b->from && a->numHops == b->numHops &&
+           a->isJump == b->isJump && moveSameHops(a, b, a->numHops);
+}
+
+static inline uint32_t* historyEntry(Searcher *s, enum player side,
+                                     const Move *m) {
+    return &s->history[(side * s->board.geo->numSquares + m->from) *
+                       NUM_DIRS + moveDir(m, 0)];
+}
+
+/*
+    Lists the moves at ply in that ply's list, growing the room to sort them
+    along with it.
+*/
+static MoveList* listMoves(Searcher *s, int ply, enum player side) {
+    MoveList *list = &s->lists[ply];
+
+    generateMoves(&s->board, side, list);
+    if (list->capacity > s->capacity[ply]) {
+        s->capacity[ply] = list->capacity;
+        s->scores[ply] = realloc(s->scores[ply], sizeof(int) * list->capacity);
+        s->order[ply] = realloc(s->order[ply], sizeof(int) * list->capacity);
+    }
+    return list;
+}
+
+/* Scores every move at ply for ordering; the best is tried first. */
+static void scoreMoves(Searcher *s, int ply, enum player side,
+                       const MoveList *list, int ttMove) {
+    int i, score;
+    const Move *m;
+
+    for (i = 0; i < list->count; i++) {
+        m = &list->moves[i];
+        if (i == ttMove)
+            score = ORDER_TT;
+        else if (m->isJump)
+            score = ORDER_CAPTURE + m->numHops * 2 + m->promotes;
+        else if (m->promotes)
+            score = ORDER_PROMOTE;
+        else if (ply < MAX_PLY && searchSameMove(m, &s->killers[ply][0]))
+            score = ORDER_KILLER + 1;
+        else if (ply < MAX_PLY && searchSameMove(m, &s->killers[ply][1]))
+            score = ORDER_KILLER;
+        else
+            score = *historyEntry(s, side, m);
+
+        s->scores[ply][i] = score;
+        s->order[ply][i] = i;
+    }
+}
+
+/*
+    Returns the index of the best-scored move not yet tried, moving it to
+    slot i of the ply's order. Selection sort: a cutoff usually comes early.
+*/
+static int nextMove(Searcher *s, int ply, int count, int i) {
+    int *order = s->order[ply];
+    int *scores = s->scores[ply];
+    int j, best = i, tmp;
+
+    for (j = i + 1; j < count; j++) {
+        if (scores[order[j]] > scores[order[best]])
+            best = j;
+    }
+    tmp = order[i];
+    order[i] = order[best];
+    order[best] = tmp;
+    return order[i];
+}
+
+/* Rewards a quiet move that caused a cutoff. */
+static void noteCutoff(Searcher *s, int ply, enum player side,
+                       const Move *m, int depth) {
+    uint32_t *h = historyEntry(s, side, m);
+    int i, size = 2 * s->board.geo->numSquares * NUM_DIRS;
+
+    if (!searchSameMove(m, &s->killers[ply][0])) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = *m;
+    }
+
+    *h += depth * depth;
+    if (*h > HISTORY_MAX) {
+        for (i = 0; i < size; i++)
+            s->history[i] /= 2;
+    }
+}
+
+/* True if the position at ply already appeared earlier on this line. */
+static bool repeated(const Searcher *s, int ply) {
+    int i;
+
+    for (i = ply - 2; i >= ply - s->reversible[ply]; i -= 2) {
+        if (s->keys[i] == s->keys[ply])
+            return true;
+    }
+    return false;
+}
+
+/*
+    When the job must finish, on the now() clock, or 0 if it has no deadline
+    (yet). A deadline set through the control overrides the time limit.
+*/
+static double jobDeadline(const SearchJob *job) {
+    SearchControl *c = job->limits->control;
+    long long us;
+
+    if (c != NULL &&
+        (us = atomic_load_explicit(&c->deadline, memory_order_relaxed)) != 0)
+        return us / 1e6;
+    if (job->limits->timeMs > 0)
+        return job->start + job->limits->timeMs / 1000.0;
+    return 0;
+}
+
+/*
+    The main thread's regular look at the clock, and at the control: a stop
+    from outside ends the search even in its first iteration.
+*/
+static void checkClock(Searcher *s) {
+    SearchControl *c = s->job->limits->control;
+    double deadline;
+
+    if (c != NULL && atomic_load_explicit(&c->stop, memory_order_relaxed)) {
+        s->canStop = true;
+        atomic_store(&s->job->stop, true);
+        return;
+    }
+
+    deadline = jobDeadline(s->job);
+    if (s->canStop && deadline > 0 && now() > deadline)
+        atomic_store(&s->job->stop, true);
+}
+
+/*
+    Negamax alpha-beta with a null window for every move but the first.
+    Below depth 0 only forced captures are searched, so positions are never
+    scored in the middle of an exchange.
+*/
+static int alphaBeta(Searcher *s, enum player side, int depth, int alpha,
+                     int beta, int ply) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    uint64_t key = s->keys[ply];
+    MoveList *list;
+    TTEntry e;
+    Undo undo;
+    const Move *m;
+    int i, idx, score, best = -WIN_SCORE - 1, bestIndex = NO_MOVE;
+    int ttMove = NO_MOVE, alphaIn = alpha, plies = 0;
+
+    s->nodes++;
+    if ((s->nodes & (CLOCK_CHECK_NODES - 1)) == 0) {
+        atomic_store_explicit(&s->reported, s->nodes, memory_order_relaxed);
+        if (s->id == 0)
+            checkClock(s);
+    }
+    if (s->canStop &&
+        atomic_load_explicit(&s->job->stop, memory_order_relaxed))
+        s->stopped = true;
+    if (s->stopped)
+        return 0;
+
+    if (ply > 0 && repeated(s, ply))
+        return 0;
+
+    if (ply > 0) {
+        switch (tbProbe(&s->board, side, &plies)) {
+            case TB_WIN:
+                return WIN_SCORE - ply - plies;
+            case TB_LOSS:
+                return -WIN_SCORE + ply + plies;
+            case TB_DRAW:
+                return 0;
+        }
+    }
+    if (ply >= MAX_PLY || (depth <= 0 && !sideHasCapture(&s->board, side)))
+        return evaluate(&s->board, side);
+
+    if (ttProbe(key, &e)) {
+        ttMove = e.move;
+        if (ply > 0 && e.depth >= depth) {
+            score = scoreFromTT(e.score, ply);
+            if (e.bound == BOUND_EXACT ||
+                (e.bound == BOUND_LOWER && score >= beta) ||
+                (e.bound == BOUND_UPPER && score <= alpha))
+                return score;
+        }
+    }
+
+    list = listMoves(s, ply, side);
+    if (list->count == 0)
+        return -WIN_SCORE + ply;
+    scoreMoves(s, ply, side, list, ttMove);
+
+    for (i = 0; i < list->count; i++) {
+        idx = nextMove(s, ply, list->count, i);
+        m = &list->moves[idx];
+
+        boardApplyMove(&s->board, m, &undo);
+        s->keys[ply + 1] = key ^ keyDelta(s->zobrist, &s->board, m, &undo);
+        s->reversible[ply + 1] = !m->isJump && (undo.moved == KING_ONE ||
+                                                undo.moved == KING_TWO)
+                                 ? s->reversible[ply] + 1 : 0;
+
+        if (i == 0) {
+            score = -alphaBeta(s, other, depth - 1, -beta, -alpha, ply + 1);
+        } else {
+            score = -alphaBeta(s, other, depth - 1, -alpha - 1, -alpha,
+                               ply + 1);
+            if (score > alpha && score < beta)
+                score = -alphaBeta(s, other, depth - 1, -beta, -alpha,
+                                   ply + 1);
+        }
+
+        boardUndoMove(&s->board, m, &undo);
+        if (s->stopped)
+            return 0;
+
+        if (score > best) {
+            best = score;
+            bestIndex = idx;
+        }
+        if (score > alpha) {
+            alpha = score;
+            if (alpha >= beta) {
+                if (!m->isJump)
+                    noteCutoff(s, ply, side, m, depth);
+                break;
+            }
+        }
+    }
+
+    if (ply == 0)
+        s->rootBest = bestIndex;
+
+    ttStore(key, scoreToTT(best, ply), depth,
+            best >= beta ? BOUND_LOWER :
+            best > alphaIn ? BOUND_EXACT : BOUND_UPPER, bestIndex);
+    return best;
+}
+
+
+static Searcher* searcherNew(SearchJob *job, int id) {
+    const Board *b = job->root;
+    Searcher *s = calloc(1, sizeof(Searcher));
+
+    int i;
+
+    s->job = job;
+    s->id = id;
+    for (i = 0; i <= MAX_PLY; i++)
+        moveListAlloc(&s->lists[i]);
+    boardInit(&s->board, b->n);
+    boardCopy(&s->board, b);
+    s->zobrist = zobristKeys(b->n);
+    s->keys[0] = zobristHash(b, job->side);
+    s->history = calloc(2 * b->geo->numSquares * NUM_DIRS, sizeof(uint32_t));
+    return s;
+}
+
+static void searcherFree(Searcher *s) {
+    int i;
+
+    for (i = 0; i <= MAX_PLY; i++) {
+        moveListFree(&s->lists[i]);
+        free(s->scores[i]);
+        free(s->order[i]);
+    }
+    free(s->history);
+    boardFree(&s->board);
+    free(s);
+}
+
+/* Nodes searched so far by every thread on the job. */
+static uint64_t jobNodes(const SearchJob *job) {
+    uint64_t total = job->threads[0]->nodes;
+    int i;
+
+    for (i = 1; i < job->numThreads; i++)
+        total += atomic_load_explicit(&job->threads[i]->reported,
+                                      memory_order_relaxed);
+    return total;
+}
+
+/*
+    One thread's iterative deepening. Every thread searches the whole tree
+    from the root (lazy SMP): they share what they learn through the
+    transposition table, so each finds more of the tree already done, and
+    their searches drift apart in the order they visit it. Odd-numbered
+    helpers run a ply ahead of the others. The main thread alone watches
+    the clock and decides when to stop; depth 1 always finishes.
+*/
+static void iterate(Searcher *s) {
+    SearchJob *job = s->job;
+    const SearchLimits *limits = job->limits;
+    int depth, score;
+    double elapsed, deadline;
+    char buf[MOVE_TEXT_LEN];
+
+    for (depth = 1 + (s->id & 1); depth <= job->maxDepth; depth++) {
+        s->canStop = s->id > 0 || depth > 1;
+        score = alphaBeta(s, job->side, depth, -WIN_SCORE - 1, WIN_SCORE + 1,
+                          0);
+        if (s->stopped)
+            break;
+
+        s->best = s->lists[0].moves[s->rootBest];
+        s->score = score;
+        s->depth = depth;
+        if (s->id > 0)
+            continue;
+
+        elapsed = now() - job->start;
+        if (limits->verbose)
+            printf("depth %2d  score %6d  nodes %12llu  %8.0f nodes/sec  %s\n",
+                   depth, score, (unsigned long long)jobNodes(job),
+                   jobNodes(job) / (elapsed > 0 ? elapsed : 1e-9),
+                   moveToString(job->root, &s->best, buf, sizeof(buf)));
+
+        // stop once the game's end is within the depth just searched; a win
+        // further off may only be a bound grafted from the table, which can
+        // lead round in circles instead of to the win. Nor start a depth
+        // that would probably not finish in what is left.
+        deadline = jobDeadline(job);
+        if (WIN_SCORE - abs(score) <= depth ||
+            (deadline > 0 && job->start + elapsed * 2 > deadline) ||
+            (limits->control != NULL && atomic_load(&limits->control->stop)))
+            break;
+    }
+
+    if (s->id == 0)
+        atomic_store(&job->stop, true);
+}
+
+static void* searchThread(void *arg) {
+    iterate(arg);
+    return NULL;
+}
+
+/*
+    Searches ever deeper from b on limits->threads threads until the time
+    budget is spent (or the depth limit reached, or the control says stop),
+    and returns the best move of the deepest search that finished.
+*/
+static bool findBestMove(const Board *b, enum player side,
+                         const SearchLimits *limits, SearchResult *result) {
+    SearchJob job;
+    Searcher *s;
+    pthread_t *helpers;
+    MoveList list;
+    int i, numHelpers = 0, plies = 0, count;
+    bool copied;
+
+    memset(result, 0, sizeof(SearchResult));
+
+    // nothing to think about with at most one legal move
+    moveListAlloc(&list);
+    count = generateMoves(b, side, &list);
+    copied = list.count == 1 && moveCopy(&result->best, &list.moves[0]);
+    moveListFree(&list);
+    if (count <= 1)
+        return copied;
+
+    // the tables know the answer outright
+    switch (tbBestMove(b, side, &result->best, &plies)) {
+        case TB_WIN:
+            result->score = WIN_SCORE - plies;
+            return true;
+        case TB_LOSS:
+            result->score = -WIN_SCORE + plies;
+            return true;
+        case TB_DRAW:
+            return true;
+    }
+
+    if (limits->engine == ENGINE_MCTS)
+        return mctsBestMove(b, side, limits, result);
+
+    if (table == NULL && !ttInit((size_t)DEFAULT_TT_MB << 20))
+        return false;
+    atomic_fetch_add(&generation, 1);
+
+    job.side = side;
+    job.root = b;
+    job.limits = limits;
+    job.start = now();
+    job.maxDepth = limits->maxDepth > 0 && limits->maxDepth < MAX_PLY
+                   ? limits->maxDepth : MAX_PLY - 1;
+    job.numThreads = limits->threads > 1 ? limits->threads : 1;
+    atomic_init(&job.stop, false);
+
+    job.threads = malloc(sizeof(Searcher*) * job.numThreads);
+    for (i = 0; i < job.numThreads; i++)
+        job.threads[i] = searcherNew(&job, i);
+
+    // the calling thread is the main thread
+    helpers = malloc(sizeof(pthread_t) * job.numThreads);
+    for (i = 1; i < job.numThreads; i++) {
+        if (pthread_create(&helpers[numHelpers], NULL, searchThread,
+                           job.threads[i]) != 0)
+            break;
+        numHelpers++;
+    }
+    iterate(job.threads[0]);
+    for (i = 0; i < numHelpers; i++)
+        pthread_join(helpers[i], NULL);
+
+    // a helper a ply ahead may have finished deeper than the main thread
+    s = job.threads[0];
+    for (i = 0; i < job.numThreads; i++) {
+        if (job.threads[i]->depth > s->depth)
+            s = job.threads[i];
+        result->nodes += job.threads[i]->nodes;
+    }
+    copied = moveCopy(&result->best, &s->best);
+    result->score = s->score;
+    result->depth = s->depth;
+    result->seconds = now() - job.start;
+
+    for (i = 0; i < job.numThreads; i++)
+        searcherFree(job.threads[i]);
+    free(job.threads);
+    free(helpers);
+    return copied;
+}
+
+/*
+    The reply the table holds as best after side plays m in b: the move to
+    think about while the opponent thinks.
+*/
+static bool predictReply(const Board *b, enum player side, const Move *m,
+                         Move *reply) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    MoveList list;
+    Board after;
+    Undo undo;
+    TTEntry e;
+    bool found = false;
+
+    if (table == NULL)
+        return false;
+
+    boardInit(&after, b->n);
+    boardCopy(&after, b);
+    boardApplyMove(&after, m, &undo);
+    if (ttProbe(zobristHash(&after, other), &e) && e.move != NO_MOVE) {
+        moveListAlloc(&list);
+        generateMoves(&after, other, &list);
+        if (e.move < list.count)
+            found = moveCopy(reply, &list.moves[e.move]);
+        moveListFree(&list);
+    }
+    boardFree(&after);
+    return found;
+}
+
+/*
+    Picks side's move in b, as findBestMove, along with the reply it
+    expects. False if side has no moves. The moves in result are its own:
+    free them with searchResultFree before it is filled again.
+*/
+bool searchBestMove(const Board *b, enum player side,
+                    const SearchLimits *limits, SearchResult *result) {
+    if (!findBestMove(b, side, limits, result))
+        return false;
+
+    // MCTS reads its expected reply off its own tree
+    if (!result->hasPonder && limits->engine != ENGINE_MCTS)
+        result->hasPonder = predictReply(b, side, &result->best,
+                                         &result->ponder);
+    return true;
+}
+
+void searchResultFree(SearchResult *result) {
+    moveFree(&result->best);
+    moveFree(&result->ponder);
+}
+
+void searchControlInit(SearchControl *c) {
+    atomic_init(&c->stop, false);
+    atomic_init(&c->deadline, 0);
+}
+
+/* Makes the search stop as soon as it next checks, within a millisecond. */
+void searchStop(SearchControl *c) {
+    atomic_store(&c->stop, true);
+}
+
+/* Gives the search ms milliseconds from now, however long it has run. */
+void searchSetDeadline(SearchControl *c, int ms) {
+    long long us = (long long)(now() * 1e6) + (long long)ms * 1000;
+
+    // 0 means no deadline
+    atomic_store(&c->deadline, us != 0 ? us : 1);
+}
+
+/*
+    Searches the starting position to a fixed depth with 1, 2, 4, ... up to
+    maxThreads threads, each from an empty table, and reports how much
+    faster each gets there than one thread, and how many more nodes a
+    second it searches.
+*/
+void runSearchBench(int n, int depth, int maxThreads) {
+    Board b;
+    SearchLimits limits;
+    SearchResult r;
+    double baseTime = 0, baseRate = 0, rate;
+    int threads;
+    char buf[MOVE_TEXT_LEN];
+
+    boardInit(&b, n);
+    boardSetup(&b);
+    if (table == NULL && !ttInit((size_t)DEFAULT_TT_MB << 20)) {
+        printf("ERROR allocating transposition table\n");
+        return;
+    }
+
+    memset(&limits, 0, sizeof(limits));
+    limits.maxDepth = depth;
+    limits.engine = ENGINE_ALPHABETA;
+
+    printf("search n=%d depth=%d\n", n, depth);
+    printf("threads  %9s  %15s  %12s  %7s  %9s  %s\n", "time", "nodes",
+           "nps", "speedup", "nps ratio", "move");
+
+    for (threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2
+                                                          : maxThreads) {
+        ttClear();
+        limits.threads = threads;
+        searchBestMove(&b, PLAYER_ONE, &limits, &r);
+
+        rate = r.seconds > 0 ? r.nodes / r.seconds : 0;
+        if (threads == 1) {
+            baseTime = r.seconds;
+            baseRate = rate;
+        }
+        printf("%7d  %7.3f s  %15llu  %12.0f  %6.2fx  %8.2fx  %s\n",
+               threads, r.seconds, (unsigned long long)r.nodes, rate,
+               r.seconds > 0 ? baseTime / r.seconds : 0,
+               baseRate > 0 ? rate / baseRate : 0,
+               moveToString(&b, &r.best, buf, sizeof(buf)));
+        fflush(stdout);
+        searchResultFree(&r);
+
+        if (threads >= maxThreads)
+            break;
+    }
+
+    boardFree(&b);
+}
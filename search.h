@@ -0,0 +1,110 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "board.h"
+
+// deepest the search goes below the root, capture sequences included
+#define MAX_PLY 128
+
+// transposition table size used unless the caller sets one up first
+#define DEFAULT_TT_MB 64
+
+// scores at or beyond WIN_BOUND are forced wins (or losses), WIN_SCORE less
+// the plies until the game ends; the search and the endgame tables both
+// stay well inside that margin, and static scores never reach it
+#define WIN_SCORE 30000
+#define WIN_BOUND (WIN_SCORE - 1000)
+
+// how the computer player looks for its move
+enum searchEngine {
+    ENGINE_ALPHABETA,   // this file
+    ENGINE_MCTS         // Monte Carlo tree search, see mcts.h
+};
+
+
+/*
+    Picks moves for the computer player: iterative-deepening alpha-beta
+    (principal variation search) ordered by the transposition table's best
+    move, capture size, killer moves and history. Positions are identified
+    by Zobrist keys, updated as each move is played and taken back rather
+    than recomputed. Positions the endgame tables cover (see tablebase.h)
+    are scored from them instead of being searched.
+
+    The transposition table is a fixed block allocated once and never
+    locked: each slot is two 64-bit words, the second being the entry and
+    the first the key XORed with it, so a slot torn by two writers fails its
+    key check and is simply treated as a miss. That lets any number of
+    threads search the same position at once over the one table (lazy SMP),
+    each picking up what the others have already worked out.
+*/
+
+/*
+    Lets another thread steer a search while it runs: stop it at once, or
+    give it a deadline it did not start with. A search with no time limit
+    and no deadline yet keeps going until told, which is how the computer
+    player thinks on its opponent's time.
+*/
+typedef struct {
+    atomic_bool stop;
+    atomic_llong deadline;  // microseconds on the search's clock; 0 for none
+} SearchControl;
+
+typedef struct {
+    // how long this move may take, in milliseconds; 0 for no limit, in
+    // which case maxDepth or control must be set
+    int timeMs;
+
+    // stop after this many plies even if there is time left; 0 for no limit
+    int maxDepth;
+
+    // threads to search on, the caller's included
+    int threads;
+
+    // print a line for every depth completed
+    bool verbose;
+
+    // to stop the search, or set its deadline, from outside; may be NULL
+    SearchControl *control;
+
+    // ENGINE_MCTS ignores maxDepth, so needs a time limit or a control
+    enum searchEngine engine;
+} SearchLimits;
+
+typedef struct {
+    Move best;
+    // from the side to move's point of view; MCTS gives its win rate,
+    // scaled from -1000 for a sure loss to 1000 for a sure win
+    int score;
+
+    int depth;          // last depth searched completely; MCTS, its main line
+    uint64_t nodes;     // by all threads together; MCTS counts playouts
+    double seconds;
+
+    // the reply the search expects, if it has one
+    Move ponder;
+    bool hasPonder;
+} SearchResult;
+
+
+uint64_t zobristHash(const Board *b, enum player side);
+uint64_t zobristMove(const Board *b, const Move *m, const Undo *u);
+
+bool ttInit(size_t bytes);
+void ttClear(void);
+
+bool searchBestMove(const Board *b, enum player side,
+                    const SearchLimits *limits, SearchResult *result);
+void searchResultFree(SearchResult *result);
+bool searchSameMove(const Move *a, const Move *b);
+
+void searchControlInit(SearchControl *c);
+void searchStop(SearchControl *c);
+void searchSetDeadline(SearchControl *c, int ms);
+void runSearchBench(int n, int depth, int maxThreads);
+
+#endif
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "selftest.h"
+#include "board.h"
+#include "clock.h"
+#include "gamelog.h"
+#include "idtable.h"
+#include "movegen.h"
+#include "perft.h"
+#include "protocol.h"
+#include "shmring.h"
+#include "varint.h"
+
+// how long to wait for the log writer to get a test game to disk
+#define LOG_WAIT_SECONDS 5
+
+
+static int checks, failures;
+
+// counts a check, saying where it was if it failed
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static bool check(bool ok, const char *what, const char *file, int line) {
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("    FAILED %s:%d: %s\n", file, line, what);
+    }
+    return ok;
+}
+
+// the one frame at the front of buf, which must be whole
+static bool onlyFrame(const NetBuffer *buf, Frame *f) {
+    return peekFrame(buf, f) == 1 && f->size == buf->len;
+}
+
+static bool sameBoard(const Board *a, const Board *b) {
+    int x, y;
+
+    if (a->n != b->n)
+        return false;
+    for (y = 0; y < a->n; y++)
+        for (x = 0; x < a->n; x++)
+            if (boardGet(a, x, y) != boardGet(b, x, y))
+                return false;
+    return true;
+}
+
+// an n by n board with nothing on it
+static void emptyBoard(Board *b, int n) {
+    boardInit(b, n);
+    boardClear(b);
+}
+
+
+/* Leaf counts from the starting position, against known-good values. */
+static void testPerft() {
+    // the standard 8x8 figures, then our own for the larger boards
+    static const uint64_t eight[] = { 7, 49, 302, 1469, 7361, 36768, 179740 };
+    static const uint64_t ten[] = { 9, 81, 658, 4265, 26875, 164406 };
+    Board b;
+    int d;
+
+    boardInit(&b, 8);
+    boardSetup(&b);
+    for (d = 1; d <= 7; d++)
+        CHECK(perft(&b, PLAYER_ONE, d) == eight[d - 1]);
+    boardFree(&b);
+
+    boardInit(&b, 10);
+    boardSetup(&b);
+    for (d = 1; d <= 6; d++)
+        CHECK(perft(&b, PLAYER_ONE, d) == ten[d - 1]);
+    boardFree(&b);
+
+    boardInit(&b, 12);
+    boardSetup(&b);
+    CHECK(perft(&b, PLAYER_ONE, 6) == 577772);
+    boardFree(&b);
+}
+
+/* Forced captures, men capturing forwards only, and crowning. */
+static void testCaptureRules() {
+    Move moves[MAX_MOVES];
+    MoveList list;
+    Board b;
+    int count;
+
+    // a jump anywhere rules out every plain move
+    emptyBoard(&b, 8);
+    boardSet(&b, 1, 2, 'X');
+    boardSet(&b, 2, 3, 'Y');
+    boardSet(&b, 5, 2, 'X');
+    moveListInit(&list, moves, MAX_MOVES);
+    count = generateMoves(&b, PLAYER_ONE, &list);
+    CHECK(count == 1);
+    CHECK(moves[0].isJump && moves[0].from == 2*8 + 1 &&
+          moves[0].to == 4*8 + 3);
+    CHECK(sideHasCapture(&b, PLAYER_ONE));
+    boardFree(&b);
+
+    // a man can't capture backwards, though a king can
+    emptyBoard(&b, 8);
+    boardSet(&b, 3, 4, 'X');
+    boardSet(&b, 2, 3, 'Y');
+    CHECK(!sideHasCapture(&b, PLAYER_ONE));
+    boardSet(&b, 3, 4, 'K');
+    CHECK(sideHasCapture(&b, PLAYER_ONE));
+    boardFree(&b);
+
+    // reaching the far row crowns a man and ends the move, even though
+    // the new king could jump on
+    emptyBoard(&b, 8);
+    boardSet(&b, 2, 5, 'X');
+    boardSet(&b, 3, 6, 'Y');
+    boardSet(&b, 5, 6, 'Y');
+    moveListInit(&list, moves, MAX_MOVES);
+    count = generateMoves(&b, PLAYER_ONE, &list);
+    CHECK(count == 1);
+    CHECK(moves[0].numHops == 1 && moves[0].promotes &&
+          moves[0].to == 7*8 + 4);
+    boardFree(&b);
+}
+
+/*
+    Chains as long as the board allows. A king on 12x12 facing 25 pieces it
+    can take in one serpentine sweep gets all of them, in 4681 chains, each
+    recorded whole and each found again by findMove, which refuses one cut
+    short. A man on 82x82 climbing a column of 40 pieces takes them all in
+    a chain longer than INLINE_HOPS, which a list with no room for its path
+    can't hold, but which is listed, checked, sent and taken back whole,
+    kings and all.
+*/
+static void testLongChains() {
+    Move moves[MAX_MOVES], m, match;
+    const Move *l;
+    MoveList list, fixed;
+    NetBuffer buf;
+    Frame f;
+    Board b, before;
+    Undo undo;
+    int x, y, i, count, longest = 0, cut = 0;
+    bool allJumps = true, allFound = true;
+
+    emptyBoard(&b, 12);
+    boardSet(&b, 1, 0, 'K');
+    for (y = 1; y <= 9; y += 2)
+        for (x = 2; x <= 10; x += 2)
+            boardSet(&b, x, y, 'Y');
+
+    moveListAlloc(&list);
+    count = generateMoves(&b, PLAYER_ONE, &list);
+    CHECK(!list.overflow && count == 4681 && list.count == count);
+    for (i = 0; i < list.count; i++) {
+        l = &list.moves[i];
+        allJumps = allJumps && l->isJump;
+        allFound = allFound && findMove(&b, PLAYER_ONE, l, &match) &&
+                   match.to == l->to && match.promotes == l->promotes;
+        if (l->numHops > longest) {
+            longest = l->numHops;
+            cut = i;
+        }
+    }
+    CHECK(allJumps && allFound);
+    CHECK(longest == 25);
+    m = list.moves[cut];
+    m.numHops--;
+    CHECK(!findMove(&b, PLAYER_ONE, &m, NULL));
+    boardFree(&b);
+
+    emptyBoard(&b, 82);
+    boardSet(&b, 1, 0, 'X');
+    for (y = 1; y < 80; y += 2)
+        boardSet(&b, 2, y, y == 7 || y == 69 ? 'L' : 'Y');
+    boardInit(&before, 82);
+    boardCopy(&before, &b);
+
+    moveListInit(&fixed, moves, MAX_MOVES);
+    CHECK(generateMoves(&b, PLAYER_ONE, &fixed) == 1 && fixed.overflow &&
+          fixed.count == 0);
+    count = generateMoves(&b, PLAYER_ONE, &list);
+    if (CHECK(count == 1 && list.count == 1)) {
+        m = list.moves[0];
+        CHECK(m.numHops == 40 && m.longPath != NULL && !m.promotes &&
+              m.to == 80*82 + 1);
+        CHECK(findMove(&b, PLAYER_ONE, &m, &match) && match.to == m.to);
+
+        CHECK(moveCopy(&match, &m) && match.ownsPath &&
+              match.longPath != m.longPath && moveSameHops(&match, &m, 40));
+        moveFree(&match);
+
+        bufferInit(&buf, 256, MAX_FRAME_LEN);
+        CHECK(writeMove(&buf, &m) && onlyFrame(&buf, &f) &&
+              parseMove(&f, &match));
+        CHECK(match.numHops == 40 && match.isJump && match.ownsPath &&
+              moveSameHops(&match, &m, 40) &&
+              findMove(&b, PLAYER_ONE, &match, &match) && match.to == m.to);
+        moveFree(&match);
+        bufferFree(&buf);
+
+        boardApplyMove(&b, &m, &undo);
+        CHECK(boardCount(&b, PLAYER_TWO) == 0 && boardGet(&b, 1, 80) == 'X');
+        boardUndoMove(&b, &m, &undo);
+        CHECK(sameBoard(&b, &before));
+    }
+
+    moveListFree(&list);
+    boardFree(&before);
+    boardFree(&b);
+}
+
+/* Every frame type written and read back, and frames that must not parse. */
+static void testProtocol() {
+    NetBuffer buf;
+    Frame f, bad;
+    Hello hello, hello2;
+    Welcome welcome, welcome2;
+    Watch watch, watch2;
+    GameOver over, over2;
+    Move m, m2;
+    Board b, b2;
+    enum player toMove;
+    // PLAYER_ONE to move on a 65536x65536 board with nothing on it
+    unsigned char big[] = { PLAYER_ONE, 0x80, 0x80, 0x04, 0, 0, 0, 0 };
+    unsigned char raw[64];
+    size_t len;
+    int code;
+
+    bufferInit(&buf, 256, MAX_FRAME_LEN + 16);
+
+    hello.version = PROTOCOL_VERSION;
+    hello.token = 0x123456789abcdefULL;
+    hello.n = 10;
+    hello.rating = 1450;
+    hello.shm = true;
+    writeHello(&buf, &hello);
+    CHECK(onlyFrame(&buf, &f) && parseHello(&f, &hello2));
+    CHECK(hello2.version == hello.version && hello2.token == hello.token &&
+          hello2.n == 10 && hello2.rating == 1450 && hello2.shm);
+    CHECK(!parseWelcome(&f, &welcome2));
+
+    // every prefix of a frame is just incomplete
+    for (len = 0; len < buf.len; len++) {
+        bufferConsume(&buf, buf.len);
+        writeHello(&buf, &hello);
+        buf.len = len;
+        CHECK(peekFrame(&buf, &f) == 0);
+    }
+    bufferConsume(&buf, buf.len);
+
+    welcome.version = PROTOCOL_VERSION;
+    welcome.role = PLAYER_TWO;
+    welcome.n = 12;
+    welcome.token = 42;
+    welcome.game = 7;
+    welcome.shm = false;
+    writeWelcome(&buf, &welcome);
+    CHECK(onlyFrame(&buf, &f) && parseWelcome(&f, &welcome2));
+    CHECK(welcome2.role == PLAYER_TWO && welcome2.n == 12 &&
+          welcome2.token == 42 && welcome2.game == 7 && !welcome2.shm);
+    bufferConsume(&buf, buf.len);
+
+    // a board of one square is refused
+    welcome.n = 1;
+    writeWelcome(&buf, &welcome);
+    CHECK(onlyFrame(&buf, &f) && !parseWelcome(&f, &welcome2));
+    bufferConsume(&buf, buf.len);
+
+    watch.version = PROTOCOL_VERSION;
+    watch.game = 1ULL << 40;
+    writeWatch(&buf, &watch);
+    CHECK(onlyFrame(&buf, &f) && parseWatch(&f, &watch2) &&
+          watch2.game == watch.game);
+    bufferConsume(&buf, buf.len);
+
+    over.winner = NO_PLAYER;
+    writeGameOver(&buf, &over);
+    CHECK(onlyFrame(&buf, &f) && parseGameOver(&f, &over2) &&
+          over2.winner == NO_PLAYER);
+    bufferConsume(&buf, buf.len);
+
+    writeError(&buf, ERROR_BAD_SIZE);
+    CHECK(onlyFrame(&buf, &f) && parseError(&f, &code) &&
+          code == ERROR_BAD_SIZE);
+    bufferConsume(&buf, buf.len);
+
+    // a chain of five hops, all directions
+    memset(&m, 0, sizeof(m));
+    m.from = 13;
+    m.isJump = true;
+    m.numHops = 5;
+    m.path = DIR_NE | DIR_NW << 2 | DIR_SE << 4 | DIR_SW << 6 | DIR_NE << 8;
+    writeMove(&buf, &m);
+    CHECK(onlyFrame(&buf, &f) && parseMove(&f, &m2));
+    CHECK(m2.from == 13 && m2.isJump && m2.numHops == 5 && m2.path == m.path);
+
+    // the same frame with a byte more payload, or a hop count out of range
+    memcpy(raw, bufferHead(&buf), buf.len);
+    len = buf.len;
+    bufferConsume(&buf, buf.len);
+    bad = f;
+    bad.len = f.len - 1;
+    CHECK(!parseMove(&bad, &m2));
+    raw[len] = 0;
+    raw[0]++;
+    bufferAppend(&buf, raw, len + 1);
+    CHECK(onlyFrame(&buf, &f) && !parseMove(&f, &m2));
+    bufferConsume(&buf, buf.len);
+    m.numHops = 0;
+    writeMove(&buf, &m);
+    CHECK(onlyFrame(&buf, &f) && !parseMove(&f, &m2));
+    bufferConsume(&buf, buf.len);
+
+    // a length of zero, or past the limit, is corrupt
+    raw[0] = 0;
+    bufferAppend(&buf, raw, 1);
+    CHECK(peekFrame(&buf, &f) < 0);
+    bufferConsume(&buf, buf.len);
+    len = varintEncode(raw, MAX_FRAME_LEN + 1);
+    bufferAppend(&buf, raw, len);
+    CHECK(peekFrame(&buf, &f) < 0);
+    bufferConsume(&buf, buf.len);
+
+    // a whole position, resizing the board it is read into
+    boardInit(&b, 10);
+    boardSetup(&b);
+    boardSet(&b, 0, 5, 'L');
+    boardInit(&b2, 8);
+    writeStateSync(&buf, &b, PLAYER_TWO);
+    CHECK(onlyFrame(&buf, &f) && parseStateSync(&f, &b2, &toMove));
+    CHECK(toMove == PLAYER_TWO && sameBoard(&b, &b2));
+    bufferConsume(&buf, buf.len);
+
+    // positions that can't be: too big a board or too small, more pieces
+    // than squares, a square off the end, a piece on a light square
+    bad.type = FRAME_STATE_SYNC;
+    bad.payload = big;
+    bad.len = sizeof(big);
+    CHECK(!parseStateSync(&bad, &b2, &toMove));
+    raw[0] = FRAME_STATE_SYNC;
+    raw[1] = PLAYER_ONE;
+    raw[2] = 1;
+    raw[3] = raw[4] = raw[5] = raw[6] = 0;
+    bad.payload = raw + 1;
+    bad.len = 6;
+    CHECK(!parseStateSync(&bad, &b2, &toMove));
+    raw[2] = 4;
+    CHECK(parseStateSync(&bad, &b2, &toMove) && b2.n == 4);
+    raw[3] = 17;
+    CHECK(!parseStateSync(&bad, &b2, &toMove));
+    raw[3] = 1;
+    raw[4] = 16;
+    raw[5] = raw[6] = raw[7] = 0;
+    bad.len = 7;
+    CHECK(!parseStateSync(&bad, &b2, &toMove));
+    raw[4] = 0;
+    CHECK(!parseStateSync(&bad, &b2, &toMove));
+    raw[4] = 1;
+    CHECK(parseStateSync(&bad, &b2, &toMove) && boardGet(&b2, 1, 0) == 'X');
+
+    boardFree(&b);
+    boardFree(&b2);
+    bufferFree(&buf);
+}
+
+/* Removal shifting entries back keeps every remaining key reachable. */
+static void testIdTable() {
+    IdTable t;
+    uint64_t key;
+    bool ok = true;
+
+    idTableInit(&t);
+
+    // keys that collide in the low bits, to make long probe runs
+    for (key = 1; key <= 4000; key++)
+        idTablePut(&t, key << 20, (void*)(uintptr_t)key);
+    CHECK(t.count == 4000);
+
+    for (key = 1; key <= 4000; key += 3)
+        idTableRemove(&t, key << 20);
+    idTableRemove(&t, 1ULL << 50);
+    for (key = 1; key <= 4000; key++) {
+        if ((key - 1) % 3 == 0)
+            ok = ok && idTableGet(&t, key << 20) == NULL;
+        else
+            ok = ok && idTableGet(&t, key << 20) == (void*)(uintptr_t)key;
+    }
+    CHECK(ok);
+    CHECK(t.count == 4000 - 1334);
+
+    // replacing a value leaves the count alone
+    idTablePut(&t, 2 << 20, NULL);
+    CHECK(t.count == 4000 - 1334 && idTableGet(&t, 2 << 20) == NULL);
+
+    idTableFree(&t);
+}
+
+/*
+    Bytes through a ring intact as the counters wrap round it many times,
+    a full ring refusing more, and a ring whose counters are impossible.
+*/
+static void testShmRing() {
+    ShmLink client, server;
+    NetBuffer out, in;
+    int fds[SHM_FDS], passed[SHM_FDS], i, round;
+    unsigned char bytes[5000];
+    bool intact = true;
+
+    if (!CHECK(shmCreate(&client, fds)))
+        return;
+
+    // the server would get its own copies through the local socket
+    for (i = 0; i < SHM_FDS; i++)
+        passed[i] = dup(fds[i]);
+    shmPassed(&client, fds);
+    if (!CHECK(shmAttach(&server, passed))) {
+        shmClose(&client);
+        return;
+    }
+
+    bufferInit(&out, sizeof(bytes), SHM_RING_SIZE * 2);
+    bufferInit(&in, sizeof(bytes), SHM_RING_SIZE * 2);
+
+    // 4999 bytes at a time doesn't divide the ring, so copies straddle it
+    for (round = 0; round < 100; round++) {
+        for (i = 0; i < 4999; i++)
+            bytes[i] = (unsigned char)(round * 31 + i);
+        bufferAppend(&out, bytes, 4999);
+        intact = intact && shmWriteFrom(&client, &out) == 4999;
+        intact = intact && shmReadInto(&server, &in) == 4999 &&
+                 memcmp(bufferHead(&in), bytes, 4999) == 0;
+        bufferConsume(&in, in.len);
+    }
+    CHECK(intact);
+    CHECK(shmReadInto(&server, &in) < 0 && errno == EAGAIN);
+
+    // fill it, then one byte more won't go
+    while (out.len < SHM_RING_SIZE + 1)
+        bufferAppend(&out, bytes, 1000);
+    CHECK(shmWriteFrom(&client, &out) == SHM_RING_SIZE);
+    CHECK(shmWriteFrom(&client, &out) < 0 && errno == EAGAIN);
+    CHECK(shmWaitWrite(&client));
+    CHECK(shmReadInto(&server, &in) == SHM_RING_SIZE);
+    bufferConsume(&out, out.len);
+    CHECK(shmWaitRead(&server));
+
+    // a writer claiming more than the ring holds
+    atomic_fetch_add(&client.tx->head, SHM_RING_SIZE + 1);
+    CHECK(shmReadInto(&server, &in) < 0 && errno == EPROTO);
+
+    bufferFree(&out);
+    bufferFree(&in);
+    shmClose(&client);
+    shmClose(&server);
+}
+
+/*
+    A game written to a log and read back: its start, every move, the
+    keyframes, which must match the board reached by the moves, and its
+    end.
+*/
+static void testGameLog() {
+    char dir[] = "/tmp/checkers-selftest-XXXXXX";
+    Move moves[MAX_MOVES], played[100], m;
+    uint64_t tokens[2] = { 11, 22 }, random = 1;
+    unsigned char end[] = { 8, LOG_END, 5, 0x80, 0x80, 0x80, 0x80, 0x08,
+                            NO_PLAYER };
+    const unsigned char *data;
+    MoveList list;
+    LogRecord r;
+    GameLog *log;
+    Board b, keyframe;
+    Undo undo;
+    enum player toMove = PLAYER_ONE, synced;
+    char *path;
+    size_t size, pos;
+    double deadline;
+    int ply, count, found, seen[LOG_GAME + 1];
+    bool movesOk = true, keyframesOk = true;
+
+    if (!CHECK(mkdtemp(dir) != NULL))
+        return;
+    log = gameLogOpen(dir, 1);
+    if (!CHECK(log != NULL))
+        return;
+
+    gameLogSession(&log->shards[0], 5);
+    gameLogStart(&log->shards[0], 5, 8, tokens);
+    boardInit(&b, 8);
+    boardSetup(&b);
+    for (ply = 0; ply < 100; ply++) {
+        moveListInit(&list, moves, MAX_MOVES);
+        count = generateMoves(&b, toMove, &list);
+        if (count == 0)
+            break;
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        played[ply] = moves[(random >> 33) % count];
+        gameLogMove(&log->shards[0], 5, ply, &played[ply]);
+        boardApplyMove(&b, &played[ply], &undo);
+        toMove = toMove == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+        if ((ply + 1) % LOG_KEYFRAME_PLIES == 0)
+            gameLogKeyframe(&log->shards[0], 5, ply + 1, &b, toMove);
+    }
+    gameLogEnd(&log->shards[0], 5, ply, NO_PLAYER);
+
+    // the batch goes to the writer once it is old enough
+    deadline = now() + LOG_WAIT_SECONDS;
+    while (atomic_load(&log->shards[0].written) < log->shards[0].offset &&
+           now() < deadline) {
+        gameLogFlush(&log->shards[0]);
+        usleep(1000);
+    }
+
+    path = gameLogPath(dir, "shard", 0, ".log");
+    data = logMap(path, &size);
+    if (!CHECK(data != NULL)) {
+        free(path);
+        boardFree(&b);
+        return;
+    }
+
+    // replay the moves as they come, checking the keyframes against them
+    memset(seen, 0, sizeof(seen));
+    boardSetup(&b);
+    boardInit(&keyframe, 8);
+    for (pos = 0; pos < size; pos += r.size) {
+        found = logNextRecord(data + pos, size - pos, &r);
+        if (!CHECK(found == 1))
+            break;
+        if (r.type <= LOG_GAME)
+            seen[r.type]++;
+        if (r.type == LOG_START)
+            CHECK(r.game == 5 && r.n == 8 && r.tokens[0] == 11 &&
+                  r.tokens[1] == 22);
+        if (r.type == LOG_MOVE) {
+            movesOk = movesOk && parseMove(&r.frame, &m) &&
+                      m.from == played[r.ply].from &&
+                      m.path == played[r.ply].path &&
+                      m.numHops == played[r.ply].numHops;
+            boardApplyMove(&b, &played[r.ply], &undo);
+        }
+        if (r.type == LOG_KEYFRAME)
+            keyframesOk = keyframesOk && r.ply % LOG_KEYFRAME_PLIES == 0 &&
+                          parseStateSync(&r.frame, &keyframe, &synced) &&
+                          sameBoard(&b, &keyframe);
+        if (r.type == LOG_END)
+            CHECK(r.ply == ply && r.winner == NO_PLAYER);
+    }
+    CHECK(seen[LOG_SESSION] == 1 && seen[LOG_START] == 1 &&
+          seen[LOG_END] == 1);
+    CHECK(seen[LOG_MOVE] == ply);
+    CHECK(seen[LOG_KEYFRAME] == ply / LOG_KEYFRAME_PLIES);
+    CHECK(movesOk);
+    CHECK(keyframesOk);
+
+    // ply 2^31 is more than an int counts; 7 << 28 is not
+    CHECK(logNextRecord(end, sizeof(end), &r) == -1);
+    end[7] = 0x07;
+    CHECK(logNextRecord(end, sizeof(end), &r) == 1 && r.ply == 7 << 28);
+
+    logUnmap(data, size);
+    unlink(path);
+    free(path);
+    path = gameLogPath(dir, "checkpoint", 0, "");
+    unlink(path);
+    free(path);
+    rmdir(dir);
+    boardFree(&b);
+    boardFree(&keyframe);
+}
+
+
+/*
+    Runs the unit tests, printing each group's result and every check that
+    failed. Returns the number of failures.
+*/
+int runSelfTests() {
+    static const struct {
+        const char *name;
+        void (*run)();
+    } groups[] = {
+        { "perft", testPerft },
+        { "capture rules", testCaptureRules },
+        { "long chains", testLongChains },
+        { "protocol", testProtocol },
+        { "id table", testIdTable },
+        { "shm ring", testShmRing },
+        { "game log", testGameLog }
+    };
+    int i, before;
+
+    for (i = 0; i < (int)(sizeof(groups) / sizeof(groups[0])); i++) {
+        before = failures;
+        groups[i].run();
+        printf("%-16s %s\n", groups[i].name,
+               failures == before ? "ok" : "FAILED");
+    }
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures;
+}
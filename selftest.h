@@ -0,0 +1,13 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+/*
+    Unit tests for the parts that are easy to get subtly wrong and hard to
+    see go wrong in play: move generation, the wire protocol, the id table,
+    the shared-memory rings and the game log. Built into the program like
+    everything else, and run with --selftest.
+*/
+
+int runSelfTests();
+
+#endif
@@ -0,0 +1,2137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+#include "board.h"
+#include "broadcast.h"
+#include "clock.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "gamelog.h"
+#include "idtable.h"
+#include "movegen.h"
+#include "poller.h"
+#include "netbuf.h"
+#include "protocol.h"
+#include "shmring.h"
+#include "spsc.h"
+
+// events handled per pass through the loop
+#define MAX_EVENTS 256
+
+// a client may queue this much unread input, and we will hold this much
+// unsent output for it, before it is dropped
+#define IN_BUFFER_LIMIT 4096
+#define OUT_BUFFER_LIMIT 65536
+
+// new games that can be waiting for each worker to pick them up
+#define HANDOFF_QUEUE_SIZE 4096
+
+// the low byte of a session token says which worker has the game
+#define MAX_WORKERS 256
+
+// a worker checkpoints its games this often when any have changed,
+// putting this many of them in per pass through its loop
+#define CHECKPOINT_MS 1000
+#define CHECKPOINT_SLICE 256
+
+// a game is held this long for a player who dropped out of it
+#define SESSION_TIMEOUT_SECONDS 60
+
+// players are matched with others whose ratings fall in the same band of
+// this width, on boards of the size they asked for, up to this big unless
+// it is the server's own
+#define RATING_BAND 200
+#define MAX_REQUESTED_N 256
+
+// session tokens drawn from the kernel per read; 256 bytes is as much as
+// one read is sure to return in full
+#define TOKEN_POOL 32
+
+// a pass through the loop sends the latest moves to at most this many
+// spectators, after the players; a spectator this many frames behind is
+// sent a snapshot of the board instead
+#define WATCH_SLICE 256
+#define WATCH_MAX_LAG 64
+
+// buffers gathered into one write to a spectator
+#define WATCH_IOV 64
+
+
+typedef struct Game Game;
+
+// one client socket
+typedef struct Connection {
+    int fd;
+
+    // for a client on this host that sent shared memory, the channel its
+    // frames go through instead; fd then only tells us when it goes
+    ShmLink *shm;
+
+    Game *game;
+    enum player role;
+
+    // closed, waiting to be freed at the end of this pass
+    bool closing;
+
+    // registered for writability because output is backed up
+    bool wantWrite;
+
+    // on this pass's list of connections with output to send
+    bool dirty;
+
+    // moves forwarded to this client and not yet written to its socket,
+    // and when the first of them was read from its opponent's
+    int relayed;
+    uint64_t relayReadAt;
+
+    // a spectator (role NO_PLAYER) is sent its game's feed from here, and
+    // is at watchSlot among the game's watchers
+    FeedCursor feed;
+    int watchSlot;
+
+    NetBuffer in, out;
+    struct Connection *nextClosed;
+    struct Connection *nextDirty;
+} Connection;
+
+// two players relaying moves to each other, and where their game stands
+struct Game {
+    Connection *players[2];
+    int numOpen;
+
+    // its id in the worker's log, and how many moves have been played
+    uint64_t id;
+    int ply;
+
+    // the token each player gets their seat back with, and where the game
+    // is in the worker's array of games
+    uint64_t tokens[2];
+    int slot;
+
+    // while a player is missing (or has yet to hear how the game ended),
+    // since when, and the game's place on the worker's list of such games
+    uint64_t absentSince;
+    Game *prevAbsent, *nextAbsent;
+
+    // spectators, the moves and result broadcast to them (started with
+    // the first), and the board as of the end of the feed for those who
+    // join or fall behind, made when first wanted
+    Connection **watchers;
+    int numWatchers, watchersCap;
+    Feed feed;
+    Broadcast *snapshot;
+
+    // while some spectators have yet to be sent the latest frames: how
+    // many, whether more frames have come since they were counted, and the
+    // game's place on the worker's list of such games
+    int sweepLeft;
+    bool sweepAgain, onSweep;
+    Game *prevSweep, *nextSweep;
+
+    // the real position; clients only ever mirror it. toMove is NO_PLAYER
+    // once the game is over.
+    Board board;
+    enum player toMove;
+    enum player winner;
+};
+
+/*
+    One event loop thread. A worker owns its games outright; the only things
+    it shares are the queue the acceptor hands it new games through and its
+    statistics, which only it writes and anyone may read.
+*/
+typedef struct {
+    int id;
+    int n;
+    pthread_t thread;
+    Poller poller;
+    Waker waker;
+    SpscQueue handoff;
+
+    // connections closed during this pass
+    Connection *closed;
+
+    // connections given output during this pass, flushed together at the
+    // end so every frame queued for a client goes out in one write
+    Connection *dirty;
+
+    // every game it holds, each again under both its players' tokens,
+    // and under its id plus one
+    Game **games;
+    int numGames, gamesCap;
+    IdTable sessions;
+    IdTable byId;
+
+    // games waiting for a player to come back, longest waiting first
+    Game *absentHead, *absentTail;
+
+    // games with spectators to send new frames to, in the order they came
+    Game *sweepHead, *sweepTail;
+
+    // where this worker's games are recorded, if anywhere
+    LogShard *log;
+    uint64_t nextGameId;
+
+    // the checkpoint being put together a slice at a time, with the number
+    // of games still to go in (-1 when there is none), when the next is
+    // due, and whether any game has changed since the last was begun
+    NetBuffer checkpoint;
+    int checkpointLeft;
+    uint64_t nextCheckpoint;
+    bool changed;
+
+    _Atomic uint64_t gamesStarted, gamesEnded;
+    _Atomic uint64_t moves, refused, resumed;
+    _Atomic uint64_t watchersJoined, watchersLeft, watchersDropped;
+    _Atomic uint64_t snapshots, watchBytes;
+    _Atomic uint64_t bytesIn, bytesOut;
+
+    // microseconds from reading a move to writing it to the opponent
+    Histogram relay;
+} Worker;
+
+enum handoffType {
+    HANDOFF_GAME,       // a freshly paired game
+    HANDOFF_RESUME,     // a player coming back to one
+    HANDOFF_WATCH       // a spectator
+};
+
+/*
+    Clients on their way from the acceptor to a worker, along with anything
+    they sent after their HELLO. A new game comes with the tokens its
+    players were given, the id it was numbered with and its board size. A
+    player coming back, or a spectator, is one client, in the first of
+    each; its token is the one it came back with, and the game the one it
+    asked to watch.
+*/
+typedef struct {
+    int type;
+    int fds[2];
+    NetBuffer in[2];
+    ShmLink *shm[2];
+    uint64_t tokens[2];
+    uint64_t game;
+    int n;
+} Handoff;
+
+// a client the acceptor has not yet seated
+typedef struct {
+    int fd;
+    bool greeted;
+    uint64_t acceptedAt;
+    uint64_t token;     // from its HELLO, if it is coming back to a game
+    bool watching;      // it sent WATCH for this game instead
+    uint64_t game;
+    int n, band;        // the game it asked for, if it wants a new one
+    NetBuffer in;
+
+    // on the local socket: descriptors passed with its HELLO, and the
+    // shared memory they were for, if it asked to use it
+    bool local;
+    int fds[SHM_FDS];
+    int numFds;
+    ShmLink *shm;
+
+    // as Player One in the lobby: the game it will be in, and its token
+    bool seated;
+    int worker;
+    uint64_t gameId, seat;
+} Pending;
+
+/*
+    Everything the metrics endpoint reports. The acceptor's own numbers are
+    written by it alone; lastMoves and lastScrape belong to the metrics
+    thread, for working out the move rate between one scrape and the next.
+*/
+typedef struct {
+    Worker *workers;
+    int numWorkers;
+    GameLog *log;
+
+    _Atomic uint64_t accepted;
+    _Atomic uint64_t lobbyWaiting;
+    _Atomic uint64_t shmLinks;
+
+    // microseconds from accepting a client to sending it WELCOME
+    Histogram handshake;
+
+    uint64_t lastMoves, lastScrape;
+    Histogram scratch;
+} ServerStats;
+
+
+static void closeConnection(Worker *w, Connection *c);
+
+/*
+    Writes a small frame straight to a client not yet being served. The
+    socket is fresh, so its send buffer has room for these few bytes.
+*/
+static bool sendDirect(int fd, NetBuffer *frame) {
+    bool sent = write(fd, bufferHead(frame), frame->len) == (ssize_t)frame->len;
+
+    bufferConsume(frame, frame->len);
+    return sent;
+}
+
+// asks to be told when c's socket can take more, while it has output left
+static void wantWritable(Worker *w, Connection *c, bool waiting) {
+    if (waiting && !c->wantWrite) {
+        c->wantWrite = true;
+        pollerModify(&w->poller, c->fd, POLL_READ | POLL_WRITE, c);
+    } else if (!waiting && c->wantWrite) {
+        c->wantWrite = false;
+        pollerModify(&w->poller, c->fd, POLL_READ, c);
+    }
+}
+
+/*
+    Sends as much queued output as the socket takes, and asks to be told
+    when it can take more if some is left over.
+*/
+static void flushConnection(Worker *w, Connection *c) {
+    uint64_t elapsed;
+    ssize_t n;
+
+    while (c->out.len > 0) {
+        if (c->shm != NULL)
+            n = shmWriteFrom(c->shm, &c->out);
+        else
+            n = bufferWriteTo(&c->out, c->fd);
+        if (n < 0) {
+            // a full ring rings our bell when the client makes room
+            if (c->shm != NULL && errno == EAGAIN && !shmWaitWrite(c->shm))
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            closeConnection(w, c);
+            return;
+        }
+        counterAdd(&w->bytesOut, n);
+    }
+
+    // every move relayed to c is now on its way, each timed from when the
+    // oldest of them arrived
+    if (c->out.len == 0 && c->relayed > 0) {
+        elapsed = nowMicros() - c->relayReadAt;
+        for (; c->relayed > 0; c->relayed--)
+            histRecord(&w->relay, elapsed);
+    }
+
+    if (c->shm == NULL)
+        wantWritable(w, c, c->out.len > 0);
+}
+
+/*
+    Notes that output was queued for c, to be sent at the end of this pass;
+    fit says whether it all went into c's buffer. A client that has let
+    OUT_BUFFER_LIMIT bytes pile up is too slow to keep; it is dropped rather
+    than allowed to hold up the sender.
+*/
+static void outputQueued(Worker *w, Connection *c, bool fit) {
+    if (!fit) {
+        printf("Dropping client that stopped reading\n");
+        closeConnection(w, c);
+        return;
+    }
+
+    if (!c->dirty && !c->wantWrite) {
+        c->dirty = true;
+        c->nextDirty = w->dirty;
+        w->dirty = c;
+    }
+}
+
+static void queueOutput(Worker *w, Connection *c, const void *bytes, size_t n) {
+    if (!c->closing)
+        outputQueued(w, c, bufferAppend(&c->out, bytes, n));
+}
+
+/* Sends the output queued during this pass, one write per connection. */
+static void flushDirty(Worker *w) {
+    Connection *c;
+
+    while ((c = w->dirty) != NULL) {
+        w->dirty = c->nextDirty;
+        c->dirty = false;
+        if (!c->closing)
+            flushConnection(w, c);
+    }
+}
+
+// the number spectators watch g by
+static uint64_t gameNumber(const Worker *w, const Game *g) {
+    return g->id * MAX_WORKERS + w->id;
+}
+
+// puts g at the back of the list of games with spectators to send to
+static void startSweep(Worker *w, Game *g) {
+    if (g->numWatchers == 0)
+        return;
+    if (g->onSweep) {
+        g->sweepAgain = true;
+        return;
+    }
+    g->onSweep = true;
+    g->sweepAgain = false;
+    g->sweepLeft = g->numWatchers;
+    g->prevSweep = w->sweepTail;
+    g->nextSweep = NULL;
+    if (w->sweepTail != NULL)
+        w->sweepTail->nextSweep = g;
+    else
+        w->sweepHead = g;
+    w->sweepTail = g;
+}
+
+static void stopSweep(Worker *w, Game *g) {
+    if (!g->onSweep)
+        return;
+    if (g->prevSweep != NULL)
+        g->prevSweep->nextSweep = g->nextSweep;
+    else
+        w->sweepHead = g->nextSweep;
+    if (g->nextSweep != NULL)
+        g->nextSweep->prevSweep = g->prevSweep;
+    else
+        w->sweepTail = g->prevSweep;
+    g->onSweep = false;
+}
+
+/*
+    Broadcasts a frame to g's spectators: it is copied onto the feed once,
+    however many there are, and the sweep takes it to each of them.
+    Nothing is kept for a game nobody has watched.
+*/
+static void broadcastFrame(Worker *w, Game *g, const void *bytes,
+                           size_t len) {
+    if (g->feed.tail == NULL)
+        return;
+    feedAppend(&g->feed, bytes, len);
+    broadcastRelease(g->snapshot);
+    g->snapshot = NULL;
+    startSweep(w, g);
+}
+
+/*
+    The board as of the end of g's feed, as a STATE_SYNC (and GAME_OVER, if
+    the game has ended), encoded once for every spectator who needs it.
+*/
+static Broadcast* snapshotOf(Game *g) {
+    NetBuffer frames;
+    GameOver over;
+
+    if (g->snapshot != NULL)
+        return g->snapshot;
+
+    bufferInit(&frames, 256, MAX_FRAME_LEN);
+    writeStateSync(&frames, &g->board,
+                   g->toMove != NO_PLAYER ? g->toMove : PLAYER_ONE);
+    if (g->toMove == NO_PLAYER) {
+        over.winner = g->winner;
+        writeGameOver(&frames, &over);
+    }
+    g->snapshot = broadcastNew(bufferHead(&frames), frames.len);
+    bufferFree(&frames);
+    return g->snapshot;
+}
+
+/*
+    Keeps spectator c from holding more than WATCH_MAX_LAG frames of its
+    game's feed in memory: one that far behind skips to a snapshot, and
+    one that falls that far behind again before it has taken its snapshot
+    (or is partway through a frame, which it can't skip) is dropped.
+    Returns false if it was.
+*/
+static bool keepUp(Worker *w, Connection *c) {
+    Game *g = c->game;
+
+    if (g == NULL || cursorLag(&c->feed, &g->feed) <= WATCH_MAX_LAG)
+        return true;
+
+    if (c->feed.then != NULL || cursorMidFrame(&c->feed) || c->out.len > 0) {
+        counterAdd(&w->watchersDropped, 1);
+        closeConnection(w, c);
+        return false;
+    }
+    cursorStop(&c->feed);
+    cursorStart(&c->feed, snapshotOf(g), &g->feed);
+    counterAdd(&w->snapshots, 1);
+    return true;
+}
+
+/*
+    Sends spectator c what its socket takes of its WELCOME and its feed,
+    gathered into one writev; the frames are written straight from the
+    shared buffers. A spectator whose game has gone is hung up on once it
+    has everything.
+*/
+static void flushWatcher(Worker *w, Connection *c) {
+    struct iovec iov[WATCH_IOV];
+    size_t fromOut;
+    ssize_t n;
+    int count;
+
+    if (!keepUp(w, c))
+        return;
+
+    for (;;) {
+        count = 0;
+        if (c->out.len > 0) {
+            iov[0].iov_base = bufferHead(&c->out);
+            iov[0].iov_len = c->out.len;
+            count = 1;
+        }
+        count += cursorGather(&c->feed, iov + count, WATCH_IOV - count);
+        if (count == 0)
+            break;
+
+        n = writev(c->fd, iov, count);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            closeConnection(w, c);
+            return;
+        }
+        counterAdd(&w->watchBytes, n);
+
+        fromOut = (size_t)n < c->out.len ? (size_t)n : c->out.len;
+        bufferConsume(&c->out, fromOut);
+        cursorAdvance(&c->feed, n - fromOut);
+    }
+
+    if (c->out.len == 0 && !cursorPending(&c->feed) && c->game == NULL) {
+        closeConnection(w, c);
+        return;
+    }
+    wantWritable(w, c, c->out.len > 0 || cursorPending(&c->feed));
+}
+
+/*
+    Takes the newest frames to spectators, at most WATCH_SLICE of them per
+    pass, so that however many are watching, the players on this worker
+    wait no longer than that before their next moves are read. Spectators
+    whose sockets are backed up are only checked on; they are sent more
+    when their sockets can take it.
+*/
+static void sweepWatchers(Worker *w) {
+    int budget = WATCH_SLICE;
+    Connection *c;
+    Game *g;
+
+    while ((g = w->sweepHead) != NULL && budget > 0) {
+        while (g->sweepLeft > 0 && budget > 0) {
+            c = g->watchers[--g->sweepLeft];
+            budget--;
+            if (c->wantWrite)
+                keepUp(w, c);
+            else
+                flushWatcher(w, c);
+        }
+        if (g->sweepLeft > 0)
+            break;
+
+        // frames that came meanwhile go out on another sweep, at the back
+        stopSweep(w, g);
+        if (g->sweepAgain)
+            startSweep(w, g);
+    }
+}
+
+// takes spectator c off its game's list
+static void unwatchGame(Connection *c) {
+    Game *g = c->game;
+    Connection *last = g->watchers[--g->numWatchers];
+
+    last->watchSlot = c->watchSlot;
+    g->watchers[c->watchSlot] = last;
+    if (g->sweepLeft > g->numWatchers)
+        g->sweepLeft = g->numWatchers;
+    c->game = NULL;
+}
+
+// a game in its start position, with no players yet
+static Game* newGame(uint64_t id, int n, const uint64_t *tokens) {
+    Game *g = calloc(1, sizeof(Game));
+
+    boardInit(&g->board, n);
+    boardSetup(&g->board);
+    g->toMove = PLAYER_ONE;
+    g->winner = NO_PLAYER;
+    g->id = id;
+    g->tokens[PLAYER_ONE] = tokens[PLAYER_ONE];
+    g->tokens[PLAYER_TWO] = tokens[PLAYER_TWO];
+    return g;
+}
+
+static void freeGame(Game *g) {
+    boardFree(&g->board);
+    free(g);
+}
+
+// makes g one of w's games, found by both its tokens
+static void holdGame(Worker *w, Game *g) {
+    if (w->numGames == w->gamesCap) {
+        w->gamesCap = w->gamesCap > 0 ? 2 * w->gamesCap : 64;
+        w->games = realloc(w->games, sizeof(Game*) * w->gamesCap);
+    }
+    g->slot = w->numGames;
+    w->games[w->numGames++] = g;
+    idTablePut(&w->sessions, g->tokens[PLAYER_ONE], g);
+    idTablePut(&w->sessions, g->tokens[PLAYER_TWO], g);
+    idTablePut(&w->byId, g->id + 1, g);
+}
+
+// puts g at the back of the list of games waiting for a player
+static void suspendGame(Worker *w, Game *g, uint64_t now) {
+    if (g->absentSince != 0)
+        return;
+    g->absentSince = now;
+    g->prevAbsent = w->absentTail;
+    g->nextAbsent = NULL;
+    if (w->absentTail != NULL)
+        w->absentTail->nextAbsent = g;
+    else
+        w->absentHead = g;
+    w->absentTail = g;
+}
+
+static void unsuspendGame(Worker *w, Game *g) {
+    if (g->absentSince == 0)
+        return;
+    if (g->prevAbsent != NULL)
+        g->prevAbsent->nextAbsent = g->nextAbsent;
+    else
+        w->absentHead = g->nextAbsent;
+    if (g->nextAbsent != NULL)
+        g->nextAbsent->prevAbsent = g->prevAbsent;
+    else
+        w->absentTail = g->prevAbsent;
+    g->absentSince = 0;
+}
+
+/*
+    Forgets a game no player is connected to any more. The last game in
+    the array takes its slot; if a checkpoint is partway through the array,
+    that one may then go in twice, which is harmless. Spectators are sent
+    the rest of the feed and then let go.
+*/
+static void endGame(Worker *w, Game *g) {
+    Game *last = w->games[--w->numGames];
+    Connection *c;
+    int i;
+
+    stopSweep(w, g);
+    for (i = 0; i < g->numWatchers; i++) {
+        c = g->watchers[i];
+        c->game = NULL;
+        if (!c->wantWrite)
+            flushWatcher(w, c);
+    }
+    free(g->watchers);
+    broadcastRelease(g->snapshot);
+    if (g->feed.tail != NULL)
+        feedStop(&g->feed);
+
+    last->slot = g->slot;
+    w->games[g->slot] = last;
+    if (w->checkpointLeft > w->numGames)
+        w->checkpointLeft = w->numGames;
+
+    idTableRemove(&w->sessions, g->tokens[PLAYER_ONE]);
+    idTableRemove(&w->sessions, g->tokens[PLAYER_TWO]);
+    idTableRemove(&w->byId, g->id + 1);
+    unsuspendGame(w, g);
+    freeGame(g);
+    counterAdd(&w->gamesEnded, 1);
+}
+
+/*
+    Takes c out of its game. A game still in play is held for the player
+    to come back to, as is a finished one that a missing player has yet to
+    hear the end of; otherwise the game goes once both players have.
+*/
+static void leaveGame(Worker *w, Connection *c) {
+    Game *g = c->game;
+
+    c->game = NULL;
+    g->players[c->role] = NULL;
+    g->numOpen--;
+
+    if (g->toMove != NO_PLAYER)
+        suspendGame(w, g, nowMicros());
+    else if (g->numOpen == 0 && g->absentSince == 0)
+        endGame(w, g);
+}
+
+static void closeConnection(Worker *w, Connection *c) {
+    if (c->closing)
+        return;
+    c->closing = true;
+
+    pollerRemove(&w->poller, c->fd);
+    close(c->fd);
+    if (c->shm != NULL)
+        pollerRemove(&w->poller, c->shm->bell.readFd);
+
+    c->nextClosed = w->closed;
+    w->closed = c;
+
+    if (c->role == NO_PLAYER) {
+        counterAdd(&w->watchersLeft, 1);
+        if (c->game != NULL)
+            unwatchGame(c);
+    } else if (c->game != NULL) {
+        leaveGame(w, c);
+    }
+}
+
+/*
+    Frees the connections closed during this pass. Runs after flushDirty,
+    so none of them is still on the dirty list.
+*/
+static void reapClosed(Worker *w) {
+    Connection *c, *next;
+
+    for (c = w->closed; c != NULL; c = next) {
+        next = c->nextClosed;
+        cursorStop(&c->feed);
+        if (c->shm != NULL) {
+            shmClose(c->shm);
+            free(c->shm);
+        }
+        bufferFree(&c->in);
+        bufferFree(&c->out);
+        free(c);
+    }
+    w->closed = NULL;
+}
+
+/*
+    Plays role's move on the game's board, capture chain and all. Returns 0
+    if it was played, or the protocolError saying why not, in which case the
+    board is untouched. The move is checked by walking its own hops (see
+    findMove), so only a chain longer than INLINE_HOPS allocates anything.
+*/
+static int applyMove(Game *g, enum player role, Move *move) {
+    enum player other = role == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    Undo undo;
+
+    if (g->toMove == NO_PLAYER)
+        return ERROR_GAME_OVER;
+    if (role != g->toMove)
+        return ERROR_OUT_OF_TURN;
+    if (move->from < 0 || move->from >= g->board.geo->numSquares ||
+        !findMove(&g->board, role, move, move))
+        return ERROR_ILLEGAL_MOVE;
+
+    boardApplyMove(&g->board, move, &undo);
+
+    // a side left without a move has lost
+    if (countMoves(&g->board, other) == 0) {
+        g->winner = role;
+        g->toMove = NO_PLAYER;
+    } else {
+        g->toMove = other;
+    }
+    return 0;
+}
+
+/*
+    Counts a move just played in g and records it, along with the board
+    every LOG_KEYFRAME_PLIES plies and the result if it ended the game.
+*/
+static void logMove(Worker *w, Game *g, const Move *move) {
+    int ply = g->ply++;
+
+    if (w->log == NULL)
+        return;
+    w->changed = true;
+    gameLogMove(w->log, g->id, ply, move);
+    if (g->ply % LOG_KEYFRAME_PLIES == 0)
+        gameLogKeyframe(w->log, g->id, g->ply, &g->board,
+                        g->ply % 2 == 0 ? PLAYER_ONE : PLAYER_TWO);
+    if (g->toMove == NO_PLAYER)
+        gameLogEnd(w->log, g->id, g->ply, g->winner);
+}
+
+/*
+    Tells c why its move was refused and sends it the real position, so a
+    client that fell out of step (or tried to cheat) is put back in line.
+*/
+static void rejectMove(Worker *w, Connection *c, int code) {
+    Game *g = c->game;
+    GameOver over;
+    bool fit = writeError(&c->out, code);
+
+    if (g->toMove == NO_PLAYER) {
+        over.winner = g->winner;
+        fit = fit && writeGameOver(&c->out, &over);
+    } else {
+        fit = fit && writeStateSync(&c->out, &g->board, g->toMove);
+    }
+    outputQueued(w, c, fit);
+}
+
+/*
+    Sends GAME_OVER to whoever is in g, spectators too. Dropping a player
+    may end g, so the players are noted first.
+*/
+static void announceWinner(Worker *w, Game *g) {
+    Connection *players[2];
+    NetBuffer frame;
+    GameOver over;
+    Connection *c;
+    int i;
+
+    over.winner = g->winner;
+    if (g->feed.tail != NULL) {
+        bufferInit(&frame, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+        writeGameOver(&frame, &over);
+        broadcastFrame(w, g, bufferHead(&frame), frame.len);
+        bufferFree(&frame);
+    }
+
+    players[PLAYER_ONE] = g->players[PLAYER_ONE];
+    players[PLAYER_TWO] = g->players[PLAYER_TWO];
+    for (i = 0; i < 2; i++) {
+        c = players[i];
+        if (c != NULL && !c->closing)
+            outputQueued(w, c, writeGameOver(&c->out, &over));
+    }
+}
+
+/*
+    Handles every complete frame c has sent, which were read at readAt.
+    Each move, however many hops, is checked and played on the server's
+    board in one step and then forwarded to the opponent byte for byte; a
+    refused move goes no further than its sender. An opponent who is away
+    gets the moves in the STATE_SYNC they come back to. Spectators get the
+    same bytes again, once the players have theirs. Partial frames stay
+    buffered until the rest arrives. Anything but a move from a player is a
+    protocol error.
+*/
+static void relayMessages(Worker *w, Connection *c, uint64_t readAt) {
+    enum player other = c->role == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    Connection *peer;
+    Frame f;
+    Move move;
+    int found, refused;
+
+    while (!c->closing && c->game != NULL) {
+        found = peekFrame(&c->in, &f);
+        if (found == 0)
+            break;
+        if (found < 0 || c->role == NO_PLAYER || !parseMove(&f, &move)) {
+            printf("Dropping client that sent a bad frame\n");
+            closeConnection(w, c);
+            return;
+        }
+
+        refused = applyMove(c->game, c->role, &move);
+        if (refused) {
+            counterAdd(&w->refused, 1);
+            rejectMove(w, c, refused);
+        } else {
+            counterAdd(&w->moves, 1);
+            logMove(w, c->game, &move);
+            peer = c->game->players[other];
+            if (peer != NULL) {
+                if (peer->relayed++ == 0)
+                    peer->relayReadAt = readAt;
+                queueOutput(w, peer, bufferHead(&c->in), f.size);
+            }
+            broadcastFrame(w, c->game, bufferHead(&c->in), f.size);
+            if (c->game->toMove == NO_PLAYER)
+                announceWinner(w, c->game);
+        }
+        moveFree(&move);
+        bufferConsume(&c->in, f.size);
+    }
+}
+
+/*
+    Takes what c's client has put in its shared memory, until the ring is
+    empty and c is marked as waiting for more. Returns false if the client
+    flooded us or wrecked the ring.
+*/
+static bool readRing(Worker *w, Connection *c) {
+    ssize_t n;
+
+    wakerDrain(&c->shm->bell);
+    do {
+        while ((n = shmReadInto(c->shm, &c->in)) > 0)
+            counterAdd(&w->bytesIn, n);
+        if (errno != EAGAIN)
+            return false;
+    } while (!shmWaitRead(c->shm));
+    return true;
+}
+
+static void readConnection(Worker *w, Connection *c) {
+    ssize_t n;
+    bool done = false;
+
+    // a client on shared memory sends nothing on its socket; reading it
+    // only finds out whether the client is still there
+    for (;;) {
+        n = bufferReadFrom(&c->in, c->fd);
+        if (n > 0) {
+            counterAdd(&w->bytesIn, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // end of file, an error, or a client flooding us with input
+        done = true;
+        break;
+    }
+    if (c->shm != NULL && !done) {
+        done = !readRing(w, c);
+
+        // the bell also rings when the client made room for what is left
+        if (c->out.len > 0)
+            outputQueued(w, c, true);
+    }
+
+    relayMessages(w, c, nowMicros());
+    if (done)
+        closeConnection(w, c);
+}
+
+/*
+    How much more a player's buffers hold than IN_BUFFER_LIMIT and
+    OUT_BUFFER_LIMIT, so that a MOVE of the longest chain on an n by n
+    board fits: a byte for every four hops, and a hop for every dark square
+    at most.
+*/
+static size_t moveFrameRoom(int n) {
+    size_t room = MAX_SMALL_FRAME + (size_t)n * n / 8;
+
+    return room < MAX_FRAME_LEN ? room : MAX_FRAME_LEN;
+}
+
+static Connection* addConnection(Worker *w, int fd, NetBuffer *in,
+                                 ShmLink *shm, Game *g, enum player role) {
+    Connection *c = calloc(1, sizeof(Connection));
+
+    c->fd = fd;
+    c->shm = shm;
+    c->game = g;
+    c->role = role;
+    c->in = *in;
+    c->in.limit = IN_BUFFER_LIMIT + moveFrameRoom(g->board.n);
+    bufferInit(&c->out, 512, OUT_BUFFER_LIMIT + moveFrameRoom(g->board.n));
+
+    g->players[role] = c;
+    g->numOpen++;
+
+    if (!pollerAdd(&w->poller, fd, POLL_READ, c) ||
+        (shm != NULL &&
+         !pollerAdd(&w->poller, shm->bell.readFd, POLL_READ, c))) {
+        printf("ERROR watching client socket\n");
+        closeConnection(w, c);
+    }
+    return c;
+}
+
+// tells the client handed over in h why it can't be served, and hangs up
+static void refuseHandoff(Handoff *h, int code) {
+    NetBuffer reply;
+
+    bufferInit(&reply, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+    writeError(&reply, code);
+    sendDirect(h->fds[0], &reply);
+    bufferFree(&reply);
+    close(h->fds[0]);
+    bufferFree(&h->in[0]);
+}
+
+/*
+    Seats a player coming back to a game with its token, in place of any
+    connection still holding the seat, and tells them where the game
+    stands. A token this worker doesn't know gets ERROR_NO_SESSION.
+*/
+static void resumeSession(Worker *w, Handoff *h) {
+    Game *g = idTableGet(&w->sessions, h->tokens[0]);
+    Connection *c, *old;
+    Welcome welcome;
+    GameOver over;
+    enum player role;
+    bool fit;
+
+    if (g == NULL) {
+        refuseHandoff(h, ERROR_NO_SESSION);
+        return;
+    }
+
+    role = g->tokens[PLAYER_ONE] == h->tokens[0] ? PLAYER_ONE : PLAYER_TWO;
+    old = g->players[role];
+    if (old != NULL) {
+        // let go of the game first, so it can't end under us
+        old->game = NULL;
+        g->players[role] = NULL;
+        g->numOpen--;
+        closeConnection(w, old);
+    }
+
+    c = addConnection(w, h->fds[0], &h->in[0], NULL, g, role);
+    if (c->closing)
+        return;
+    counterAdd(&w->resumed, 1);
+
+    welcome.version = PROTOCOL_VERSION;
+    welcome.role = role;
+    welcome.n = g->board.n;
+    welcome.token = h->tokens[0];
+    welcome.game = gameNumber(w, g);
+    welcome.shm = false;
+    fit = writeWelcome(&c->out, &welcome);
+    if (g->toMove == NO_PLAYER) {
+        over.winner = g->winner;
+        fit = fit && writeGameOver(&c->out, &over);
+    } else {
+        fit = fit && writeStateSync(&c->out, &g->board, g->toMove);
+    }
+
+    // with both players back, or this one told how it ended, nobody is
+    // missing anything
+    if (g->numOpen == 2 || g->toMove == NO_PLAYER)
+        unsuspendGame(w, g);
+
+    outputQueued(w, c, fit);
+    if (!c->closing)
+        readConnection(w, c);
+}
+
+/*
+    Adds a spectator to the game it asked for and starts it off with the
+    board as it stands. A game's feed starts with its first spectator.
+*/
+static void watchGame(Worker *w, Handoff *h) {
+    Game *g = idTableGet(&w->byId, h->game + 1);
+    Connection *c;
+    Welcome welcome;
+
+    if (g == NULL) {
+        refuseHandoff(h, ERROR_NO_GAME);
+        return;
+    }
+
+    c = calloc(1, sizeof(Connection));
+    c->fd = h->fds[0];
+    c->role = NO_PLAYER;
+    c->in = h->in[0];
+    bufferInit(&c->out, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+    counterAdd(&w->watchersJoined, 1);
+    if (!pollerAdd(&w->poller, c->fd, POLL_READ, c)) {
+        printf("ERROR watching client socket\n");
+        closeConnection(w, c);
+        return;
+    }
+
+    if (g->numWatchers == g->watchersCap) {
+        g->watchersCap = g->watchersCap > 0 ? 2 * g->watchersCap : 16;
+        g->watchers = realloc(g->watchers,
+                              sizeof(Connection*) * g->watchersCap);
+    }
+    c->game = g;
+    c->watchSlot = g->numWatchers;
+    g->watchers[g->numWatchers++] = c;
+    if (g->feed.tail == NULL)
+        feedStart(&g->feed);
+
+    welcome.version = PROTOCOL_VERSION;
+    welcome.role = NO_PLAYER;
+    welcome.n = g->board.n;
+    welcome.token = 0;
+    welcome.game = gameNumber(w, g);
+    welcome.shm = false;
+    writeWelcome(&c->out, &welcome);
+    cursorStart(&c->feed, snapshotOf(g), &g->feed);
+    flushWatcher(w, c);
+}
+
+/*
+    Takes over the games, returning players and spectators the acceptor
+    has queued for this worker. Player One may have moved before Player
+    Two arrived, so read from both right away.
+*/
+static void adoptGames(Worker *w) {
+    Handoff h;
+    Game *g;
+    Connection *one, *two;
+
+    wakerDrain(&w->waker);
+
+    while (spscPop(&w->handoff, &h)) {
+        if (h.type == HANDOFF_RESUME) {
+            resumeSession(w, &h);
+            continue;
+        }
+        if (h.type == HANDOFF_WATCH) {
+            watchGame(w, &h);
+            continue;
+        }
+
+        g = newGame(h.game, h.n, h.tokens);
+        w->nextGameId = h.game + 1;
+        holdGame(w, g);
+        if (w->log != NULL) {
+            gameLogStart(w->log, g->id, h.n, h.tokens);
+            w->changed = true;
+        }
+        one = addConnection(w, h.fds[PLAYER_ONE], &h.in[PLAYER_ONE],
+                            h.shm[PLAYER_ONE], g, PLAYER_ONE);
+        two = addConnection(w, h.fds[PLAYER_TWO], &h.in[PLAYER_TWO],
+                            h.shm[PLAYER_TWO], g, PLAYER_TWO);
+        counterAdd(&w->gamesStarted, 1);
+
+        if (!one->closing)
+            readConnection(w, one);
+        if (!two->closing)
+            readConnection(w, two);
+    }
+}
+
+/*
+    Gives up on players who have been gone longer than
+    SESSION_TIMEOUT_SECONDS. The player who stayed wins by forfeit; a game
+    both players left is abandoned and forgotten.
+*/
+static void expireSessions(Worker *w) {
+    uint64_t now = nowMicros();
+    Game *g;
+    bool over;
+
+    while ((g = w->absentHead) != NULL &&
+           now - g->absentSince >= SESSION_TIMEOUT_SECONDS * 1000000ULL) {
+        unsuspendGame(w, g);
+
+        over = g->toMove == NO_PLAYER;
+        if (!over) {
+            if (g->players[PLAYER_ONE] != NULL)
+                g->winner = PLAYER_ONE;
+            else if (g->players[PLAYER_TWO] != NULL)
+                g->winner = PLAYER_TWO;
+            g->toMove = NO_PLAYER;
+            if (w->log != NULL) {
+                gameLogEnd(w->log, g->id, g->ply, g->winner);
+                w->changed = true;
+            }
+        }
+
+        if (g->numOpen == 0)
+            endGame(w, g);
+        else if (!over)
+            announceWinner(w, g);
+    }
+}
+
+/*
+    Works on this worker's checkpoint: begins one every CHECKPOINT_MS while
+    games are changing, puts CHECKPOINT_SLICE games in per pass so that no
+    pass stalls for long however many games there are, and hands it to the
+    log writer once every game is in. Finished games are left out.
+*/
+static void checkpointGames(Worker *w) {
+    uint64_t now;
+    Game *g;
+    int i;
+
+    if (w->checkpointLeft < 0) {
+        now = nowMicros();
+        if (!w->changed || now < w->nextCheckpoint)
+            return;
+        checkpointBegin(&w->checkpoint, w->log, w->nextGameId);
+        w->checkpointLeft = w->numGames;
+        w->nextCheckpoint = now + CHECKPOINT_MS * 1000;
+        w->changed = false;
+    }
+
+    for (i = 0; i < CHECKPOINT_SLICE && w->checkpointLeft > 0; i++) {
+        g = w->games[--w->checkpointLeft];
+        if (g->toMove == NO_PLAYER)
+            continue;
+        if (!checkpointGame(&w->checkpoint, g->id, g->ply, g->tokens,
+                            &g->board, g->toMove)) {
+            printf("ERROR checkpoint of worker %d is too big\n", w->id);
+            bufferFree(&w->checkpoint);
+            w->checkpointLeft = -1;
+            return;
+        }
+    }
+
+    if (w->checkpointLeft == 0) {
+        // the writer is still on the last one; try again next time
+        if (!gameLogCheckpoint(w->log, &w->checkpoint))
+            w->changed = true;
+        w->checkpointLeft = -1;
+    }
+}
+
+// the sooner of two pollerWait timeouts, where -1 is forever
+static int soonest(int a, int b) {
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return a < b ? a : b;
+}
+
+/*
+    How long the worker may sleep before it has something to do: flush its
+    log, get on with a checkpoint or a sweep of spectators, or give up on a
+    missing player.
+*/
+static int workerTimeout(Worker *w) {
+    uint64_t now = nowMicros(), due;
+    int timeout = -1;
+
+    if (w->sweepHead != NULL)
+        return 0;
+
+    if (w->absentHead != NULL) {
+        due = w->absentHead->absentSince + SESSION_TIMEOUT_SECONDS * 1000000ULL;
+        timeout = due > now ? (due - now) / 1000 + 1 : 0;
+    }
+    if (w->log == NULL)
+        return timeout;
+
+    timeout = soonest(timeout, gameLogTimeout(w->log));
+    if (w->checkpointLeft > 0)
+        return 0;
+    if (w->changed)
+        timeout = soonest(timeout, w->nextCheckpoint > now ?
+                                   (w->nextCheckpoint - now) / 1000 + 1 : 0);
+    return timeout;
+}
+
+static void* workerLoop(void *arg) {
+    Worker *w = arg;
+    PollEvent events[MAX_EVENTS];
+    Connection *c;
+    int i, numEvents;
+
+    for (;;) {
+        numEvents = pollerWait(&w->poller, events, MAX_EVENTS,
+                               workerTimeout(w));
+        if (numEvents < 0) {
+            printf("ERROR waiting for events\n");
+            break;
+        }
+
+        for (i = 0; i < numEvents; i++) {
+            if (events[i].data == &w->waker) {
+                adoptGames(w);
+                continue;
+            }
+
+            c = events[i].data;
+            if (!c->closing && (events[i].events & POLL_WRITE)) {
+                if (c->role == NO_PLAYER)
+                    flushWatcher(w, c);
+                else
+                    flushConnection(w, c);
+            }
+            if (!c->closing && (events[i].events & POLL_READ))
+                readConnection(w, c);
+        }
+
+        expireSessions(w);
+        flushDirty(w);
+        sweepWatchers(w);
+        reapClosed(w);
+        if (w->log != NULL) {
+            checkpointGames(w);
+            gameLogFlush(w->log);
+        }
+    }
+
+    return NULL;
+}
+
+static bool initWorker(Worker *w, int id, int n) {
+    memset(w, 0, sizeof(Worker));
+    histInit(&w->relay);
+    idTableInit(&w->sessions);
+    idTableInit(&w->byId);
+    w->id = id;
+    w->n = n;
+    w->checkpointLeft = -1;
+
+    return pollerCreate(&w->poller) && wakerCreate(&w->waker) &&
+           spscInit(&w->handoff, sizeof(Handoff), HANDOFF_QUEUE_SIZE) &&
+           pollerAdd(&w->poller, w->waker.readFd, POLL_READ, &w->waker);
+}
+
+static bool startWorker(Worker *w) {
+    return pthread_create(&w->thread, NULL, workerLoop, w) == 0;
+}
+
+
+// closes whatever descriptors p passed that have not been put to use
+static void closePassed(Pending *p) {
+    for (; p->numFds > 0; p->numFds--)
+        close(p->fds[p->numFds - 1]);
+}
+
+static void dropPending(Poller *poller, Pending *p) {
+    pollerRemove(poller, p->fd);
+    close(p->fd);
+    closePassed(p);
+    if (p->shm != NULL) {
+        shmClose(p->shm);
+        free(p->shm);
+    }
+    bufferFree(&p->in);
+    free(p);
+}
+
+/*
+    Reads from a client the acceptor is holding. Returns false if it hung
+    up, sent garbage or spoke the wrong protocol version; true once it has
+    sent its HELLO or WATCH (setting greeted, and token or game if it is
+    coming back to a game or watching one, or the board size and rating
+    band it wants, and shm if it sent shared memory we can use) or if it
+    just needs to send more.
+*/
+static bool readPending(Pending *p) {
+    NetBuffer reply;
+    Frame f;
+    Hello hello;
+    Watch watch;
+    ssize_t n;
+    int found, version;
+
+    for (;;) {
+        if (p->local)
+            n = shmReadOpening(&p->in, p->fd, p->fds, &p->numFds);
+        else
+            n = bufferReadFrom(&p->in, p->fd);
+        if (n > 0)
+            continue;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+
+    if (p->greeted) {
+        closePassed(p);
+        return true;
+    }
+
+    found = peekFrame(&p->in, &f);
+    if (found == 0)
+        return true;
+    if (found < 0)
+        return false;
+    if (parseHello(&f, &hello)) {
+        version = hello.version;
+        p->token = hello.token;
+        p->n = hello.n;
+        p->band = (unsigned int)hello.rating / RATING_BAND;
+
+        // only new games are played over shared memory
+        if (hello.shm && hello.token == 0 && p->numFds == SHM_FDS) {
+            p->shm = malloc(sizeof(ShmLink));
+            if (!shmAttach(p->shm, p->fds)) {
+                free(p->shm);
+                p->shm = NULL;
+            }
+            p->numFds = 0;
+        }
+    } else if (parseWatch(&f, &watch)) {
+        version = watch.version;
+        p->watching = true;
+        p->game = watch.game;
+    } else {
+        return false;
+    }
+    bufferConsume(&p->in, f.size);
+    closePassed(p);
+
+    if (version != PROTOCOL_VERSION) {
+        bufferInit(&reply, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+        writeError(&reply, ERROR_BAD_VERSION);
+        sendDirect(p->fd, &reply);
+        bufferFree(&reply);
+        return false;
+    }
+
+    p->greeted = true;
+    return true;
+}
+
+/*
+    Sends p its WELCOME, timing the handshake from when it was accepted.
+*/
+static bool welcomePending(ServerStats *stats, Pending *p, NetBuffer *reply,
+                           const Welcome *welcome) {
+    writeWelcome(reply, welcome);
+    if (!sendDirect(p->fd, reply))
+        return false;
+    histRecord(&stats->handshake, nowMicros() - p->acceptedAt);
+    return true;
+}
+
+/*
+    Passes a client coming back to a game, or come to watch one, to the
+    worker its token or game number names. If that worker's queue is full
+    the client is hung up on, and tries again.
+*/
+static void routeToGame(Poller *poller, ServerStats *stats, Pending *p,
+                        NetBuffer *reply) {
+    uint64_t number = p->watching ? p->game : p->token;
+    int id = number % MAX_WORKERS;
+    Worker *w;
+    Handoff h;
+
+    if (id >= stats->numWorkers) {
+        writeError(reply, p->watching ? ERROR_NO_GAME : ERROR_NO_SESSION);
+        sendDirect(p->fd, reply);
+        dropPending(poller, p);
+        return;
+    }
+
+    w = &stats->workers[id];
+    memset(&h, 0, sizeof(Handoff));
+    h.type = p->watching ? HANDOFF_WATCH : HANDOFF_RESUME;
+    h.fds[0] = p->fd;
+    h.in[0] = p->in;
+    h.tokens[0] = p->token;
+    h.game = number / MAX_WORKERS;
+    if (!spscPush(&w->handoff, &h)) {
+        dropPending(poller, p);
+        return;
+    }
+    pollerRemove(poller, p->fd);
+    free(p);
+    wakerSignal(&w->waker);
+}
+
+/*
+    The acceptor's lobby: the Player One of each board size and rating
+    band waiting for an opponent. There is never more than one, since the
+    next to ask for the same is seated with it at once, so pairing is one
+    lookup per arrival however many are waiting.
+*/
+typedef struct {
+    IdTable waiting;        // by lobbyKey
+    uint64_t *nextIds;      // the id of the next game on each worker
+    int next;               // the worker the next game goes to
+    int defaultN;
+
+    // kernel randomness for session tokens, fetched a pool at a time
+    uint64_t pool[TOKEN_POOL];
+    int poolLeft;
+} Lobby;
+
+/*
+    A session token for a seat in a game on worker id, with the worker in
+    the low byte. Each is drawn from the kernel's generator on its own, so
+    that one player's tokens say nothing about another's and no one can
+    take over a seat that isn't theirs. Returns 0 if there is no
+    randomness to be had.
+*/
+static uint64_t newToken(Lobby *lobby, int id) {
+    uint64_t token;
+    ssize_t got;
+
+    do {
+        if (lobby->poolLeft == 0) {
+            // a read this small is never cut short or interrupted
+            got = getrandom(lobby->pool, sizeof(lobby->pool), 0);
+            if (got != sizeof(lobby->pool))
+                return 0;
+            lobby->poolLeft = TOKEN_POOL;
+        }
+        token = lobby->pool[--lobby->poolLeft] << 8 | id;
+    } while (token >> 8 == 0);
+    return token;
+}
+
+// where p waits in the lobby; never 0, since n is over 1
+static uint64_t lobbyKey(const Pending *p) {
+    return (uint64_t)p->n << 32 | (uint32_t)p->band;
+}
+
+// takes a Player One who gave up waiting out of the lobby
+static void lobbyLeave(ServerStats *stats, Lobby *lobby, Pending *p) {
+    if (!p->seated)
+        return;
+    idTableRemove(&lobby->waiting, lobbyKey(p));
+    atomic_store_explicit(&stats->lobbyWaiting, lobby->waiting.count,
+                          memory_order_relaxed);
+}
+
+/*
+    Hands the game between one and two, both welcomed, to the worker
+    chosen for it when one arrived. The worker owns both sockets and their
+    buffers from here on.
+*/
+static void startGame(Poller *poller, ServerStats *stats, Pending *one,
+                      Pending *two) {
+    Worker *w = &stats->workers[one->worker];
+    Handoff h;
+    int i;
+
+    pollerRemove(poller, one->fd);
+    pollerRemove(poller, two->fd);
+    memset(&h, 0, sizeof(Handoff));
+    h.type = HANDOFF_GAME;
+    h.game = one->gameId;
+    h.n = one->n;
+    h.fds[PLAYER_ONE] = one->fd;
+    h.in[PLAYER_ONE] = one->in;
+    h.shm[PLAYER_ONE] = one->shm;
+    h.tokens[PLAYER_ONE] = one->seat;
+    h.fds[PLAYER_TWO] = two->fd;
+    h.in[PLAYER_TWO] = two->in;
+    h.shm[PLAYER_TWO] = two->shm;
+    h.tokens[PLAYER_TWO] = two->seat;
+    free(one);
+    free(two);
+
+    if (spscPush(&w->handoff, &h)) {
+        wakerSignal(&w->waker);
+        return;
+    }
+    printf("Worker %d is backed up; dropping a new game\n", w->id);
+    for (i = 0; i < 2; i++) {
+        close(h.fds[i]);
+        bufferFree(&h.in[i]);
+        if (h.shm[i] != NULL) {
+            shmClose(h.shm[i]);
+            free(h.shm[i]);
+        }
+    }
+}
+
+/*
+    Seats p, which wants a new game: with the player waiting for the same
+    board size and rating band if there is one, or else as Player One of a
+    game on the next worker in turn, with its id (the next of that
+    worker's nextIds) chosen now so that its token and game number can
+    name it, to wait for the next to ask for the same.
+*/
+static void lobbyJoin(Poller *poller, ServerStats *stats, Lobby *lobby,
+                      Pending *p, NetBuffer *reply) {
+    Welcome welcome;
+    Pending *first;
+    uint64_t key;
+
+    if (p->n == 0)
+        p->n = lobby->defaultN;
+    if (p->n < 2 || (p->n > MAX_REQUESTED_N && p->n != lobby->defaultN)) {
+        writeError(reply, ERROR_BAD_SIZE);
+        sendDirect(p->fd, reply);
+        dropPending(poller, p);
+        return;
+    }
+
+    key = lobbyKey(p);
+    first = idTableGet(&lobby->waiting, key);
+    welcome.version = PROTOCOL_VERSION;
+    welcome.n = p->n;
+    welcome.shm = p->shm != NULL;
+    if (p->shm != NULL)
+        counterAdd(&stats->shmLinks, 1);
+
+    if (first == NULL) {
+        p->worker = lobby->next;
+        lobby->next = (lobby->next + 1) % stats->numWorkers;
+        p->seat = newToken(lobby, p->worker);
+        if (p->seat == 0) {
+            printf("ERROR reading random bytes for a session token\n");
+            dropPending(poller, p);
+            return;
+        }
+        p->gameId = lobby->nextIds[p->worker]++;
+        welcome.role = PLAYER_ONE;
+        welcome.token = p->seat;
+        welcome.game = p->gameId * MAX_WORKERS + p->worker;
+        if (!welcomePending(stats, p, reply, &welcome)) {
+            dropPending(poller, p);
+            return;
+        }
+        p->seated = true;
+        idTablePut(&lobby->waiting, key, p);
+    } else {
+        p->seat = newToken(lobby, first->worker);
+        if (p->seat == 0) {
+            printf("ERROR reading random bytes for a session token\n");
+            dropPending(poller, p);
+            return;
+        }
+        welcome.role = PLAYER_TWO;
+        welcome.token = p->seat;
+        welcome.game = first->gameId * MAX_WORKERS + first->worker;
+        if (!welcomePending(stats, p, reply, &welcome)) {
+            dropPending(poller, p);
+            return;
+        }
+        idTableRemove(&lobby->waiting, key);
+        startGame(poller, stats, first, p);
+    }
+    atomic_store_explicit(&stats->lobbyWaiting, lobby->waiting.count,
+                          memory_order_relaxed);
+}
+
+/*
+    Accepts every connection waiting on listenFd, the local socket if
+    local, to be read from until it has said what it wants.
+*/
+static void acceptAll(Poller *poller, ServerStats *stats, int listenFd,
+                      bool local) {
+    Pending *p;
+    int fd, one = 1;
+
+    while ((fd = accept(listenFd, NULL, NULL)) >= 0 || errno == EINTR) {
+        if (fd < 0)
+            continue;
+        setNonBlocking(fd);
+        if (!local)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        counterAdd(&stats->accepted, 1);
+        p = calloc(1, sizeof(Pending));
+        p->fd = fd;
+        p->local = local;
+        p->acceptedAt = nowMicros();
+        bufferInit(&p->in, 256, IN_BUFFER_LIMIT);
+        if (!pollerAdd(poller, fd, POLL_READ, p)) {
+            close(fd);
+            bufferFree(&p->in);
+            free(p);
+        }
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        printf("ERROR on accept\n");
+}
+
+/*
+    Accepts clients, on the TCP socket and the local one (if localFd isn't
+    -1), waits for each one's HELLO, and seats those wanting a new game
+    through the lobby, handing each game to a worker once both its players
+    are there; a client coming back to a game, or watching one, goes to the
+    worker that has it. Every new connection is accepted as soon as it
+    arrives, so a burst of them waits here, not in the kernel's accept
+    queue.
+*/
+static void acceptLoop(int listenFd, int localFd, int n, ServerStats *stats,
+                       uint64_t *nextIds) {
+    Poller poller;
+    PollEvent events[MAX_EVENTS];
+    Pending *p;
+    NetBuffer reply;
+    Lobby lobby;
+    int i, numEvents;
+
+    // the listening sockets are told apart from clients by these
+    static int tcpMark, localMark;
+
+    if (!pollerCreate(&poller) ||
+        !pollerAdd(&poller, listenFd, POLL_READ, &tcpMark) ||
+        (localFd >= 0 && !pollerAdd(&poller, localFd, POLL_READ, &localMark))) {
+        printf("ERROR creating event loop\n");
+        return;
+    }
+    bufferInit(&reply, MAX_SMALL_FRAME, MAX_SMALL_FRAME);
+
+    idTableInit(&lobby.waiting);
+    lobby.nextIds = nextIds;
+    lobby.next = 0;
+    lobby.defaultN = n;
+    lobby.poolLeft = 0;
+
+    for (;;) {
+        numEvents = pollerWait(&poller, events, MAX_EVENTS, -1);
+        if (numEvents < 0) {
+            printf("ERROR waiting for connections\n");
+            return;
+        }
+
+        for (i = 0; i < numEvents; i++) {
+            if (events[i].data == &tcpMark) {
+                acceptAll(&poller, stats, listenFd, false);
+                continue;
+            }
+            if (events[i].data == &localMark) {
+                acceptAll(&poller, stats, localFd, true);
+                continue;
+            }
+
+            p = events[i].data;
+            if (!readPending(p)) {
+                // a Player One who gave up waiting frees the seat
+                lobbyLeave(stats, &lobby, p);
+                dropPending(&poller, p);
+                continue;
+            }
+            if (!p->greeted || p->seated)
+                continue;
+
+            if (p->token != 0 || p->watching)
+                routeToGame(&poller, stats, p, &reply);
+            else
+                lobbyJoin(&poller, stats, &lobby, p, &reply);
+        }
+    }
+}
+
+/*
+    Opens the local socket that clients on this host can pass shared memory
+    over. Returns -1, and the server does without, if it can't.
+*/
+static int openLocalSocket(int port) {
+    struct sockaddr_un addr;
+    socklen_t len = shmLocalAddress(&addr, port);
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (addr.sun_path[0] != '\0')
+        unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *) &addr, len) < 0 ||
+        listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int openListenSocket(int port) {
+    struct sockaddr_in serv_addr;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("ERROR opening socket\n");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        printf("ERROR on binding\n");
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd)) {
+        printf("ERROR on listen\n");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    How many shards the log in dir has: the number of workers that wrote
+    it, which the server has to keep for the tokens they gave out to stay
+    good. 0 for a new directory.
+*/
+static int countShards(const char *dir) {
+    struct stat st;
+    char *log, *checkpoint;
+    bool found;
+    int n;
+
+    for (n = 0; n < MAX_WORKERS; n++) {
+        log = gameLogPath(dir, "shard", n, ".log");
+        checkpoint = gameLogPath(dir, "checkpoint", n, "");
+        found = stat(log, &st) == 0 || stat(checkpoint, &st) == 0;
+        free(log);
+        free(checkpoint);
+        if (!found)
+            break;
+    }
+    return n;
+}
+
+// drops the game with id from games, which are keyed by id + 1
+static void forgetGame(IdTable *games, uint64_t id) {
+    Game *g = idTableGet(games, id + 1);
+
+    if (g != NULL) {
+        idTableRemove(games, id + 1);
+        freeGame(g);
+    }
+}
+
+// brings games up to date with one record from the log
+static void replayRecord(Worker *w, IdTable *games, const LogRecord *r) {
+    Game *g = idTableGet(games, r->game + 1);
+    Move m;
+    size_t i;
+
+    switch (r->type) {
+    case LOG_SESSION:
+        // a restart that came back without its games: those left over
+        // from before, with ids from here on, are gone
+        for (i = 0; i <= games->mask; ) {
+            if (games->slots[i].key > r->game)
+                forgetGame(games, games->slots[i].key - 1);
+            else
+                i++;
+        }
+        if (r->game > w->nextGameId)
+            w->nextGameId = r->game;
+        break;
+    case LOG_START:
+        if (g == NULL)
+            idTablePut(games, r->game + 1, newGame(r->game, r->n, r->tokens));
+        if (r->game >= w->nextGameId)
+            w->nextGameId = r->game + 1;
+        break;
+    case LOG_MOVE:
+        // the checkpoint may have had this move already
+        if (g == NULL || r->ply != g->ply)
+            break;
+        if (!parseMove(&r->frame, &m)) {
+            forgetGame(games, r->game);
+            break;
+        }
+        if (applyMove(g, g->toMove, &m) != 0)
+            forgetGame(games, r->game);
+        else
+            g->ply++;
+        moveFree(&m);
+        break;
+    case LOG_KEYFRAME:
+        if (g == NULL || r->ply <= g->ply)
+            break;
+        if (!parseStateSync(&r->frame, &g->board, &g->toMove))
+            forgetGame(games, r->game);
+        else
+            g->ply = r->ply;
+        break;
+    case LOG_END:
+        forgetGame(games, r->game);
+        break;
+    }
+}
+
+/*
+    Brings back the games worker w had in play when the server stopped:
+    those in its checkpoint, brought up to date by what its log says
+    happened once the checkpoint was begun, and any begun since. They wait
+    for their players as if both had dropped out. A log cut short partway
+    through a record is trimmed back to its last whole one, so that what
+    is logged from here on can be read. Returns how many games there are,
+    or -1 if the files can't be read.
+*/
+static int restoreShard(Worker *w, const char *dir, int shard) {
+    const unsigned char *data;
+    char *path;
+    size_t size, pos = 0, i;
+    uint64_t offset = 0, now = nowMicros();
+    IdTable games;
+    LogRecord r;
+    Game *g;
+    int found = 1, restored = 0;
+
+    idTableInit(&games);
+
+    path = gameLogPath(dir, "checkpoint", shard, "");
+    data = logMap(path, &size);
+    if (data == NULL && errno != 0 && errno != ENOENT) {
+        printf("ERROR reading %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (pos < size && logNextRecord(data + pos, size - pos, &r) == 1) {
+        if (r.type == LOG_CHECKPOINT) {
+            w->nextGameId = r.game;
+            offset = r.offset;
+        } else if (r.type == LOG_GAME) {
+            forgetGame(&games, r.game);
+            g = newGame(r.game, w->n, r.tokens);
+            g->ply = r.ply;
+            if (parseStateSync(&r.frame, &g->board, &g->toMove))
+                idTablePut(&games, r.game + 1, g);
+            else
+                freeGame(g);
+        }
+        pos += r.size;
+    }
+    if (data != NULL)
+        logUnmap(data, size);
+    free(path);
+
+    path = gameLogPath(dir, "shard", shard, ".log");
+    data = logMap(path, &size);
+    if (data == NULL && errno != 0 && errno != ENOENT) {
+        printf("ERROR reading %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (pos = offset; pos < size; pos += r.size) {
+        found = logNextRecord(data + pos, size - pos, &r);
+        if (found <= 0)
+            break;
+        replayRecord(w, &games, &r);
+    }
+    if (data != NULL)
+        logUnmap(data, size);
+    if (found < 0) {
+        printf("ERROR %s is corrupt at byte %zu\n", path, pos);
+    } else if (pos < size) {
+        printf("Trimming %s to its last whole record\n", path);
+        if (truncate(path, pos) < 0)
+            printf("ERROR trimming %s: %s\n", path, strerror(errno));
+    }
+    free(path);
+
+    for (i = 0; i <= games.mask; i++) {
+        g = games.slots[i].value;
+        if (g == NULL)
+            continue;
+        if (g->toMove == NO_PLAYER) {
+            freeGame(g);
+            continue;
+        }
+        holdGame(w, g);
+        suspendGame(w, g, now);
+        restored++;
+    }
+    idTableFree(&games);
+
+    counterAdd(&w->gamesStarted, restored);
+    w->changed = true;
+    return restored;
+}
+
+/*
+    Sums the workers' numbers and prints them, with the acceptor's, for the
+    metrics endpoint. Runs on the metrics thread while the others carry on;
+    every number it reads is only ever written by one thread, so each is
+    right as of some moment during the scrape.
+*/
+static void writeServerMetrics(FILE *out, void *arg) {
+    ServerStats *stats = arg;
+    Worker *w;
+    LogShard *s;
+    uint64_t started = 0, ended = 0, moves = 0, refused = 0, resumed = 0;
+    uint64_t bytesIn = 0, bytesOut = 0, logged = 0, syncs = 0, lost = 0;
+    uint64_t joined = 0, left = 0, dropped = 0, snapshots = 0, watched = 0;
+    uint64_t now = nowMicros();
+    int i;
+
+#define READ(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+    histInit(&stats->scratch);
+    for (i = 0; i < stats->numWorkers; i++) {
+        w = &stats->workers[i];
+        started += READ(w->gamesStarted);
+        ended += READ(w->gamesEnded);
+        moves += READ(w->moves);
+        refused += READ(w->refused);
+        resumed += READ(w->resumed);
+        bytesIn += READ(w->bytesIn);
+        bytesOut += READ(w->bytesOut);
+        joined += READ(w->watchersJoined);
+        left += READ(w->watchersLeft);
+        dropped += READ(w->watchersDropped);
+        snapshots += READ(w->snapshots);
+        watched += READ(w->watchBytes);
+        histMerge(&stats->scratch, &w->relay);
+    }
+
+    metricsCounter(out, "checkers_connections_accepted_total",
+                   "Client connections accepted.", READ(stats->accepted));
+    metricsGauge(out, "checkers_lobby_waiting",
+                 "Players seated and waiting for an opponent.",
+                 READ(stats->lobbyWaiting));
+    metricsCounter(out, "checkers_shm_connections_total",
+                   "Players whose frames went through shared memory.",
+                   READ(stats->shmLinks));
+    metricsCounter(out, "checkers_games_started_total",
+                   "Games handed to a worker.", started);
+    metricsGauge(out, "checkers_games_active",
+                 "Games in play, or held for a player who dropped out.",
+                 started - ended);
+    metricsCounter(out, "checkers_sessions_resumed_total",
+                   "Players who reconnected to a game with their token.",
+                   resumed);
+    metricsCounter(out, "checkers_moves_total",
+                   "Moves played and relayed.", moves);
+    metricsCounter(out, "checkers_moves_refused_total",
+                   "Moves refused as illegal or out of turn.", refused);
+    metricsGauge(out, "checkers_moves_per_second",
+                 "Moves relayed per second since the previous scrape.",
+                 (moves - stats->lastMoves) * 1e6 /
+                 (now > stats->lastScrape ? now - stats->lastScrape : 1));
+    metricsCounter(out, "checkers_bytes_in_total",
+                   "Bytes read from clients in games.", bytesIn);
+    metricsCounter(out, "checkers_bytes_out_total",
+                   "Bytes written to clients in games.", bytesOut);
+    metricsGauge(out, "checkers_spectators",
+                 "Spectators watching a game.", joined - left);
+    metricsCounter(out, "checkers_spectators_dropped_total",
+                   "Spectators dropped for falling too far behind.",
+                   dropped);
+    metricsCounter(out, "checkers_spectator_snapshots_total",
+                   "Snapshots sent to spectators in place of the moves "
+                   "they missed.", snapshots);
+    metricsCounter(out, "checkers_spectator_bytes_out_total",
+                   "Bytes written to spectators.", watched);
+    if (stats->log != NULL) {
+        for (i = 0; i < stats->log->numShards; i++) {
+            s = &stats->log->shards[i];
+            logged += READ(s->written);
+            syncs += READ(s->syncs);
+            lost += READ(s->dropped);
+        }
+        metricsCounter(out, "checkers_log_bytes_written_total",
+                       "Bytes of game records written to disk.", logged);
+        metricsCounter(out, "checkers_log_syncs_total",
+                       "Game log syncs to disk.", syncs);
+        metricsCounter(out, "checkers_log_records_dropped_total",
+                       "Game records lost because the writer fell behind.",
+                       lost);
+    }
+    metricsSummary(out, "checkers_handshake_microseconds",
+                   "Time from accepting a client to sending it WELCOME.",
+                   &stats->handshake);
+    metricsSummary(out, "checkers_relay_microseconds",
+                   "Time from reading a move to writing it to the opponent.",
+                   &stats->scratch);
+#undef READ
+
+    stats->lastMoves = moves;
+    stats->lastScrape = now;
+}
+
+/*
+    Runs the server: any number of games, each a pair of clients seated in
+    the order they connect. Games are spread over numWorkers threads, each
+    relaying its own games from its own event loop. With a metricsPort,
+    counters and latency histograms are served on it to local scrapers.
+
+    With a logDir, every game is recorded there, one log per worker, and
+    the games in play are checkpointed there too. On starting over with
+    the same logDir, the server picks up the games that were in play and
+    holds them for their players to come back to. Never returns unless the
+    server can't be set up.
+*/
+int runServer(const ServerOptions *options) {
+    ServerStats *stats;
+    Worker *workers;
+    GameLog *log = NULL;
+    uint64_t started, *nextIds;
+    int numWorkers = options->numWorkers, shards = 0, restored = 0;
+    int listenFd, localFd, found, i;
+
+    // a client vanishing mid-write must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    listenFd = openListenSocket(options->port);
+    if (listenFd < 0)
+        return 1;
+    localFd = openLocalSocket(options->port);
+    if (localFd < 0)
+        printf("No local socket; clients on this host will use TCP\n");
+
+    if (numWorkers < 1)
+        numWorkers = 1;
+    if (numWorkers > MAX_WORKERS)
+        numWorkers = MAX_WORKERS;
+    if (options->logDir != NULL)
+        shards = countShards(options->logDir);
+    if (shards > 0 && shards != numWorkers) {
+        printf("%s was written by %d workers; using as many\n",
+               options->logDir, shards);
+        numWorkers = shards;
+    }
+
+    workers = malloc(sizeof(Worker) * numWorkers);
+    for (i = 0; i < numWorkers; i++) {
+        if (!initWorker(&workers[i], i, options->n)) {
+            printf("ERROR creating worker event loop\n");
+            return 1;
+        }
+    }
+
+    if (shards > 0) {
+        started = nowMicros();
+        for (i = 0; i < numWorkers; i++) {
+            found = restoreShard(&workers[i], options->logDir, i);
+            if (found < 0)
+                return 1;
+            restored += found;
+        }
+        printf("Restored %d games in %.1f ms\n", restored,
+               (nowMicros() - started) / 1000.0);
+    }
+    if (options->logDir != NULL) {
+        log = gameLogOpen(options->logDir, numWorkers);
+        if (log == NULL)
+            return 1;
+        for (i = 0; i < numWorkers; i++) {
+            workers[i].log = &log->shards[i];
+            gameLogSession(workers[i].log, workers[i].nextGameId);
+        }
+        printf("Recording games in %s\n", options->logDir);
+    }
+
+    // new games are numbered by the acceptor from here on
+    nextIds = malloc(sizeof(uint64_t) * numWorkers);
+    for (i = 0; i < numWorkers; i++)
+        nextIds[i] = workers[i].nextGameId;
+
+    for (i = 0; i < numWorkers; i++) {
+        if (!startWorker(&workers[i])) {
+            printf("ERROR starting worker thread\n");
+            return 1;
+        }
+    }
+    printf("Relaying games on %d worker threads\n", numWorkers);
+
+    stats = calloc(1, sizeof(ServerStats));
+    stats->workers = workers;
+    stats->numWorkers = numWorkers;
+    stats->log = log;
+    histInit(&stats->handshake);
+    stats->lastScrape = nowMicros();
+    if (options->metricsPort != 0) {
+        if (!metricsStart(options->metricsPort, writeServerMetrics, stats)) {
+            printf("ERROR serving metrics on port %d\n",
+                   options->metricsPort);
+            return 1;
+        }
+        printf("Serving metrics on http://127.0.0.1:%d/metrics\n",
+               options->metricsPort);
+    }
+
+    acceptLoop(listenFd, localFd, options->n, stats, nextIds);
+    return 1;
+}
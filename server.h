@@ -0,0 +1,18 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+typedef struct {
+    int port;
+    int n;          // board size for clients that don't ask for one
+    int numWorkers;
+
+    // where to serve metrics; 0 for nowhere
+    int metricsPort;
+
+    // directory to keep the game log in; NULL to keep none
+    const char *logDir;
+} ServerOptions;
+
+int runServer(const ServerOptions *options);
+
+#endif
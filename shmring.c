@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+// "ckrs", so that a stray mapping isn't taken for a channel
+#define SHM_MAGIC 0x636b7273
+
+
+/* Creates the shared memory a channel lives in, for reading and writing. */
+static int openMemory() {
+    int fd;
+#ifdef __linux__
+    fd = memfd_create("checkers", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    char name[64];
+
+    snprintf(name, sizeof(name), "/checkers-%d-%ld", (int)getpid(),
+             (long)random());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink(name);
+#endif
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, sizeof(ShmChannel)) < 0) {
+        close(fd);
+        return -1;
+    }
+#ifdef __linux__
+    // the server maps it too; it must not be cut short under the server
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+/*
+    Makes a new channel as the client: maps it and makes both bells. Fills
+    in fds with what the server needs to attach to it, to be passed along
+    with the HELLO and then handed to shmPassed.
+*/
+bool shmCreate(ShmLink *l, int fds[SHM_FDS]) {
+    Waker toServer, toClient;
+    int memory = openMemory();
+
+    if (memory < 0)
+        return false;
+    l->channel = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, memory, 0);
+    if (l->channel == MAP_FAILED) {
+        close(memory);
+        return false;
+    }
+    if (!wakerCreate(&toServer)) {
+        munmap(l->channel, sizeof(ShmChannel));
+        close(memory);
+        return false;
+    }
+    if (!wakerCreate(&toClient)) {
+        munmap(l->channel, sizeof(ShmChannel));
+        close(memory);
+        close(toServer.readFd);
+        if (toServer.writeFd != toServer.readFd)
+            close(toServer.writeFd);
+        return false;
+    }
+
+    // the mapping starts out zeroed: both rings empty, nobody waiting
+    l->channel->magic = SHM_MAGIC;
+    l->channel->ringSize = SHM_RING_SIZE;
+    l->rx = &l->channel->toClient;
+    l->tx = &l->channel->toServer;
+    l->bell.readFd = toClient.readFd;
+    l->bell.writeFd = toServer.writeFd;
+
+    fds[0] = memory;
+    fds[1] = toServer.readFd;
+    fds[2] = toClient.writeFd;
+    return true;
+}
+
+/*
+    Lets go of the client's copies of the descriptors shmCreate filled in
+    that it has no more use for, once they have been passed to the server
+    or the server could not be reached.
+*/
+void shmPassed(const ShmLink *l, int fds[SHM_FDS]) {
+    int i;
+
+    for (i = 0; i < SHM_FDS; i++) {
+        if (fds[i] >= 0 && fds[i] != l->bell.readFd &&
+            fds[i] != l->bell.writeFd)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+/*
+    Attaches the server to the channel whose descriptors a client passed
+    it, taking them over; they are closed if it fails. A mapping of the
+    wrong size, or one that could be shrunk while we use it, is refused.
+*/
+bool shmAttach(ShmLink *l, int fds[SHM_FDS]) {
+    struct stat st;
+    bool ok;
+
+    ok = fstat(fds[0], &st) == 0 && st.st_size == sizeof(ShmChannel);
+#ifdef __linux__
+    ok = ok && (fcntl(fds[0], F_GET_SEALS) & F_SEAL_SHRINK) != 0;
+#endif
+    l->channel = ok ? mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fds[0], 0) : MAP_FAILED;
+    close(fds[0]);
+
+    if (l->channel != MAP_FAILED && (l->channel->magic != SHM_MAGIC ||
+                                     l->channel->ringSize != SHM_RING_SIZE)) {
+        munmap(l->channel, sizeof(ShmChannel));
+        l->channel = MAP_FAILED;
+    }
+    if (l->channel == MAP_FAILED || !setNonBlocking(fds[1])) {
+        if (l->channel != MAP_FAILED)
+            munmap(l->channel, sizeof(ShmChannel));
+        close(fds[1]);
+        close(fds[2]);
+        return false;
+    }
+
+    l->rx = &l->channel->toServer;
+    l->tx = &l->channel->toClient;
+    l->bell.readFd = fds[1];
+    l->bell.writeFd = fds[2];
+    return true;
+}
+
+void shmClose(ShmLink *l) {
+    munmap(l->channel, sizeof(ShmChannel));
+    close(l->bell.readFd);
+    if (l->bell.writeFd != l->bell.readFd)
+        close(l->bell.writeFd);
+}
+
+
+// rings the other side's bell if it is asleep waiting on flag
+static void ring(ShmLink *l, _Atomic int *waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) &&
+        atomic_exchange(waiting, 0))
+        wakerSignal(&l->bell);
+}
+
+/*
+    Takes whatever the other side has written, up to the buffer limit.
+    Returns the number of bytes taken, or -1 with errno set: EAGAIN when
+    there is nothing to take, ENOBUFS when the buffer is full, EPROTO when
+    the ring is corrupt.
+*/
+ssize_t shmReadInto(ShmLink *l, NetBuffer *buf) {
+    ShmRing *r = l->rx;
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t n, at = tail & (SHM_RING_SIZE - 1), first;
+
+    if (head - tail > SHM_RING_SIZE) {
+        errno = EPROTO;
+        return -1;
+    }
+    n = head - tail;
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (buf->len + n > buf->limit)
+        n = buf->limit - buf->len;
+    if (n == 0 || !bufferReserve(buf, n)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    first = n < SHM_RING_SIZE - at ? n : SHM_RING_SIZE - at;
+    memcpy(bufferTail(buf), r->data + at, first);
+    memcpy(bufferTail(buf) + first, r->data, n - first);
+    buf->len += n;
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+
+    ring(l, &r->writerWaiting);
+    return n;
+}
+
+/*
+    Puts as much of buf as there is room for in the ring to the other
+    side. Returns the number of bytes written, or -1 with errno set: EAGAIN
+    when the ring is full, EPROTO when it is corrupt.
+*/
+ssize_t shmWriteFrom(ShmLink *l, NetBuffer *buf) {
+    ShmRing *r = l->tx;
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t n = buf->len, at = head & (SHM_RING_SIZE - 1), first;
+
+    if (head - tail > SHM_RING_SIZE) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n == 0)
+        return 0;
+    if (n > SHM_RING_SIZE - (head - tail))
+        n = SHM_RING_SIZE - (head - tail);
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    first = n < SHM_RING_SIZE - at ? n : SHM_RING_SIZE - at;
+    memcpy(r->data + at, bufferHead(buf), first);
+    memcpy(r->data, bufferHead(buf) + first, n - first);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    bufferConsume(buf, n);
+
+    ring(l, &r->readerWaiting);
+    return n;
+}
+
+/*
+    Marks this side as waiting for bytes to read. Returns true if it may
+    now sleep on its bell, which will ring when some come; false, unmarked,
+    if some came meanwhile.
+*/
+bool shmWaitRead(ShmLink *l) {
+    ShmRing *r = l->rx;
+
+    atomic_store(&r->readerWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&r->head) == atomic_load(&r->tail))
+        return true;
+    atomic_store(&r->readerWaiting, 0);
+    return false;
+}
+
+/* The same for room to write. */
+bool shmWaitWrite(ShmLink *l) {
+    ShmRing *r = l->tx;
+
+    atomic_store(&r->writerWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&r->head) - atomic_load(&r->tail) >= SHM_RING_SIZE)
+        return true;
+    atomic_store(&r->writerWaiting, 0);
+    return false;
+}
+
+
+/*
+    The address of the local socket a server on port takes shared-memory
+    clients on. Returns its length.
+*/
+socklen_t shmLocalAddress(struct sockaddr_un *addr, int port) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+#ifdef __linux__
+    // in the abstract namespace, so a crashed server leaves nothing behind
+    snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "checkers-%d",
+             port);
+    return offsetof(struct sockaddr_un, sun_path) + 1 +
+           strlen(addr->sun_path + 1);
+#else
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/checkers-%d.sock",
+             port);
+    return sizeof(struct sockaddr_un);
+#endif
+}
+
+/* Sends the opening frame on a local socket with fds passed alongside. */
+bool shmSendOpening(int fd, const NetBuffer *frame, const int fds[SHM_FDS]) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * SHM_FDS)];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = bufferHead(frame);
+    iov.iov_len = frame->len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SHM_FDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * SHM_FDS);
+
+    return sendmsg(fd, &msg, 0) == (ssize_t)frame->len;
+}
+
+/*
+    Reads from a local socket like bufferReadFrom, also taking any
+    descriptors passed with the bytes: the first SHM_FDS into fds, counted
+    in *numFds, and any more closed.
+*/
+ssize_t shmReadOpening(NetBuffer *buf, int fd, int fds[SHM_FDS],
+                       int *numFds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * SHM_FDS)];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    size_t room = 4096;
+    ssize_t n;
+    int i, count, passed;
+
+    if (buf->len + room > buf->limit)
+        room = buf->limit - buf->len;
+    if (room == 0 || !bufferReserve(buf, room)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = bufferTail(buf);
+    iov.iov_len = room;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    n = recvmsg(fd, &msg, 0);
+    if (n < 0)
+        return n;
+    buf->len += n;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < count; i++) {
+            memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*numFds < SHM_FDS)
+                fds[(*numFds)++] = passed;
+            else
+                close(passed);
+        }
+    }
+    return n;
+}
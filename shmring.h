@@ -0,0 +1,81 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "netbuf.h"
+#include "poller.h"
+
+
+/*
+    A connection's frames carried through shared memory instead of a
+    socket, for a client on the same host as the server.
+
+    The client maps a channel of two single-producer/single-consumer byte
+    rings, one each way, and makes a bell for each side: an eventfd (a pipe
+    elsewhere) that the other side rings when it has put bytes in the ring
+    this side reads, or made room in the ring it writes. It passes the
+    mapping and the server's bells over the server's local socket along
+    with its HELLO, and the socket stays open so that each side sees the
+    other go.
+
+    A side that runs out of bytes or room marks itself waiting and looks
+    once more before it sleeps on its bell; a side that moves bytes rings
+    the bell only if it finds the other waiting. A busy connection costs no
+    system calls at all, and one that has gone quiet one write to wake.
+    Neither side trusts the other's counters: a ring whose counters make no
+    sense is treated as a broken connection.
+*/
+
+// bytes each ring holds; a power of two
+#define SHM_RING_SIZE (64 << 10)
+
+// descriptors passed with the HELLO: the mapping, the server's own bell,
+// and the client's bell, which the server rings
+#define SHM_FDS 3
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t head;     // bytes ever written
+    _Atomic int writerWaiting;              // the writer is asleep for room
+    _Alignas(64) _Atomic uint64_t tail;     // bytes ever read
+    _Atomic int readerWaiting;              // the reader is asleep for bytes
+    _Alignas(64) unsigned char data[SHM_RING_SIZE];
+} ShmRing;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t ringSize;
+    ShmRing toServer, toClient;
+} ShmChannel;
+
+// one side's view of a channel
+typedef struct {
+    ShmChannel *channel;
+    ShmRing *rx, *tx;
+
+    // readFd is this side's bell, to sleep on; writeFd the other side's
+    Waker bell;
+} ShmLink;
+
+
+bool shmCreate(ShmLink *l, int fds[SHM_FDS]);
+void shmPassed(const ShmLink *l, int fds[SHM_FDS]);
+bool shmAttach(ShmLink *l, int fds[SHM_FDS]);
+void shmClose(ShmLink *l);
+
+ssize_t shmReadInto(ShmLink *l, NetBuffer *buf);
+ssize_t shmWriteFrom(ShmLink *l, NetBuffer *buf);
+bool shmWaitRead(ShmLink *l);
+bool shmWaitWrite(ShmLink *l);
+
+socklen_t shmLocalAddress(struct sockaddr_un *addr, int port);
+bool shmSendOpening(int fd, const NetBuffer *frame, const int fds[SHM_FDS]);
+ssize_t shmReadOpening(NetBuffer *buf, int fd, int fds[SHM_FDS],
+                       int *numFds);
+
+#endif
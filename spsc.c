@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc.h"
+
+
+/* Sets up q to hold capacity elements, rounded up to a power of two. */
+bool spscInit(SpscQueue *q, size_t elemSize, size_t capacity) {
+    size_t size = 1;
+
+    while (size < capacity)
+        size *= 2;
+
+    q->slots = malloc(elemSize * size);
+    if (q->slots == NULL)
+        return false;
+    q->elemSize = elemSize;
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return true;
+}
+
+void spscFree(SpscQueue *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/* Producer side. Returns false if the queue is full. */
+bool spscPush(SpscQueue *q, const void *elem) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail - head > q->mask)
+        return false;
+
+    memcpy(q->slots + (tail & q->mask) * q->elemSize, elem, q->elemSize);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/* Consumer side. Returns false if the queue is empty. */
+bool spscPop(SpscQueue *q, void *elem) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    memcpy(elem, q->slots + (head & q->mask) * q->elemSize, q->elemSize);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool spscEmpty(SpscQueue *q) {
+    return atomic_load_explicit(&q->head, memory_order_acquire) ==
+           atomic_load_explicit(&q->tail, memory_order_acquire);
+}
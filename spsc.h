@@ -0,0 +1,31 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+
+/*
+    Bounded lock-free queue for exactly one producer thread and one consumer
+    thread. Elements are fixed-size and copied in and out. The head and tail
+    counters live on separate cache lines so the two threads don't fight
+    over one.
+*/
+typedef struct {
+    char *slots;
+    size_t elemSize;
+    size_t mask;
+
+    _Alignas(64) atomic_size_t head;    // next slot to pop; written by consumer
+    _Alignas(64) atomic_size_t tail;    // next slot to push; written by producer
+} SpscQueue;
+
+
+bool spscInit(SpscQueue *q, size_t elemSize, size_t capacity);
+void spscFree(SpscQueue *q);
+bool spscPush(SpscQueue *q, const void *elem);
+bool spscPop(SpscQueue *q, void *elem);
+bool spscEmpty(SpscQueue *q);
+
+#endif
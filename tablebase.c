@@ -0,0 +1,684 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tablebase.h"
+#include "clock.h"
+#include "movegen.h"
+
+#define TB_MAGIC "CKTB"
+#define TB_VERSION 1
+
+// squares a king can stand on, and a man: never on the row it is crowned on
+#define DARK_SQUARES 32
+#define MAN_SQUARES 28
+
+// one more than the most pieces of one class a table can hold
+#define COUNT_RANGE (TB_MAX_PIECES + 1)
+#define NUM_SLOTS (COUNT_RANGE * COUNT_RANGE * COUNT_RANGE * COUNT_RANGE)
+
+// A stored value is 0 for a draw, otherwise one more than the number of
+// plies left in the game; the side to move wins if that number is odd.
+// While generating, VALUE_INVALID marks an index that is not a position.
+#define VALUE_INVALID 255
+#define MAX_PLIES 253
+
+#define PATH_LEN 512
+
+
+enum slotState {
+    SLOT_UNTRIED,
+    SLOT_OPEN,
+    SLOT_MISSING
+};
+
+// how many of each piece class a table holds, with player one to move
+typedef struct {
+    int count[NUM_PIECE_TYPES];
+} Material;
+
+// start of every table file; the values follow it
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t n;
+    uint8_t count[NUM_PIECE_TYPES];
+    uint8_t reserved[6];
+    uint64_t entries;
+} TableHeader;
+
+// one material signature's table, mapped the first time it is needed
+typedef struct {
+    atomic_int state;
+    const uint8_t *values;
+    uint64_t entries;
+} TableSlot;
+
+// a table being generated, held in memory until it is solved
+typedef struct {
+    Material mat;
+    uint64_t entries;
+    uint8_t *values;
+    int longest;
+} GenTable;
+
+// the signatures of one generation step, handed out to the threads
+typedef struct {
+    const char *dir;
+    Material *mats;
+    int numMats;
+    atomic_int next;
+    atomic_bool failed;
+} GenLevel;
+
+
+static char *tableDir = NULL;
+static TableSlot slots[NUM_SLOTS];
+static pthread_mutex_t slotLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t indexOnce = PTHREAD_ONCE_INIT;
+static uint64_t binomial[DARK_SQUARES + 1][TB_MAX_PIECES + 1];
+static int darkSquare[DARK_SQUARES];    // board square of each dark square
+static int darkIndex[TB_N * TB_N];      // and the other way, -1 if light
+
+
+static void buildIndexTables(void) {
+    const BoardGeometry *g = boardGeometry(TB_N);
+    int i, k, sq, d = 0;
+
+    for (i = 0; i <= DARK_SQUARES; i++) {
+        binomial[i][0] = 1;
+        for (k = 1; k <= TB_MAX_PIECES; k++)
+            binomial[i][k] = i == 0 ? 0 : binomial[i-1][k-1] + binomial[i-1][k];
+    }
+
+    for (sq = 0; sq < TB_N * TB_N; sq++) {
+        darkIndex[sq] = -1;
+        if (bitTest(g->dark, sq)) {
+            darkIndex[sq] = d;
+            darkSquare[d++] = sq;
+        }
+    }
+}
+
+// squares a class of piece may stand on, counted from groupBase: player
+// one's men never stand on the far row, player two's never on row 0
+static inline int groupSize(int type) {
+    return type == MAN_ONE || type == MAN_TWO ? MAN_SQUARES : DARK_SQUARES;
+}
+
+static inline int groupBase(int type) {
+    return type == MAN_TWO ? DARK_SQUARES - MAN_SQUARES : 0;
+}
+
+static inline int materialSlot(const Material *mat) {
+    return ((mat->count[MAN_ONE] * COUNT_RANGE + mat->count[MAN_TWO]) *
+            COUNT_RANGE + mat->count[KING_ONE]) * COUNT_RANGE +
+           mat->count[KING_TWO];
+}
+
+static bool sameMaterial(const Material *a, const Material *b) {
+    return memcmp(a->count, b->count, sizeof(a->count)) == 0;
+}
+
+// the same material with the colours swapped
+static void flipMaterial(const Material *mat, Material *flipped) {
+    int t;
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++)
+        flipped->count[t ^ 1] = mat->count[t];
+}
+
+static uint64_t tableEntries(const Material *mat) {
+    uint64_t entries = 1;
+    int t;
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++)
+        entries *= binomial[groupSize(t)][mat->count[t]];
+    return entries;
+}
+
+static void tablePath(const char *dir, const Material *mat, char *buf,
+                      int len) {
+    snprintf(buf, len, "%s/%dX%dK%dY%dL.tb", dir, mat->count[MAN_ONE],
+             mat->count[KING_ONE], mat->count[MAN_TWO], mat->count[KING_TWO]);
+}
+
+/*
+    Works out which table and entry hold b with side to move. With player
+    two to move the board is turned half round (square sq becomes 63 - sq)
+    and the colours swapped, so that player one is to move. Each class of
+    piece is numbered as a set of squares, and the sets combine as digits of
+    a mixed-radix number.
+*/
+static uint64_t locate(const Board *b, enum player side, Material *mat) {
+    int group[NUM_PIECE_TYPES][TB_MAX_PIECES];
+    bool flip = side == PLAYER_TWO;
+    int t, to, k, i, sq;
+    uint64_t word, rank, index = 0;
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        to = flip ? t ^ 1 : t;
+        mat->count[to] = b->count[t];
+        k = 0;
+        for (word = boardBits(b, t)[0]; word; word &= word - 1) {
+            sq = __builtin_ctzll(word);
+            if (flip)
+                sq = TB_N * TB_N - 1 - sq;
+            // turning the board round reverses the order squares come in
+            group[to][flip ? b->count[t] - 1 - k : k] =
+                darkIndex[sq] - groupBase(to);
+            k++;
+        }
+    }
+
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        rank = 0;
+        for (i = 0; i < mat->count[t]; i++)
+            rank += binomial[group[t][i]][i + 1];
+        index = index * binomial[groupSize(t)][mat->count[t]] + rank;
+    }
+    return index;
+}
+
+/*
+    Sets b up as the position at index in the table for mat, player one to
+    move. False if the index puts two pieces on one square.
+*/
+static bool placeEntry(Board *b, const Material *mat, uint64_t index) {
+    uint64_t rank[NUM_PIECE_TYPES], size, occupied = 0, bit;
+    int t, i, c;
+
+    for (t = NUM_PIECE_TYPES - 1; t >= 0; t--) {
+        size = binomial[groupSize(t)][mat->count[t]];
+        rank[t] = index % size;
+        index /= size;
+    }
+
+    boardClear(b);
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        c = groupSize(t);
+        for (i = mat->count[t] - 1; i >= 0; i--) {
+            do {
+                c--;
+            } while (binomial[c][i + 1] > rank[t]);
+            rank[t] -= binomial[c][i + 1];
+
+            bit = (uint64_t)1 << darkSquare[c + groupBase(t)];
+            if (occupied & bit)
+                return false;
+            occupied |= bit;
+            boardBits(b, t)[0] |= bit;
+        }
+        b->count[t] = mat->count[t];
+    }
+    return true;
+}
+
+/* Maps slot's table file, or notes that there is none usable. */
+static void mapTable(TableSlot *slot, const Material *mat) {
+    char path[PATH_LEN];
+    struct stat st;
+    const TableHeader *h;
+    void *base;
+    int fd, t;
+
+    tablePath(tableDir, mat, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        atomic_store_explicit(&slot->state, SLOT_MISSING, memory_order_release);
+        return;
+    }
+
+    base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(TableHeader))
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        atomic_store_explicit(&slot->state, SLOT_MISSING, memory_order_release);
+        return;
+    }
+
+    h = base;
+    for (t = 0; t < NUM_PIECE_TYPES; t++) {
+        if (h->count[t] != mat->count[t])
+            break;
+    }
+    if (memcmp(h->magic, TB_MAGIC, 4) != 0 || h->version != TB_VERSION ||
+        h->n != TB_N || t < NUM_PIECE_TYPES ||
+        h->entries != tableEntries(mat) ||
+        st.st_size != (off_t)(sizeof(TableHeader) + h->entries)) {
+        printf("ERROR %s is not a usable table\n", path);
+        munmap(base, st.st_size);
+        atomic_store_explicit(&slot->state, SLOT_MISSING, memory_order_release);
+        return;
+    }
+
+    // probes land anywhere in the file; read-ahead only wastes memory
+    madvise(base, st.st_size, MADV_RANDOM);
+    slot->values = (const uint8_t *)base + sizeof(TableHeader);
+    slot->entries = h->entries;
+    atomic_store_explicit(&slot->state, SLOT_OPEN, memory_order_release);
+}
+
+static const TableSlot* openTable(const Material *mat) {
+    TableSlot *slot = &slots[materialSlot(mat)];
+    int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+    if (state == SLOT_UNTRIED) {
+        pthread_mutex_lock(&slotLock);
+        if (atomic_load_explicit(&slot->state, memory_order_relaxed) ==
+            SLOT_UNTRIED)
+            mapTable(slot, mat);
+        pthread_mutex_unlock(&slotLock);
+        state = atomic_load_explicit(&slot->state, memory_order_acquire);
+    }
+    return state == SLOT_OPEN ? slot : NULL;
+}
+
+static int decodeValue(int value, int *plies) {
+    if (value == 0)
+        return TB_DRAW;
+    *plies = value - 1;
+    return *plies % 2 == 1 ? TB_WIN : TB_LOSS;
+}
+
+
+/*
+    Looks tables up in dir from now on. Nothing is read until a position
+    needs it; tables that are not there are simply not used.
+*/
+void tbOpen(const char *dir) {
+    pthread_once(&indexOnce, buildIndexTables);
+    free(tableDir);
+    tableDir = strdup(dir);
+}
+
+/*
+    What the tables say about b with side to move. For a win or a loss,
+    plies is how long the game lasts with best play. TB_UNKNOWN if no table
+    covers the position.
+*/
+int tbProbe(const Board *b, enum player side, int *plies) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    const TableSlot *slot;
+    Material mat;
+    uint64_t index;
+    int total;
+
+    if (tableDir == NULL || b->n != TB_N)
+        return TB_UNKNOWN;
+    total = boardCount(b, PLAYER_ONE) + boardCount(b, PLAYER_TWO);
+    if (total > TB_MAX_PIECES)
+        return TB_UNKNOWN;
+
+    // a side with no pieces has no moves
+    if (boardCount(b, side) == 0) {
+        *plies = 0;
+        return TB_LOSS;
+    }
+    if (boardCount(b, other) == 0)
+        return TB_UNKNOWN;
+
+    index = locate(b, side, &mat);
+    slot = openTable(&mat);
+    if (slot == NULL)
+        return TB_UNKNOWN;
+    return decodeValue(slot->values[index], plies);
+}
+
+/*
+    Picks side's best move in b straight from the tables: the quickest win,
+    else a draw, else the longest loss. Returns what the position is worth,
+    or TB_UNKNOWN (with best untouched) if any move leads out of the tables.
+*/
+int tbBestMove(const Board *b, enum player side, Move *best, int *plies) {
+    enum player other = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    Move moves[MAX_MOVES];
+    MoveList list;
+    Board child;
+    Undo undo;
+    int i, result, childPlies = 0, value, bestValue = INT_MIN, bestIndex = -1;
+
+    if (tbProbe(b, side, plies) == TB_UNKNOWN)
+        return TB_UNKNOWN;
+
+    moveListInit(&list, moves, MAX_MOVES);
+    generateMoves(b, side, &list);
+    if (list.count == 0)
+        return TB_LOSS;
+
+    boardInit(&child, b->n);
+    boardCopy(&child, b);
+    for (i = 0; i < list.count; i++) {
+        boardApplyMove(&child, &moves[i], &undo);
+        result = tbProbe(&child, other, &childPlies);
+        boardUndoMove(&child, &moves[i], &undo);
+
+        // rank moves: short wins over long ones over draws over long
+        // losses over short ones
+        if (result == TB_LOSS)
+            value = INT_MAX - childPlies;
+        else if (result == TB_DRAW)
+            value = 0;
+        else if (result == TB_WIN)
+            value = INT_MIN + 1 + childPlies;
+        else
+            break;
+
+        if (value > bestValue) {
+            bestValue = value;
+            bestIndex = i;
+        }
+    }
+    boardFree(&child);
+
+    if (i < list.count)
+        return TB_UNKNOWN;
+    *best = moves[bestIndex];
+    return tbProbe(b, side, plies);
+}
+
+
+/*
+    The value of child, player two to move, from the tables being solved
+    or, for the fewer pieces a capture or promotion leads to, from disk.
+*/
+static int childValue(const GenTable *tables, int numTables,
+                      const Board *child) {
+    const TableSlot *slot;
+    Material mat;
+    uint64_t index;
+    int i;
+
+    if (boardCount(child, PLAYER_TWO) == 0)
+        return 1;
+
+    index = locate(child, PLAYER_TWO, &mat);
+    for (i = 0; i < numTables; i++) {
+        if (sameMaterial(&tables[i].mat, &mat))
+            return tables[i].values[index];
+    }
+    slot = openTable(&mat);
+    return slot != NULL ? slot->values[index] : 0;
+}
+
+/*
+    One pass over table t, settling every position whose value now follows
+    from its children: a win if some move leaves the opponent lost, a loss
+    if every move leaves them won. Returns how many were settled, or -1 if
+    a game would run longer than a value can say.
+*/
+static long solvePass(GenTable *tables, int numTables, GenTable *t,
+                      Board *b) {
+    Move moves[MAX_MOVES];
+    MoveList list;
+    Undo undo;
+    uint64_t index;
+    long settled = 0;
+    int i, value, plies, quickestWin, longestLoss;
+    bool allWon;
+
+    for (index = 0; index < t->entries; index++) {
+        if (t->values[index] != 0)
+            continue;
+        if (!placeEntry(b, &t->mat, index)) {
+            t->values[index] = VALUE_INVALID;
+            continue;
+        }
+
+        moveListInit(&list, moves, MAX_MOVES);
+        generateMoves(b, PLAYER_ONE, &list);
+
+        quickestWin = INT_MAX;
+        longestLoss = -1;
+        allWon = true;
+        for (i = 0; i < list.count; i++) {
+            boardApplyMove(b, &moves[i], &undo);
+            value = childValue(tables, numTables, b);
+            boardUndoMove(b, &moves[i], &undo);
+
+            if (value == 0) {
+                allWon = false;
+            } else if ((value - 1) % 2 == 0) {
+                if (value - 1 < quickestWin)
+                    quickestWin = value - 1;
+            } else if (value - 1 > longestLoss) {
+                longestLoss = value - 1;
+            }
+        }
+
+        if (list.count == 0)
+            plies = 0;
+        else if (quickestWin != INT_MAX)
+            plies = quickestWin + 1;
+        else if (allWon)
+            plies = longestLoss + 1;
+        else
+            continue;
+
+        if (plies > MAX_PLIES)
+            return -1;
+        if (plies > t->longest)
+            t->longest = plies;
+        t->values[index] = plies + 1;
+        settled++;
+    }
+    return settled;
+}
+
+static bool writeTable(const char *dir, const GenTable *t) {
+    char path[PATH_LEN], tmp[PATH_LEN + 8];
+    TableHeader h;
+    FILE *f;
+    bool ok;
+    int i;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TB_MAGIC, 4);
+    h.version = TB_VERSION;
+    h.n = TB_N;
+    for (i = 0; i < NUM_PIECE_TYPES; i++)
+        h.count[i] = t->mat.count[i];
+    h.entries = t->entries;
+
+    // written aside and renamed, so a bot never maps half a table
+    tablePath(dir, &t->mat, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        printf("ERROR writing %s: %s\n", tmp, strerror(errno));
+        return false;
+    }
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fwrite(t->values, 1, t->entries, f) == t->entries;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        printf("ERROR writing %s\n", path);
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static void reportTable(const GenTable *t, double seconds) {
+    uint64_t i, counts[3] = { 0, 0, 0 }, total;
+    int plies = 0;
+    char path[PATH_LEN];
+
+    for (i = 0; i < t->entries; i++) {
+        if (t->values[i] == VALUE_INVALID)
+            continue;
+        counts[decodeValue(t->values[i], &plies) - TB_WIN]++;
+    }
+    total = counts[0] + counts[1] + counts[2];
+    if (total == 0)
+        total = 1;
+
+    tablePath("", &t->mat, path, sizeof(path));
+    printf("%-12s %12llu positions  %5.1f%% won  %5.1f%% drawn  "
+           "%5.1f%% lost  longest %3d plies  %7.2f s\n", path + 1,
+           (unsigned long long)(counts[0] + counts[1] + counts[2]),
+           100.0 * counts[0] / total, 100.0 * counts[1] / total,
+           100.0 * counts[2] / total, t->longest, seconds);
+    fflush(stdout);
+}
+
+/*
+    Solves mat's table together with its colour-swapped twin, since each
+    side's non-capturing moves lead into the other's, and writes both.
+*/
+static bool solveMaterial(const char *dir, const Material *mat) {
+    GenTable tables[2];
+    Board b;
+    Material flipped;
+    uint64_t j;
+    long settled, pass;
+    double start = now();
+    int i, numTables = 1;
+    bool ok = true;
+
+    flipMaterial(mat, &flipped);
+    tables[0].mat = *mat;
+    if (!sameMaterial(mat, &flipped))
+        tables[numTables++].mat = flipped;
+
+    for (i = 0; i < numTables; i++) {
+        tables[i].entries = tableEntries(&tables[i].mat);
+        tables[i].values = calloc(tables[i].entries, 1);
+        tables[i].longest = 0;
+        if (tables[i].values == NULL)
+            ok = false;
+    }
+
+    boardInit(&b, TB_N);
+    do {
+        settled = 0;
+        for (i = 0; ok && i < numTables; i++) {
+            pass = solvePass(tables, numTables, &tables[i], &b);
+            if (pass < 0) {
+                printf("ERROR a game runs past %d plies\n", MAX_PLIES);
+                ok = false;
+            }
+            settled += pass;
+        }
+    } while (ok && settled > 0);
+    boardFree(&b);
+
+    // whatever is left unsettled is a draw
+    for (i = 0; ok && i < numTables; i++) {
+        reportTable(&tables[i], now() - start);
+        for (j = 0; j < tables[i].entries; j++) {
+            if (tables[i].values[j] == VALUE_INVALID)
+                tables[i].values[j] = 0;
+        }
+        ok = writeTable(dir, &tables[i]);
+    }
+
+    for (i = 0; i < numTables; i++)
+        free(tables[i].values);
+    return ok;
+}
+
+static void* generateThread(void *arg) {
+    GenLevel *level = arg;
+    int i;
+
+    while ((i = atomic_fetch_add(&level->next, 1)) < level->numMats) {
+        if (atomic_load(&level->failed))
+            break;
+        if (!solveMaterial(level->dir, &level->mats[i]))
+            atomic_store(&level->failed, true);
+    }
+    return NULL;
+}
+
+/*
+    Lists the signatures with `total` pieces of which `men` are men, each
+    side having at least one piece, keeping one of each colour-swapped pair.
+    None of them can reach another except its own twin.
+*/
+static int listLevel(int total, int men, Material *mats) {
+    Material m, flipped;
+    int m1, k1, num = 0;
+
+    for (m1 = 0; m1 <= men; m1++) {
+        for (k1 = 0; k1 <= total - men; k1++) {
+            m.count[MAN_ONE] = m1;
+            m.count[KING_ONE] = k1;
+            m.count[MAN_TWO] = men - m1;
+            m.count[KING_TWO] = total - men - k1;
+            if (m1 + k1 == 0 || m1 + k1 == total)
+                continue;
+
+            flipMaterial(&m, &flipped);
+            if (memcmp(m.count, flipped.count, sizeof(m.count)) <= 0)
+                mats[num++] = m;
+        }
+    }
+    return num;
+}
+
+/*
+    Builds every table with up to maxPieces pieces into dir, fewest pieces
+    first and, for the same number, fewest men first, so that whatever a
+    capture or promotion leads to is already on disk. The signatures of each
+    step are shared out among numThreads threads.
+*/
+bool tbGenerate(const char *dir, int maxPieces, int numThreads) {
+    Material mats[COUNT_RANGE * COUNT_RANGE];
+    pthread_t *threads;
+    GenLevel level;
+    double start = now();
+    int total, men, i, started;
+
+    if (maxPieces > TB_MAX_PIECES)
+        maxPieces = TB_MAX_PIECES;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("ERROR creating %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+    tbOpen(dir);
+
+    printf("tablebases up to %d pieces in %s, threads=%d\n", maxPieces, dir,
+           numThreads);
+    threads = malloc(sizeof(pthread_t) * numThreads);
+
+    for (total = 2; total <= maxPieces; total++) {
+        for (men = 0; men <= total; men++) {
+            level.dir = dir;
+            level.mats = mats;
+            level.numMats = listLevel(total, men, mats);
+            atomic_init(&level.next, 0);
+            atomic_init(&level.failed, false);
+
+            started = 0;
+            for (i = 0; i < numThreads && i < level.numMats; i++) {
+                if (pthread_create(&threads[started], NULL, generateThread,
+                                   &level) == 0)
+                    started++;
+            }
+            if (started == 0)
+                generateThread(&level);
+            for (i = 0; i < started; i++)
+                pthread_join(threads[i], NULL);
+
+            if (atomic_load(&level.failed)) {
+                free(threads);
+                return false;
+            }
+        }
+    }
+
+    printf("done in %.2f s\n", now() - start);
+    free(threads);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <stdbool.h>
+
+#include "board.h"
+
+// tablebases cover the standard board only
+#define TB_N 8
+
+// most pieces, both sides together, a table can be built for
+#define TB_MAX_PIECES 6
+
+// where tables are written and looked for unless told otherwise
+#define TB_DEFAULT_DIR "tables"
+
+// what a table says about the side to move
+enum tbResult {
+    TB_UNKNOWN,     // no table covers the position
+    TB_WIN,
+    TB_DRAW,
+    TB_LOSS
+};
+
+
+/*
+    Endgame tablebases for the 8x8 board: for every position with few
+    enough pieces, whether the side to move wins, loses or draws with best
+    play, and in how many plies the game ends.
+
+    There is one file per material signature (how many men and kings each
+    side has), holding one byte per position at an index computed from
+    where the pieces stand. Only positions with player one to move are
+    stored; the rest are looked up with the board turned round and the
+    colours swapped. Files are mapped read-only the first time a position
+    needs them, so opening the tables costs nothing and every process on a
+    machine shares the same pages.
+
+    The generator solves the smallest signatures first, each from its own
+    positions and the already-written tables that captures and promotions
+    lead into. Signatures that do not depend on each other are solved on
+    separate threads.
+*/
+
+void tbOpen(const char *dir);
+int tbProbe(const Board *b, enum player side, int *plies);
+int tbBestMove(const Board *b, enum player side, Move *best, int *plies);
+bool tbGenerate(const char *dir, int maxPieces, int numThreads);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "tournament.h"
+#include "clock.h"
+#include "movegen.h"
+#include "mcts.h"
+
+// a game is drawn after this many king moves in a row with nothing taken
+#define DRAW_PLIES 80
+
+// or once it has gone on this many plies per row of the board
+#define MAX_PLIES_PER_ROW 40
+
+// tree memory for each MCTS search; many run at once
+#define TOURNAMENT_MCTS_MB 16
+
+
+typedef struct {
+    int n;
+    int games;
+    int openPlies;
+    const SearchLimits *engine[2];  // a, then b
+
+    atomic_int next;    // the next game to start
+
+    // totals so far, from a's point of view
+    pthread_mutex_t lock;
+    int wins, losses, draws;
+    long plies;
+    int shortest, longest;
+    uint64_t nodes;
+    double start;
+} Tournament;
+
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static const char* engineName(const SearchLimits *limits) {
+    return limits->engine == ENGINE_MCTS ? "mcts" : "alphabeta";
+}
+
+// Elo difference that scores a fraction p of the points, clamped short of
+// the infinities at 0 and 1
+static double elo(double p) {
+    if (p < 0.001)
+        p = 0.001;
+    if (p > 0.999)
+        p = 0.999;
+    return 400 * log10(p / (1 - p));
+}
+
+/*
+    Plays game g: random plies from the start, the same for games 2k and
+    2k+1, then the engines in turn, a playing first in even games. Returns
+    the winner, NO_PLAYER for a draw, with the game's length in *plies.
+*/
+static enum player playGame(Tournament *t, int g, int *plies,
+                            uint64_t *nodes) {
+    const SearchLimits *limits;
+    enum player side = PLAYER_ONE, winner = NO_PLAYER;
+    SearchResult r;
+    MoveList list;
+    Board b;
+    Move m;
+    Undo undo;
+    uint64_t seed = g / 2;
+    int reversible = 0;
+    int maxPlies = MAX_PLIES_PER_ROW * t->n;
+
+    boardInit(&b, t->n);
+    boardSetup(&b);
+    moveListAlloc(&list);
+    memset(&r, 0, sizeof(r));
+
+    for (*plies = 0; *plies < maxPlies && reversible < DRAW_PLIES;
+         (*plies)++) {
+        if (*plies < t->openPlies) {
+            generateMoves(&b, side, &list);
+            if (list.count == 0) {
+                winner = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+                break;
+            }
+            m = list.moves[splitmix64(&seed) % list.count];
+        } else {
+            limits = t->engine[(side == PLAYER_ONE) != (g % 2 == 0)];
+            searchResultFree(&r);
+            if (!searchBestMove(&b, side, limits, &r)) {
+                winner = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+                break;
+            }
+            *nodes += r.nodes;
+            m = r.best;
+        }
+
+        if (!m.isJump && boardPieceAt(&b, m.from) >= KING_ONE)
+            reversible++;
+        else
+            reversible = 0;
+        boardApplyMove(&b, &m, &undo);
+        side = side == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+    }
+
+    searchResultFree(&r);
+    moveListFree(&list);
+    boardFree(&b);
+    return winner;
+}
+
+/*
+    Adds a finished game to the totals and prints them: the score so far,
+    the Elo difference it suggests with a 95% interval, and the pace.
+*/
+static void recordGame(Tournament *t, int g, enum player winner, int plies,
+                       uint64_t nodes) {
+    enum player aSide = g % 2 == 0 ? PLAYER_ONE : PLAYER_TWO;
+    const char *result;
+    double p, deviation, margin, elapsed;
+    int played;
+
+    pthread_mutex_lock(&t->lock);
+    if (winner == NO_PLAYER) {
+        t->draws++;
+        result = "draw";
+    } else if (winner == aSide) {
+        t->wins++;
+        result = "a wins";
+    } else {
+        t->losses++;
+        result = "b wins";
+    }
+    t->plies += plies;
+    t->nodes += nodes;
+    if (t->shortest == 0 || plies < t->shortest)
+        t->shortest = plies;
+    if (plies > t->longest)
+        t->longest = plies;
+
+    played = t->wins + t->losses + t->draws;
+    p = (t->wins + 0.5 * t->draws) / played;
+    deviation = sqrt((t->wins * (1 - p) * (1 - p) + t->losses * p * p +
+                      t->draws * (0.5 - p) * (0.5 - p)) / played);
+    margin = 1.96 * deviation / sqrt(played);
+    elapsed = now() - t->start;
+
+    printf("game %5d  %-6s in %4d plies (a as %s)  +%d -%d =%d  "
+           "Elo %+5.0f [%+5.0f, %+5.0f]  %5.1f plies avg  %6.2f games/s\n",
+           g + 1, result, plies, aSide == PLAYER_ONE ? "one" : "two",
+           t->wins, t->losses, t->draws, elo(p), elo(p - margin),
+           elo(p + margin), (double)t->plies / played,
+           played / (elapsed > 0 ? elapsed : 1e-9));
+    fflush(stdout);
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void* tournamentThread(void *arg) {
+    Tournament *t = arg;
+    enum player winner;
+    uint64_t nodes;
+    int g, plies;
+
+    while ((g = atomic_fetch_add(&t->next, 1)) < t->games) {
+        nodes = 0;
+        winner = playGame(t, g, &plies, &nodes);
+        recordGame(t, g, winner, plies, nodes);
+    }
+    return NULL;
+}
+
+/*
+    Plays the games on numThreads threads, each taking the next game not
+    yet started until there are none left, and sums up when all are done.
+*/
+void runTournament(int n, int games, int openPlies, int numThreads,
+                   const SearchLimits *a, const SearchLimits *b) {
+    Tournament t;
+    SearchLimits limits[2];
+    pthread_t *threads;
+    double elapsed;
+    int i, played, started = 0;
+
+    // the games, not the searches, are spread over the threads
+    limits[0] = *a;
+    limits[1] = *b;
+    for (i = 0; i < 2; i++) {
+        limits[i].threads = 1;
+        limits[i].verbose = false;
+        limits[i].control = NULL;
+    }
+
+    memset(&t, 0, sizeof(Tournament));
+    t.n = n;
+    t.games = games;
+    t.openPlies = openPlies;
+    t.engine[0] = &limits[0];
+    t.engine[1] = &limits[1];
+    atomic_init(&t.next, 0);
+    pthread_mutex_init(&t.lock, NULL);
+
+    // set up before any game starts, rather than by whichever search is
+    // first
+    if (!ttInit((size_t)DEFAULT_TT_MB << 20) ||
+        !mctsInit((size_t)TOURNAMENT_MCTS_MB << 20)) {
+        printf("ERROR allocating search tables\n");
+        return;
+    }
+
+    printf("tournament n=%d, %d games, %d opening plies, %d threads\n",
+           n, games, openPlies, numThreads);
+    printf("a: %s  %d ms  depth %d\n", engineName(&limits[0]),
+           limits[0].timeMs, limits[0].maxDepth);
+    printf("b: %s  %d ms  depth %d\n", engineName(&limits[1]),
+           limits[1].timeMs, limits[1].maxDepth);
+    fflush(stdout);
+
+    t.start = now();
+    threads = malloc(sizeof(pthread_t) * numThreads);
+    for (i = 0; i < numThreads; i++) {
+        if (pthread_create(&threads[started], NULL, tournamentThread, &t)
+            != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        tournamentThread(&t);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now() - t.start;
+
+    played = t.wins + t.losses + t.draws;
+    if (played > 0) {
+        printf("a %s vs b %s: +%d -%d =%d, %.1f%% for a\n",
+               engineName(&limits[0]), engineName(&limits[1]), t.wins,
+               t.losses, t.draws,
+               100 * (t.wins + 0.5 * t.draws) / played);
+        printf("games %d to %d plies, %.1f on average\n", t.shortest,
+               t.longest, (double)t.plies / played);
+        printf("%.2f s, %.2f games/s, %.0f nodes/s\n", elapsed,
+               played / elapsed, t.nodes / elapsed);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&t.lock);
+}
@@ -0,0 +1,23 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include "search.h"
+
+// random plies at the start of each pair of games unless told otherwise
+#define DEFAULT_OPENING_PLIES 4
+
+
+/*
+    Plays engine against engine with no window and no server: games games
+    on an n by n board, numThreads of them at a time, each search on one
+    thread. Every pair of games starts from the same openPlies random
+    plies, with the engines swapping colours, so neither gains from a
+    lucky opening. A line is printed as each game finishes, with the
+    running score, an Elo estimate for a over b, game lengths and games a
+    second.
+*/
+
+void runTournament(int n, int games, int openPlies, int numThreads,
+                   const SearchLimits *a, const SearchLimits *b);
+
+#endif
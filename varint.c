@@ -0,0 +1,40 @@
+#include "varint.h"
+
+
+/*
+    Writes v to out, which has room for VARINT_MAX_BYTES. Returns the number
+    of bytes written.
+*/
+size_t varintEncode(unsigned char *out, uint64_t v) {
+    size_t len = 0;
+
+    while (v >= 0x80) {
+        out[len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[len++] = v;
+    return len;
+}
+
+/*
+    Reads a varint from the len bytes at data, starting at *pos and moving
+    it past. If the bytes run out, or there are more than a 64-bit value
+    needs, sets *ok false and returns 0.
+*/
+uint64_t varintDecode(const unsigned char *data, size_t len, size_t *pos,
+                      bool *ok) {
+    uint64_t v = 0;
+    unsigned int byte;
+    int shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+        if (*pos >= len)
+            break;
+        byte = data[(*pos)++];
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    *ok = false;
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// most bytes a varint takes
+#define VARINT_MAX_BYTES 10
+
+
+/*
+    Unsigned LEB128, the integer encoding shared by the wire protocol and
+    the game log: seven bits a byte, least significant first, the top bit
+    set on every byte but the last.
+*/
+
+size_t varintEncode(unsigned char *out, uint64_t v);
+uint64_t varintDecode(const unsigned char *data, size_t len, size_t *pos,
+                      bool *ok);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "watch.h"
+#include "movegen.h"
+#include "netclient.h"
+
+
+static const char* playerName(enum player p) {
+    return p == PLAYER_ONE ? "Player One" : "Player Two";
+}
+
+int runWatch(const char *host, int port, uint64_t game) {
+    ServerLink link;
+    ServerEvent e;
+    Board board;
+    Move match;
+    Undo undo;
+    enum player turn = PLAYER_ONE;
+    char buf[MOVE_TEXT_LEN];
+
+    if (!linkWatch(&link, host, port, game))
+        return 1;
+
+    boardInit(&board, link.welcome.n);
+    boardSetup(&board);
+    printf("Watching game %llu on a %dx%d board\n",
+           (unsigned long long)link.welcome.game, board.n, board.n);
+
+    while (linkReadEvent(&link, &e)) {
+        switch (e.type) {
+            case EVENT_MOVE:
+                if (turn == NO_PLAYER || e.move.from < 0 ||
+                    e.move.from >= board.geo->numSquares ||
+                    !findMove(&board, turn, &e.move, &match)) {
+                    printf("ERROR the server sent an illegal move\n");
+                    moveFree(&e.move);
+                    break;
+                }
+                printf("%s: %s\n", playerName(turn),
+                       moveToString(&board, &match, buf, sizeof(buf)));
+                boardApplyMove(&board, &match, &undo);
+                turn = turn == PLAYER_ONE ? PLAYER_TWO : PLAYER_ONE;
+                moveFree(&e.move);
+                break;
+            case EVENT_STATE_SYNC:
+                boardCopy(&board, e.board);
+                boardFree(e.board);
+                free(e.board);
+                turn = e.player;
+                boardPrint(&board, stdout);
+                printf("%s to move\n", playerName(turn));
+                break;
+            case EVENT_GAME_OVER:
+                boardPrint(&board, stdout);
+                printf("%s wins\n", playerName(e.player));
+                boardFree(&board);
+                close(link.fd);
+                return 0;
+            case EVENT_ERROR:
+            case EVENT_CLOSED:
+                break;
+        }
+    }
+
+    printf("ERROR lost connection to server\n");
+    boardFree(&board);
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+
+/*
+    Watches a game on the server as a spectator, by the number its players
+    were given: prints the board as it stands, then each move as it is
+    played, and the board and the winner at the end.
+*/
+int runWatch(const char *host, int port, uint64_t game);
+
+#endif